@@ -133,8 +133,6 @@
 
 local Runtime   = require("com.raw.runtime")
 local RawBuffer = require("com.raw.buffer")
-local MiniZip   = require("com.raw.minizip")
-local libffi    = require("com.raw.libffi")
 local uv        = require("luv")
 
 local format             = string.format
@@ -156,18 +154,6 @@ local fs_lseek           = uv.fs_lseek
 local fs_close           = uv.fs_close
 local fs_dup             = uv.fs_dup
 
--- MiniZip
-local unzip_open                  = MiniZip.unzip_open
-local unzip_goto_first_file       = MiniZip.unzip_goto_first_file
-local unzip_goto_next_file        = MiniZip.unzip_goto_next_file
-local unzip_get_current_file_info = MiniZip.unzip_get_current_file_info
-local unzip_open_current_file     = MiniZip.unzip_open_current_file
-local unzip_read_current_file     = MiniZip.unzip_read_current_file
-local unzip_close_current_file    = MiniZip.unzip_close_current_file
-local unzip_close                 = MiniZip.unzip_close
-local UNZ_OK                      = MiniZip.UNZ_OK
-local UNZ_END_OF_LIST_OF_FILE     = MiniZip.UNZ_END_OF_LIST_OF_FILE
-
 -- Standard errno constants for error handling
 local ENOENT =  2 -- No such file or directory
 local EIO    =  5 -- I/O error
@@ -210,6 +196,10 @@ local function STRING_RemovePrefix (String, Prefix)
   return String:sub(#Prefix + 1)
 end
 
+local function STRING_HasSuffix (String, Suffix)
+  return (String:sub(-#Suffix) == Suffix)
+end
+
 local function INIT_ArraySlice (Array, IndexStart, IndexEnd)
   local NewArray = {}
   for Index = IndexStart, IndexEnd do
@@ -756,11 +746,9 @@ end
 -- HIGH LEVEL BUFFER IMPLEMENTATION                                           --
 --------------------------------------------------------------------------------
 
--- This buffer is hard to implement in its own file "buffer.lua" because ZIP
--- extraction needs NewBuffer and at this stage PACKAGE.SEARCHERS function is
--- not yet available.
+-- This buffer is hard to implement in its own file "buffer.lua" because at
+-- this stage PACKAGE.SEARCHERS function is not yet available.
 
-local GetPageSize       = libffi.getpagesize
 local RawNewBuffer      = RawBuffer.newbuffer
 local RawGetCapacity    = RawBuffer.getcapacity
 local RawEnsureCapacity = RawBuffer.ensurecapacity
@@ -853,71 +841,14 @@ end
 -- MINIZIP HANDLING                                                           --
 --------------------------------------------------------------------------------
 
--- For simplicity we store ZIP_File as a global variable
-
--- Reuse buffer for reading ZIP file contents
-local ZIP_Filename = INIT_Arg[1] -- the executable always embed a ZIP file
-local PAGE_SIZE    = GetPageSize()
-local ZIP_Buffer   = NewBuffer(PAGE_SIZE)
-local ZIP_File     = unzip_open(ZIP_Filename)
+-- The ZIP central directory is indexed once by lua-application.c and shared by
+-- all the threads, reading an entry is a hash lookup instead of a walk through
+-- the whole directory. The decompressed entries are cached on the C side.
 
-assert(ZIP_File, format("Failed to open ZIP file: %s", ZIP_Filename))
-
-local function ZIP_ExtractFile (FileInfo)
-  -- local data
-  local Result = unzip_open_current_file(ZIP_File)
-  local FileContent
-  -- Extract file content
-  if (Result == UNZ_OK) then
-    local SizeInBytes = FileInfo.uncompressed_size
-    -- Read the entire file content
-    if (SizeInBytes > 0) then
-      -- Ensure our buffer has enough capacity for the entire file
-      ZIP_Buffer:ensurecapacity(SizeInBytes)
-      -- The buffer might have moved in memory
-      local BufferData = ZIP_Buffer:getpointer()
-      -- Read the entire file in one operation
-      local Data, ErrorMessage = unzip_read_current_file(ZIP_File, SizeInBytes, BufferData, SizeInBytes)
-      if Data and (#Data > 0) then
-        FileContent = Data
-      end
-    elseif (SizeInBytes == 0) then
-      FileContent = ""
-    end
-    -- Close entry
-    unzip_close_current_file(ZIP_File)
-  end
-  -- Return value
-  return FileContent
-end
+local ReadZipEntry = Runtime.readzipentry
 
 local function INIT_ZipLoadFile (ZipEntryName)
-  -- local data
-  local FileContent = nil
-  local Result      = unzip_goto_first_file(ZIP_File)
-  local Continue    = (Result == UNZ_OK)
-  local FileFound   = false
-  -- Process files while we have more files and haven't found our target
-  while Continue and (not FileFound) do
-    -- Get current file information
-    local FileInfo, ErrorMessage = unzip_get_current_file_info(ZIP_File)
-    -- Check entry
-    if FileInfo and (FileInfo.filename == ZipEntryName) then
-      FileContent = ZIP_ExtractFile(FileInfo)
-      FileFound   = true
-    else
-      -- Move to next file
-      Result = unzip_goto_next_file(ZIP_File)
-      -- Error handling
-      if (Result == UNZ_END_OF_LIST_OF_FILE) then
-        Continue = false -- Normal end of file list
-      elseif (Result ~= UNZ_OK) then
-        Continue = false -- Error occurred
-      end
-    end
-  end
-  -- Return the file content
-  return FileContent
+  return ReadZipEntry(ZipEntryName)
 end
 
 --------------------------------------------------------------------------------
@@ -1563,19 +1494,39 @@ local COMEXE_ZIP_PATH = {
   [[share/lua/5.5/?/init.lua]], -- Different from Lua Standard
 }
 
+local function INIT_LoaderError (AtChunkName, ErrorContext, ErrorMessage)
+  -- Syntax error, stop immediately
+  print(format("ComEXE Loader [%s] (%s) from ZIP", AtChunkName, ErrorContext))
+  print(ErrorMessage)
+  os.exit(1)
+end
+
+-- The chunks are loaded on the C side: the decompressed entries and their
+-- bytecode are shared by all the threads in a process-wide cache, a module
+-- already loaded by another thread is not parsed again.
+local LoadZipEntry = Runtime.loadzipentry
+
 local function ZIP_SearchLuaModule (PathList, ModuleName)
   local RealModuleName = ModuleName:gsub("%.", "/")
+  local AtChunkName    = format("@%s", ModuleName)
   local Index          = 1
-  local Content
+  local Chunk
   -- Iterate
-  while (Content == nil) and (Index <= #PathList) do
+  while (Chunk == nil) and (Index <= #PathList) do
     local Path     = PathList[Index]
     local ZipEntry = Path:gsub("%?", RealModuleName)
-    Content = INIT_ZipLoadFile(ZipEntry)
-    Index  = (Index + 1)
+    local NewChunk, ErrorMessage = LoadZipEntry(ZipEntry, AtChunkName)
+    if NewChunk then
+      Chunk = NewChunk
+    elseif ErrorMessage and (not STRING_HasSuffix(ZipEntry, INIT_BinarySuffix)) then
+      INIT_LoaderError(AtChunkName, "ZIP", ErrorMessage)
+    end
+    -- A bytecode entry rejected by the running Lua (version or format
+    -- mismatch) is ignored, the next path is the source of the same module
+    Index = (Index + 1)
   end
   -- Return value
-  return Content
+  return Chunk
 end
 
 --------------------------------------------------------------------------------
@@ -1589,25 +1540,22 @@ local function INIT_LoadChunk (FileContent, ChunkName, ErrorContext)
   if Chunk then
     return Chunk
   else
-    -- Syntax error, stop immediately
-    print(format("ComEXE Loader [%s] (%s) from ZIP", AtChunkName, ErrorContext))
-    print(ErrorMessage)
-    os.exit(1)
+    INIT_LoaderError(AtChunkName, ErrorContext, ErrorMessage)
   end
 end
 
 local function INIT_SearcherZipRuntime (ModuleName)
-  local FileContent = ZIP_SearchLuaModule(COMEXE_ZIP_PATH_RUNTIME, ModuleName)
-  if FileContent then
-    return INIT_LoadChunk(FileContent, ModuleName, "ZIP")
+  local Chunk = ZIP_SearchLuaModule(COMEXE_ZIP_PATH_RUNTIME, ModuleName)
+  if Chunk then
+    return Chunk
   end
   -- Return no error: continue to next searcher
 end
 
 local function INIT_SearcherZip (ModuleName)
-  local FileContent = ZIP_SearchLuaModule(COMEXE_ZIP_PATH, ModuleName)
-  if FileContent then
-    return INIT_LoadChunk(FileContent, ModuleName, "ZIP")
+  local Chunk = ZIP_SearchLuaModule(COMEXE_ZIP_PATH, ModuleName)
+  if Chunk then
+    return Chunk
   end
   -- Return no error: continue to next searcher
 end
@@ -1768,11 +1716,83 @@ arg = INIT_BuildLuaArguments(ExeFilename, NewOptions, NewScript, NewArguments)
 collectgarbage("restart")
 
 --------------------------------------------------------------------------------
--- RUN THREAD MAIN CODE                                                       --
+-- THREAD RESET                                                               --
 --------------------------------------------------------------------------------
 
-local Thread   = require("com.thread")
-local ThreadId = Thread.getid()
+-- When the thread pool is enabled, lua-application.c keeps the finished
+-- instances to run other modules later. INIT_ResetThread restores the state
+-- found at the end of init.lua:
+--
+-- * the fields of _G, package, package.loaded and package.preload
+-- * the fields of the tables in package.loaded, one level deep: string.foo or
+--   a patched table.insert are removed, but string.foo.bar is not restored
+-- * the fields of the string metatable
+--
+-- The state kept in the upvalues of the modules loaded by init.lua (com.event,
+-- com.thread, luv) and the values reachable through deeper tables are not
+-- restored. lua-application.c removes the event handlers and the pending
+-- events, but luv handles left open survive the reset. This is why the pool is
+-- disabled unless Thread.setpoolsize is called.
+
+local Thread = require("com.thread")
+
+local function INIT_NewSnapshot (Table)
+  local Snapshot = {}
+  for Key, Value in next, Table do
+    Snapshot[Key] = Value
+  end
+  return Snapshot
+end
+
+local function INIT_RestoreSnapshot (Table, Snapshot)
+  for Key in next, Table do
+    if (Snapshot[Key] == nil) then
+      rawset(Table, Key, nil)
+    end
+  end
+  for Key, Value in next, Snapshot do
+    rawset(Table, Key, Value)
+  end
+end
+
+local setglobalmetatable   = debug.setmetatable -- ignore __metatable
+local INIT_GlobalMetatable = getmetatable(_G)
+local INIT_StringMetatable = debug.getmetatable("")
+
+-- Table -> Snapshot, for _G, the package tables, the loaded modules and the
+-- string metatable
+local INIT_Snapshots = {}
+
+local function INIT_AddSnapshot (Table)
+  if (type(Table) == "table") and (INIT_Snapshots[Table] == nil) then
+    INIT_Snapshots[Table] = INIT_NewSnapshot(Table)
+  end
+end
+
+INIT_AddSnapshot(_G)
+INIT_AddSnapshot(package)
+INIT_AddSnapshot(package.loaded)
+INIT_AddSnapshot(package.preload)
+INIT_AddSnapshot(INIT_StringMetatable)
+for Name, Module in next, package.loaded do
+  INIT_AddSnapshot(Module)
+end
+
+local function INIT_ResetThread ()
+  setglobalmetatable(_G, INIT_GlobalMetatable)
+  setglobalmetatable("", INIT_StringMetatable)
+  for Table, Snapshot in next, INIT_Snapshots do
+    INIT_RestoreSnapshot(Table, Snapshot)
+  end
+  -- Take the current configuration, like a new instance
+  INIT_SetSearcher(getloaderconfig())
+  setwarningfunction(INIT_DoNothing)
+  collectgarbage("collect")
+end
+
+--------------------------------------------------------------------------------
+-- RUN THREAD MAIN CODE                                                       --
+--------------------------------------------------------------------------------
 
 -- When loading a new/thread instance, lua-application.c set the module name in
 -- the variable thread.getname(). If the user thread.create("test") then
@@ -1790,17 +1810,20 @@ local ThreadId = Thread.getid()
 -- unmodified init.lua without "INIT_AppEntryPoint", so we need to specify
 -- "main" manually.
 --
-local ModuleToLoad
-if (ThreadId == 1) then
-  ModuleToLoad = (INIT_AppEntryPoint or "main")
-else
-  local ModuleName = Thread.getname()
-  ModuleToLoad = ModuleName
+-- The module is not required here: the instance might be an idle instance of
+-- the thread pool, the module name and the ThreadId are only known when it is
+-- claimed by Thread.create. lua-application.c calls INIT_RunThread then.
+--
+local function INIT_RunThread ()
+  local ThreadId = Thread.getid()
+  local ModuleToLoad
+  if (ThreadId == 1) then
+    ModuleToLoad = (INIT_AppEntryPoint or "main")
+  else
+    local ModuleName = Thread.getname()
+    ModuleToLoad = ModuleName
+  end
+  require(ModuleToLoad)
 end
 
-require(ModuleToLoad)
-
-if ZIP_File then
-  unzip_close(ZIP_File)
-  ZIP_File = nil
-end
+return INIT_RunThread, INIT_ResetThread
@@ -0,0 +1,318 @@
+--------------------------------------------------------------------------------
+-- DOCUMENTATION                                                              --
+--------------------------------------------------------------------------------
+
+-- CopasUv
+-- A readiness poller for Copas based on the luv loop of the thread: epoll on
+-- Linux, IOCP on Windows.
+--
+-- By default Copas waits with socket.select: each step passes all the waiting
+-- sockets to the kernel and scans them all again, and select is limited to
+-- FD_SETSIZE sockets (1024 on Linux). With this poller each socket has a
+-- uv_poll handle, started when Copas starts waiting on it and stopped when it
+-- leaves the sets of Copas. A step only costs the sockets which are ready, so
+-- thousands of idle connections cost nothing. The handle is kept while the
+-- socket is stopped, it is closed when Copas closes or removes the socket.
+--
+-- install() replaces socket.select for all the Copas loops of the current
+-- thread, the sockets already waiting are moved to the poller. uninstall()
+-- restores socket.select.
+--
+-- The poller runs the luv loop of the thread: the luv handles and the events
+-- of com.event using the "uv" mode are serviced while Copas waits. The luv
+-- loop is not reentrant, Copas must not be stepped from a luv callback.
+--
+-- runloop(IsDone) turns it around: Event.runloop("uv") runs the luv loop and
+-- Copas is stepped from a check handle after each poll phase. The poller
+-- doesn't run the loop then, a timer steps Copas for its timers and its
+-- resumable threads. A single uv_run waits for the sockets, the luv
+-- handles and the events, without polling.
+
+--------------------------------------------------------------------------------
+-- IMPORTS                                                                    --
+--------------------------------------------------------------------------------
+
+local Copas = require("copas")
+local Event = require("com.event")
+local uv    = require("luv")
+
+local find = string.find
+local ceil = math.ceil
+local huge = math.huge
+
+--------------------------------------------------------------------------------
+-- PRIVATE FUNCTIONS                                                          --
+--------------------------------------------------------------------------------
+
+-- Add Socket to a ready list, once. The lists are indexed both ways like the
+-- results of socket.select.
+local function POLLER_MarkReady (List, Socket)
+  if (List[Socket] == nil) then
+    local Index = (#List + 1)
+    List[Index]  = Socket
+    List[Socket] = Index
+  end
+end
+
+-- Drop the sockets which left the set of Kind after being marked ready
+local function POLLER_FilterReady (Poller, List, Kind)
+  local Entries  = Poller.Entries
+  local Filtered = {}
+  for Index = 1, #List do
+    local Socket = List[Index]
+    local Entry  = Entries[Socket]
+    if Entry and Entry[Kind] then
+      POLLER_MarkReady(Filtered, Socket)
+    end
+  end
+  return Filtered
+end
+
+local function POLLER_NewReadyLists (Poller)
+  Poller.Readable = {}
+  Poller.Writable = {}
+end
+
+local function POLLER_CloseEntry (Poller, Entry)
+  Poller.Entries[Entry.Socket] = nil
+  if (Poller.ByFd[Entry.Fd] == Entry) then
+    Poller.ByFd[Entry.Fd] = nil
+  end
+  if Entry.Handle then
+    Entry.Handle:close()
+    Entry.Handle = nil
+  end
+end
+
+-- Start or stop the uv_poll handle to match the sets of the socket
+local function POLLER_UpdateEntry (Poller, Entry)
+  local Mask
+  if Entry.r and Entry.w then
+    Mask = "rw"
+  elseif Entry.r then
+    Mask = "r"
+  elseif Entry.w then
+    Mask = "w"
+  end
+  if (Entry.Handle == nil) then
+    -- Not a valid descriptor, nothing to poll
+  elseif (Mask == nil) and (Entry.Socket:getfd() < 0) then
+    -- Closed without copas.close(), the handle can't be used anymore
+    POLLER_CloseEntry(Poller, Entry)
+  elseif (Mask == nil) then
+    -- Stopped, the handle is reused when the socket waits again
+    if Entry.Mask then
+      Entry.Mask = nil
+      Entry.Handle:stop()
+    end
+  elseif (Mask ~= Entry.Mask) then
+    Entry.Mask = Mask
+    Entry.Handle:start(Mask, Entry.Callback)
+  end
+end
+
+local function POLLER_NewEntry (Poller, Socket)
+  local Fd = (Socket.getfd and Socket:getfd())
+  local Entry = {
+    Socket = Socket,
+    Fd     = Fd,
+  }
+  -- A closed socket keeps its entry until Copas removes it, its descriptor
+  -- might already belong to a new socket
+  local Stale = (Fd and Poller.ByFd[Fd])
+  if Stale then
+    POLLER_CloseEntry(Poller, Stale)
+  end
+  if Fd and (Fd >= 0) then
+    Entry.Handle = uv.new_socket_poll(Fd)
+  end
+  if Entry.Handle then
+    Poller.ByFd[Fd] = Entry
+    -- An error is reported as readable and writable: the next operation on
+    -- the socket gets the error
+    Entry.Callback = function (Error, Events)
+      if Entry.r and (Error or find(Events, "r", 1, true)) then
+        POLLER_MarkReady(Poller.Readable, Socket)
+      end
+      if Entry.w and (Error or find(Events, "w", 1, true)) then
+        POLLER_MarkReady(Poller.Writable, Socket)
+      end
+    end
+  end
+  Poller.Entries[Socket] = Entry
+  return Entry
+end
+
+local function POLLER_MethodAdd (Poller, Socket, Kind)
+  local Entry = (Poller.Entries[Socket] or POLLER_NewEntry(Poller, Socket))
+  Entry[Kind] = true
+  if (Entry.Handle == nil) then
+    -- Not a valid descriptor: ready at once, like select does, so that the
+    -- socket operation reports the error
+    POLLER_MarkReady((Kind == "r") and Poller.Readable or Poller.Writable, Socket)
+  elseif (Kind == "r") and Socket.dirty and Socket:dirty() then
+    -- Data already buffered by the socket, the kernel will not signal it
+    POLLER_MarkReady(Poller.Readable, Socket)
+  end
+  POLLER_UpdateEntry(Poller, Entry)
+end
+
+local function POLLER_MethodRemove (Poller, Socket, Kind)
+  local Entry = Poller.Entries[Socket]
+  if Entry then
+    Entry[Kind] = nil
+    POLLER_UpdateEntry(Poller, Entry)
+  end
+end
+
+local function POLLER_MethodClose (Poller, Socket)
+  local Entry = Poller.Entries[Socket]
+  if Entry then
+    POLLER_CloseEntry(Poller, Entry)
+  end
+end
+
+-- Wait like socket.select: Timeout in seconds, nil or math.huge to wait until
+-- a socket is ready. The sockets already marked ready are returned at once.
+local function POLLER_MethodWait (Poller, Timeout)
+  if Poller.Driven then
+    -- The loop is run by Event.runloop, POLLER_WakeUpLater uses Timeout
+    Poller.Timeout = Timeout
+  elseif (#Poller.Readable == 0) and (#Poller.Writable == 0) then
+    if (Timeout == nil) or (Timeout == huge) or (Timeout < 0) then
+      uv.run("once")
+    elseif (Timeout > 0) then
+      Poller.Timer:start(ceil(Timeout * 1000), 0, Poller.OnTimeout)
+      uv.run("once")
+      Poller.Timer:stop()
+    else
+      uv.run("nowait")
+    end
+  end
+  local Readable = POLLER_FilterReady(Poller, Poller.Readable, "r")
+  local Writable = POLLER_FilterReady(Poller, Poller.Writable, "w")
+  POLLER_NewReadyLists(Poller)
+  if (#Readable == 0) and (#Writable == 0) then
+    return Readable, Writable, "timeout"
+  else
+    return Readable, Writable
+  end
+end
+
+-- Step Copas again after the last Timeout given to wait, at once if sockets
+-- are ready. Without timeout, only the sockets and the events wake it up.
+local function POLLER_WakeUpLater (Poller)
+  local Timeout = Poller.Timeout
+  if (#Poller.Readable > 0) or (#Poller.Writable > 0) then
+    Timeout = 0
+  end
+  if (Timeout == nil) or (Timeout == huge) or (Timeout < 0) then
+    Poller.Timer:stop()
+  else
+    Poller.Timer:start(ceil(Timeout * 1000), 0, Poller.OnStep)
+  end
+end
+
+local function POLLER_Close (Poller)
+  for Socket, Entry in pairs(Poller.Entries) do
+    POLLER_CloseEntry(Poller, Entry)
+  end
+  Poller.Timer:close()
+end
+
+local function NewPoller ()
+  local Poller = {
+    Entries   = {},
+    ByFd      = {},
+    Timer     = uv.new_timer(),
+    OnTimeout = function () end,
+    add       = POLLER_MethodAdd,
+    remove    = POLLER_MethodRemove,
+    close     = POLLER_MethodClose,
+    wait      = POLLER_MethodWait,
+  }
+  POLLER_NewReadyLists(Poller)
+  return Poller
+end
+
+--------------------------------------------------------------------------------
+-- PUBLIC API                                                                 --
+--------------------------------------------------------------------------------
+
+-- One poller per thread, like the luv loop and the Copas scheduler
+local CurrentPoller
+
+local function Install ()
+  if (CurrentPoller == nil) then
+    CurrentPoller = NewPoller()
+    Copas.setpoller(CurrentPoller)
+  end
+end
+
+local function Uninstall ()
+  if CurrentPoller then
+    Copas.setpoller(nil)
+    POLLER_Close(CurrentPoller)
+    CurrentPoller = nil
+  end
+end
+
+local function IsInstalled ()
+  return (CurrentPoller ~= nil)
+end
+
+-- Step Copas from Event.runloop("uv") until IsDone() returns true after a
+-- step, or until Event.stoploop() is called. The poller is installed while
+-- the loop runs if needed. An error raised by Copas stops the loop and is
+-- raised again.
+local function RunLoop (IsDone)
+  local Installed = (CurrentPoller == nil)
+  Install()
+  local Poller = CurrentPoller
+  local Check  = uv.new_check()
+  local Stopped = false
+  local ErrorMessage
+  -- The check handle only runs after a poll phase, the timer of the poller
+  -- calls Step directly
+  local function Step ()
+    if (not Stopped) then
+      local Ok, StepError = pcall(Copas.step)
+      if (not Ok) then
+        ErrorMessage = StepError
+        Stopped      = true
+      elseif IsDone() then
+        Stopped = true
+      else
+        POLLER_WakeUpLater(Poller)
+      end
+      if Stopped then
+        Event.stoploop()
+      end
+    end
+  end
+  Poller.Driven = true
+  Poller.OnStep = Step
+  Check:start(Step)
+  Poller.Timer:start(0, 0, Step)
+  Event.runloop("uv")
+  Check:close()
+  Poller.Timer:stop()
+  Poller.Driven  = false
+  Poller.OnStep  = nil
+  Poller.Timeout = nil
+  if Installed then
+    Uninstall()
+  end
+  if ErrorMessage then
+    error(ErrorMessage, 0)
+  end
+end
+
+local PUBLIC_API = {
+  install     = Install,
+  uninstall   = Uninstall,
+  isinstalled = IsInstalled,
+  runloop     = RunLoop,
+}
+
+return PUBLIC_API
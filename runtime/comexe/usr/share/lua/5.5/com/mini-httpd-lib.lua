@@ -12,6 +12,7 @@
 
 local Runtime = require("com.runtime")
 local Url     = require("socket.url")
+local HttpRaw = require("com.raw.http")
 
 local format     = string.format
 local concat     = table.concat
@@ -389,6 +390,7 @@ local HTTP_STATUS_TEXT = {
   [401] = "Unauthorized",
   [403] = "Forbidden",
   [404] = "Not Found",
+  [431] = "Request Header Fields Too Large",
   [500] = "Internal Server Error",
   [502] = "Bad Gateway",
   [503] = "Service Unavailable"
@@ -427,6 +429,7 @@ end
 
 local PUBLIC_API = {
   parserequestline    = HTTP_ParseHttpRequestLine,
+  parserequesthead    = HttpRaw.parsehead,
   parserequesttarget  = HTTP_ParseHttpPath,
   formatresponse      = HTTP_FormatResponse,
   parseheaderline     = HTTP_ParseHeaderLine,
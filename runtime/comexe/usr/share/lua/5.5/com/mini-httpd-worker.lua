@@ -0,0 +1,48 @@
+--------------------------------------------------------------------------------
+-- DOCUMENTATION                                                              --
+--------------------------------------------------------------------------------
+
+-- Worker thread of com.mini-httpd, started by newserver(WorkerCount)
+-- Create the ServerApp with Config.module, listen on the shared port and run
+-- the Copas loop until the event MiniHttpdStop. The result of listen is
+-- pushed in the channel Results: true and the URI, or false and an error
+-- message.
+
+--------------------------------------------------------------------------------
+-- IMPORTS                                                                    --
+--------------------------------------------------------------------------------
+
+local Thread    = require("com.thread")
+local Event     = require("com.event")
+local MiniHttpd = require("com.mini-httpd")
+
+--------------------------------------------------------------------------------
+-- WORKER                                                                     --
+--------------------------------------------------------------------------------
+
+local Config, Results = Thread.getarguments()
+
+local function WORKER_Listen ()
+  local Server     = MiniHttpd.newserver()
+  local AppModule  = require(Config.module)
+  local App        = AppModule.newserverapp(Server, Config.moduleoptions)
+  Server:bind(Config, App)
+  local Success, ErrorString = Server:listen(App)
+  if Success then
+    Event.register("MiniHttpdStop", function ()
+      Server:stop(App)
+    end)
+  end
+  return Server, App, Success, ErrorString
+end
+
+local Ok, Server, App, Success, ErrorString = pcall(WORKER_Listen)
+
+if (not Ok) then
+  Results:push(false, Server) -- Error message
+elseif (not Success) then
+  Results:push(false, ErrorString)
+else
+  Results:push(true, Server:geturi(App))
+  Server:runloop()
+end
@@ -23,6 +23,33 @@
 --   Use com.websocket middleware module:
 --     local WebSocket = require("com.websocket")
 --     local Ws, Error = WebSocket.new(Request)
+--
+-- Worker threads:
+--   newserver(WorkerCount) serves the connections from WorkerCount threads
+--   running com/mini-httpd-worker.lua. Each worker binds the same port with
+--   SO_REUSEPORT and runs its own Copas loop, the kernel spreads the incoming
+--   connections between them. SO_REUSEPORT is not available on Windows.
+--
+--   The config given to bind must contain "module", the name of a module
+--   exposing newserverapp(Server, Options) like tests/mini-httpd/hello-httpd.lua,
+--   and optionally "moduleoptions". Each worker creates its own ServerApp
+--   with it. The config is copied to the workers like the arguments of an
+--   event.
+--
+--   The ServerApp given to bind stays in the calling thread and only
+--   receives the events: "Started" once all the workers listen, "Closed"
+--   once all the workers are finished. stop() asks all the workers to stop.
+--
+-- Poller:
+--   runloop installs com.copas-uv in the calling thread while it runs, and
+--   uninstalls it when it returns: Copas waits on the sockets with the luv
+--   loop instead of socket.select, which is not limited to FD_SETSIZE
+--   sockets and only costs the sockets which are ready. A poller installed
+--   by the application is kept.
+--
+--   runloop runs Event.runloop("uv"), Copas is stepped by copas-uv: the
+--   sockets, the luv handles and the events of com.event wake up the same
+--   uv_run, the thread doesn't spin between Copas and com.event.
 
 --------------------------------------------------------------------------------
 -- MODULE                                                                     --
@@ -32,16 +59,21 @@ local Runtime     = require("com.runtime")
 local MiniHttpLib = require("com.mini-httpd-lib")
 local LuaSocket   = require("socket")
 local Copas       = require("copas")
+local CopasUv     = require("com.copas-uv")
 local Event       = require("com.event")
 local SslServer   = require("com.ssl-server")
+local Thread      = require("com.thread")
+local Channel     = require("com.channel")
 local sslmod      = require("mbedtls.ssl")
 
 local format        = string.format
+local match         = string.match
+local find          = string.find
+local sub           = string.sub
+local max           = math.max
 local concat        = table.concat
 local append        = Runtime.append
 local hasprefix     = Runtime.hasprefix
-local RunOnce       = Event.runonce
-local step          = Copas.step
 local pause         = Copas.pause
 local finished      = Copas.finished
 local wrap          = Copas.wrap
@@ -49,12 +81,14 @@ local addthread     = Copas.addthread
 local timernew      = Copas.timer.new
 local newconfig     = sslmod.newconfig
 local newconfig_mem = sslmod.newconfig_mem
+local newticketkey  = sslmod.newticketkey
 local sslwrap       = SslServer.wrap
+local sslresumption = SslServer.enableresumption
+local sslticketkey  = SslServer.updateticketkey
 
-local parserequestline    = MiniHttpLib.parserequestline
+local parserequesthead    = MiniHttpLib.parserequesthead
 local parserequesttarget  = MiniHttpLib.parserequesttarget
 local formatresponse      = MiniHttpLib.formatresponse
-local parseheaderline     = MiniHttpLib.parseheaderline
 local parseheadervalue    = MiniHttpLib.parseheadervalue
 local parseformdata       = MiniHttpLib.parseformdata
 local parseurlencodedform = MiniHttpLib.parseurlencodedform
@@ -68,29 +102,127 @@ local SERVER_SOCKET_BACKLOG    =  64 -- Maximum number of pending connections
 local SERVER_KEEPALIVE_TIMEOUT =  15 -- Seconds to wait for next request on keep-alive
 local SERVER_KEEPALIVE_MAXREQS = 100 -- Maximum requests per keep-alive connection
 
+local READER_CHUNK_SIZE = 8192 -- Bytes received at once while reading a request head
+
+-- Response sent when the request head is rejected
+local HEAD_ERROR_CODES = {
+  ["invalid request line"] = 400,
+  ["invalid header"]       = 400,
+  ["too many headers"]     = 431,
+  ["head too large"]       = 431,
+}
+
+local WORKER_MODULE_NAME   = "com.mini-httpd-worker"
+local WORKER_EXIT_EVENT    = "MiniHttpdWorkerExit"
+local WORKER_START_TIMEOUT = 10000 -- Milliseconds to wait for a worker to listen
+
 --------------------------------------------------------------------------------
--- SERVER TYPE                                                                --
+-- CONNECTION READER                                                          --
 --------------------------------------------------------------------------------
 
-local function SERVER_ReadHeaders (Client)
-  -- Read HTTP request headers
-  local HttpHeaders = {}
-  local HeadersDone = false
-  repeat
-    local Line, ErrorMessage = Client:receive("*l")
-    if ErrorMessage or (not Line) or (Line == "") then
-      HeadersDone = true
-    else
-      local Key, Value = parseheaderline(Line)
-      if (Key and Value) then
-        HttpHeaders[Key] = Value
+-- The head of a request is received in chunks and parsed at once by
+-- parserequesthead. The bytes received after the head, the start of the body
+-- or the next pipelined request, are kept in the reader: its receive method
+-- returns them before reading the client again. Like LuaSocket, the prefix
+-- counts in the size given as a number.
+
+local function READER_RemoveCr (Line)
+  if (sub(Line, -1) == "\r") then
+    Line = sub(Line, 1, -2)
+  end
+  return Line
+end
+
+local function READER_MethodReceive (Reader, Pattern, Prefix)
+  local Client  = Reader.client
+  local Pending = Reader.pending
+  local Data
+  local ErrorMessage
+  local Partial
+  Pattern = (Pattern or "*l")
+  if (Pending == "") then
+    Data, ErrorMessage, Partial = Client:receive(Pattern, Prefix)
+  else
+    -- The prefix is returned as is, followed by the pending bytes
+    local Head = (Prefix or "")
+    Reader.pending = ""
+    if (Pattern == "*l") then
+      local Index = find(Pending, "\n", 1, true)
+      if Index then
+        Data           = format("%s%s", Head, READER_RemoveCr(sub(Pending, 1, (Index - 1))))
+        Reader.pending = sub(Pending, (Index + 1))
+      else
+        Data, ErrorMessage, Partial = Client:receive(Pattern, format("%s%s", Head, READER_RemoveCr(Pending)))
       end
+    elseif (type(Pattern) == "number") and (#Pending >= (Pattern - #Head)) then
+      local Wanted   = max((Pattern - #Head), 0)
+      Data           = format("%s%s", Head, sub(Pending, 1, Wanted))
+      Reader.pending = sub(Pending, (Wanted + 1))
+    elseif (type(Pattern) == "number") then
+      Data, ErrorMessage, Partial = Client:receive(Pattern, format("%s%s", Head, Pending))
+    else
+      Data, ErrorMessage, Partial = Client:receive(Pattern, format("%s%s", Head, Pending))
     end
-  until HeadersDone
-  -- Return value
-  return HttpHeaders
+  end
+  return Data, ErrorMessage, Partial
 end
 
+-- Return Method, Target, Version and Headers, or false and the reason
+local function READER_MethodReceiveHead (Reader)
+  local Client = Reader.client
+  local Method, Target, Version, Headers, HeadSize = parserequesthead(Reader.pending)
+  while (not Method) and (Target == "incomplete") do
+    local Data, ErrorMessage, Partial = Client:receivepartial(READER_CHUNK_SIZE)
+    local Chunk = (Data or Partial)
+    if Chunk and (#Chunk > 0) then
+      Reader.pending = format("%s%s", Reader.pending, Chunk)
+      Method, Target, Version, Headers, HeadSize = parserequesthead(Reader.pending)
+    else
+      Target = (ErrorMessage or "closed")
+    end
+  end
+  if Method then
+    Reader.pending = sub(Reader.pending, (HeadSize + 1))
+  end
+  return Method, Target, Version, Headers
+end
+
+local function READER_MethodSend (Reader, Data)
+  return Reader.client:send(Data)
+end
+
+local function READER_MethodClose (Reader)
+  return Reader.client:close()
+end
+
+local function READER_MethodSetTimeout (Reader, TimeoutSec)
+  return Reader.client:settimeout(TimeoutSec)
+end
+
+local function READER_MethodGetPeerName (Reader)
+  return Reader.client:getpeername()
+end
+
+local function SERVER_NewReader (Client)
+  local NewReader = {
+    -- private data
+    client  = Client,
+    pending = "",
+    -- methods
+    receive     = READER_MethodReceive,
+    receivehead = READER_MethodReceiveHead,
+    send        = READER_MethodSend,
+    close       = READER_MethodClose,
+    settimeout  = READER_MethodSetTimeout,
+    getpeername = READER_MethodGetPeerName,
+  }
+  return NewReader
+end
+
+--------------------------------------------------------------------------------
+-- SERVER TYPE                                                                --
+--------------------------------------------------------------------------------
+
 -- Read HTTP request encoded with "Transfer-Encoding: chunked"
 -- Can be tested with curl
 -- curl -H "Transfer-Encoding: chunked" -d @test.bin --request POST http://127.0.0.1:8801/test-chunk-data-receive -vv
@@ -334,8 +466,11 @@ local function SERVER_HandleHandshake (ServerEntry, Client)
         SslConfig = newconfig("tls-server")
       end
       assert(SslConfig, "mini-httpd: cannot create ssl server config")
+      ServerEntry.ticketperiod = sslresumption(SslConfig, Config)
       -- Save config
       ServerEntry.sslconfig = SslConfig
+    else
+      ServerEntry.ticketperiod = sslticketkey(SslConfig, Config, ServerEntry.ticketperiod)
     end
     local ClientOrError, ErrorMessage = sslwrap(Client, SslConfig, ServerEntry)
     if ClientOrError then
@@ -374,26 +509,16 @@ local function SERVER_CopasClientHandler (ServerEntry, Client)
     KeepAliveRemaining = 0
   end
   local RequestCount = 0
+  local Reader       = SERVER_NewReader(WrappedClient)
   while (KeepAliveRemaining > 0) do
-    -- Read request line
+    -- Read and parse the request head
     local KeepAliveTimer = SERVER_StartKeepAliveTimer(WrappedClient, RequestCount)
-    local RequestLine, ReceiveError = WrappedClient:receive("*l")
+    local Method, HttpPath, Version, Headers = Reader:receivehead()
     KeepAliveTimer:cancel()
-    -- Parse request
-    local Method
-    local HttpPath
-    local Version
-    if RequestLine then
-      Method, HttpPath, Version = parserequestline(RequestLine)
-    elseif (ReceiveError ~= "closed") and (ReceiveError ~= "close-notify") then
-      -- close-notify sent by the client during SSL shutdown
-      print(format("# WARNING: invalid request line %q %q", RequestLine, ReceiveError))
-    end
-    if Method and HttpPath and Version then
+    if Method then
       -- Process request
-      local Headers     = SERVER_ReadHeaders(WrappedClient)
-      local ContentData = SERVER_ReadBody(WrappedClient, Headers)
-      local Request     = SERVER_BuildRequest(WrappedClient, Method, HttpPath, Version, Headers, ContentData, KeepAliveRemaining)
+      local ContentData = SERVER_ReadBody(Reader, Headers)
+      local Request     = SERVER_BuildRequest(Reader, Method, HttpPath, Version, Headers, ContentData, KeepAliveRemaining)
       local ServerApp   = ServerEntry.serverapp
       -- Delegate request
       ServerApp:request(Request)
@@ -410,17 +535,41 @@ local function SERVER_CopasClientHandler (ServerEntry, Client)
         KeepAliveRemaining = 0
       end
     else
-      -- Invalid or empty request line (timeout or client closed)
+      -- Invalid head, timeout or client closed
+      local ErrorMessage = HttpPath
+      local HttpCode     = HEAD_ERROR_CODES[ErrorMessage]
+      if HttpCode then
+        WrappedClient:send(formatresponse(HttpCode, ErrorMessage, { ["Connection"] = "close" }, "text/plain"))
+      elseif (ErrorMessage ~= "closed") and (ErrorMessage ~= "close-notify") then
+        -- close-notify sent by the client during SSL shutdown
+        print(format("# WARNING: invalid request head %q", ErrorMessage))
+      end
       KeepAliveRemaining = 0
       WrappedClient:close()
     end
   end
 end
 
+-- LuaSocket.tcp() only creates the socket in bind, so the options set before
+-- bind would be ignored: create a socket of the family of BindHost
+local function SERVER_NewSocket (BindHost)
+  local Addresses = (BindHost ~= "*") and LuaSocket.dns.getaddrinfo(BindHost)
+  local NewSocket
+  if Addresses and Addresses[1] and (Addresses[1].family == "inet6") then
+    NewSocket = LuaSocket.tcp6()
+  else
+    NewSocket = LuaSocket.tcp4()
+  end
+  return NewSocket
+end
+
 local function SERVER_Start (ServerEntry, BindHost, Port)
   -- Create the server socket
-  local NewServerSocket = LuaSocket.tcp()
+  local NewServerSocket = SERVER_NewSocket(BindHost)
   NewServerSocket:setoption("reuseaddr", true)
+  if ServerEntry.config.reuseport then
+    NewServerSocket:setoption("reuseport", true)
+  end
   local BindSuccess, ErrorString = NewServerSocket:bind(BindHost, Port)
   local NewUri
   if BindSuccess then
@@ -461,7 +610,105 @@ local function SERVER_Stop (ServerEntry)
     ServerEntry.state     = "STOPPED"
     ServerEntry.socket    = false
     ServerEntry.sslconfig = false
+    ServerEntry.uri       = false
+  end
+end
+
+--------------------------------------------------------------------------------
+-- WORKER THREADS                                                             --
+--------------------------------------------------------------------------------
+
+-- Entries by worker thread ID, to route the exit events of the workers
+local WORKERS_Entries = {}
+local WORKERS_Running = 0
+
+local function WORKERS_OnExit (ThreadId)
+  local ServerEntry = WORKERS_Entries[ThreadId]
+  Thread.join(ThreadId)
+  if ServerEntry then
+    WORKERS_Entries[ThreadId] = nil
+    WORKERS_Running     = (WORKERS_Running - 1)
+    ServerEntry.running = (ServerEntry.running - 1)
+    -- Closed is only sent when Started has been sent
+    if (ServerEntry.running == 0) and (ServerEntry.state ~= "INIT") then
+      ServerEntry.state = "STOPPED"
+      ServerEntry.uri   = false
+      ServerEntry.serverapp:event("Closed", nil)
+    end
+  end
+end
+
+local function WORKERS_Stop (ServerEntry)
+  if (ServerEntry.running > 0) then
+    for Index = 1, #ServerEntry.workers do
+      Event.send(ServerEntry.workers[Index], "MiniHttpdStop")
+    end
+  end
+end
+
+-- Start a worker and wait until it listens. Return true, the URI and the
+-- port, or false and an error message.
+local function WORKERS_StartWorker (ServerEntry, WorkerConfig)
+  local ThreadId = Thread.create(WORKER_MODULE_NAME, WORKER_EXIT_EVENT, {
+    arguments = { WorkerConfig, ServerEntry.results },
+  })
+  WORKERS_Entries[ThreadId] = ServerEntry
+  WORKERS_Running     = (WORKERS_Running + 1)
+  ServerEntry.running = (ServerEntry.running + 1)
+  append(ServerEntry.workers, ThreadId)
+  -- The worker always reports, even when its module fails to load
+  local Ok, Success, UriOrError = ServerEntry.results:poptimeout(WORKER_START_TIMEOUT)
+  if (not Ok) then
+    Success    = false
+    UriOrError = "worker start timeout"
+  end
+  return Success, UriOrError
+end
+
+local function WORKERS_Listen (Server, ServerEntry)
+  Event.register(WORKER_EXIT_EVENT, WORKERS_OnExit)
+  -- The workers share the port
+  local WorkerConfig = {}
+  for Key, Value in pairs(ServerEntry.config) do
+    WorkerConfig[Key] = Value
+  end
+  WorkerConfig.reuseport = true
+  -- The workers share the ticket keys: a client resumes its session whatever
+  -- the worker receiving its next connection. Each worker derives the key of
+  -- the current period from the secret, they rotate it at the same time.
+  local SharedTicketKey = SERVER_ConfigUseSsl(WorkerConfig)
+    and (WorkerConfig.sessiontickets ~= false)
+    and (not WorkerConfig.ticketkey)
+    and (not WorkerConfig.ticketsecret)
+  if SharedTicketKey then
+    -- The 32 bytes of a random key
+    WorkerConfig.ticketsecret = select(2, newticketkey())
+  end
+  ServerEntry.workers    = {}
+  ServerEntry.results    = Channel.new()
+  -- The first worker resolves the port 0, the others bind the same port
+  local Success, Uri = WORKERS_StartWorker(ServerEntry, WorkerConfig)
+  local ErrorString
+  if Success then
+    WorkerConfig.port = tonumber(match(Uri, ":(%d+)$"))
+    local Index = 2
+    while Success and (Index <= Server.workercount) do
+      Success, ErrorString = WORKERS_StartWorker(ServerEntry, WorkerConfig)
+      Index = (Index + 1)
+    end
+  else
+    ErrorString = Uri
   end
+  -- Update state
+  if Success then
+    ServerEntry.state = "RUNNING"
+    ServerEntry.uri   = Uri
+    ServerEntry.serverapp:event("Started", Uri)
+  else
+    WORKERS_Stop(ServerEntry)
+  end
+  -- Return value
+  return Success, ErrorString
 end
 
 --------------------------------------------------------------------------------
@@ -478,14 +725,30 @@ end
 --   key         - PEM key string
 --   certkeyfile - path to combined cert+key file
 --
+-- Session resumption, see com/ssl-server.lua enableresumption:
+--   sessioncache   - number of TLS 1.2 sessions cached, false to disable
+--   sessiontimeout - seconds a session stays in the cache
+--   sessiontickets - false to disable the session tickets
+--   ticketlifetime - seconds a ticket is valid
+--   ticketname     - ticket key name (4 bytes)
+--   ticketkey      - ticket key (32 bytes), replaced by a random key when
+--                    its lifetime expires
+--   ticketsecret   - secret (32 bytes) from which the ticket key of each
+--                    period is derived, generated for the workers
+--
 -- ServerApp must expose:
 --   request(ServerApp, Request) - handle HTTP request
 --   event(ServerApp, EventType, Value) - receive server events (Started, Closed)
 --
 local function HTTPD_Bind (Server, SslOptions, HttpHandler)
-  -- Validate ServerApp
+  -- Validate ServerApp, with workers the requests are handled by the
+  -- ServerApp of each worker
   assert(type(HttpHandler) == "table", "mini-httpd: ServerApp must be a table")
-  assert(type(HttpHandler.request) == "function", "mini-httpd: ServerApp must expose request method")
+  if Server.workercount then
+    assert(type(SslOptions.module) == "string", "mini-httpd: workers require module in config")
+  else
+    assert(type(HttpHandler.request) == "function", "mini-httpd: ServerApp must expose request method")
+  end
   assert(type(HttpHandler.event) == "function", "mini-httpd: ServerApp must expose event method")
   -- Create the new entry
   local NewServerEntry = {
@@ -493,6 +756,8 @@ local function HTTPD_Bind (Server, SslOptions, HttpHandler)
     config    = SslOptions,
     socket    = false,
     sslconfig = false,
+    uri       = false,
+    running   = 0,
     state     = "INIT",
   }
   -- Register in the main server
@@ -508,10 +773,14 @@ local function HTTPD_MethodListen (Server, HttpHandler)
   local Port = SslOptions["port"]
   assert(Host, "mini-httpd: listen requires host in config")
   assert(Port, "mini-httpd: listen requires port in config")
+  if Server.workercount then
+    return WORKERS_Listen(Server, ServerEntry)
+  end
   local ServerSocket, Uri, ErrorString = SERVER_Start(ServerEntry, Host, Port)
   ServerEntry.socket = ServerSocket
   if ServerSocket then
     ServerEntry.state = "RUNNING"
+    ServerEntry.uri   = Uri
     HttpHandler:event("Started", Uri)
   end
   local Success = (ServerSocket ~= false)
@@ -520,15 +789,29 @@ end
 
 local function HTTPD_MethodStop (Server, HttpHandler)
   local ServerEntry = Server.entries[HttpHandler]
-  SERVER_Stop(ServerEntry)
+  if Server.workercount then
+    WORKERS_Stop(ServerEntry)
+  else
+    SERVER_Stop(ServerEntry)
+  end
 end
 
+-- Return the URI of a listening ServerApp, false otherwise
+local function HTTPD_MethodGetUri (Server, HttpHandler)
+  local ServerEntry = Server.entries[HttpHandler]
+  return (ServerEntry and ServerEntry.uri)
+end
+
+local function HTTPD_IsDone ()
+  return (finished() and (WORKERS_Running == 0))
+end
+
+-- Run until the Copas tasks and the workers of this thread are finished. The
+-- exit events of the workers are received by the same loop.
 local function HTTPD_MethodRunLoop (Server)
-  local Continue = true
-  while Continue do
-    step()
-    RunOnce()
-    Continue = (not finished())
+  -- Event.stoploop() called by a handler only stops the current round
+  while (not HTTPD_IsDone()) do
+    CopasUv.runloop(HTTPD_IsDone)
   end
 end
 
@@ -562,15 +845,21 @@ end
 -- CONSTRUCTOR                                                                --
 --------------------------------------------------------------------------------
 
-local function HTTPD_NewServer ()
+-- WorkerCount is nil to serve from the calling thread
+local function HTTPD_NewServer (WorkerCount)
+  if (WorkerCount ~= nil) then
+    assert((math.type(WorkerCount) == "integer") and (WorkerCount >= 1), "mini-httpd: invalid worker count")
+  end
   -- Create the main server object
   local NewServer = {
     -- private data
-    entries = {},
+    entries     = {},
+    workercount = WorkerCount,
     -- methods
     bind      = HTTPD_Bind,
     listen    = HTTPD_MethodListen,
     stop      = HTTPD_MethodStop,
+    geturi    = HTTPD_MethodGetUri,
     runloop   = HTTPD_MethodRunLoop,
     newthread = HTTPD_MethodNewThread,
     newtimer  = HTTPD_MethodNewTimer,
@@ -393,8 +393,18 @@ local function ZIP_GetActionForEntry (Merger, SourceId, EntryName)
   return Action
 end
 
+-- Set a function called for each entry written in the ZIP
+--
+-- EntryHook(EntryName, EntryContent) can return an additional entry
+-- NewEntryName, NewEntryContent which will be written right after the current
+-- one. It is used by "comexe make" to add precompiled bytecode entries.
+local function ZIPM_MergerSetEntryHook (Merger, EntryHook)
+  assert((EntryHook == nil) or (type(EntryHook) == "function"), "EntryHook must be a function")
+  Merger.EntryHook = EntryHook
+end
+
 -- Write a ZIP entry, warn about duplicates
-local function ZIPM_WriteEntry (Writer, EntryName, EntryContent, EntriesSet)
+local function ZIPM_WriteEntry (Merger, Writer, EntryName, EntryContent, EntriesSet)
   -- Validate inputs
   assert(type(EntryName)    == "string", "EntryName must be a string")
   assert(type(EntryContent) == "string", "EntryContent must be a string")
@@ -408,6 +418,21 @@ local function ZIPM_WriteEntry (Writer, EntryName, EntryContent, EntriesSet)
   if Success then
     EntriesSet[EntryName] = true -- Duplicate detection
   end
+  -- Additional entry generated from the current one
+  local EntryHook = Merger.EntryHook
+  if Success and EntryHook then
+    local NewEntryName, NewEntryContent = EntryHook(EntryName, EntryContent)
+    if NewEntryName and (not EntriesSet[NewEntryName]) then
+      local NewSuccess, NewErrorString = Writer:WriteEntry(NewEntryName, NewEntryContent)
+      if NewSuccess then
+        EntriesSet[NewEntryName] = true
+        Merger:verboselog("%s -> %s", EntryName, NewEntryName)
+      else
+        local Error = format("Failed to write generated entry [%s]: %s\n", NewEntryName, NewErrorString)
+        stderr:write(Error)
+      end
+    end
+  end
   -- Return value
   return Success, ErrorString
 end
@@ -432,7 +457,7 @@ local function ZIPM_ImportDirectory (Merger, Writer, SourceId, SourcePath, Entri
       if (Action == "COPY") then
         local FileContent = readfile(NativePathname, "string")
         if FileContent then
-          local Success, ErrorString = ZIPM_WriteEntry(Writer, ZipEntryName, FileContent, EntriesSet)
+          local Success, ErrorString = ZIPM_WriteEntry(Merger, Writer, ZipEntryName, FileContent, EntriesSet)
           if Success then
             Merger:verboselog("%s -> %s", NativePathname, ZipEntryName)
           else
@@ -457,7 +482,7 @@ local function ZIPM_ImportZipFile (Merger, Writer, SourceId, ZipFilename, Entrie
     if (EntryAction == "COPY") then
       local ZipEntryContent = ReadFunction()
       if ZipEntryContent then
-        local WriteSuccess, WriteErrorString = ZIPM_WriteEntry(Writer, ZipEntryname, ZipEntryContent, EntriesSet)
+        local WriteSuccess, WriteErrorString = ZIPM_WriteEntry(Merger, Writer, ZipEntryname, ZipEntryContent, EntriesSet)
         if WriteSuccess then
           Merger:verboselog("%s", ZipEntryname)
         else
@@ -494,7 +519,7 @@ local function ZIPM_MethodWriteZip (Merger)
   for Index, Entry in ipairs(Entries) do
     local EntryName    = Entry.name
     local EntryContent = Entry.content
-    local Success, ErrorString = ZIPM_WriteEntry(Writer, EntryName, EntryContent, EntriesSet)
+    local Success, ErrorString = ZIPM_WriteEntry(Merger, Writer, EntryName, EntryContent, EntriesSet)
     if ErrorString then
       print(format("ERROR writing entry [%s]: %s", EntryName, ErrorString))
     else
@@ -523,10 +548,11 @@ end
 local ZIPM_Metatable = {
   -- custom methods
   __index = {
-    AddEntry  = ZIPM_MergerAddEntry,
-    AddSource = ZIPM_MergerAddSource,
-    AddRule   = ZIPM_MergerAddRule,
-    WriteZip  = ZIPM_MethodWriteZip
+    AddEntry     = ZIPM_MergerAddEntry,
+    AddSource    = ZIPM_MergerAddSource,
+    AddRule      = ZIPM_MergerAddRule,
+    SetEntryHook = ZIPM_MergerSetEntryHook,
+    WriteZip     = ZIPM_MethodWriteZip
   }
 }
 
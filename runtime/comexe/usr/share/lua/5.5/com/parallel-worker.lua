@@ -0,0 +1,118 @@
+--------------------------------------------------------------------------------
+-- DOCUMENTATION                                                              --
+--------------------------------------------------------------------------------
+
+-- Worker thread of com.parallel
+-- Pull the jobs from the channel Jobs until it is closed, push the results in
+-- the channel Results. A job is:
+--   JobId, TaskKind, TaskData, "call", Arguments...
+--   JobId, TaskKind, TaskData, "map" or "foreach", FirstIndex, Values
+-- A result is JobId, true, Values... or JobId, false, ErrorMessage
+--
+-- An error out of a job, like a job too large for the option maxmemory, ends
+-- the worker. It pushes 0, false, ErrorMessage, JobId before exiting: the
+-- pool fails the job being run, if any, and stops counting on this worker.
+
+--------------------------------------------------------------------------------
+-- IMPORTS                                                                    --
+--------------------------------------------------------------------------------
+
+local Thread = require("com.thread")
+
+local find     = string.find
+local sub      = string.sub
+local format   = string.format
+local tostring = tostring
+local pcall    = pcall
+
+-- JobId of the exit message
+local WORKER_EXIT_ID = 0
+
+--------------------------------------------------------------------------------
+-- PRIVATE FUNCTIONS                                                          --
+--------------------------------------------------------------------------------
+
+local Jobs, Results = Thread.getarguments()
+
+-- The functions are loaded once per worker
+local Functions = {}
+
+-- The job being run, reported if the worker exits meanwhile
+local CurrentJobId
+
+local function WORKER_LoadFunction (TaskKind, TaskData)
+  local Function
+  if (TaskKind == "bytecode") then
+    Function = assert(load(TaskData, "=parallel", "b"))
+  else
+    local Separator    = find(TaskData, ":", 1, true)
+    local ModuleName   = sub(TaskData, 1, (Separator - 1))
+    local FunctionName = sub(TaskData, (Separator + 1))
+    Function = require(ModuleName)[FunctionName]
+    if (type(Function) ~= "function") then
+      error(format("function '%s' not found", TaskData), 0)
+    end
+  end
+  return Function
+end
+
+local function WORKER_GetFunction (TaskKind, TaskData)
+  local Function = Functions[TaskData]
+  if (Function == nil) then
+    Function            = WORKER_LoadFunction(TaskKind, TaskData)
+    Functions[TaskData] = Function
+  end
+  return Function
+end
+
+local function WORKER_RunChunk (Function, Collect, FirstIndex, Values)
+  local Output = {}
+  for Index = 1, #Values do
+    local Result = Function(Values[Index], (FirstIndex + Index - 1))
+    if Collect then
+      Output[Index] = Result
+    end
+  end
+  return Output
+end
+
+local function WORKER_RunJob (TaskKind, TaskData, Mode, ...)
+  local Function = WORKER_GetFunction(TaskKind, TaskData)
+  if (Mode == "call") then
+    return Function(...)
+  else
+    return WORKER_RunChunk(Function, (Mode == "map"), ...)
+  end
+end
+
+local function WORKER_PushResult (JobId, Success, ...)
+  -- The results might not be supported by the channels
+  local Pushed, ErrorMessage = pcall(Results.push, Results, JobId, Success, ...)
+  if (not Pushed) then
+    Results:push(JobId, false, tostring(ErrorMessage))
+  end
+end
+
+local function WORKER_ProcessJob (Ok, JobId, ...)
+  if Ok then
+    CurrentJobId = JobId
+    WORKER_PushResult(JobId, pcall(WORKER_RunJob, ...))
+    CurrentJobId = nil
+  end
+  return Ok
+end
+
+local function WORKER_Run ()
+  while WORKER_ProcessJob(Jobs:pop()) do
+  end
+end
+
+--------------------------------------------------------------------------------
+-- MAIN                                                                       --
+--------------------------------------------------------------------------------
+
+local Ok, ErrorMessage = pcall(WORKER_Run)
+
+if (not Ok) then
+  Results:push(WORKER_EXIT_ID, false, tostring(ErrorMessage), CurrentJobId)
+end
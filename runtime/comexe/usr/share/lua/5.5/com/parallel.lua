@@ -0,0 +1,309 @@
+--------------------------------------------------------------------------------
+-- DOCUMENTATION                                                              --
+--------------------------------------------------------------------------------
+
+-- Parallel
+-- A pool of worker threads running Lua functions, for CPU-bound batch jobs.
+--
+-- The workers are started once and run com/parallel-worker.lua. They all pull
+-- their jobs from the same channel: a worker which is done takes the next job,
+-- so a slow job never delays the jobs queued behind it. Pool:map cuts the
+-- array in chunks, several chunks per worker, to balance the load while
+-- keeping a single message per chunk.
+--
+-- A task is a Lua function or a string "module:function". A Lua function is
+-- sent with string.dump: it must not rely on upvalues, only on its arguments
+-- and the global variables of the worker. A "module:function" task is
+-- require'd by the worker.
+--
+-- The results come back in a channel read only by the thread which created
+-- the pool. A worker which exits on an error tells the pool in the same
+-- channel: the job it was running fails, and once no worker is left, all the
+-- pending jobs fail instead of waiting forever. The result of a future which is collected without being read is
+-- dropped, when it is already received or when it arrives later. Pool:close()
+-- must be called before the end of the program.
+--
+-- The options of Parallel.new are the options of Thread.create for the
+-- workers, like cpus or priority. The option arguments is reserved.
+
+--------------------------------------------------------------------------------
+-- IMPORTS                                                                    --
+--------------------------------------------------------------------------------
+
+local Thread  = require("com.thread")
+local Channel = require("com.channel")
+local uv      = require("luv")
+
+local dump   = string.dump
+local find   = string.find
+local format = string.format
+local pack   = table.pack
+local unpack = table.unpack
+local ceil   = math.ceil
+local max    = math.max
+local min    = math.min
+local hrtime = uv.hrtime
+
+--------------------------------------------------------------------------------
+-- CONSTANTS                                                                  --
+--------------------------------------------------------------------------------
+
+local WORKER_MODULE_NAME = "com.parallel-worker"
+
+-- Number of chunks per worker for Pool:map and Pool:foreach
+local CHUNKS_PER_WORKER = 4
+
+-- JobId of the message pushed by a worker which exits on an error
+local WORKER_EXIT_ID = 0
+
+--------------------------------------------------------------------------------
+-- PRIVATE FUNCTIONS                                                          --
+--------------------------------------------------------------------------------
+
+-- Return the kind and the data of a task, as expected by the workers
+local function POOL_EncodeTask (Pool, Task)
+  local TaskKind
+  local TaskData
+  if (type(Task) == "function") then
+    TaskData = Pool.Dumps[Task]
+    if (TaskData == nil) then
+      TaskData         = dump(Task)
+      Pool.Dumps[Task] = TaskData
+    end
+    TaskKind = "bytecode"
+  elseif (type(Task) == "string") and find(Task, ":", 1, true) then
+    TaskKind = "module"
+    TaskData = Task
+  else
+    error("task must be a function or a string \"module:function\"", 3)
+  end
+  return TaskKind, TaskData
+end
+
+local function POOL_PushJob (Pool, TaskKind, TaskData, Mode, ...)
+  if Pool.Closed then
+    error("pool is closed", 3)
+  end
+  local JobId = Pool.NextJobId
+  Pool.NextJobId = (JobId + 1)
+  assert(Pool.Jobs:push(JobId, TaskKind, TaskData, Mode, ...))
+  return JobId
+end
+
+local function POOL_SetResult (Pool, JobId, Result)
+  if Pool.Abandoned[JobId] then
+    Pool.Abandoned[JobId] = nil
+  else
+    Pool.Done[JobId] = Result
+  end
+end
+
+-- The worker exited while running LostJobId, or while waiting for a job
+local function POOL_OnWorkerExit (Pool, Success, ErrorMessage, LostJobId)
+  Pool.RunningCount = (Pool.RunningCount - 1)
+  Pool.ExitMessage  = format("worker exited: %s", ErrorMessage)
+  if LostJobId then
+    POOL_SetResult(Pool, LostJobId, pack(false, Pool.ExitMessage))
+  end
+end
+
+-- Store a result popped from the channel, Ok is false on timeout
+local function POOL_StoreResult (Pool, Ok, JobId, ...)
+  if (not Ok) then
+    -- Timeout
+  elseif (JobId == WORKER_EXIT_ID) then
+    POOL_OnWorkerExit(Pool, ...)
+  else
+    POOL_SetResult(Pool, JobId, pack(...))
+  end
+  return Ok
+end
+
+-- Wait for the result of JobId, forever when TimeoutMs is nil. Return the
+-- packed result: Success followed by the values or the error message. The
+-- results of the exited workers are all received before their exit message:
+-- once no worker is left, the jobs without result will never run.
+local function POOL_WaitResult (Pool, JobId, TimeoutMs)
+  local Done     = Pool.Done
+  local Results  = Pool.Results
+  local Deadline = (TimeoutMs and (hrtime() + (TimeoutMs * 1000000)))
+  local Waiting  = true
+  while (Done[JobId] == nil) and Waiting and (Pool.RunningCount > 0) do
+    if Deadline then
+      local RemainingMs = max(0, ((Deadline - hrtime()) // 1000000))
+      Waiting = POOL_StoreResult(Pool, Results:poptimeout(RemainingMs))
+    else
+      Waiting = POOL_StoreResult(Pool, Results:pop())
+    end
+  end
+  local Result = Done[JobId]
+  if (Result == nil) and (Pool.RunningCount == 0) then
+    Result = pack(false, Pool.ExitMessage)
+  end
+  Done[JobId] = nil
+  return Result
+end
+
+local function FUTURE_MethodGet (Future, TimeoutMs)
+  local Result = Future.Result
+  if (Result == nil) then
+    Result        = POOL_WaitResult(Future.Pool, Future.JobId, TimeoutMs)
+    Future.Result = Result
+  end
+  if Result then
+    return unpack(Result, 1, Result.n)
+  else
+    return false, "timeout"
+  end
+end
+
+local function FUTURE_MethodIsReady (Future)
+  if (Future.Result == nil) then
+    Future.Result = POOL_WaitResult(Future.Pool, Future.JobId, 0)
+  end
+  return (Future.Result ~= nil)
+end
+
+-- The future is collected before its result is read: drop the result
+local function FUTURE_GarbageCollect (Future)
+  if (Future.Result == nil) then
+    local Pool  = Future.Pool
+    local JobId = Future.JobId
+    if (Pool.Done[JobId] ~= nil) then
+      Pool.Done[JobId] = nil
+    else
+      Pool.Abandoned[JobId] = true
+    end
+  end
+end
+
+local FUTURE_METATABLE = {
+  __gc = FUTURE_GarbageCollect,
+}
+
+local function POOL_MethodSubmit (Pool, Task, ...)
+  local TaskKind, TaskData = POOL_EncodeTask(Pool, Task)
+  local Future = {
+    Pool    = Pool,
+    JobId   = POOL_PushJob(Pool, TaskKind, TaskData, "call", ...),
+    get     = FUTURE_MethodGet,
+    isready = FUTURE_MethodIsReady,
+  }
+  return setmetatable(Future, FUTURE_METATABLE)
+end
+
+local function POOL_Slice (Array, FirstIndex, LastIndex)
+  local Slice = {}
+  for Index = FirstIndex, LastIndex do
+    Slice[Index - FirstIndex + 1] = Array[Index]
+  end
+  return Slice
+end
+
+-- Run Task on all the values of Array, in chunks. Return the results in the
+-- order of Array when Collect is true.
+local function POOL_RunChunks (Pool, Task, Array, ChunkSize, Collect)
+  local TaskKind, TaskData = POOL_EncodeTask(Pool, Task)
+  local Mode       = (Collect and "map" or "foreach")
+  local ValueCount = #Array
+  local Chunks     = {}
+  if (ChunkSize == nil) then
+    ChunkSize = max(1, ceil(ValueCount / (Pool.WorkerCount * CHUNKS_PER_WORKER)))
+  end
+  -- Queue all the chunks before waiting
+  for FirstIndex = 1, ValueCount, ChunkSize do
+    local LastIndex = min(ValueCount, (FirstIndex + ChunkSize - 1))
+    local Slice     = POOL_Slice(Array, FirstIndex, LastIndex)
+    local JobId     = POOL_PushJob(Pool, TaskKind, TaskData, Mode, FirstIndex, Slice)
+    Chunks[#Chunks + 1] = { JobId, FirstIndex, LastIndex }
+  end
+  -- Wait for all the chunks, even after an error, to leave no result behind
+  local Output = (Collect and {})
+  local ErrorMessage
+  for Index = 1, #Chunks do
+    local JobId, FirstIndex, LastIndex = unpack(Chunks[Index])
+    local Result = POOL_WaitResult(Pool, JobId)
+    if (not Result[1]) then
+      ErrorMessage = (ErrorMessage or Result[2])
+    elseif Collect then
+      local ChunkOutput = Result[2]
+      for ValueIndex = FirstIndex, LastIndex do
+        Output[ValueIndex] = ChunkOutput[ValueIndex - FirstIndex + 1]
+      end
+    end
+  end
+  if ErrorMessage then
+    error(ErrorMessage, 0)
+  end
+  return Output
+end
+
+local function POOL_MethodMap (Pool, Task, Array, ChunkSize)
+  return POOL_RunChunks(Pool, Task, Array, ChunkSize, true)
+end
+
+local function POOL_MethodForEach (Pool, Task, Array, ChunkSize)
+  POOL_RunChunks(Pool, Task, Array, ChunkSize, false)
+end
+
+local function POOL_MethodGetWorkerCount (Pool)
+  return Pool.WorkerCount
+end
+
+-- The workers finish the queued jobs before exiting
+local function POOL_MethodClose (Pool)
+  if (not Pool.Closed) then
+    Pool.Closed = true
+    Pool.Jobs:close()
+    for Index = 1, #Pool.Workers do
+      Thread.join(Pool.Workers[Index])
+    end
+  end
+end
+
+local function NewPool (WorkerCount, ThreadOptions)
+  -- Default to one worker per CPU
+  WorkerCount = (WorkerCount or Thread.getcpucount())
+  if (math.type(WorkerCount) ~= "integer") or (WorkerCount < 1) then
+    error(format("invalid worker count '%s'", WorkerCount), 2)
+  end
+  -- Create new Pool object
+  local Pool = {
+    Jobs         = Channel.new(),
+    Results      = Channel.new(),
+    Workers      = {},
+    WorkerCount  = WorkerCount,
+    RunningCount = WorkerCount,
+    NextJobId    = 1,
+    Done         = {},
+    Abandoned    = {},
+    Dumps        = setmetatable({}, { __mode = "k" }),
+    Closed       = false,
+    submit       = POOL_MethodSubmit,
+    map          = POOL_MethodMap,
+    foreach      = POOL_MethodForEach,
+    workercount  = POOL_MethodGetWorkerCount,
+    close        = POOL_MethodClose,
+  }
+  -- Start the workers, without exit event: Pool:close joins them
+  local Options = {}
+  for Key, Value in pairs(ThreadOptions or {}) do
+    Options[Key] = Value
+  end
+  Options.arguments = { Pool.Jobs, Pool.Results }
+  for Index = 1, WorkerCount do
+    Pool.Workers[Index] = Thread.create(WORKER_MODULE_NAME, nil, Options)
+  end
+  -- Return value
+  return Pool
+end
+
+--------------------------------------------------------------------------------
+-- PUBLIC API                                                                 --
+--------------------------------------------------------------------------------
+
+local PUBLIC_API = {
+  new = NewPool,
+}
+
+return PUBLIC_API
@@ -7,6 +7,17 @@
 -- The function "wrap" is designed to be called from mini-httpd. It is needed
 -- because mini-httpd is run within Copas loop. This wrapper will call
 -- Copas.pause() to yield when waiting during mbedtls SSL handshake.
+--
+-- The function "enableresumption" enables the session resumption on a server
+-- config: a session cache for TLS 1.2 and session tickets for TLS 1.2 and
+-- TLS 1.3. A client coming back resumes its session with an abbreviated
+-- handshake, without the certificate and its signature. The cache lives in
+-- the config, only the connections of this config share it. The tickets are
+-- kept by the clients: the servers configured with the same ticket key
+-- resume the sessions of each other. mbedtls replaces an expired key by a
+-- random key, so the servers sharing a key must rotate it on time: with a
+-- shared "ticketsecret", like the workers of mini-httpd, the key of each
+-- period is derived from the secret, see "updateticketkey".
 
 --------------------------------------------------------------------------------
 -- IMPORTS                                                                    --
@@ -15,10 +26,16 @@
 local Copas       = require("copas")
 local mbedtls     = require("mbedtls")
 local Ssl         = require("mbedtls.ssl")
+local Md          = require("mbedtls.md")
 local chunkbuffer = require("com.chunk-buffer")
 
 local format         = string.format
 local sub            = string.sub
+local min            = math.min
+local max            = math.max
+local floor          = math.floor
+local time           = os.time
+local hmac           = Md.hmac
 local pause          = Copas.pause
 local newcontext     = Ssl.newcontext
 local newchunkbuffer = chunkbuffer.newchunkbuffer
@@ -30,6 +47,10 @@ local newchunkbuffer = chunkbuffer.newchunkbuffer
 local READ_WINDOW_SMALL = 1024
 local READ_WINDOW_LARGE = 4096
 
+local SESSION_CACHE_SIZE      = 1024  -- Sessions kept for the TLS 1.2 clients
+local SESSION_CACHE_TIMEOUT   = 3600  -- Seconds
+local SESSION_TICKET_LIFETIME = 86400 -- Seconds, at most 7 days
+
 --------------------------------------------------------------------------------
 -- COPAS COROUTINE INTEGRATION                                                --
 --------------------------------------------------------------------------------
@@ -79,6 +100,41 @@ local function COPAS_ReadBytesOrYield (ChunkBuffer, SslContext, WantSizeInBytes,
   return Success, ErrorString
 end
 
+-- Read at least one byte, as many as mbedtls has
+local function COPAS_ReadAnyOrYield (ChunkBuffer, SslContext, SharedState, ServerEntry)
+  -- local data
+  local Success = true
+  local Waiting = (ChunkBuffer:len() == 0)
+  local ErrorString
+  -- Main loop
+  while Success and Waiting do
+    if (SharedState.value == "closed")
+      or (ServerEntry.state == "STOPPED")
+    then
+      ErrorString = "closed"
+      Success     = false
+    else
+      local ReadChunk, ReadErrorString = SslContext:read(READ_WINDOW_LARGE)
+      if ReadChunk then
+        if (#ReadChunk > 0) then
+          ChunkBuffer:append(ReadChunk)
+          Waiting = false
+        else
+          ErrorString = "closed"
+          Success     = false
+        end
+      elseif (ReadErrorString == "want-read") then
+        pause(0) -- Copas yield: allow other coroutines to work
+      else
+        Success     = false
+        ErrorString = ReadErrorString
+      end
+    end
+  end
+  -- Return value
+  return Success, ErrorString
+end
+
 local function COPAS_ReadLineOrYield (ChunkBuffer, SslContext, RawSocket, SharedState, ServerEntry)
   -- local data
   local Success         = true
@@ -258,6 +314,38 @@ local function C_ADAPTER_MethodReceive (Adapter, UserPattern, UserPrefix)
   return Result, ErrorString, PartialResult
 end
 
+-- Like copas.receivepartial: return as soon as some data is available, up to
+-- SizeInBytes bytes
+local function C_ADAPTER_MethodReceivePartial (Adapter, SizeInBytes, UserPrefix)
+  -- Retrieve data
+  local ChunkBuffer = Adapter.ChunkBuffer
+  local SslContext  = Adapter.SslContext
+  local SharedState = Adapter.SharedState
+  local ServerEntry = Adapter.ServerEntry
+  -- Handle defaults
+  local Prefix = (UserPrefix or "")
+  -- local data
+  local Result
+  local ErrorString
+  local PartialResult
+  -- Handle request
+  if (type(SizeInBytes) ~= "number") then
+    ErrorString   = format("Unsupported receive pattern %q", SizeInBytes)
+    PartialResult = Prefix
+  else
+    local Success, FillErrorString = COPAS_ReadAnyOrYield(ChunkBuffer, SslContext, SharedState, ServerEntry)
+    if Success then
+      local ReceivedData = ChunkBuffer:consume(min(SizeInBytes, ChunkBuffer:len()))
+      Result = format("%s%s", Prefix, ReceivedData)
+    else
+      ErrorString   = (FillErrorString or "closed")
+      PartialResult = Prefix
+    end
+  end
+  -- Return value
+  return Result, ErrorString, PartialResult
+end
+
 local function C_ADAPTER_MethodSend (Adapter, Data)
   -- Retrieve data
   local SslContext  = Adapter.SslContext
@@ -314,13 +402,14 @@ end
 local C_ADAPTER_Metatable = {
   -- Custom methods
   __index = {
-    settimeout  = C_ADAPTER_MethodSetTimeout,
-    close       = C_ADAPTER_MethodClose,
-    getfd       = C_ADAPTER_MethodGetFd,
-    getpeername = C_ADAPTER_MethodGetPeerName,
-    dirty       = C_ADAPTER_MethodDirty,
-    receive     = C_ADAPTER_MethodReceive,
-    send        = C_ADAPTER_MethodSend,
+    settimeout     = C_ADAPTER_MethodSetTimeout,
+    close          = C_ADAPTER_MethodClose,
+    getfd          = C_ADAPTER_MethodGetFd,
+    getpeername    = C_ADAPTER_MethodGetPeerName,
+    dirty          = C_ADAPTER_MethodDirty,
+    receive        = C_ADAPTER_MethodReceive,
+    receivepartial = C_ADAPTER_MethodReceivePartial,
+    send           = C_ADAPTER_MethodSend,
   },
   -- Generic methods
   __tostring = C_ADAPTER_MethodToString,
@@ -385,6 +474,87 @@ local function SERVER_SslHandshake (SslContext, MaxAttempts, RawSocket, SharedSt
   return Success, ErrorString
 end
 
+--------------------------------------------------------------------------------
+-- SESSION RESUMPTION                                                         --
+--------------------------------------------------------------------------------
+
+-- The key of the period number Period, the same for all the servers sharing
+-- Secret
+local function SERVER_DeriveTicketKey (Secret, Period)
+  local Label = format("%d", Period)
+  local Name  = sub(hmac("SHA256", Secret, ("name:" .. Label), true), 1, 4)
+  local Key   = hmac("SHA256", Secret, ("key:" .. Label), true)
+  return Name, Key
+end
+
+-- With Options.ticketsecret, rotate the ticket key when a new period of
+-- ticketlifetime/2 seconds has started since LastPeriod, and return the
+-- current period. The key is rotated before mbedtls expires it, and the key of
+-- the previous period is still accepted: a ticket is valid at least half of
+-- its lifetime on all the servers. Called before each handshake, without a
+-- secret it does nothing.
+local function SERVER_UpdateTicketKey (SslConfig, Options, LastPeriod)
+  -- Retrieve data
+  local Secret         = Options["ticketsecret"]
+  local TicketLifetime = (Options["ticketlifetime"] or SESSION_TICKET_LIFETIME)
+  -- local data
+  local Period = LastPeriod
+  if Secret and (Options["sessiontickets"] ~= false) then
+    Period = floor(time() / max(floor(TicketLifetime / 2), 1))
+    if (Period ~= LastPeriod) then
+      -- The previous key is kept by mbedtls, the servers which had no
+      -- handshake during the last period need it too
+      if (LastPeriod ~= (Period - 1)) then
+        local PreviousName, PreviousKey = SERVER_DeriveTicketKey(Secret, (Period - 1))
+        SslConfig:rotateticketkey(PreviousName, PreviousKey, TicketLifetime)
+      end
+      local Name, Key = SERVER_DeriveTicketKey(Secret, Period)
+      SslConfig:rotateticketkey(Name, Key, TicketLifetime)
+    end
+  end
+  -- Return value
+  return Period
+end
+
+-- Enable the session cache and the session tickets on a server config, before
+-- its first connection. Options is the config of mini-httpd:
+--   sessioncache   - number of sessions in the cache, false to disable
+--   sessiontimeout - seconds a session stays in the cache
+--   sessiontickets - false to disable the tickets
+--   ticketlifetime - seconds a ticket is valid
+--   ticketname     - name of the ticket key, 4 bytes from Ssl.newticketkey()
+--   ticketkey      - ticket key, 32 bytes from Ssl.newticketkey()
+--   ticketsecret   - secret from which the key of each period is derived
+-- Without ticketkey nor ticketsecret, mbedtls generates a random key per
+-- config. A ticketkey is replaced by a random key when its lifetime expires,
+-- unless the application rotates it with SslConfig:rotateticketkey() before.
+-- Return the period of the ticket key, for SERVER_UpdateTicketKey.
+local function SERVER_EnableResumption (SslConfig, Options)
+  -- Retrieve data
+  local CacheSize      = Options["sessioncache"]
+  local CacheTimeout   = (Options["sessiontimeout"] or SESSION_CACHE_TIMEOUT)
+  local UseTickets     = (Options["sessiontickets"] ~= false)
+  local TicketLifetime = (Options["ticketlifetime"] or SESSION_TICKET_LIFETIME)
+  local TicketName     = Options["ticketname"]
+  local TicketKey      = Options["ticketkey"]
+  -- local data
+  local Period
+  -- Session cache
+  if (CacheSize ~= false) then
+    SslConfig:setsessioncache((CacheSize or SESSION_CACHE_SIZE), CacheTimeout)
+  end
+  -- Session tickets
+  if UseTickets then
+    SslConfig:setsessiontickets(TicketLifetime)
+    if TicketName and TicketKey then
+      SslConfig:rotateticketkey(TicketName, TicketKey, TicketLifetime)
+    end
+    Period = SERVER_UpdateTicketKey(SslConfig, Options, nil)
+  end
+  -- Return value
+  return Period
+end
+
 --------------------------------------------------------------------------------
 -- WRAPPER SSL                                                                --
 --------------------------------------------------------------------------------
@@ -455,7 +625,9 @@ end
 --------------------------------------------------------------------------------
 
 local PUBLIC_API = {
-  wrap = SERVER_WrapSSL,
+  wrap             = SERVER_WrapSSL,
+  enableresumption = SERVER_EnableResumption,
+  updateticketkey  = SERVER_UpdateTicketKey,
 }
 
 return PUBLIC_API
@@ -12,6 +12,21 @@
 -- We basically want to support SSL from mbedtls-lua without modifying LuaSocket
 -- runtime\comexe\usr\share\lua\5.5\ssl\https.lua
 --
+-- Session resumption:
+--   The session of each server ("hostname:port", the SNI hostname or the
+--   address) is saved after the handshake and when the connection is closed,
+--   the next connection to the same server resumes it with an abbreviated
+--   handshake. With TLS 1.3 the session is only known once the ticket sent by
+--   the server after the handshake has been read. The sessions are kept in
+--   the Lua state, each thread has its own.
+--
+--   A resumed session skips the verification of the certificate, so the key
+--   of a session includes the fields of the configuration which change the
+--   verification (verify, cafile, capath) and the client certificate: a
+--   session opened with verify "none" is never resumed by a configuration
+--   which verifies the server. At most SESSION_MAX_COUNT sessions are kept,
+--   the oldest is dropped first.
+--
 
 --------------------------------------------------------------------------------
 -- IMPORTS                                                                    --
@@ -32,6 +47,91 @@ local newchunkbuffer = chunkbuffer.newchunkbuffer
 
 local READ_WINDOW_SMALL = 512
 local READ_WINDOW_LARGE = 2048
+local SESSION_MAX_COUNT = 64
+
+--------------------------------------------------------------------------------
+-- SESSIONS                                                                   --
+--------------------------------------------------------------------------------
+
+-- Last session of each server, serialized by SslContext:getsession(). The
+-- keys are also stored in CLIENT_SessionKeys, in the order of their creation.
+local CLIENT_Sessions     = {}
+local CLIENT_SessionKeys  = {}
+local CLIENT_SessionFirst = 1
+local CLIENT_SessionLast  = 0
+
+-- LuaSec accepts a string or an array of strings
+local function CLIENT_ConfigValue (Value)
+  local Result
+  if (type(Value) == "table") then
+    Result = table.concat(Value, ",")
+  else
+    Result = tostring(Value)
+  end
+  return Result
+end
+
+local function CLIENT_SessionKey (Adapter)
+  -- Retrieve data
+  local Socket = Adapter.Socket
+  local Config = Adapter.Config
+  -- local data
+  local Address, Port = Socket:getpeername()
+  local SessionKey
+  if Port then
+    SessionKey = format("%s:%s|%s|%s|%s|%s",
+                        (Adapter.ServerName or Address),
+                        Port,
+                        CLIENT_ConfigValue(Config.verify),
+                        CLIENT_ConfigValue(Config.cafile),
+                        CLIENT_ConfigValue(Config.capath),
+                        CLIENT_ConfigValue(Config.certificate))
+  end
+  -- Return value
+  return SessionKey
+end
+
+local function CLIENT_StoreSession (SessionKey, Session)
+  -- New server: drop the oldest session when the cache is full
+  if (CLIENT_Sessions[SessionKey] == nil) then
+    if ((CLIENT_SessionLast - CLIENT_SessionFirst + 1) >= SESSION_MAX_COUNT) then
+      CLIENT_Sessions[CLIENT_SessionKeys[CLIENT_SessionFirst]] = nil
+      CLIENT_SessionKeys[CLIENT_SessionFirst] = nil
+      CLIENT_SessionFirst = (CLIENT_SessionFirst + 1)
+    end
+    CLIENT_SessionLast = (CLIENT_SessionLast + 1)
+    CLIENT_SessionKeys[CLIENT_SessionLast] = SessionKey
+  end
+  CLIENT_Sessions[SessionKey] = Session
+end
+
+-- Called before the first handshake step
+local function CLIENT_LoadSession (Adapter)
+  -- Retrieve data
+  local SslContext = Adapter.SslContext
+  -- local data
+  local SessionKey = CLIENT_SessionKey(Adapter)
+  local Session    = (SessionKey and CLIENT_Sessions[SessionKey])
+  if Session then
+    SslContext:setsession(Session)
+  end
+  -- Update adapter
+  Adapter.SessionKey = (SessionKey or false)
+end
+
+-- getsession returns nil when there is no new session since the last call
+local function CLIENT_SaveSession (Adapter)
+  -- Retrieve data
+  local SslContext = Adapter.SslContext
+  local SessionKey = Adapter.SessionKey
+  -- Save session
+  if SessionKey then
+    local Session = SslContext:getsession()
+    if Session then
+      CLIENT_StoreSession(SessionKey, Session)
+    end
+  end
+end
 
 --------------------------------------------------------------------------------
 -- TLS CALLBACKS                                                             --
@@ -130,6 +230,7 @@ local function C_ADAPTER_MethodClose (Adapter)
   local Socket     = Adapter.Socket
   local SslContext = Adapter.SslContext
   -- Close and reset
+  CLIENT_SaveSession(Adapter)
   SslContext:closenotify()
   SslContext:reset()
   -- Return value
@@ -247,9 +348,14 @@ local function C_ADAPTER_MethodDoHandshake (Adapter)
   -- local data
   local ReturnValue
   local ErrorString
+  -- Resume the last session of the server
+  if (Adapter.SessionKey == nil) then
+    CLIENT_LoadSession(Adapter)
+  end
   -- Handshake
   local Success, StatusString = SslContext:handshake()
   if Success then
+    CLIENT_SaveSession(Adapter)
     ReturnValue = true
   else
     if (StatusString == "continue") or (StatusString == "want-write") then
@@ -267,6 +373,8 @@ end
 local function C_ADAPTER_MethodSni (Adapter, Hostname)
   -- Retrieve data
   local SslContext = Adapter.SslContext
+  -- The hostname also identifies the session of the server
+  Adapter.ServerName = Hostname
   -- Perform SNI
   return SslContext:sethostname(Hostname)
 end
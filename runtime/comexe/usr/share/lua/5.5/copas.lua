@@ -146,7 +146,12 @@ local object_names = setmetatable({}, {
 -- adds a FIFO queue for each socket in the set
 -------------------------------------------------------------------------------
 
-local function newsocketset()
+-- readiness poller replacing socket.select, see copas.setpoller()
+local _poller
+
+-- @param kind (optional) "r" or "w", the sets with a kind are reported to
+-- the poller when sockets are inserted or removed
+local function newsocketset(kind)
   local set = {}
 
   do  -- set implementation
@@ -158,6 +163,9 @@ local function newsocketset()
       if not reverse[skt] then
         self[#self + 1] = skt
         reverse[skt] = #self
+        if kind and _poller then
+          _poller:add(skt, kind)
+        end
         return skt
       end
     end
@@ -174,6 +182,9 @@ local function newsocketset()
           reverse[top] = index
           self[index] = top
         end
+        if kind and _poller then
+          _poller:remove(skt, kind)
+        end
         return skt
       end
     end
@@ -334,8 +345,8 @@ local _writing_log = {}
 
 local _closed = {} -- track sockets that have been closed (list/array)
 
-local _reading = newsocketset() -- sockets currently being read
-local _writing = newsocketset() -- sockets currently being written
+local _reading = newsocketset("r") -- sockets currently being read
+local _writing = newsocketset("w") -- sockets currently being written
 local _isSocketTimeout = { -- set of errors indicating a socket-timeout
   ["timeout"] = true,      -- default LuaSocket timeout
   ["wantread"] = true,     -- LuaSec specific timeout
@@ -1263,6 +1274,9 @@ function copas.removeserver(server, keep_open)
 
   _servers:remove(skt)
   _reading:remove(skt)
+  if _poller then
+    _poller:close(skt)
+  end
 
   if keep_open then
     return true
@@ -1510,10 +1524,17 @@ local _select_plain do
     if _closed[1] then
       for i, skt in ipairs(_closed) do
         _closed[i] = { _reading:remove(skt), _writing:remove(skt) }
+        if _poller then
+          _poller:close(skt)
+        end
       end
     end
 
-    _readable_task._events, _writable_task._events, err = socket.select(_reading, _writing, timeout)
+    if _poller then
+      _readable_task._events, _writable_task._events, err = _poller:wait(timeout)
+    else
+      _readable_task._events, _writable_task._events, err = socket.select(_reading, _writing, timeout)
+    end
     local r_events, w_events = _readable_task._events, _writable_task._events
 
     -- inject closed sockets in readable/writeable task so they can error out properly
@@ -1631,6 +1652,30 @@ function copas.step(timeout)
 end
 
 
+-------------------------------------------------------------------------------
+-- Replaces socket.select() with a readiness poller, or restores it when
+-- poller is nil. The sockets already waiting are moved to the new poller.
+-- A poller is an object with the methods:
+--   poller:add(skt, kind) and poller:remove(skt, kind), kind is "r" or "w"
+--   poller:close(skt), the socket was closed with copas.close() or removed
+--   with copas.removeserver(), the poller can release what it keeps for it
+--   poller:wait(timeout), returns the readable and writable sockets like
+--   socket.select(), or "timeout" as third value when none is ready
+-------------------------------------------------------------------------------
+function copas.setpoller(poller)
+  local previous = _poller
+  for _, skt in ipairs(_reading) do
+    if previous then previous:remove(skt, "r") end
+    if poller then poller:add(skt, "r") end
+  end
+  for _, skt in ipairs(_writing) do
+    if previous then previous:remove(skt, "w") end
+    if poller then poller:add(skt, "w") end
+  end
+  _poller = poller
+end
+
+
 -------------------------------------------------------------------------------
 -- Check whether there is something to do.
 -- returns false if there are no sockets for read/write nor tasks scheduled
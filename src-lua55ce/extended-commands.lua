@@ -172,6 +172,78 @@ local function EXT_CreateInitLua (ApplicationEntryPoint)
   return NewInitLua
 end
 
+-- Same prefixes than the ZIP searchers in comexe/init.lua
+local MAKE_MODULE_PREFIXES = {
+  "comexe/usr/share/lua/5.5/",
+  "lua/",
+  "share/lua/5.5/",
+}
+
+-- comexe/usr/share/lua/5.5/com/runtime.lua -> com.runtime
+-- lua/my-lib/init.lua                      -> my-lib
+local function MAKE_GetModuleName (EntryName)
+  local ModuleName = EntryName
+  local Index      = 1
+  local Found      = false
+  while (not Found) and (Index <= #MAKE_MODULE_PREFIXES) do
+    local Prefix = MAKE_MODULE_PREFIXES[Index]
+    if hasprefix(ModuleName, Prefix) then
+      ModuleName = removeprefix(ModuleName, Prefix)
+      Found      = true
+    end
+    Index = (Index + 1)
+  end
+  if hassuffix(ModuleName, "/init.lua") then
+    ModuleName = removesuffix(ModuleName, "/init.lua")
+  else
+    ModuleName = removesuffix(ModuleName, ".lua")
+  end
+  ModuleName = ModuleName:gsub("/", ".")
+  -- Return value
+  return ModuleName
+end
+
+-- The bytecode is produced by string.dump of the running Lua: it is only
+-- embedded when the target has the same ARCH-OS, a cross-compiled executable
+-- only embeds the sources.
+local function EXT_CanEmbedBytecode (TargetName)
+  -- local data
+  local ARCH, OS = TargetName:match("^([^%-]+)%-([^%-]+)")
+  -- Return value
+  return (ARCH == getparam("ARCH")) and (OS == getparam("OS"))
+end
+
+-- The searchers of comexe/init.lua try "module-ARCH-OS.bin" before
+-- "module.lua", and fallback to the source if the bytecode is rejected by the
+-- running Lua (version or format mismatch). The debug information is kept to
+-- get the same error messages than with the sources.
+local function EXT_NewBytecodeHook (TargetName)
+  -- local data
+  local ARCH, OS     = TargetName:match("^([^%-]+)%-([^%-]+)")
+  local BinarySuffix = format("-%s-%s.bin", ARCH, OS)
+  -- local callback
+  local function CompileEntry (EntryName, EntryContent)
+    local BinaryEntryName
+    local Binary
+    if hassuffix(EntryName, ".lua") and (EntryName ~= COMEXE_ZIP_INIT_ENTRY) then
+      local ModuleName  = MAKE_GetModuleName(EntryName)
+      local ChunkName   = format("@%s", ModuleName)
+      local Chunk, ErrorString = load(EntryContent, ChunkName, "t")
+      if Chunk then
+        BinaryEntryName = format("%s%s", removesuffix(EntryName, ".lua"), BinarySuffix)
+        Binary          = string.dump(Chunk, false)
+      else
+        -- Not necessarily a module, keep the source only
+        MAKE_Log("SKIP BYTECODE %s: %s", EntryName, ErrorString)
+      end
+    end
+    -- Return value
+    return BinaryEntryName, Binary
+  end
+  -- Return value
+  return CompileEntry
+end
+
 local function EXT_AddRuntimeSource (Merger, TargetEntryName)
   -- Create a new source for runtime
   local Source = Merger:AddSource(COMEXE_EXE, "zip")
@@ -193,7 +265,7 @@ local function EXT_AddRuntimeSource (Merger, TargetEntryName)
   Merger:AddRule(Source, ".*",           "SKIP")
 end
 
-local function EXT_MakeExe (OutputFilename, TargetName, DataInputs, ApplicationEntryPoint, NeedStdlib, VerboseFlag)
+local function EXT_MakeExe (OutputFilename, TargetName, DataInputs, ApplicationEntryPoint, NeedStdlib, NeedBytecode, VerboseFlag)
   -- Validate inputs
   assert(TargetName, "make requires a target name")
   assert(DataInputs and (#DataInputs > 0), "make requires at least one data input (directory or ZIP file)")
@@ -224,6 +296,12 @@ local function EXT_MakeExe (OutputFilename, TargetName, DataInputs, ApplicationE
     MergerOptions = "VERBOSE"
   end
   local Merger = NewMerger(TempZipFilename, Z_BEST_COMPRESSION, MergerOptions)
+  -- Precompile the Lua modules for the target
+  if NeedBytecode and EXT_CanEmbedBytecode(TargetName) then
+    Merger:SetEntryHook(EXT_NewBytecodeHook(TargetName))
+  elseif NeedBytecode then
+    MAKE_Log("SKIP BYTECODE for %s: cross-compilation", TargetName)
+  end
   -- runtime/init.lua
   local NewInitLua = EXT_CreateInitLua(ApplicationEntryPoint)
   Merger:AddEntry(COMEXE_ZIP_INIT_ENTRY, NewInitLua)
@@ -266,7 +344,7 @@ local function HandleHelp ()
   print("Extended Commands:")
   print("  --help, -h                        Show this help message")
   print("  --list-targets                    List available targets for make command")
-  print("  --make, -m DIR/OR/ZIP/my-prog.lua [-v] [--nostdlib] [-t target] [-o output]")
+  print("  --make, -m DIR/OR/ZIP/my-prog.lua [-v] [--nostdlib] [--nobytecode] [-t target] [-o output]")
   print("  --zip l or list <file.zip>        List contents of a zip file")
   print("  --zip c or create <file.zip> ...  Create/overwrite a zip file")
   print("  --find <directory>                Find files in a directory")
@@ -365,8 +443,9 @@ end
 
 local function ExtractMakeFlags (Arguments)
   -- Parse flags and source argument
-  local Verbose    = false
-  local NeedStdlib = true
+  local Verbose      = false
+  local NeedStdlib   = true
+  local NeedBytecode = true
   local SourceList = {}
   local TargetSpec
   local OutputFile
@@ -378,6 +457,8 @@ local function ExtractMakeFlags (Arguments)
       Verbose = true
     elseif (Arg == "--nostdlib") then
       NeedStdlib = false
+    elseif (Arg == "--nobytecode") then
+      NeedBytecode = false
     elseif (Arg == "-t") then
       Index = (Index + 1)
       if (Index <= #Arguments) then
@@ -403,7 +484,7 @@ local function ExtractMakeFlags (Arguments)
     error("make requires a source file or directory argument")
   end
   -- Return the parsed flags as multiple values
-  return Verbose, TargetSpec, OutputFile, SourceList, NeedStdlib
+  return Verbose, TargetSpec, OutputFile, SourceList, NeedStdlib, NeedBytecode
 end
 
 local function MAKE_FilterSources (SourceList)
@@ -471,7 +552,7 @@ end
 
 local function HandleMake (Arguments)
   -- Extract flags
-  local Verbose, Target, UserOutputFile, SourceList, NeedStdlib = ExtractMakeFlags(Arguments)
+  local Verbose, Target, UserOutputFile, SourceList, NeedStdlib, NeedBytecode = ExtractMakeFlags(Arguments)
   if Verbose then
     MAKE_Log = MAKE_VerboseLog
   end
@@ -502,7 +583,7 @@ local function HandleMake (Arguments)
   for Index, TargetName in ipairs(TargetList) do
     local OutputFilename = MAKE_DetermineOutputFilename(UserOutputFile, FirstLuaModuleName, FirstDirectoryName, TargetName, AppendSuffix)
     MAKE_Log("Building target '%s' -> %s", TargetName, OutputFilename)
-    EXT_MakeExe(OutputFilename, TargetName, NewSourceList, ApplicationEntryPoint, NeedStdlib, Verbose)
+    EXT_MakeExe(OutputFilename, TargetName, NewSourceList, ApplicationEntryPoint, NeedStdlib, NeedBytecode, Verbose)
     SuccessCount = (SuccessCount + 1)
     MAKE_Log("Successfully built: %s", OutputFilename)
   end
@@ -1,4 +1,5 @@
 #include <stddef.h>
+#include <stdbool.h>
 size_t PLAT_GetPageSizeInBytes();
 int PLAT_IsAtty(int FileDescriptor);
 void PLAT_ThreadInitalize();
@@ -7,12 +8,17 @@ void *PLAT_SafeAlloc0(size_t Count,size_t ObjectSizeInBytes);
 void *PLAT_SafeRealloc(void *Object,size_t ObjectSizeInBytes);
 void PLAT_Free(void *Object);
 char *PLAT_StrDup(const char *String);
-#include <stdbool.h>
+struct mi_heap_s *PLAT_NewHeap();
+void *PLAT_HeapRealloc(struct mi_heap_s *Heap,void *Object,size_t ObjectSizeInBytes);
+void PLAT_DestroyHeap(struct mi_heap_s *Heap);
+bool PLAT_GetRandom(void *Output,size_t Size);
 #include <lua.h>
 int luaopen_luv(lua_State *LuaState);
 int luaopen_socket_core(lua_State *LuaState);
 int luaopen_mime_core(lua_State *LuaState);
 int luaopen_mbedtls(lua_State *LuaState);
+struct uv_loop_s *luv_loop(lua_State *LuaState);
+struct EM_Writer *LUA_GetMessageWriter(lua_State *LuaState);
 struct LUA_Application *LUA_CreateApplication(size_t Argc,const char **Argv);
 void LUA_RunApplication(struct LUA_Application *Application);
 void SERVICE_NotifyInstance(struct LUA_Application *Application,const char *EventName,unsigned int ControlCode);
@@ -73,10 +79,114 @@ size_t TA_GetCapacity(struct TA_Array *Array);
 bool TA_IsValid(struct TA_Array *Array,size_t Offset);
 void *TA_GetObject(struct TA_Array *Array,size_t Offset);
 void TA_RemoveObject(struct TA_Array *Array,size_t Offset);
+uint64_t TH_Hash(const void *Key,size_t KeyLength);
+struct TH_Map *TH_CreateMap(size_t InitialCapacity);
+void TH_FreeMap(struct TH_Map *Map);
+size_t TH_GetCount(struct TH_Map *Map);
+void *TH_GetObject(struct TH_Map *Map,const void *Key,size_t KeyLength);
+void *TH_SetObject(struct TH_Map *Map,const void *Key,size_t KeyLength,void *Object);
+void *TH_RemoveObject(struct TH_Map *Map,const void *Key,size_t KeyLength);
+bool TH_GetNext(struct TH_Map *Map,size_t *Cursor,const char **Key,size_t *KeyLength,void **Object);
+struct ZI_Index *ZI_CreateIndex(const char *ZipFilename);
+void ZI_FreeIndex(struct ZI_Index *Index);
+size_t ZI_GetEntryCount(struct ZI_Index *Index);
+bool ZI_GetEntryInfo(struct ZI_Index *Index,const char *EntryName,size_t EntryNameLength,uint64_t *UncompressedSize,uint64_t *CompressedSize,uint32_t *Method);
+uint8_t *ZI_ReadEntry(struct ZI_Index *Index,const char *EntryName,size_t EntryNameLength,size_t *SizeInBytes);
+struct MC_Statistics {
+  uint64_t Hits;
+  uint64_t Misses;
+  uint64_t Insertions;
+  uint64_t Evictions;
+  size_t   EntryCount;
+  size_t   SizeInBytes;
+  size_t   CapacityInBytes;
+};
+struct MC_Blob *MC_NewBlob(const void *Data,size_t SizeInBytes);
+void MC_ReleaseBlob(struct MC_Blob *Blob);
+const uint8_t *MC_GetBlobData(struct MC_Blob *Blob);
+size_t MC_GetBlobSize(struct MC_Blob *Blob);
+struct MC_Cache *MC_CreateCache(size_t CapacityInBytes);
+void MC_FreeCache(struct MC_Cache *Cache);
+struct MC_Blob *MC_AcquireBlob(struct MC_Cache *Cache,const char *Key,size_t KeyLength);
+void MC_InsertBlob(struct MC_Cache *Cache,const char *Key,size_t KeyLength,struct MC_Blob *Blob);
+void MC_RemoveBlob(struct MC_Cache *Cache,const char *Key,size_t KeyLength);
+void MC_CountLoad(struct MC_Cache *Cache,bool IsHit);
+void MC_SetCapacity(struct MC_Cache *Cache,size_t CapacityInBytes);
+void MC_GetStatistics(struct MC_Cache *Cache,struct MC_Statistics *Statistics);
+struct MQ_Node {
+  struct MQ_Node *Next;
+};
+struct MQ_Queue {
+  struct MQ_Node *Head; /* Producers */
+  struct MQ_Node *Tail; /* Consumer  */
+  struct MQ_Node  Stub;
+  size_t          Count;
+};
+void MQ_InitQueue(struct MQ_Queue *Queue);
+bool MQ_Push(struct MQ_Queue *Queue,struct MQ_Node *Node);
+struct MQ_Node *MQ_Pop(struct MQ_Queue *Queue);
+size_t MQ_GetCount(struct MQ_Queue *Queue);
+struct EM_Writer {
+  uint8_t    *Data;
+  size_t      SizeInBytes;
+  size_t      CapacityInBytes;
+  int32_t     ValueCount;
+  int32_t     SharedCount; /* Blobs and channels */
+  const char *ErrorReason; /* Set when EM_WriteLuaValue fails */
+  int         ErrorType;   /* LUA_TXXX of the faulty value     */
+};
+void EM_InitWriter(struct EM_Writer *Writer);
+void EM_FreeWriter(struct EM_Writer *Writer);
+void EM_ResetWriter(struct EM_Writer *Writer);
+void EM_WriteNil(struct EM_Writer *Writer);
+void EM_WriteBoolean(struct EM_Writer *Writer,bool Value);
+void EM_WriteInteger(struct EM_Writer *Writer,int64_t Value);
+void EM_WriteDouble(struct EM_Writer *Writer,double Value);
+void EM_WriteString(struct EM_Writer *Writer,const char *String,size_t Length);
+void EM_WriteLightUserData(struct EM_Writer *Writer,void *Value);
+bool EM_WriteLuaValue(struct EM_Writer *Writer,lua_State *LuaState,int Index);
+struct EM_Message *EM_NewMessage(struct EM_Writer *Writer);
+struct EM_Message *EM_ShareMessage(struct EM_Message *Message);
+void EM_FreeMessage(struct EM_Message *Message);
+struct MQ_Node *EM_GetNode(struct EM_Message *Message);
+struct EM_Message *EM_GetMessage(struct MQ_Node *Node);
+int32_t EM_GetValueCount(struct EM_Message *Message);
+void EM_SetCall(struct EM_Message *Message,int64_t CallerId,uint64_t CallId);
+uint64_t EM_GetCallId(struct EM_Message *Message);
+int64_t EM_GetCallerId(struct EM_Message *Message);
+size_t EM_GetSizeInBytes(struct EM_Message *Message);
+int32_t EM_PushValues(lua_State *LuaState,struct EM_Message *Message);
+int32_t EM_PushValuesAndFree(lua_State *LuaState,struct EM_Message *Message);
 int luaopen_libminizip(lua_State *LuaState);
 LUALIB_API int luaopen_libffiraw(lua_State *LuaState);
 int luaopen_win32(lua_State *LuaState);
 int luaopen_buffer(lua_State *LuaState);
+struct SB_Blob *SB_NewBlob(const void *Data,size_t SizeInBytes);
+void SB_RetainBlob(struct SB_Blob *Blob);
+void SB_ReleaseBlob(struct SB_Blob *Blob);
+const uint8_t *SB_GetData(struct SB_Blob *Blob);
+size_t SB_GetSize(struct SB_Blob *Blob);
+void SB_PushBlob(lua_State *LuaState,struct SB_Blob *Blob);
+struct SB_Blob *SB_ToBlob(lua_State *LuaState,int Index);
+int luaopen_blob(lua_State *LuaState);
+int luaopen_http(lua_State *LuaState);
+enum CH_Status {
+  CH_STATUS_OK,
+  CH_STATUS_CLOSED,
+  CH_STATUS_FULL,
+  CH_STATUS_EMPTY,
+  CH_STATUS_TIMEOUT
+};
+struct CH_Channel *CH_NewChannel(size_t MaxCount);
+void CH_RetainChannel(struct CH_Channel *Channel);
+void CH_ReleaseChannel(struct CH_Channel *Channel);
+void CH_PushChannel(lua_State *LuaState,struct CH_Channel *Channel);
+struct CH_Channel *CH_ToChannel(lua_State *LuaState,int Index);
+enum CH_Status CH_PushMessage(struct CH_Channel *Channel,struct EM_Message *Message,int64_t TimeoutMs);
+struct EM_Message *CH_PopMessage(struct CH_Channel *Channel,int64_t TimeoutMs,enum CH_Status *Status);
+void CH_CloseChannel(struct CH_Channel *Channel);
+int luaopen_channel(lua_State *LuaState);
+int luaopen_shared(lua_State *LuaState);
 void SERVICE_Initialize(struct LUA_Application *Application);
 int luaopen_service(lua_State *LuaState);
 int luaopen_wincom_raw(lua_State *LuaState);
@@ -0,0 +1,841 @@
+/*----------------------------------------------------------------------------*
+ * PROJECT  ComEXE                                                            *
+ * FILENAME event-message.c                                                   *
+ * CONTENT  Serialization of the event arguments sent between Lua instances   *
+ *----------------------------------------------------------------------------*
+ * Copyright (c) 2020-2026 Pascal COMBIER                                     *
+ * This source code is licensed under the BSD 2-clause license found in the   *
+ * LICENSE file in the root directory of this source tree.                    *
+ *----------------------------------------------------------------------------*/
+
+/*============================================================================*/
+/* INFORMATION                                                                */
+/*============================================================================*/
+
+/* An event is serialized by the sender in a EM_Writer, outside of any lock.
+ * EM_NewMessage then copies the serialized values in a single allocation which
+ * can be pushed in the mailbox (mpsc-queue.c) of the target instance. The
+ * message is owned by the mailbox until the target pops it, decodes it with
+ * EM_PushValues and frees it.
+ *
+ * The writer is reused by the sender for the next events, so the serialization
+ * does not allocate once the writer has grown to the size of the events.
+ *
+ * Each value is a 1-byte tag followed by its payload, the payloads are copied
+ * with memcpy because they are not aligned.
+ *
+ * A table is copied by value: the array part 1..#t, then the other key/value
+ * pairs. Both counts are written before the values, so the receiver creates
+ * the table with the right size in a single lua_createtable. The metatables
+ * are not copied. The nesting is limited to EM_MAX_DEPTH, a table which
+ * contains itself is rejected instead of being copied until the limit.
+ *
+ * A blob (lua-libblob.c) or a channel (lua-libchannel.c) is written as a
+ * pointer. Each payload holds its own reference on the shared objects it
+ * contains: taken by EM_NewMessage, released when the payload is freed, so a
+ * message discarded without being read does not leak.
+ *
+ * A message is a mailbox node pointing to a reference-counted payload. A
+ * broadcast encodes the arguments once: EM_ShareMessage creates another node
+ * for the same payload, so each target only costs a small allocation. The
+ * first message and the payload are a single allocation, freed with the last
+ * message.
+ */
+
+/*============================================================================*/
+/* MAKEHEADERS PUBLIC INTERFACE                                               */
+/*============================================================================*/
+
+#if MKH_INTERFACE
+
+/*---------*/
+/* HEADERS */
+/*---------*/
+
+#include <stddef.h>  /* size_t  */
+#include <stdint.h>  /* uint8_t */
+#include <stdbool.h> /* bool    */
+
+#include <lua.h>
+
+/*-------*/
+/* TYPES */
+/*-------*/
+
+struct EM_Writer
+{
+  uint8_t    *Data;
+  size_t      SizeInBytes;
+  size_t      CapacityInBytes;
+  int32_t     ValueCount;
+  int32_t     SharedCount; /* Blobs and channels */
+  const char *ErrorReason; /* Set when EM_WriteLuaValue fails */
+  int         ErrorType;   /* LUA_TXXX of the faulty value     */
+};
+
+struct EM_Message;
+
+#endif
+
+/*============================================================================*/
+/* IMPLEMENTATION HEADERS                                                     */
+/*============================================================================*/
+
+#include <stdio.h>  /* fprintf */
+#include <stdlib.h> /* exit    */
+#include <string.h> /* memcpy  */
+#include <limits.h> /* INT_MAX */
+
+#include <lauxlib.h>
+
+#include "comexe.h"
+
+/*============================================================================*/
+/* PRIVATE TYPES                                                              */
+/*============================================================================*/
+
+#define EM_INITIAL_CAPACITY 256
+
+#define EM_MAX_DEPTH 32
+
+typedef enum
+{
+  EM_TYPE_NIL,
+  EM_TYPE_BOOLEAN,
+  EM_TYPE_INTEGER,
+  EM_TYPE_DOUBLE,
+  EM_TYPE_STRING,
+  EM_TYPE_LIGHTUSERDATA,
+  EM_TYPE_TABLE,
+  EM_TYPE_BLOB,
+  EM_TYPE_CHANNEL
+
+} EM_Type_t;
+
+struct EM_Payload
+{
+  size_t             ReferenceCount;
+  struct EM_Message *Owner; /* Message allocated with the payload */
+  size_t             SizeInBytes;
+  int32_t            ValueCount;
+  int32_t            SharedCount;
+  uint8_t            Data[];
+};
+
+/* CallId is not zero for a call, the reply is expected by the instance
+ * CallerId. Those are not shared with the payload. */
+struct EM_Message
+{
+  struct MQ_Node     Node; /* Mailbox link */
+  struct EM_Payload *Payload;
+  int64_t            CallerId;
+  uint64_t           CallId;
+};
+
+/*============================================================================*/
+/* PRIVATE API                                                                */
+/*============================================================================*/
+
+static uint8_t *EM_Reserve (struct EM_Writer *Writer, size_t SizeInBytes)
+{
+  size_t   NeededCapacity = (Writer->SizeInBytes + SizeInBytes);
+  uint8_t *Destination;
+
+  if (NeededCapacity > Writer->CapacityInBytes)
+  {
+    Writer->CapacityInBytes = (NeededCapacity * 2);
+    Writer->Data            = PLAT_SafeRealloc(Writer->Data, Writer->CapacityInBytes);
+  }
+
+  Destination          = (Writer->Data + Writer->SizeInBytes);
+  Writer->SizeInBytes += SizeInBytes;
+
+  return Destination;
+}
+
+static void EM_WriteTag (struct EM_Writer *Writer, EM_Type_t Type)
+{
+  uint8_t *Destination = EM_Reserve(Writer, 1);
+
+  *Destination = (uint8_t)Type;
+}
+
+static void EM_WriteBytes (struct EM_Writer *Writer,
+                           const void       *Source,
+                           size_t            SizeInBytes)
+{
+  uint8_t *Destination = EM_Reserve(Writer, SizeInBytes);
+
+  memcpy(Destination, Source, SizeInBytes);
+}
+
+static void EM_ReadBytes (const uint8_t **Cursor,
+                          void           *Destination,
+                          size_t          SizeInBytes)
+{
+  memcpy(Destination, *Cursor, SizeInBytes);
+  *Cursor += SizeInBytes;
+}
+
+/*============================================================================*/
+/* ENCODING                                                                   */
+/*============================================================================*/
+
+/* The EM_EncodeXXX functions write one value without counting it, they are
+ * used for the values nested in tables */
+
+static void EM_EncodeBoolean (struct EM_Writer *Writer, bool Value)
+{
+  uint8_t Byte = (Value ? 1 : 0);
+
+  EM_WriteTag(Writer, EM_TYPE_BOOLEAN);
+  EM_WriteBytes(Writer, &Byte, sizeof(Byte));
+}
+
+static void EM_EncodeInteger (struct EM_Writer *Writer, int64_t Value)
+{
+  EM_WriteTag(Writer, EM_TYPE_INTEGER);
+  EM_WriteBytes(Writer, &Value, sizeof(Value));
+}
+
+static void EM_EncodeDouble (struct EM_Writer *Writer, double Value)
+{
+  EM_WriteTag(Writer, EM_TYPE_DOUBLE);
+  EM_WriteBytes(Writer, &Value, sizeof(Value));
+}
+
+static void EM_EncodeString (struct EM_Writer *Writer, const char *String, size_t Length)
+{
+  EM_WriteTag(Writer, EM_TYPE_STRING);
+  EM_WriteBytes(Writer, &Length, sizeof(Length));
+  EM_WriteBytes(Writer, String, Length);
+}
+
+static void EM_EncodeLightUserData (struct EM_Writer *Writer, void *Value)
+{
+  EM_WriteTag(Writer, EM_TYPE_LIGHTUSERDATA);
+  EM_WriteBytes(Writer, &Value, sizeof(Value));
+}
+
+static void EM_EncodeBlob (struct EM_Writer *Writer, struct SB_Blob *Blob)
+{
+  EM_WriteTag(Writer, EM_TYPE_BLOB);
+  EM_WriteBytes(Writer, &Blob, sizeof(Blob));
+  Writer->SharedCount++;
+}
+
+static void EM_EncodeChannel (struct EM_Writer *Writer, struct CH_Channel *Channel)
+{
+  EM_WriteTag(Writer, EM_TYPE_CHANNEL);
+  EM_WriteBytes(Writer, &Channel, sizeof(Channel));
+  Writer->SharedCount++;
+}
+
+static bool EM_SetError (struct EM_Writer *Writer, const char *Reason, int Type)
+{
+  Writer->ErrorReason = Reason;
+  Writer->ErrorType   = Type;
+
+  return false;
+}
+
+static bool EM_EncodeLuaValue (struct EM_Writer *Writer,
+                               lua_State        *LuaState,
+                               int               Index,
+                               const void      **Path,
+                               int32_t           Depth);
+
+/* Path contains the tables being encoded, from the outermost one */
+static bool EM_EncodeTable (struct EM_Writer *Writer,
+                            lua_State        *LuaState,
+                            int               Index,
+                            const void      **Path,
+                            int32_t           Depth)
+{
+  const void *Table = lua_topointer(LuaState, Index);
+  bool        Success;
+  size_t      ArrayCount;
+  size_t      HashCount;
+  size_t      HashCountOffset;
+  size_t      ArrayIndex;
+  lua_Integer Key;
+  int32_t     PathIndex;
+
+  if ((Depth >= EM_MAX_DEPTH) || !lua_checkstack(LuaState, 3))
+  {
+    return EM_SetError(Writer, "nested too deeply", LUA_TTABLE);
+  }
+
+  for (PathIndex = 0; PathIndex < Depth; PathIndex++)
+  {
+    if (Path[PathIndex] == Table)
+    {
+      return EM_SetError(Writer, "cycle detected", LUA_TTABLE);
+    }
+  }
+
+  Path[Depth] = Table;
+  ArrayCount  = lua_rawlen(LuaState, Index);
+  HashCount   = 0;
+  Success     = true;
+
+  EM_WriteTag(Writer, EM_TYPE_TABLE);
+  EM_WriteBytes(Writer, &ArrayCount, sizeof(ArrayCount));
+
+  /* The hash count is only known at the end, Data might move until then */
+  HashCountOffset = Writer->SizeInBytes;
+  EM_WriteBytes(Writer, &HashCount, sizeof(HashCount));
+
+  /* Array part */
+  for (ArrayIndex = 1; Success && (ArrayIndex <= ArrayCount); ArrayIndex++)
+  {
+    lua_rawgeti(LuaState, Index, (lua_Integer)ArrayIndex);
+    Success = EM_EncodeLuaValue(Writer, LuaState, -1, Path, (Depth + 1));
+    lua_pop(LuaState, 1);
+  }
+
+  /* Hash part: everything which is not in 1..ArrayCount */
+  if (Success)
+  {
+    lua_pushnil(LuaState);
+    while (Success && lua_next(LuaState, Index))
+    {
+      if (lua_isinteger(LuaState, -2))
+      {
+        Key = lua_tointeger(LuaState, -2);
+      }
+      else
+      {
+        Key = 0;
+      }
+
+      if ((Key < 1) || ((lua_Unsigned)Key > ArrayCount))
+      {
+        Success = (EM_EncodeLuaValue(Writer, LuaState, -2, Path, (Depth + 1))
+                   && EM_EncodeLuaValue(Writer, LuaState, -1, Path, (Depth + 1)));
+        HashCount++;
+      }
+
+      lua_pop(LuaState, 1); /* Keep the key for lua_next */
+    }
+
+    if (!Success)
+    {
+      lua_pop(LuaState, 1); /* Pop the key, lua_next did not finish */
+    }
+  }
+
+  memcpy((Writer->Data + HashCountOffset), &HashCount, sizeof(HashCount));
+
+  return Success;
+}
+
+static bool EM_EncodeLuaValue (struct EM_Writer *Writer,
+                               lua_State        *LuaState,
+                               int               Index,
+                               const void      **Path,
+                               int32_t           Depth)
+{
+  bool               Success = true;
+  int                Type    = lua_type(LuaState, Index);
+  const char        *String;
+  size_t             Length;
+  struct SB_Blob    *Blob;
+  struct CH_Channel *Channel;
+
+  switch (Type)
+  {
+  case LUA_TNUMBER:
+    if (lua_isinteger(LuaState, Index))
+    {
+      EM_EncodeInteger(Writer, lua_tointeger(LuaState, Index));
+    }
+    else
+    {
+      EM_EncodeDouble(Writer, lua_tonumber(LuaState, Index));
+    }
+    break;
+
+  case LUA_TBOOLEAN:
+    EM_EncodeBoolean(Writer, lua_toboolean(LuaState, Index));
+    break;
+
+  case LUA_TSTRING:
+    String = lua_tolstring(LuaState, Index, &Length);
+    EM_EncodeString(Writer, String, Length);
+    break;
+
+  case LUA_TLIGHTUSERDATA:
+    EM_EncodeLightUserData(Writer, lua_touserdata(LuaState, Index));
+    break;
+
+  case LUA_TNIL:
+    EM_WriteTag(Writer, EM_TYPE_NIL);
+    break;
+
+  case LUA_TTABLE:
+    Success = EM_EncodeTable(Writer, LuaState, lua_absindex(LuaState, Index), Path, Depth);
+    break;
+
+  case LUA_TUSERDATA:
+    Blob    = SB_ToBlob(LuaState, Index);
+    Channel = CH_ToChannel(LuaState, Index);
+    if (Blob)
+    {
+      EM_EncodeBlob(Writer, Blob);
+    }
+    else if (Channel)
+    {
+      EM_EncodeChannel(Writer, Channel);
+    }
+    else
+    {
+      Success = EM_SetError(Writer, "unsupported type", Type);
+    }
+    break;
+
+  default:
+    Success = EM_SetError(Writer, "unsupported type", Type);
+    break;
+  }
+
+  return Success;
+}
+
+/*============================================================================*/
+/* WRITER API                                                                 */
+/*============================================================================*/
+
+void EM_InitWriter (struct EM_Writer *Writer)
+{
+  Writer->Data            = PLAT_SafeRealloc(NULL, EM_INITIAL_CAPACITY);
+  Writer->SizeInBytes     = 0;
+  Writer->CapacityInBytes = EM_INITIAL_CAPACITY;
+  Writer->ValueCount      = 0;
+  Writer->SharedCount     = 0;
+  Writer->ErrorReason     = NULL;
+  Writer->ErrorType       = LUA_TNONE;
+}
+
+void EM_FreeWriter (struct EM_Writer *Writer)
+{
+  PLAT_Free(Writer->Data);
+  Writer->Data            = NULL;
+  Writer->SizeInBytes     = 0;
+  Writer->CapacityInBytes = 0;
+  Writer->ValueCount      = 0;
+}
+
+void EM_ResetWriter (struct EM_Writer *Writer)
+{
+  Writer->SizeInBytes = 0;
+  Writer->ValueCount  = 0;
+  Writer->SharedCount = 0;
+  Writer->ErrorReason = NULL;
+  Writer->ErrorType   = LUA_TNONE;
+}
+
+void EM_WriteNil (struct EM_Writer *Writer)
+{
+  EM_WriteTag(Writer, EM_TYPE_NIL);
+  Writer->ValueCount++;
+}
+
+void EM_WriteBoolean (struct EM_Writer *Writer, bool Value)
+{
+  EM_EncodeBoolean(Writer, Value);
+  Writer->ValueCount++;
+}
+
+void EM_WriteInteger (struct EM_Writer *Writer, int64_t Value)
+{
+  EM_EncodeInteger(Writer, Value);
+  Writer->ValueCount++;
+}
+
+void EM_WriteDouble (struct EM_Writer *Writer, double Value)
+{
+  EM_EncodeDouble(Writer, Value);
+  Writer->ValueCount++;
+}
+
+void EM_WriteString (struct EM_Writer *Writer, const char *String, size_t Length)
+{
+  EM_EncodeString(Writer, String, Length);
+  Writer->ValueCount++;
+}
+
+void EM_WriteLightUserData (struct EM_Writer *Writer, void *Value)
+{
+  EM_EncodeLightUserData(Writer, Value);
+  Writer->ValueCount++;
+}
+
+/* Return false if the value can't be encoded, the reason is stored in the
+ * writer. The content of the writer is then partial and must be reset. */
+bool EM_WriteLuaValue (struct EM_Writer *Writer, lua_State *LuaState, int Index)
+{
+  const void *Path[EM_MAX_DEPTH];
+  bool        Success;
+
+  Success = EM_EncodeLuaValue(Writer, LuaState, Index, Path, 0);
+
+  if (Success)
+  {
+    Writer->ValueCount++;
+  }
+
+  return Success;
+}
+
+/*============================================================================*/
+/* MESSAGE API                                                                */
+/*============================================================================*/
+
+/* Retain or release each shared object of the message, the cursor is moved
+ * after the value */
+static void EM_VisitSharedObjects (const uint8_t **Cursor, bool Retain)
+{
+  uint8_t            Type = *(*Cursor)++;
+  size_t             Length;
+  size_t             ArrayCount;
+  size_t             HashCount;
+  size_t             Index;
+  struct SB_Blob    *Blob;
+  struct CH_Channel *Channel;
+
+  switch (Type)
+  {
+  case EM_TYPE_NIL:
+    break;
+
+  case EM_TYPE_BOOLEAN:
+    *Cursor += sizeof(uint8_t);
+    break;
+
+  case EM_TYPE_INTEGER:
+    *Cursor += sizeof(int64_t);
+    break;
+
+  case EM_TYPE_DOUBLE:
+    *Cursor += sizeof(double);
+    break;
+
+  case EM_TYPE_STRING:
+    EM_ReadBytes(Cursor, &Length, sizeof(Length));
+    *Cursor += Length;
+    break;
+
+  case EM_TYPE_LIGHTUSERDATA:
+    *Cursor += sizeof(void *);
+    break;
+
+  case EM_TYPE_TABLE:
+    EM_ReadBytes(Cursor, &ArrayCount, sizeof(ArrayCount));
+    EM_ReadBytes(Cursor, &HashCount, sizeof(HashCount));
+    for (Index = 0; Index < (ArrayCount + (2 * HashCount)); Index++)
+    {
+      EM_VisitSharedObjects(Cursor, Retain);
+    }
+    break;
+
+  case EM_TYPE_BLOB:
+    EM_ReadBytes(Cursor, &Blob, sizeof(Blob));
+    if (Retain)
+    {
+      SB_RetainBlob(Blob);
+    }
+    else
+    {
+      SB_ReleaseBlob(Blob);
+    }
+    break;
+
+  case EM_TYPE_CHANNEL:
+    EM_ReadBytes(Cursor, &Channel, sizeof(Channel));
+    if (Retain)
+    {
+      CH_RetainChannel(Channel);
+    }
+    else
+    {
+      CH_ReleaseChannel(Channel);
+    }
+    break;
+
+  default:
+    fprintf(stderr, "ERROR: Unknown event type %d\n", Type);
+    exit(4);
+    break;
+  }
+}
+
+static void EM_VisitPayloadSharedObjects (struct EM_Payload *Payload, bool Retain)
+{
+  const uint8_t *Cursor = Payload->Data;
+  int32_t        Index;
+
+  for (Index = 0; Index < Payload->ValueCount; Index++)
+  {
+    EM_VisitSharedObjects(&Cursor, Retain);
+  }
+}
+
+/* Copy the content of the writer in a new message, the writer is not reset */
+struct EM_Message *EM_NewMessage (struct EM_Writer *Writer)
+{
+  struct EM_Message *Message;
+  struct EM_Payload *Payload;
+
+  Message = PLAT_SafeRealloc(NULL, sizeof(struct EM_Message) + sizeof(struct EM_Payload) + Writer->SizeInBytes);
+  Payload = (struct EM_Payload *)(Message + 1);
+
+  Payload->ReferenceCount = 1;
+  Payload->Owner          = Message;
+  Payload->SizeInBytes    = Writer->SizeInBytes;
+  Payload->ValueCount     = Writer->ValueCount;
+  Payload->SharedCount    = Writer->SharedCount;
+  memcpy(Payload->Data, Writer->Data, Writer->SizeInBytes);
+
+  if (Payload->SharedCount > 0)
+  {
+    EM_VisitPayloadSharedObjects(Payload, true);
+  }
+
+  Message->Node.Next = NULL;
+  Message->Payload   = Payload;
+  Message->CallerId  = 0;
+  Message->CallId    = 0;
+
+  return Message;
+}
+
+/* Return a new message with the same payload. Message must not be freed or
+ * delivered concurrently, the sender shares it before delivering it. */
+struct EM_Message *EM_ShareMessage (struct EM_Message *Message)
+{
+  struct EM_Message *NewMessage = PLAT_SafeRealloc(NULL, sizeof(struct EM_Message));
+
+  __atomic_add_fetch(&Message->Payload->ReferenceCount, 1, __ATOMIC_RELAXED);
+
+  NewMessage->Node.Next = NULL;
+  NewMessage->Payload   = Message->Payload;
+  NewMessage->CallerId  = 0;
+  NewMessage->CallId    = 0;
+
+  return NewMessage;
+}
+
+void EM_FreeMessage (struct EM_Message *Message)
+{
+  struct EM_Payload *Payload = Message->Payload;
+  struct EM_Message *Owner   = Payload->Owner;
+
+  /* The owner is freed with the payload, even if it was popped first */
+  if (Message != Owner)
+  {
+    PLAT_Free(Message);
+  }
+
+  if (__atomic_sub_fetch(&Payload->ReferenceCount, 1, __ATOMIC_ACQ_REL) == 0)
+  {
+    if (Payload->SharedCount > 0)
+    {
+      EM_VisitPayloadSharedObjects(Payload, false);
+    }
+
+    PLAT_Free(Owner);
+  }
+}
+
+struct MQ_Node *EM_GetNode (struct EM_Message *Message)
+{
+  return &Message->Node;
+}
+
+struct EM_Message *EM_GetMessage (struct MQ_Node *Node)
+{
+  return (struct EM_Message *)((uint8_t *)Node - offsetof(struct EM_Message, Node));
+}
+
+int32_t EM_GetValueCount (struct EM_Message *Message)
+{
+  return Message->Payload->ValueCount;
+}
+
+void EM_SetCall (struct EM_Message *Message, int64_t CallerId, uint64_t CallId)
+{
+  Message->CallerId = CallerId;
+  Message->CallId   = CallId;
+}
+
+/* Return 0 if the message is not a call */
+uint64_t EM_GetCallId (struct EM_Message *Message)
+{
+  return Message->CallId;
+}
+
+int64_t EM_GetCallerId (struct EM_Message *Message)
+{
+  return Message->CallerId;
+}
+
+/* Size of the serialized values, the content of the blobs is not included */
+size_t EM_GetSizeInBytes (struct EM_Message *Message)
+{
+  return Message->Payload->SizeInBytes;
+}
+
+static size_t EM_ReadCount (const uint8_t **Cursor)
+{
+  size_t Count;
+
+  EM_ReadBytes(Cursor, &Count, sizeof(Count));
+
+  return Count;
+}
+
+/* lua_createtable takes int, the size is only a hint */
+static int EM_ClampSize (size_t Count)
+{
+  return ((Count > INT_MAX) ? INT_MAX : (int)Count);
+}
+
+static void EM_DecodeValue (lua_State *LuaState, const uint8_t **Cursor)
+{
+  uint8_t     Type = *(*Cursor)++;
+  uint8_t     Byte;
+  int64_t     Integer;
+  double      Double;
+  size_t      Length;
+  void       *Pointer;
+  size_t      ArrayCount;
+  size_t      HashCount;
+  size_t      Index;
+  void       *Blob;
+  void       *Channel;
+
+  switch (Type)
+  {
+  case EM_TYPE_NIL:
+    lua_pushnil(LuaState);
+    break;
+
+  case EM_TYPE_BOOLEAN:
+    EM_ReadBytes(Cursor, &Byte, sizeof(Byte));
+    lua_pushboolean(LuaState, Byte);
+    break;
+
+  case EM_TYPE_INTEGER:
+    EM_ReadBytes(Cursor, &Integer, sizeof(Integer));
+    lua_pushinteger(LuaState, Integer);
+    break;
+
+  case EM_TYPE_DOUBLE:
+    EM_ReadBytes(Cursor, &Double, sizeof(Double));
+    lua_pushnumber(LuaState, Double);
+    break;
+
+  case EM_TYPE_STRING:
+    Length = EM_ReadCount(Cursor);
+    lua_pushlstring(LuaState, (const char *)*Cursor, Length);
+    *Cursor += Length;
+    break;
+
+  case EM_TYPE_LIGHTUSERDATA:
+    EM_ReadBytes(Cursor, &Pointer, sizeof(Pointer));
+    lua_pushlightuserdata(LuaState, Pointer);
+    break;
+
+  case EM_TYPE_TABLE:
+    /* Table + key + value, the depth is bounded by the writer */
+    luaL_checkstack(LuaState, 3, "event table nested too deeply");
+    ArrayCount = EM_ReadCount(Cursor);
+    HashCount  = EM_ReadCount(Cursor);
+    lua_createtable(LuaState, EM_ClampSize(ArrayCount), EM_ClampSize(HashCount));
+    for (Index = 1; Index <= ArrayCount; Index++)
+    {
+      EM_DecodeValue(LuaState, Cursor);
+      lua_rawseti(LuaState, -2, (lua_Integer)Index);
+    }
+    for (Index = 0; Index < HashCount; Index++)
+    {
+      EM_DecodeValue(LuaState, Cursor); /* Key   */
+      EM_DecodeValue(LuaState, Cursor); /* Value */
+      lua_rawset(LuaState, -3);
+    }
+    break;
+
+  case EM_TYPE_BLOB:
+    /* The userdata takes its own reference, the message keeps its one */
+    EM_ReadBytes(Cursor, &Blob, sizeof(Blob));
+    SB_PushBlob(LuaState, Blob);
+    break;
+
+  case EM_TYPE_CHANNEL:
+    EM_ReadBytes(Cursor, &Channel, sizeof(Channel));
+    CH_PushChannel(LuaState, Channel);
+    break;
+
+  default:
+    fprintf(stderr, "ERROR: Unknown event type %d\n", Type);
+    exit(4);
+    break;
+  }
+}
+
+/* Push all the values of the message on the stack, return the number of
+ * values pushed */
+int32_t EM_PushValues (lua_State *LuaState, struct EM_Message *Message)
+{
+  struct EM_Payload *Payload = Message->Payload;
+  const uint8_t     *Cursor  = Payload->Data;
+  int32_t            Index;
+
+  luaL_checkstack(LuaState, Payload->ValueCount, "too many event arguments");
+
+  for (Index = 0; Index < Payload->ValueCount; Index++)
+  {
+    EM_DecodeValue(LuaState, &Cursor);
+  }
+
+  return Payload->ValueCount;
+}
+
+static int EM_PushValuesProtected (lua_State *LuaState)
+{
+  struct EM_Message *Message = lua_touserdata(LuaState, 1);
+
+  lua_pop(LuaState, 1);
+
+  return EM_PushValues(LuaState, Message); /* Number of values returned on the stack */
+}
+
+/* Like EM_PushValues, then free the message. The decoding can raise an error
+ * (stack overflow, memory), the message is freed before the error is
+ * propagated so the references of its blobs and channels are not leaked. */
+int32_t EM_PushValuesAndFree (lua_State *LuaState, struct EM_Message *Message)
+{
+  int32_t ValueCount = Message->Payload->ValueCount;
+  int32_t Status;
+
+  /* The protected function, its argument and the values */
+  if (!lua_checkstack(LuaState, (ValueCount + 2)))
+  {
+    EM_FreeMessage(Message);
+    luaL_error(LuaState, "too many event arguments");
+  }
+
+  lua_pushcfunction(LuaState, EM_PushValuesProtected);
+  lua_pushlightuserdata(LuaState, Message);
+  Status = lua_pcall(LuaState, 1, LUA_MULTRET, 0);
+
+  EM_FreeMessage(Message);
+
+  if (Status != LUA_OK)
+  {
+    lua_error(LuaState);
+  }
+
+  return ValueCount;
+}
@@ -34,6 +34,11 @@
  * issue comes from. For these reasons, we choosed to simply DETECT this
  * situation when a thread is being close.
  *
+ * The children of an instance are linked in a list protected by
+ * InstanceArrayMutex. When an instance is joined, its children are moved to
+ * RootInstance: their exit event goes there, and the threads still active at
+ * the end are printed from RootInstance without scanning InstanceArray.
+ *
  * EVENT SUPPORTED TYPES
  *
  * [X] LUA_TNIL
@@ -41,9 +46,9 @@
  * [X] LUA_TLIGHTUSERDATA
  * [X] LUA_TNUMBER
  * [X] LUA_TSTRING
- * [ ] LUA_TTABLE
+ * [X] LUA_TTABLE (copied by value, see event-message.c)
  * [ ] LUA_TFUNCTION
- * [ ] LUA_TUSERDATA
+ * [X] LUA_TUSERDATA (only com.blob and com.channel, shared by reference)
  * [ ] LUA_TTHREAD
  *
  * STANDARD OUTPUT AND ERROR OUTPUT
@@ -59,6 +64,57 @@
  * LUA_RunEventLoop need to wait for 2 kind of things: events from other
  * LUA_Instance and state change from LUA_CloseEventLoop.
  *
+ * MAILBOX
+ *
+ * Each instance receives its events in a lock-free MPSC queue (mpsc-queue.c).
+ * The sender serializes the arguments in its own EM_Writer (event-message.c)
+ * without holding any lock, then pushes a single allocation in the mailbox of
+ * the target. The target is only signaled when its mailbox was empty, the
+ * senders don't take StateMutex for the following events. The receiver pops
+ * the messages one by one, so the senders are never blocked by the handlers.
+ *
+ * Previously, the events were copied in a double buffer protected by
+ * EventMutex, and every send was taking EventMutex and StateMutex.
+ *
+ * The mailbox can be bounded in messages and in bytes (Thread.create options).
+ * The sender reserves its room in MailboxMessages/MailboxBytes with a compare
+ * exchange before pushing the message, the receiver releases it once the
+ * message is freed. A sender blocked in Event.sendtimeout waits on
+ * MailboxCondition with StateMutex, the receiver only takes StateMutex when
+ * MailboxWaiters is not zero. The counters are always updated, so
+ * Event.getmailboxstats works with unbounded mailboxes too.
+ *
+ * CALLS
+ *
+ * Thread.call is an event with a CallId (event-message.c). The handler is
+ * called with LUA_MULTRET and its results are sent back in a reply message.
+ * The reply is not queued in a mailbox: each instance has a single reply
+ * slot (Reply, PendingCallId) protected by StateMutex, and the caller waits on
+ * ReplyCondition. The CallIds are unique in the application, a reply which
+ * arrives after a timeout doesn't match PendingCallId and is dropped. The
+ * callee finds the caller by ThreadId under InstanceArrayMutex, so a caller
+ * which is gone is never touched. The calls still queued when a thread
+ * finishes get an error reply.
+ *
+ * EVENT HANDLERS
+ *
+ * The event names can be interned in the application (EventIdMap), the IDs
+ * are shared by all the instances. An instance registers its handlers in
+ * HandlerRefs, indexed by event ID. An event sent by ID is dispatched with an
+ * array index, the name is only resolved when there is no handler. An event
+ * sent by name still calls the global function first, for compatibility.
+ * When there is no handler at all, the event goes to the fallback, if any,
+ * otherwise it is discarded with an error message (it was exit(3) before).
+ *
+ * MEMORY
+ *
+ * Each instance creates its lua_State in its own thread, with its own
+ * mimalloc heap (APP_LuaAllocator). The allocations of an instance never
+ * contend with the other threads, and the lua_State is closed by the same
+ * thread before it exits: the finalizers run there, the frees are local to
+ * the heap, then the remaining pages are released at once. Before that, the
+ * lua_State was created by the parent and closed by the thread calling
+ * Thread.join, so every free was a cross-thread free.
  *
  * EMBEDDED VS SIMPLE MODE
  *
@@ -90,6 +146,45 @@
  * At some point, we tried to make the SetLoader update all the running threads
  * with the broadcast thing. It was a bad idea, it create a dependancy on event
  * loop to implement the notification.
+ *
+ * EMBEDDED ZIP INDEX
+ *
+ * The central directory of the ZIP embedded in the executable is parsed once
+ * in LUA_CreateApplication (see zip-index.c). The resulting index is immutable
+ * and shared by all the instances: "require" doesn't walk the central
+ * directory anymore and the threads don't open the executable again.
+ *
+ * MODULE CACHE
+ *
+ * The decompressed ZIP entries and the bytecode of the chunks loaded from the
+ * ZIP are stored in a process-wide cache (see module-cache.c). The first
+ * instance which require a module pays for the inflate and the parsing, the
+ * following instances only pay for a hash lookup and a lua_load of bytecode.
+ * The bytecode is dumped without stripping the debug information, so the
+ * error messages are the same than with the source.
+ *
+ * comexe/init.lua itself is compiled only once in LUA_CreateApplication. Each
+ * new instance loads the resulting bytecode, so spawning a thread does not
+ * parse the source again. If the compilation fails, the source is kept and the
+ * error is reported by the instance like before.
+ *
+ * THREAD POOL
+ *
+ * Thread.setpoolsize(N) keeps up to N idle instances, already past
+ * APP_LoadComexeApi, waiting for a module to run. Thread.create claims an idle
+ * instance if there is one (hit), otherwise it creates a new one (miss).
+ *
+ * comexe/init.lua does not require the module itself: it returns a runner and
+ * a reset function, stored in the registry of the instance. When the pool is
+ * enabled, a finished instance waits in LUA_LuaThread until it is joined. Then
+ * Thread.join decides if the instance goes back to the pool: the instance
+ * calls the reset function (globals and package.loaded are restored as they
+ * were at the end of init.lua) and becomes idle again. Otherwise the thread is
+ * terminated and released like before.
+ *
+ * Idle instances are not in InstanceArray, they only get a ThreadId when they
+ * are claimed. The pool is shut down by LUA_RunApplication once the main
+ * instance is finished.
  */
 
 /*============================================================================*/
@@ -121,16 +216,17 @@ struct LUA_Application;
 /* IMPLEMENTATION HEADERS                                                     */
 /*============================================================================*/
 
-#include <string.h>  /* memcpy */
-#include <stdbool.h> /* bool   */
-#include <time.h>    /* time   */
+#include <stdio.h>   /* fprintf */
+#include <stdlib.h>  /* exit    */
+#include <string.h>  /* memcpy  */
+#include <stdbool.h> /* bool    */
+#include <time.h>    /* time    */
 
 #include <lua.h>
 #include <lauxlib.h>
 #include <lualib.h>
 #include <uv.h>
-
-#include "unzip.h" /* minizip headers */
+#include <mbedtls/threading.h> /* mbedtls_threading_mutex_t */
 
 #include "comexe.h"
 #include "version.h"
@@ -147,8 +243,13 @@ static const char *LUA_EMBEDDED_ENTRY_NAME = "comexe/init.lua";
 
 #define APP_INITIAL_INSTANCE_CAPACITY 16
 
-#define LUA_INSTANCE_PENDING_EVENT_COUNT 16
-#define LUA_INSTANCE_PENDING_EVENT_SIZE  512
+#define APP_INITIAL_TOPIC_CAPACITY 16
+
+#define APP_INITIAL_NAME_CAPACITY 16
+
+#define APP_INITIAL_EVENT_NAME_CAPACITY 64
+
+#define APP_MODULE_CACHE_CAPACITY (32 * 1024 * 1024)
 
 #define APP_BIT_SET(Value, Mask)                \
   do {                                          \
@@ -167,6 +268,11 @@ static const char *LUA_EMBEDDED_ENTRY_NAME = "comexe/init.lua";
 #define INSTANCE_MASK_ACTIVE             ((uint8_t)(1 << 0))
 #define INSTANCE_MASK_EVENTS_PENDING     ((uint8_t)(1 << 1))
 #define INSTANCE_MASK_LOOP_CLOSE_REQUEST ((uint8_t)(1 << 2))
+#define INSTANCE_MASK_ASSIGNED           ((uint8_t)(1 << 3))
+#define INSTANCE_MASK_FINISHED           ((uint8_t)(1 << 4))
+#define INSTANCE_MASK_JOINED             ((uint8_t)(1 << 5))
+#define INSTANCE_MASK_RECYCLE            ((uint8_t)(1 << 6))
+#define INSTANCE_MASK_POOL_SHUTDOWN      ((uint8_t)(1 << 7))
 
 struct LUA_Instance
 {
@@ -174,16 +280,94 @@ struct LUA_Instance
   struct LUA_Application *Application;
   const char             *ExitEventName;
   struct LUA_Instance    *Parent;
+  struct LUA_Instance    *FirstChild;
+  struct LUA_Instance    *NextSibling;
+  struct LUA_Instance    *PreviousSibling;
+  const char             *RegisteredName;
   size_t                  Offset;
   uv_thread_t             Thread;
   lua_State              *LuaState;
+  struct mi_heap_s       *Heap;
+  size_t                  MemoryBytes;
+  size_t                  MemoryPeak;
+  uint64_t                MemoryAllocations;
+  uint64_t                MemoryRefused;
+  size_t                  MemoryLimit;
+  size_t                  MaxMemory;
+  char                   *CpuMask;
+  bool                    AffinitySet;
+  int                     Priority;
+  bool                    HasPriority;
+  const char             *ThreadName;
   uint8_t                 State;
   uv_mutex_t              StateMutex;
   uv_cond_t               StateCondition;
-  struct BA_Allocator    *EventBufferReceive;
-  struct BA_Allocator    *EventBufferTemp;
-  uv_mutex_t              EventMutex;
+  struct MQ_Queue         Mailbox;
+  size_t                  MailboxMaxMessages;
+  size_t                  MailboxMaxBytes;
+  size_t                  MailboxMessages;
+  size_t                  MailboxBytes;
+  size_t                  MailboxHighWater;
+  uint64_t                MailboxEnqueued;
+  uint64_t                MailboxBytesEnqueued;
+  uint64_t                MailboxDropped;
+  uint64_t                MailboxBlocked;
+  uint32_t                MailboxWaiters;
+  bool                    MailboxClosed;
+  uv_cond_t               MailboxCondition;
+  struct EM_Writer        MessageWriter;
+  uv_cond_t               ReplyCondition;
+  uint64_t                PendingCallId;
+  struct EM_Message      *Reply;
+  struct EM_Message      *Arguments;
+  uv_async_t              EventAsync;
+  bool                    AsyncEnabled;
+  bool                    UvLoopRunning;
+  struct LUA_Instance   **BroadcastTargets;
+  size_t                  BroadcastCapacity;
+  uint32_t                PinCount;
   int                     WarningFunctionRef;
+  int                    *HandlerRefs;
+  size_t                  HandlerCapacity;
+  int                     FallbackRef;
+  bool                    Poolable;
+  uv_cond_t               JoinCondition;
+  int                     RunnerRef;
+  int                     ResetRef;
+};
+
+/* Options of Thread.create, a limit of 0 means unbounded. StackSize 0 is the
+ * default stack size. */
+struct APP_ThreadOptions
+{
+  size_t             MaxMessages;
+  size_t             MaxBytes;
+  size_t             MaxMemory;
+  size_t             StackSize;
+  char              *CpuMask;    /* Owned by the new instance, NULL for all */
+  int                Priority;
+  bool               HasPriority;
+  const char        *ThreadName; /* Lua string, duplicated by the instance */
+  struct EM_Message *Arguments;  /* Owned by the new instance */
+};
+
+/* IdleInstances can hold Capacity instances, Capacity is the largest PoolSize
+ * requested so far. WarmingCount is the number of instances which will become
+ * idle soon: new instances loading comexe/init.lua and recycled instances
+ * being reset. */
+struct APP_Pool
+{
+  uv_mutex_t            PoolMutex;
+  uv_cond_t             PoolCondition;
+  struct LUA_Instance **IdleInstances;
+  size_t                IdleCount;
+  size_t                WarmingCount;
+  size_t                PoolSize;
+  size_t                Capacity;
+  bool                  Shutdown;
+  uint64_t              Hits;
+  uint64_t              Misses;
+  uint64_t              Recycled;
 };
 
 /* By design, we store struct LUA_Instance RootInstance as a statically
@@ -200,62 +384,42 @@ struct LUA_Application
   struct LUA_Instance   RootInstance;
   struct TA_Array      *InstanceArray;
   uv_mutex_t            InstanceArrayMutex;
+  uv_cond_t             UnpinCondition;
+  struct ZI_Index      *ZipIndex;
+  struct MC_Cache      *ModuleCache;
   uint8_t              *ComexeApi;
   size_t                ComexeApiSizeInBytes;
+  uint8_t              *ComexeApiBytecode;
+  size_t                ComexeApiBytecodeSizeInBytes;
+  struct APP_Pool       Pool;
+  char                 *DefaultCpuMask; /* Affinity at startup, NULL if unknown */
+  struct TH_Map        *TopicMap;
+  uv_rwlock_t           NameLock;
+  struct TH_Map        *NameMap;
+  uint64_t              NextCallId;
+  uv_mutex_t            EventNameMutex;
+  struct TH_Map        *EventIdMap;
+  char                **EventNames;
+  size_t                EventNameCount;
+  size_t                EventNameCapacity;
   char                  LoaderConfiguration[16];
 };
 
-typedef enum
+/* Subscribers of a topic, protected by InstanceArrayMutex like the instances.
+ * The topics are never removed from TopicMap, only freed with the
+ * application. */
+struct APP_Topic
 {
-  INSTANCE_EVENT_START,
-  INSTANCE_EVENT_PARAM_INTEGER,
-  INSTANCE_EVENT_PARAM_BOOLEAN,
-  INSTANCE_EVENT_PARAM_DOUBLE,
-  INSTANCE_EVENT_PARAM_STRING,
-  INSTANCE_EVENT_PARAM_NIL,
-  INSTANCE_EVENT_PARAM_USERDATA,
-  INSTANCE_EVENT_END
-
-} APP_EventType_t;
+  struct LUA_Instance **Subscribers;
+  size_t                SubscriberCount;
+  size_t                Capacity;
+};
 
-struct MAIN_Event
+struct APP_DumpBuffer
 {
-  APP_EventType_t Type;
-  union
-  {
-    struct
-    {
-      int32_t ArgumentCount;
-    } Start;
-
-    struct
-    {
-      size_t  Length;
-      char   *ValuePointer;
-      char    Value[];
-    } String;
-
-    struct
-    {
-      int64_t Value;
-    } Integer;
-
-    struct
-    {
-      int32_t Value;
-    } Boolean;
-
-    struct
-    {
-      double Value;
-    } Double;
-
-    struct
-    {
-      void *Value;
-    } UserData;
-
-  } Data;
+  uint8_t *Data;
+  size_t   SizeInBytes;
+  size_t   CapacityInBytes;
 };
 
 /*============================================================================*/
@@ -270,6 +434,10 @@ extern int luaopen_mbedtls     (lua_State *LuaState);
 extern int luaopen_libtcc      (lua_State *LuaState);
 extern int luaopen_lpeg        (lua_State *LuaState);
 
+/* From luv.h, which is not in the include directories. The struct tag is
+ * used because this declaration ends up in comexe.h, without uv.h */
+extern struct uv_loop_s *luv_loop (lua_State *LuaState);
+
 /*============================================================================*/
 /* PRE-DECLARATIONS                                                           */
 /*============================================================================*/
@@ -278,21 +446,35 @@ extern int luaopen_lpeg        (lua_State *LuaState);
  * API parts, before the definition of Instance-related functions (which are
  * actually using the LUA API) */
 
-static struct LUA_Instance* APP_CreateInstance (struct LUA_Application *Application,
-                                                struct LUA_Instance    *ParentInstance,
-                                                const char             *ComponentName,
-                                                const char             *ExitEventName);
+static struct LUA_Instance* APP_CreateInstance (struct LUA_Application         *Application,
+                                                struct LUA_Instance            *ParentInstance,
+                                                const char                     *ComponentName,
+                                                const char                     *ExitEventName,
+                                                const struct APP_ThreadOptions *Options);
 
 static void APP_ReleaseInstance (struct LUA_Instance *Instance);
 
-/*============================================================================*/
-/* STANDARD LIBRARIES ADDONS                                                  */
-/*============================================================================*/
+static struct LUA_Instance *APP_ClaimPooledInstance (struct LUA_Application         *Application,
+                                                     struct LUA_Instance            *ParentInstance,
+                                                     const char                     *ComponentName,
+                                                     const char                     *ExitEventName,
+                                                     const struct APP_ThreadOptions *Options);
 
-static bool STRING_Equals (const char *String1, const char *String2)
-{
-  return (strcmp(String1, String2) == 0);
-}
+static bool APP_ReservePoolSlot (struct LUA_Application *Application);
+
+static void APP_SetPoolSize (struct LUA_Application *Application, size_t PoolSize);
+
+static void APP_UnsubscribeInstance (struct LUA_Application *Application,
+                                     struct LUA_Instance    *Instance);
+
+/* The calls are implemented with the events, but exposed in com.thread */
+static int LUA_CallThread (lua_State *LuaState);
+
+static int LUA_CallThreadTimeout (lua_State *LuaState);
+
+static int LUA_PostCall (lua_State *LuaState);
+
+static int LUA_GetReply (lua_State *LuaState);
 
 /*============================================================================*/
 /* APPLICATION-RELATED LUA ADDONS                                             */
@@ -327,585 +509,2462 @@ static struct LUA_Instance *LUA_GetInstance (lua_State *LuaState)
   return Instance;
 }
 
+/* The writer of the instance, for the modules which encode messages */
+struct EM_Writer *LUA_GetMessageWriter (lua_State *LuaState)
+{
+  struct LUA_Instance *Instance = LUA_GetInstance(LuaState);
+
+  return &Instance->MessageWriter;
+}
+
+static void APP_SetIntegerField (lua_State   *LuaState,
+                                 const char  *FieldName,
+                                 lua_Integer  Value)
+{
+  lua_pushinteger(LuaState, Value);
+  lua_setfield(LuaState, -2, FieldName);
+}
+
 /*============================================================================*/
-/* THREAD API                                                                 */
+/* INSTANCE PINNING                                                           */
 /*============================================================================*/
 
-/* NewThread(ComponentName, ExitEventName) */
-static int LUA_NewThread (lua_State *LuaState)
+/* A thread which uses another instance after releasing InstanceArrayMutex,
+ * to wait for room in its mailbox or to deliver a message, pins it first.
+ * Thread.join waits for the pins to be released before it releases or
+ * recycles the instance. PinCount is protected by InstanceArrayMutex. */
+
+/* Return NULL if InstanceId is not valid */
+static struct LUA_Instance *APP_PinInstance (struct LUA_Application *Application,
+                                             int64_t                 InstanceId)
 {
-  struct LUA_Instance    *Instance      = LUA_GetInstance(LuaState);
-  struct LUA_Application *Application   = Instance->Application;
-  int32_t                 ArgumentCount = lua_gettop(LuaState);
-  const char             *ThreadEventName;
-  const char             *ComponentName;
-  size_t                  ComponentNameLength;
-  struct LUA_Instance    *ChildInstance;
+  struct LUA_Instance *Instance;
 
-  if ((ArgumentCount >= 1) && (lua_isstring(LuaState, 1)))
+  uv_mutex_lock(&Application->InstanceArrayMutex);
+  if (TA_IsValid(Application->InstanceArray, InstanceId))
   {
-    ComponentName = lua_tolstring(LuaState, 1, &ComponentNameLength);
+    Instance = TA_GetObject(Application->InstanceArray, InstanceId);
+    Instance->PinCount++;
+  }
+  else
+  {
+    Instance = NULL;
+  }
+  uv_mutex_unlock(&Application->InstanceArrayMutex);
 
-    if ((ArgumentCount >= 2) && lua_isstring(LuaState, 2))
-    {
-      ThreadEventName = lua_tostring(LuaState, 2);
-    }
-    else
+  return Instance;
+}
+
+static void APP_UnpinInstances (struct LUA_Application  *Application,
+                                struct LUA_Instance    **Instances,
+                                size_t                   InstanceCount)
+{
+  bool   Unpinned = false;
+  size_t InstanceIndex;
+
+  uv_mutex_lock(&Application->InstanceArrayMutex);
+  for (InstanceIndex = 0; InstanceIndex < InstanceCount; InstanceIndex++)
+  {
+    Instances[InstanceIndex]->PinCount--;
+    if (Instances[InstanceIndex]->PinCount == 0)
     {
-      ThreadEventName = NULL;
+      Unpinned = true;
     }
+  }
+  if (Unpinned)
+  {
+    uv_cond_broadcast(&Application->UnpinCondition);
+  }
+  uv_mutex_unlock(&Application->InstanceArrayMutex);
+}
 
-    ChildInstance = APP_CreateInstance(Application, Instance, ComponentName, ThreadEventName);
+/* InstanceArrayMutex must be locked, the instance must be removed from
+ * InstanceArray: nobody can pin it anymore */
+static void APP_WaitUntilUnpinned (struct LUA_Application *Application,
+                                   struct LUA_Instance    *Instance)
+{
+  while (Instance->PinCount > 0)
+  {
+    uv_cond_wait(&Application->UnpinCondition, &Application->InstanceArrayMutex);
+  }
+}
 
-    lua_pushinteger(LuaState, ChildInstance->Offset);
+/*============================================================================*/
+/* INSTANCE TREE AND NAMES                                                    */
+/*============================================================================*/
+
+/* InstanceArrayMutex must be locked */
+static void APP_LinkChild (struct LUA_Instance *ParentInstance,
+                           struct LUA_Instance *ChildInstance)
+{
+  ChildInstance->Parent          = ParentInstance;
+  ChildInstance->PreviousSibling = NULL;
+  ChildInstance->NextSibling     = ParentInstance->FirstChild;
+
+  if (ParentInstance->FirstChild)
+  {
+    ParentInstance->FirstChild->PreviousSibling = ChildInstance;
+  }
+
+  ParentInstance->FirstChild = ChildInstance;
+}
+
+/* InstanceArrayMutex must be locked */
+static void APP_UnlinkChild (struct LUA_Instance *ChildInstance)
+{
+  if (ChildInstance->PreviousSibling)
+  {
+    ChildInstance->PreviousSibling->NextSibling = ChildInstance->NextSibling;
   }
   else
   {
-    lua_pushnil(LuaState);
+    ChildInstance->Parent->FirstChild = ChildInstance->NextSibling;
   }
 
-  return 1; /* Number of values returned on the stack */
+  if (ChildInstance->NextSibling)
+  {
+    ChildInstance->NextSibling->PreviousSibling = ChildInstance->PreviousSibling;
+  }
+
+  ChildInstance->PreviousSibling = NULL;
+  ChildInstance->NextSibling     = NULL;
 }
 
-static int LUA_GetThreadId (lua_State *LuaState)
+/* Remove Instance from the tree, its children are moved to RootInstance.
+ * InstanceArrayMutex must be locked. */
+static void APP_RemoveFromTree (struct LUA_Application *Application,
+                                struct LUA_Instance    *Instance)
 {
-  struct LUA_Instance *Instance = LUA_GetInstance(LuaState);
+  struct LUA_Instance *ChildInstance;
 
-  /* Push instance key on the stack */
-  lua_pushinteger(LuaState, Instance->Offset);
+  APP_UnlinkChild(Instance);
 
-  return 1; /* Number of values returned on the stack */
+  while (Instance->FirstChild)
+  {
+    ChildInstance = Instance->FirstChild;
+    APP_UnlinkChild(ChildInstance);
+    APP_LinkChild(&Application->RootInstance, ChildInstance);
+  }
 }
 
-static int LUA_GetThreadModuleName (lua_State *LuaState)
+/* Return the thread ID registered under Name, 0 if there is none */
+static size_t APP_FindRegisteredName (struct LUA_Application *Application,
+                                      const char             *Name,
+                                      size_t                  NameLength)
 {
-  struct LUA_Instance *Instance = LUA_GetInstance(LuaState);
+  struct LUA_Instance *Instance;
+  size_t               InstanceOffset;
 
-  /* Push module name on the stack */
-  lua_pushstring(LuaState, Instance->ModuleName);
+  uv_rwlock_rdlock(&Application->NameLock);
+  Instance = TH_GetObject(Application->NameMap, Name, NameLength);
+  if (Instance)
+  {
+    InstanceOffset = Instance->Offset;
+  }
+  else
+  {
+    InstanceOffset = 0;
+  }
+  uv_rwlock_rdunlock(&Application->NameLock);
 
-  return 1; /* Number of values returned on the stack */
+  return InstanceOffset;
 }
 
-static void LUA_WaitAndRelease (struct LUA_Application *Application,
-                                struct LUA_Instance    *TargetInstance)
+/* Return NULL if no instance is registered under Name. The name is resolved
+ * and the instance pinned under InstanceArrayMutex: Thread.join removes the
+ * name under the same lock, the name can't resolve to an instance being
+ * released or to the next owner of its offset. */
+static struct LUA_Instance *APP_PinNamedInstance (struct LUA_Application *Application,
+                                                  const char             *Name,
+                                                  size_t                  NameLength)
 {
-  /* Wait for thread execution */
-  uv_thread_join(&TargetInstance->Thread);
+  struct LUA_Instance *Instance;
 
-  /* Remove from array */
   uv_mutex_lock(&Application->InstanceArrayMutex);
-  TA_RemoveObject(Application->InstanceArray, TargetInstance->Offset);
+  uv_rwlock_rdlock(&Application->NameLock);
+  Instance = TH_GetObject(Application->NameMap, Name, NameLength);
+  if (Instance)
+  {
+    Instance->PinCount++;
+  }
+  uv_rwlock_rdunlock(&Application->NameLock);
   uv_mutex_unlock(&Application->InstanceArrayMutex);
 
-  /* Release resources */
-  APP_ReleaseInstance(TargetInstance);
+  return Instance;
 }
 
-static int LUA_JoinThread (lua_State *LuaState)
+/* NameLock must be locked for writing */
+static void APP_RemoveRegisteredName (struct LUA_Application *Application,
+                                      struct LUA_Instance    *Instance)
 {
-  struct LUA_Instance    *Instance      = LUA_GetInstance(LuaState);
-  struct LUA_Application *Application   = Instance->Application;
-  int32_t                 ArgumentCount = lua_gettop(LuaState);
-  bool                    Success       = false;
-  int64_t                 ThreadId;
-  struct LUA_Instance    *TargetInstance;
+  if (Instance->RegisteredName)
+  {
+    TH_RemoveObject(Application->NameMap, Instance->RegisteredName, strlen(Instance->RegisteredName));
+    PLAT_Free((void *)Instance->RegisteredName); /* Discard const */
+    Instance->RegisteredName = NULL;
+  }
+}
 
-  if ((ArgumentCount >= 1) && lua_isinteger(LuaState, 1))
+/* The target of an event or a call is a thread ID or a registered name */
+static void APP_CheckTarget (lua_State *LuaState, int32_t Index)
+{
+  if (lua_type(LuaState, Index) != LUA_TSTRING)
   {
-    ThreadId = lua_tointeger(LuaState, 1);
+    luaL_checkinteger(LuaState, Index);
+  }
+}
 
-    uv_mutex_lock(&Application->InstanceArrayMutex);
-    if (TA_IsValid(Application->InstanceArray, ThreadId))
-    {
-      TargetInstance = TA_GetObject(Application->InstanceArray, ThreadId);
-    }
-    else
-    {
-      TargetInstance = NULL;
-    }
-    uv_mutex_unlock(&Application->InstanceArrayMutex);
+/* Pin the target checked by APP_CheckTarget, return NULL if the thread ID is
+ * invalid or the name is not registered */
+static struct LUA_Instance *APP_PinTarget (lua_State *LuaState, int32_t Index)
+{
+  struct LUA_Instance *Instance = LUA_GetInstance(LuaState);
+  const char          *Name;
+  size_t               NameLength;
+  struct LUA_Instance *TargetInstance;
 
-    if (TargetInstance)
-    {
-      LUA_WaitAndRelease(Application, TargetInstance);
-      Success = true;
-    }
+  if (lua_type(LuaState, Index) == LUA_TSTRING)
+  {
+    Name           = lua_tolstring(LuaState, Index, &NameLength);
+    TargetInstance = APP_PinNamedInstance(Instance->Application, Name, NameLength);
+  }
+  else
+  {
+    TargetInstance = APP_PinInstance(Instance->Application, lua_tointeger(LuaState, Index));
   }
 
-  lua_pushboolean(LuaState, Success);
-  
-  return 1; /* Number of values returned on the stack */
+  return TargetInstance;
 }
 
-static const struct luaL_Reg THREADS_FUNCTIONS[] = 
+/* Register(Name), a thread has at most one name. Return true, or false and
+ * "exists" if Name belongs to another thread. */
+static int LUA_RegisterThread (lua_State *LuaState)
 {
-  { "create",  LUA_NewThread           },
-  { "getid",   LUA_GetThreadId         },
-  { "getname", LUA_GetThreadModuleName },
-  { "join",    LUA_JoinThread          },
-  { NULL,      NULL                    }
-};
+  struct LUA_Instance    *Instance    = LUA_GetInstance(LuaState);
+  struct LUA_Application *Application = Instance->Application;
+  size_t                  NameLength;
+  const char             *Name        = luaL_checklstring(LuaState, 1, &NameLength);
+  struct LUA_Instance    *Owner;
+  int                     ResultCount;
 
-static int luaopen_threads (lua_State *LuaState)
+  luaL_argcheck(LuaState, ((NameLength > 0) && (strlen(Name) == NameLength)), 1, "invalid thread name");
+
+  uv_rwlock_wrlock(&Application->NameLock);
+  Owner = TH_GetObject(Application->NameMap, Name, NameLength);
+  if (Owner == NULL)
+  {
+    APP_RemoveRegisteredName(Application, Instance);
+    Instance->RegisteredName = PLAT_StrDup(Name);
+    TH_SetObject(Application->NameMap, Instance->RegisteredName, NameLength, Instance);
+  }
+  uv_rwlock_wrunlock(&Application->NameLock);
+
+  if ((Owner == NULL) || (Owner == Instance))
+  {
+    lua_pushboolean(LuaState, true);
+    ResultCount = 1;
+  }
+  else
+  {
+    lua_pushboolean(LuaState, false);
+    lua_pushliteral(LuaState, "exists");
+    ResultCount = 2;
+  }
+
+  return ResultCount; /* Number of values returned on the stack */
+}
+
+/* Unregister(), return false if the thread has no name */
+static int LUA_UnregisterThread (lua_State *LuaState)
 {
-  luaL_newlib(LuaState, THREADS_FUNCTIONS);
-  
+  struct LUA_Instance    *Instance    = LUA_GetInstance(LuaState);
+  struct LUA_Application *Application = Instance->Application;
+  bool                    Registered;
+
+  uv_rwlock_wrlock(&Application->NameLock);
+  Registered = (Instance->RegisteredName != NULL);
+  APP_RemoveRegisteredName(Application, Instance);
+  uv_rwlock_wrunlock(&Application->NameLock);
+
+  lua_pushboolean(LuaState, Registered);
+
+  return 1; /* Number of values returned on the stack */
+}
+
+/* WhereIs(Name), return the thread ID or nil */
+static int LUA_WhereIsThread (lua_State *LuaState)
+{
+  struct LUA_Instance *Instance = LUA_GetInstance(LuaState);
+  size_t               NameLength;
+  const char          *Name     = luaL_checklstring(LuaState, 1, &NameLength);
+  size_t               InstanceOffset;
+
+  InstanceOffset = APP_FindRegisteredName(Instance->Application, Name, NameLength);
+
+  if (InstanceOffset > 0)
+  {
+    lua_pushinteger(LuaState, (lua_Integer)InstanceOffset);
+  }
+  else
+  {
+    lua_pushnil(LuaState);
+  }
+
   return 1; /* Number of values returned on the stack */
 }
 
 /*============================================================================*/
-/* EVENTS API                                                                 */
+/* THREAD API                                                                 */
 /*============================================================================*/
 
-static void APP_EnqueueEventArgument (struct BA_Allocator *EventQueue,
-                                      struct MAIN_Event   *Event)
+/* Return 0 if the option is not set */
+static size_t APP_GetSizeOption (lua_State  *LuaState,
+                                 int32_t     TableIndex,
+                                 const char *OptionName)
 {
-  size_t             Length;
-  BA_Key_t           Key;
-  uint8_t           *NewBlob;
-  struct MAIN_Event *pEvent;
-  
-  if (Event->Type == INSTANCE_EVENT_PARAM_STRING)
-  {
-    Length = Event->Data.String.Length;
+  lua_Integer Value;
 
-    BA_AllocateBlob(EventQueue, sizeof(struct MAIN_Event) + Length + 1, &Key, &NewBlob);
+  lua_getfield(LuaState, TableIndex, OptionName);
 
-    pEvent                           = (struct MAIN_Event *)NewBlob;
-    pEvent->Type                     = Event->Type;
-    pEvent->Data.String.Length       = Length;
-    pEvent->Data.String.ValuePointer = (char *)(NewBlob + sizeof(struct MAIN_Event));
-
-    memcpy(pEvent->Data.String.Value, Event->Data.String.ValuePointer, Length + 1);
+  if (lua_isnil(LuaState, -1))
+  {
+    Value = 0;
+  }
+  else if (lua_isinteger(LuaState, -1) && (lua_tointeger(LuaState, -1) >= 0))
+  {
+    Value = lua_tointeger(LuaState, -1);
   }
   else
   {
-    BA_PushBlob(EventQueue, Event, sizeof(struct MAIN_Event));
+    Value = luaL_error(LuaState, "option '%s' must be a positive integer", OptionName);
   }
+
+  lua_pop(LuaState, 1);
+
+  return (size_t)Value;
 }
 
-static void APP_CopyEventArguments (lua_State           *LuaState,
-                                    struct BA_Allocator *PendingEvents,
-                                    uint32_t             StartIndex,
-                                    uint32_t             EndIndex)
+/* Encode the array Options.arguments, return NULL if the option is not set */
+static struct EM_Message *APP_ReadArgumentsOption (lua_State *LuaState,
+                                                   int32_t    TableIndex)
 {
-  struct MAIN_Event  Event;
-  uint32_t           Index;
-  int32_t            ValueType;
-  const char        *EventString;
-  size_t             EventStringLength;
+  struct LUA_Instance *Instance = LUA_GetInstance(LuaState);
+  struct EM_Writer    *Writer   = &Instance->MessageWriter;
+  struct EM_Message   *Message;
+  lua_Integer          ArgumentCount;
+  lua_Integer          Index;
 
-  /* Enqueue event start */
-  Event.Type                     = INSTANCE_EVENT_START;
-  Event.Data.Start.ArgumentCount = (EndIndex - (StartIndex - 1));
-  APP_EnqueueEventArgument(PendingEvents, &Event);
+  lua_getfield(LuaState, TableIndex, "arguments");
 
-  for (Index = StartIndex; Index <= EndIndex; Index++)
+  if (lua_isnil(LuaState, -1))
   {
-    ValueType = lua_type(LuaState, Index);
+    Message = NULL;
+  }
+  else
+  {
+    luaL_argcheck(LuaState, lua_istable(LuaState, -1), TableIndex, "option 'arguments' must be a table");
+
+    ArgumentCount = luaL_len(LuaState, -1);
+    EM_ResetWriter(Writer);
 
-    switch (ValueType)
+    for (Index = 1; Index <= ArgumentCount; Index++)
     {
-    case LUA_TNUMBER:
-      if (lua_isinteger(LuaState, Index))
+      lua_rawgeti(LuaState, -1, Index);
+      if (!EM_WriteLuaValue(Writer, LuaState, -1))
       {
-        Event.Type               = INSTANCE_EVENT_PARAM_INTEGER;
-        Event.Data.Integer.Value = lua_tointeger(LuaState, Index);
+        luaL_error(LuaState,
+                   "argument %d: %s '%s'",
+                   (int)Index,
+                   Writer->ErrorReason,
+                   lua_typename(LuaState, Writer->ErrorType));
       }
-      else
-      {
-        Event.Type              = INSTANCE_EVENT_PARAM_DOUBLE;
-        Event.Data.Double.Value = lua_tonumber(LuaState, Index);
-      }
-      APP_EnqueueEventArgument(PendingEvents, &Event);
-      break;
+      lua_pop(LuaState, 1);
+    }
 
-    case LUA_TBOOLEAN:
-      Event.Type               = INSTANCE_EVENT_PARAM_BOOLEAN;
-      Event.Data.Boolean.Value = lua_toboolean(LuaState, Index);
-      APP_EnqueueEventArgument(PendingEvents, &Event);
-      break;
+    Message = EM_NewMessage(Writer);
+  }
 
-    case LUA_TSTRING:
-      EventString                    = lua_tolstring(LuaState, Index, &EventStringLength);
-      Event.Type                     = INSTANCE_EVENT_PARAM_STRING;
-      Event.Data.String.Length       = EventStringLength;
-      Event.Data.String.ValuePointer = (char *)EventString; /* Used temporarily */
-      APP_EnqueueEventArgument(PendingEvents, &Event);
-      break;
+  lua_pop(LuaState, 1);
 
-    case LUA_TLIGHTUSERDATA:
-      Event.Type                = INSTANCE_EVENT_PARAM_USERDATA;
-      Event.Data.UserData.Value = lua_touserdata(LuaState, Index);
-      APP_EnqueueEventArgument(PendingEvents, &Event);
-      break;
+  return Message;
+}
 
-    case LUA_TNIL:
-      Event.Type = INSTANCE_EVENT_PARAM_NIL;
-      APP_EnqueueEventArgument(PendingEvents, &Event);
-      break;
+/* Same order as the libuv constants, from UV_THREAD_PRIORITY_LOWEST */
+static const char *const APP_PRIORITY_NAMES[] =
+{
+  "lowest",
+  "belownormal",
+  "normal",
+  "abovenormal",
+  "highest",
+  NULL
+};
 
-    default:
-      fprintf(stderr,
-              "ERROR: PostEvent param %d type is unsupported '%s'\n",
-              Index,
-              lua_typename(LuaState, ValueType));
-      exit(2);
-    }
-  }
+/* Return false if the option is not set */
+static bool APP_GetPriorityOption (lua_State *LuaState,
+                                   int32_t    TableIndex,
+                                   int       *Priority)
+{
+  const char *Name;
+  bool        Found;
+  int         Index;
 
-  /* Enqueue event end */
-  Event.Type = INSTANCE_EVENT_END;
-  APP_EnqueueEventArgument(PendingEvents, &Event);
-}
+  lua_getfield(LuaState, TableIndex, "priority");
 
-static int LUA_PostEvent (lua_State *LuaState)
-{
-  uint32_t                ArgumentCount = lua_gettop(LuaState);
-  struct LUA_Instance    *Instance      = LUA_GetInstance(LuaState);
-  struct LUA_Application *Application   = Instance->Application;
-  struct LUA_Instance    *TargetInstance;
-  int64_t                 InstanceId;
-  struct BA_Allocator    *PendingEvents;
-  bool                    Success;
-
-  if ((ArgumentCount >= 2) && (lua_isinteger(LuaState, 1)))
+  if (lua_isnil(LuaState, -1))
+  {
+    Found = false;
+  }
+  else
   {
-    InstanceId = lua_tointeger(LuaState, 1);
+    Name  = lua_tostring(LuaState, -1);
+    Found = false;
+    Index = 0;
 
-    if (lua_type(LuaState, 2) != LUA_TSTRING)
+    while ((Name != NULL) && !Found && (APP_PRIORITY_NAMES[Index] != NULL))
     {
-      luaL_error(LuaState, "PostEvent(EventName, ...): ERROR EventName must be a string");
+      Found = (strcmp(Name, APP_PRIORITY_NAMES[Index]) == 0);
+      Index++;
     }
-    else
+
+    if (!Found)
     {
-      uv_mutex_lock(&Application->InstanceArrayMutex);
-      if (TA_IsValid(Application->InstanceArray, InstanceId))
-      {
-        TargetInstance = TA_GetObject(Application->InstanceArray, InstanceId);
-      }
-      else
-      {
-        TargetInstance = NULL;
-      }
-      uv_mutex_unlock(&Application->InstanceArrayMutex);
+      luaL_error(LuaState, "option 'priority' must be 'lowest', 'belownormal', 'normal', 'abovenormal' or 'highest'");
     }
 
-    if (TargetInstance)
-    {
-      /* Enqueue the event */
-      uv_mutex_lock(&TargetInstance->EventMutex);
-      PendingEvents = TargetInstance->EventBufferReceive;
-      APP_CopyEventArguments(LuaState, PendingEvents, 2, ArgumentCount);
-      uv_mutex_unlock(&TargetInstance->EventMutex);
+    *Priority = (UV_THREAD_PRIORITY_LOWEST + Index - 1);
+  }
 
-      /* Notify the event loop */
-      uv_mutex_lock(&TargetInstance->StateMutex);
-      APP_BIT_SET(TargetInstance->State, INSTANCE_MASK_EVENTS_PENDING);
-      uv_cond_signal(&TargetInstance->StateCondition);
-      uv_mutex_unlock(&TargetInstance->StateMutex);
+  lua_pop(LuaState, 1);
 
-      Success = true;
-    }
-    else
-    {
-      Success = false;
-    }
+  return Found;
+}
+
+/* Return NULL if the option is not set. The string stays referenced by the
+ * options table. */
+static const char *APP_GetNameOption (lua_State *LuaState,
+                                      int32_t    TableIndex)
+{
+  const char *Name;
+
+  lua_getfield(LuaState, TableIndex, "name");
+
+  if (lua_isnil(LuaState, -1))
+  {
+    Name = NULL;
+  }
+  else if (lua_type(LuaState, -1) == LUA_TSTRING)
+  {
+    Name = lua_tostring(LuaState, -1);
   }
   else
   {
-    Success = false;
+    Name = NULL;
+    luaL_error(LuaState, "option 'name' must be a string");
   }
 
-  /* Push success/failure result */
-  lua_pushboolean(LuaState, Success);
+  lua_pop(LuaState, 1);
 
-  return 1; /* Number of values returned on the stack */
+  return Name;
 }
 
-static int LUA_BroadcastEvent (lua_State *LuaState)
+/* Check the array Options.cpus, before anything is allocated. Return the size
+ * of the CPU mask, 0 if the option is not set. */
+static size_t APP_CheckCpusOption (lua_State *LuaState,
+                                   int32_t    TableIndex)
 {
-  uint32_t                ArgumentCount = lua_gettop(LuaState);
-  struct LUA_Instance    *Instance      = LUA_GetInstance(LuaState);
-  struct LUA_Application *Application   = Instance->Application;
-  struct LUA_Instance    *TargetInstance;
-  struct BA_Allocator    *PendingEvents;
-  size_t                  InstanceCapacity;
-  size_t                  InstanceOffset;
-  bool                    Continue;
+  int         MaskSize;
+  lua_Integer CpuCount;
+  lua_Integer Index;
+  lua_Integer Cpu;
 
-  if ((ArgumentCount >= 1) && (lua_isstring(LuaState, 1)))
+  lua_getfield(LuaState, TableIndex, "cpus");
+
+  if (lua_isnil(LuaState, -1))
+  {
+    MaskSize = 0;
+  }
+  else
   {
-    InstanceOffset = 1;
-    Continue       = true;
+    luaL_argcheck(LuaState, lua_istable(LuaState, -1), TableIndex, "option 'cpus' must be a table");
 
-    while (Continue)
+    MaskSize = uv_cpumask_size();
+    if (MaskSize <= 0)
     {
-      uv_mutex_lock(&Application->InstanceArrayMutex);
-      InstanceCapacity = TA_GetCapacity(Application->InstanceArray);
+      luaL_error(LuaState, "option 'cpus' is not supported on this platform");
+    }
 
-      if (InstanceOffset <= InstanceCapacity)
-      {
-        if (TA_IsValid(Application->InstanceArray, InstanceOffset))
-        {
-          TargetInstance = TA_GetObject(Application->InstanceArray, InstanceOffset);
-
-          if (TargetInstance)
-          {
-            uv_mutex_lock(&TargetInstance->EventMutex);
-            PendingEvents = TargetInstance->EventBufferReceive;
-            APP_CopyEventArguments(LuaState, PendingEvents, 1, ArgumentCount);
-            uv_mutex_unlock(&TargetInstance->EventMutex);
-
-            uv_mutex_lock(&TargetInstance->StateMutex);
-            APP_BIT_SET(TargetInstance->State, INSTANCE_MASK_EVENTS_PENDING);
-            uv_cond_signal(&TargetInstance->StateCondition);
-            uv_mutex_unlock(&TargetInstance->StateMutex);
-          }
-        }
-        InstanceOffset++;
-      }
-      else
+    CpuCount = luaL_len(LuaState, -1);
+    if (CpuCount == 0)
+    {
+      luaL_error(LuaState, "option 'cpus' must not be empty");
+    }
+
+    for (Index = 1; Index <= CpuCount; Index++)
+    {
+      lua_rawgeti(LuaState, -1, Index);
+      Cpu = (lua_isinteger(LuaState, -1) ? lua_tointeger(LuaState, -1) : -1);
+      if ((Cpu < 0) || (Cpu >= MaskSize))
       {
-        Continue = false;
+        luaL_error(LuaState, "option 'cpus': invalid CPU at index %d", (int)Index);
       }
-
-      uv_mutex_unlock(&Application->InstanceArrayMutex);
+      lua_pop(LuaState, 1);
     }
   }
 
-  return 0; /* Number of values returned on the stack */
+  lua_pop(LuaState, 1);
+
+  return (size_t)MaskSize;
 }
 
-/* One could imagine that we could PostEvent an "ExitLoop" event to self but
- * this seems a bad idea. In LUA_RunEventLoop, we need an exit condition. This
- * exit condition is good to put the instance state. If we don't use that, we
- * would need an additional information such as ExitLoopProcessed, with
- * potentially another mutex/condition.
- */ 
-static int LUA_CloseEventLoop (lua_State *LuaState)
+/* Options.cpus has been checked by APP_CheckCpusOption */
+static char *APP_NewCpuMask (lua_State *LuaState,
+                             int32_t    TableIndex,
+                             size_t     MaskSize)
 {
-  struct LUA_Instance *Instance = LUA_GetInstance(LuaState);
-
-  uv_mutex_lock(&Instance->StateMutex);
-  APP_BIT_SET(Instance->State, INSTANCE_MASK_LOOP_CLOSE_REQUEST);
-  uv_cond_signal(&Instance->StateCondition);
-  uv_mutex_unlock(&Instance->StateMutex);
+  char        *CpuMask = PLAT_SafeAlloc0(MaskSize, sizeof(char));
+  lua_Integer  CpuCount;
+  lua_Integer  Index;
 
-  return 0; /* Number of values returned on the stack */
-}
+  lua_getfield(LuaState, TableIndex, "cpus");
 
-static size_t LUA_ProcessSingleEvent (lua_State           *LuaState,
-                                      struct BA_Allocator *PendingEvents,
-                                      uint32_t             TokenIndex,
-                                      uint32_t             EventCount)
-{
-  size_t             TokenProcessed;
-  struct MAIN_Event *Event;
-  size_t             EventSizeInBytes;
-  const char        *FunctionName;
-  int32_t            ArgumentCount;
-  bool               IsProcessing;
-  int32_t            Status;
+  CpuCount = luaL_len(LuaState, -1);
+  for (Index = 1; Index <= CpuCount; Index++)
+  {
+    lua_rawgeti(LuaState, -1, Index);
+    CpuMask[lua_tointeger(LuaState, -1)] = 1;
+    lua_pop(LuaState, 1);
+  }
 
-  /* Get argument count from START event */
-  BA_GetBlob(PendingEvents, TokenIndex, (uint8_t **)&Event, &EventSizeInBytes);
-  ArgumentCount = (Event->Data.Start.ArgumentCount - 1);
-  TokenIndex++;
+  lua_pop(LuaState, 1);
 
-  /* Get function name */
-  BA_GetBlob(PendingEvents, TokenIndex, (uint8_t **)&Event, &EventSizeInBytes);
-  FunctionName = Event->Data.String.Value;
-  TokenIndex++;
+  return CpuMask;
+}
 
-  TokenProcessed = 2;
+/* All the options are checked before allocating the CPU mask and the
+ * arguments, an invalid option leaks nothing */
+static void APP_ReadThreadOptions (lua_State                *LuaState,
+                                   int32_t                   TableIndex,
+                                   struct APP_ThreadOptions *Options)
+{
+  size_t MaskSize;
 
-  /* Get function */
-  lua_getglobal(LuaState, FunctionName);
+  memset(Options, 0, sizeof(struct APP_ThreadOptions));
 
-  if (lua_isnil(LuaState, -1))
+  if (!lua_isnoneornil(LuaState, TableIndex))
   {
-    lua_pop(LuaState, 1);  /* Pop the nil value */
-    fprintf(stderr, "ERROR: function '%s' not found\n", FunctionName);
-    exit(3);
+    luaL_checktype(LuaState, TableIndex, LUA_TTABLE);
+
+    Options->MaxMessages = APP_GetSizeOption(LuaState, TableIndex, "maxmessages");
+    Options->MaxBytes    = APP_GetSizeOption(LuaState, TableIndex, "maxbytes");
+    Options->MaxMemory   = APP_GetSizeOption(LuaState, TableIndex, "maxmemory");
+    Options->StackSize   = APP_GetSizeOption(LuaState, TableIndex, "stacksize");
+    Options->HasPriority = APP_GetPriorityOption(LuaState, TableIndex, &Options->Priority);
+    Options->ThreadName  = APP_GetNameOption(LuaState, TableIndex);
+    MaskSize             = APP_CheckCpusOption(LuaState, TableIndex);
+    Options->Arguments   = APP_ReadArgumentsOption(LuaState, TableIndex);
+
+    if (MaskSize > 0)
+    {
+      Options->CpuMask = APP_NewCpuMask(LuaState, TableIndex, MaskSize);
+    }
   }
+}
 
-  IsProcessing = true;
+/* NewThread(ComponentName, ExitEventName, Options) */
+static int LUA_NewThread (lua_State *LuaState)
+{
+  struct LUA_Instance      *Instance      = LUA_GetInstance(LuaState);
+  struct LUA_Application   *Application   = Instance->Application;
+  int32_t                   ArgumentCount = lua_gettop(LuaState);
+  const char               *ThreadEventName;
+  const char               *ComponentName;
+  size_t                    ComponentNameLength;
+  struct LUA_Instance      *ChildInstance;
+  struct APP_ThreadOptions  Options;
 
-  /* Process arguments */
-  while (IsProcessing && (TokenIndex <= EventCount))
+  if ((ArgumentCount >= 1) && (lua_isstring(LuaState, 1)))
   {
-    BA_GetBlob(PendingEvents, TokenIndex++, (uint8_t **)&Event, &EventSizeInBytes);
-    TokenProcessed++;
+    ComponentName = lua_tolstring(LuaState, 1, &ComponentNameLength);
 
-    switch (Event->Type)
-    {
-    case INSTANCE_EVENT_PARAM_BOOLEAN:
-      lua_pushboolean(LuaState, Event->Data.Boolean.Value);
-      break;
+    APP_ReadThreadOptions(LuaState, 3, &Options);
 
-    case INSTANCE_EVENT_PARAM_INTEGER:
-      lua_pushinteger(LuaState, Event->Data.Integer.Value);
-      break;
+    if ((ArgumentCount >= 2) && lua_isstring(LuaState, 2))
+    {
+      ThreadEventName = lua_tostring(LuaState, 2);
+    }
+    else
+    {
+      ThreadEventName = NULL;
+    }
 
-    case INSTANCE_EVENT_PARAM_DOUBLE:
-      lua_pushnumber(LuaState, Event->Data.Double.Value);
-      break;
+    /* The pooled threads have the default stack size and priority */
+    if ((Options.StackSize == 0) && !Options.HasPriority)
+    {
+      ChildInstance = APP_ClaimPooledInstance(Application, Instance, ComponentName, ThreadEventName, &Options);
+    }
+    else
+    {
+      ChildInstance = NULL;
+    }
 
-    case INSTANCE_EVENT_PARAM_STRING:
-      lua_pushlstring(LuaState, Event->Data.String.Value, Event->Data.String.Length);
-      break;
+    if (ChildInstance == NULL)
+    {
+      ChildInstance = APP_CreateInstance(Application, Instance, ComponentName, ThreadEventName, &Options);
+    }
 
-    case INSTANCE_EVENT_PARAM_NIL:
-      lua_pushnil(LuaState);
-      break;
+    lua_pushinteger(LuaState, ChildInstance->Offset);
+  }
+  else
+  {
+    lua_pushnil(LuaState);
+  }
 
-    case INSTANCE_EVENT_PARAM_USERDATA:
-      lua_pushlightuserdata(LuaState, Event->Data.UserData.Value);
-      break;
+  return 1; /* Number of values returned on the stack */
+}
 
-    case INSTANCE_EVENT_END:
-      Status = lua_pcall(LuaState, ArgumentCount, 0, 0);
-      if (Status != LUA_OK)
-      {
-        fprintf(stderr, "ERROR: Failed to call function '%s': %s\n",
-                FunctionName, lua_tostring(LuaState, -1));
-        lua_pop(LuaState, 1);  /* Pop the error message */
-      }
-      IsProcessing = false;
-      break;
+static int LUA_GetThreadId (lua_State *LuaState)
+{
+  struct LUA_Instance *Instance = LUA_GetInstance(LuaState);
 
-    default:
-      fprintf(stderr, "ERROR: Unknown event type %d\n", Event->Type);
-      exit(4);
-      break;
-    }
-  }
+  /* Push instance key on the stack */
+  lua_pushinteger(LuaState, Instance->Offset);
 
-  return TokenProcessed;
+  return 1; /* Number of values returned on the stack */
 }
 
-static void LUA_ProcessEventsIfNeeded (lua_State           *LuaState,
-                                       struct LUA_Instance *Instance)
+static int LUA_GetThreadModuleName (lua_State *LuaState)
 {
- struct BA_Allocator *PendingEvents;
- uint32_t             TokenCount;
- uint32_t             TokenIndex;
- uint32_t             ProcessedTokens;
+  struct LUA_Instance *Instance = LUA_GetInstance(LuaState);
+
+  /* Push module name on the stack */
+  lua_pushstring(LuaState, Instance->ModuleName);
+
+  return 1; /* Number of values returned on the stack */
+}
 
-  uv_mutex_lock(&Instance->EventMutex);
-  TokenCount = BA_GetCount(Instance->EventBufferReceive);
+/* Return the values of Options.arguments given to Thread.create */
+static int LUA_GetThreadArguments (lua_State *LuaState)
+{
+  struct LUA_Instance *Instance = LUA_GetInstance(LuaState);
+  int                  ResultCount;
 
-  if (TokenCount == 0)
+  if (Instance->Arguments)
   {
-    uv_mutex_unlock(&Instance->EventMutex);
+    ResultCount = EM_PushValues(LuaState, Instance->Arguments);
   }
   else
   {
-    /* Swap buffers and unlock */
-    PendingEvents = Instance->EventBufferReceive;
-    Instance->EventBufferReceive = Instance->EventBufferTemp;
-    Instance->EventBufferTemp    = PendingEvents;
-
-    /* Update state */
-    uv_mutex_lock(&Instance->StateMutex);
-    APP_BIT_CLEAR(Instance->State, INSTANCE_MASK_EVENTS_PENDING);
-    uv_mutex_unlock(&Instance->StateMutex);
+    ResultCount = 0;
+  }
 
-    /* Unlock event */
-    uv_mutex_unlock(&Instance->EventMutex);
+  return ResultCount; /* Number of values returned on the stack */
+}
 
-    /* Process events */
-    TokenIndex = 1;
+static void LUA_WaitAndRelease (struct LUA_Application *Application,
+                                struct LUA_Instance    *TargetInstance)
+{
+  bool Recycle;
 
-    /* During the processing, events can still be enqueued */
-    while (TokenIndex <= TokenCount)
+  if (TargetInstance->Poolable)
+  {
+    /* The thread doesn't terminate, wait for the end of the module */
+    uv_mutex_lock(&TargetInstance->StateMutex);
+    while ((TargetInstance->State & INSTANCE_MASK_FINISHED) == 0)
     {
-      ProcessedTokens = LUA_ProcessSingleEvent(LuaState, PendingEvents, TokenIndex, TokenCount);
-      TokenIndex += ProcessedTokens;
+      uv_cond_wait(&TargetInstance->JoinCondition, &TargetInstance->StateMutex);
     }
-
-    BA_Reset(PendingEvents);
+    uv_mutex_unlock(&TargetInstance->StateMutex);
+  }
+  else
+  {
+    /* Wait for thread execution */
+    uv_thread_join(&TargetInstance->Thread);
   }
-}
 
-static int LUA_ProcessEvents (lua_State *LuaState)
-{
-  struct LUA_Instance *Instance = LUA_GetInstance(LuaState);
+  /* Remove the name and remove from array together, then wait for the
+   * senders still using the instance: its mailbox is closed, they don't block
+   * anymore */
+  uv_mutex_lock(&Application->InstanceArrayMutex);
+  uv_rwlock_wrlock(&Application->NameLock);
+  APP_RemoveRegisteredName(Application, TargetInstance);
+  uv_rwlock_wrunlock(&Application->NameLock);
+  TA_RemoveObject(Application->InstanceArray, TargetInstance->Offset);
+  APP_RemoveFromTree(Application, TargetInstance);
+  APP_UnsubscribeInstance(Application, TargetInstance);
+  APP_WaitUntilUnpinned(Application, TargetInstance);
+  uv_mutex_unlock(&Application->InstanceArrayMutex);
 
-  LUA_ProcessEventsIfNeeded(LuaState, Instance);
+  if (TargetInstance->Poolable)
+  {
+    Recycle = APP_ReservePoolSlot(Application);
 
-  return 0; /* Number of values returned on the stack */
+    /* Unblock the instance, it will go back to the pool or terminate */
+    uv_mutex_lock(&TargetInstance->StateMutex);
+    APP_BIT_SET(TargetInstance->State, INSTANCE_MASK_JOINED);
+    if (Recycle)
+    {
+      APP_BIT_SET(TargetInstance->State, INSTANCE_MASK_RECYCLE);
+    }
+    uv_cond_broadcast(&TargetInstance->JoinCondition);
+    uv_mutex_unlock(&TargetInstance->StateMutex);
+
+    if (!Recycle)
+    {
+      uv_thread_join(&TargetInstance->Thread);
+      APP_ReleaseInstance(TargetInstance);
+    }
+  }
+  else
+  {
+    /* Release resources */
+    APP_ReleaseInstance(TargetInstance);
+  }
 }
 
-static int LUA_RunEventLoop (lua_State *LuaState)
+static int LUA_JoinThread (lua_State *LuaState)
 {
-  struct LUA_Instance *Instance = LUA_GetInstance(LuaState);
-  bool                 Continue = true;
-  
-  const uint32_t MASK_STOP = (INSTANCE_MASK_EVENTS_PENDING | INSTANCE_MASK_LOOP_CLOSE_REQUEST);
-  
-  while (Continue)
+  struct LUA_Instance    *Instance      = LUA_GetInstance(LuaState);
+  struct LUA_Application *Application   = Instance->Application;
+  int32_t                 ArgumentCount = lua_gettop(LuaState);
+  bool                    Success       = false;
+  int64_t                 ThreadId;
+  struct LUA_Instance    *TargetInstance;
+
+  if ((ArgumentCount >= 1) && lua_isinteger(LuaState, 1))
   {
-    LUA_ProcessEventsIfNeeded(LuaState, Instance);
+    ThreadId = lua_tointeger(LuaState, 1);
 
-    uv_mutex_lock(&Instance->StateMutex);
-    while ((Instance->State & MASK_STOP) == 0)
+    uv_mutex_lock(&Application->InstanceArrayMutex);
+    if (TA_IsValid(Application->InstanceArray, ThreadId))
     {
-      uv_cond_wait(&Instance->StateCondition, &Instance->StateMutex);
+      TargetInstance = TA_GetObject(Application->InstanceArray, ThreadId);
+    }
+    else
+    {
+      TargetInstance = NULL;
+    }
+    uv_mutex_unlock(&Application->InstanceArrayMutex);
+
+    if (TargetInstance)
+    {
+      LUA_WaitAndRelease(Application, TargetInstance);
+      Success = true;
     }
-    Continue = ((Instance->State & INSTANCE_MASK_LOOP_CLOSE_REQUEST) == 0);
-    uv_mutex_unlock(&Instance->StateMutex);
   }
 
-  return 0; /* Number of values returned on the stack */
+  lua_pushboolean(LuaState, Success);
+  
+  return 1; /* Number of values returned on the stack */
 }
 
-/* API will be reworked at runtime by init.lua */
-static const struct luaL_Reg EVENTS_FUNCTIONS[] =
+/* SetPoolSize(Size), a size of 0 disable the pool */
+static int LUA_SetPoolSize (lua_State *LuaState)
 {
-  { "runloop",   LUA_RunEventLoop   },
-  { "stoploop",  LUA_CloseEventLoop },
-  { "runonce",   LUA_ProcessEvents  },
-  { "send",      LUA_PostEvent      },
-  { "broadcast", LUA_BroadcastEvent },
-  { NULL,        NULL               }
-};
+  struct LUA_Instance    *Instance    = LUA_GetInstance(LuaState);
+  struct LUA_Application *Application = Instance->Application;
+  lua_Integer             PoolSize    = luaL_checkinteger(LuaState, 1);
 
-static int luaopen_events (lua_State *LuaState)
-{
-  luaL_newlib(LuaState, EVENTS_FUNCTIONS);
-  
-  return 1; /* Number of values returned on the stack */
-}
+  luaL_argcheck(LuaState, (PoolSize >= 0), 1, "pool size must be non-negative");
 
-/*============================================================================*/
-/* RUNTIME API                                                                */
-/*============================================================================*/
+  APP_SetPoolSize(Application, (size_t)PoolSize);
 
-static int LUA_GetLoaderConfiguration (lua_State *LuaState)
+  return 0; /* Number of values returned on the stack */
+}
+
+static int LUA_GetPoolStats (lua_State *LuaState)
 {
   struct LUA_Instance    *Instance    = LUA_GetInstance(LuaState);
   struct LUA_Application *Application = Instance->Application;
+  struct APP_Pool        *Pool        = &Application->Pool;
 
-  lua_pushstring(LuaState, (const char *)Application->LoaderConfiguration);
+  lua_createtable(LuaState, 0, 6); /* State, Array, Keys */
+
+  uv_mutex_lock(&Pool->PoolMutex);
+  APP_SetIntegerField(LuaState, "size",     (lua_Integer)Pool->PoolSize);
+  APP_SetIntegerField(LuaState, "idle",     (lua_Integer)Pool->IdleCount);
+  APP_SetIntegerField(LuaState, "warming",  (lua_Integer)Pool->WarmingCount);
+  APP_SetIntegerField(LuaState, "hits",     (lua_Integer)Pool->Hits);
+  APP_SetIntegerField(LuaState, "misses",   (lua_Integer)Pool->Misses);
+  APP_SetIntegerField(LuaState, "recycled", (lua_Integer)Pool->Recycled);
+  uv_mutex_unlock(&Pool->PoolMutex);
 
   return 1; /* Number of values returned on the stack */
 }
 
-static void APP_WarningCallback (void *ud, const char *msg, int tocont) 
+/* GetMemoryStats([ThreadId]), the current thread by default. Return nil if
+ * the thread ID is invalid. */
+static int LUA_GetMemoryStats (lua_State *LuaState)
 {
-  struct LUA_Instance *Instance = (struct LUA_Instance *)ud;
-  lua_State           *LuaState = Instance->LuaState;
-  int                  LuaType;
-  const char          *ErrorMessage;
-    
-  /* Get the stored Lua warning function */
-  if (Instance->WarningFunctionRef != LUA_REFNIL)
+  struct LUA_Instance    *Instance    = LUA_GetInstance(LuaState);
+  struct LUA_Application *Application = Instance->Application;
+  lua_Integer             InstanceId  = luaL_optinteger(LuaState, 1, (lua_Integer)Instance->Offset);
+  struct LUA_Instance    *TargetInstance;
+
+  lua_createtable(LuaState, 0, 5); /* State, Array, Keys */
+
+  /* The target can't be released while InstanceArrayMutex is locked */
+  uv_mutex_lock(&Application->InstanceArrayMutex);
+  if (TA_IsValid(Application->InstanceArray, InstanceId))
   {
-    LuaType = lua_rawgeti(LuaState, LUA_REGISTRYINDEX, Instance->WarningFunctionRef);
-    
+    TargetInstance = TA_GetObject(Application->InstanceArray, InstanceId);
+  }
+  else
+  {
+    TargetInstance = NULL;
+  }
+
+  if (TargetInstance)
+  {
+    APP_SetIntegerField(LuaState, "bytes",       (lua_Integer)__atomic_load_n(&TargetInstance->MemoryBytes,       __ATOMIC_RELAXED));
+    APP_SetIntegerField(LuaState, "peak",        (lua_Integer)__atomic_load_n(&TargetInstance->MemoryPeak,        __ATOMIC_RELAXED));
+    APP_SetIntegerField(LuaState, "allocations", (lua_Integer)__atomic_load_n(&TargetInstance->MemoryAllocations, __ATOMIC_RELAXED));
+    APP_SetIntegerField(LuaState, "refused",     (lua_Integer)__atomic_load_n(&TargetInstance->MemoryRefused,     __ATOMIC_RELAXED));
+    APP_SetIntegerField(LuaState, "maxmemory",   (lua_Integer)TargetInstance->MaxMemory);
+  }
+  uv_mutex_unlock(&Application->InstanceArrayMutex);
+
+  if (TargetInstance == NULL)
+  {
+    lua_pushnil(LuaState);
+  }
+
+  return 1; /* Number of values returned on the stack */
+}
+
+/* Number of CPUs the process can run on, to size the pools */
+static int LUA_GetCpuCount (lua_State *LuaState)
+{
+  lua_pushinteger(LuaState, (lua_Integer)uv_available_parallelism());
+
+  return 1; /* Number of values returned on the stack */
+}
+
+static const struct luaL_Reg THREADS_FUNCTIONS[] = 
+{
+  { "create",         LUA_NewThread           },
+  { "getid",          LUA_GetThreadId         },
+  { "getname",        LUA_GetThreadModuleName },
+  { "getarguments",   LUA_GetThreadArguments  },
+  { "join",           LUA_JoinThread          },
+  { "setpoolsize",    LUA_SetPoolSize         },
+  { "getpoolstats",   LUA_GetPoolStats        },
+  { "getmemorystats", LUA_GetMemoryStats      },
+  { "getcpucount",    LUA_GetCpuCount         },
+  { "register",       LUA_RegisterThread      },
+  { "unregister",     LUA_UnregisterThread    },
+  { "whereis",        LUA_WhereIsThread       },
+  { "call",           LUA_CallThread          },
+  { "calltimeout",    LUA_CallThreadTimeout   },
+  { "postcall",       LUA_PostCall            },
+  { "getreply",       LUA_GetReply            },
+  { NULL,             NULL                    }
+};
+
+static int luaopen_threads (lua_State *LuaState)
+{
+  luaL_newlib(LuaState, THREADS_FUNCTIONS);
+  
+  return 1; /* Number of values returned on the stack */
+}
+
+/*============================================================================*/
+/* EVENTS API                                                                 */
+/*============================================================================*/
+
+/* Return the ID of EventName, a new ID is assigned on the first call. The IDs
+ * are shared by all the instances and start at 1, the names are kept until
+ * the application is freed. */
+static lua_Integer APP_InternEventName (struct LUA_Application *Application,
+                                        const char             *EventName,
+                                        size_t                  EventNameLength)
+{
+  uintptr_t EventId;
+  char     *NameCopy;
+
+  uv_mutex_lock(&Application->EventNameMutex);
+  EventId = (uintptr_t)TH_GetObject(Application->EventIdMap, EventName, EventNameLength);
+
+  if (EventId == 0)
+  {
+    if (Application->EventNameCount == Application->EventNameCapacity)
+    {
+      Application->EventNameCapacity = (Application->EventNameCapacity * 2);
+      Application->EventNames        = PLAT_SafeRealloc(Application->EventNames,
+                                                        (Application->EventNameCapacity * sizeof(char *)));
+    }
+
+    NameCopy = PLAT_SafeAlloc0(1, (EventNameLength + 1));
+    memcpy(NameCopy, EventName, EventNameLength);
+
+    EventId = Application->EventNameCount++;
+    Application->EventNames[EventId] = NameCopy;
+    TH_SetObject(Application->EventIdMap, EventName, EventNameLength, (void *)EventId);
+  }
+  uv_mutex_unlock(&Application->EventNameMutex);
+
+  return (lua_Integer)EventId;
+}
+
+/* Return 0 if EventName has no ID */
+static lua_Integer APP_FindEventId (struct LUA_Application *Application,
+                                    const char             *EventName,
+                                    size_t                  EventNameLength)
+{
+  uintptr_t EventId;
+
+  uv_mutex_lock(&Application->EventNameMutex);
+  EventId = (uintptr_t)TH_GetObject(Application->EventIdMap, EventName, EventNameLength);
+  uv_mutex_unlock(&Application->EventNameMutex);
+
+  return (lua_Integer)EventId;
+}
+
+/* Return NULL if EventId is unknown */
+static const char *APP_GetEventName (struct LUA_Application *Application,
+                                     lua_Integer             EventId)
+{
+  const char *EventName;
+
+  uv_mutex_lock(&Application->EventNameMutex);
+  if ((EventId > 0) && ((size_t)EventId < Application->EventNameCount))
+  {
+    EventName = Application->EventNames[EventId];
+  }
+  else
+  {
+    EventName = NULL;
+  }
+  uv_mutex_unlock(&Application->EventNameMutex);
+
+  return EventName;
+}
+
+/* An event is identified by its name or by its ID */
+static void APP_CheckEventName (lua_State *LuaState, int32_t Index)
+{
+  if ((lua_type(LuaState, Index) != LUA_TSTRING) && !lua_isinteger(LuaState, Index))
+  {
+    luaL_error(LuaState, "PostEvent(EventName, ...): ERROR EventName must be a string or an event ID");
+  }
+}
+
+/* Serialize the arguments StartIndex..EndIndex in the writer of the sender.
+ * This is done before looking for the target, outside of any lock. */
+static void APP_EncodeEvent (lua_State           *LuaState,
+                             struct LUA_Instance *Instance,
+                             int32_t              StartIndex,
+                             int32_t              EndIndex)
+{
+  struct EM_Writer *Writer = &Instance->MessageWriter;
+  int32_t           Index;
+
+  EM_ResetWriter(Writer);
+
+  for (Index = StartIndex; Index <= EndIndex; Index++)
+  {
+    if (!EM_WriteLuaValue(Writer, LuaState, Index))
+    {
+      /* Nothing has been delivered yet */
+      luaL_error(LuaState,
+                 "PostEvent param %d: %s '%s'",
+                 Index,
+                 Writer->ErrorReason,
+                 lua_typename(LuaState, Writer->ErrorType));
+    }
+  }
+}
+
+/* uv_async_send can be called from any thread. Must be called with StateMutex
+ * locked: the thread disables the handle under this mutex before closing its
+ * lua_State. */
+static void APP_WakeUpLoop (struct LUA_Instance *Instance)
+{
+  if (__atomic_load_n(&Instance->AsyncEnabled, __ATOMIC_ACQUIRE))
+  {
+    uv_async_send(&Instance->EventAsync);
+  }
+}
+
+/* Add Amount to Counter if the result stays within Limit, 0 is unbounded. An
+ * empty mailbox accepts a message larger than the limit, otherwise such a
+ * message could never be sent. */
+static bool APP_TryAddCounter (size_t *Counter, size_t Amount, size_t Limit)
+{
+  size_t Current = __atomic_load_n(Counter, __ATOMIC_SEQ_CST);
+  bool   Added   = false;
+  bool   Full    = false;
+
+  while (!Added && !Full)
+  {
+    if ((Limit > 0) && (Current > 0) && ((Current + Amount) > Limit))
+    {
+      Full = true;
+    }
+    else
+    {
+      Added = __atomic_compare_exchange_n(Counter, &Current, (Current + Amount), true,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    }
+  }
+
+  return Added;
+}
+
+static void APP_UpdateHighWater (struct LUA_Instance *TargetInstance, size_t Depth)
+{
+  size_t HighWater = __atomic_load_n(&TargetInstance->MailboxHighWater, __ATOMIC_RELAXED);
+
+  while ((Depth > HighWater)
+         && !__atomic_compare_exchange_n(&TargetInstance->MailboxHighWater, &HighWater, Depth, true,
+                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+  {
+    /* HighWater has been updated by the compare exchange */
+  }
+}
+
+/* Reserve the room for a message in the mailbox of the target, before the
+ * delivery. When Bounded is false, the limits are ignored: the exit events and
+ * the service notifications are never dropped. */
+static bool APP_ReserveMailbox (struct LUA_Instance *TargetInstance,
+                                size_t               SizeInBytes,
+                                bool                 Bounded)
+{
+  size_t MaxMessages = (Bounded ? TargetInstance->MailboxMaxMessages : 0);
+  size_t MaxBytes    = (Bounded ? TargetInstance->MailboxMaxBytes    : 0);
+  bool   Reserved;
+
+  if (APP_TryAddCounter(&TargetInstance->MailboxMessages, 1, MaxMessages))
+  {
+    Reserved = APP_TryAddCounter(&TargetInstance->MailboxBytes, SizeInBytes, MaxBytes);
+
+    if (!Reserved)
+    {
+      __atomic_sub_fetch(&TargetInstance->MailboxMessages, 1, __ATOMIC_SEQ_CST);
+    }
+  }
+  else
+  {
+    Reserved = false;
+  }
+
+  if (Reserved)
+  {
+    APP_UpdateHighWater(TargetInstance, __atomic_load_n(&TargetInstance->MailboxMessages, __ATOMIC_RELAXED));
+    __atomic_add_fetch(&TargetInstance->MailboxEnqueued, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&TargetInstance->MailboxBytesEnqueued, SizeInBytes, __ATOMIC_RELAXED);
+  }
+
+  return Reserved;
+}
+
+/* Called by the receiver once a message is freed. The blocked senders are
+ * registered in MailboxWaiters before their last attempt, so StateMutex is
+ * only taken when somebody is waiting. */
+static void APP_ReleaseMailbox (struct LUA_Instance *Instance, size_t SizeInBytes)
+{
+  __atomic_sub_fetch(&Instance->MailboxMessages, 1, __ATOMIC_SEQ_CST);
+  __atomic_sub_fetch(&Instance->MailboxBytes, SizeInBytes, __ATOMIC_SEQ_CST);
+
+  if (__atomic_load_n(&Instance->MailboxWaiters, __ATOMIC_SEQ_CST) > 0)
+  {
+    uv_mutex_lock(&Instance->StateMutex);
+    uv_cond_broadcast(&Instance->MailboxCondition);
+    uv_mutex_unlock(&Instance->StateMutex);
+  }
+}
+
+/* MailboxClosed is written under StateMutex, read without it by the senders */
+static bool APP_IsMailboxClosed (struct LUA_Instance *Instance)
+{
+  return __atomic_load_n(&Instance->MailboxClosed, __ATOMIC_SEQ_CST);
+}
+
+/* Wait at most TimeoutMs milliseconds for some room in the mailbox of the
+ * target, forever if TimeoutMs is negative. Return false on timeout, or when
+ * the target finishes its module while the sender is waiting. */
+static bool APP_WaitForMailbox (struct LUA_Instance *TargetInstance,
+                                size_t               SizeInBytes,
+                                int64_t              TimeoutMs)
+{
+  bool     Reserved = APP_ReserveMailbox(TargetInstance, SizeInBytes, true);
+  bool     Expired  = false;
+  uint64_t Deadline;
+  uint64_t Now;
+
+  if (!Reserved && (TimeoutMs != 0))
+  {
+    __atomic_add_fetch(&TargetInstance->MailboxBlocked, 1, __ATOMIC_RELAXED);
+    Deadline = (uv_hrtime() + ((uint64_t)TimeoutMs * 1000000));
+
+    uv_mutex_lock(&TargetInstance->StateMutex);
+    __atomic_add_fetch(&TargetInstance->MailboxWaiters, 1, __ATOMIC_SEQ_CST);
+
+    Reserved = APP_ReserveMailbox(TargetInstance, SizeInBytes, true);
+
+    while (!(Reserved || Expired || TargetInstance->MailboxClosed))
+    {
+      if (TimeoutMs < 0)
+      {
+        uv_cond_wait(&TargetInstance->MailboxCondition, &TargetInstance->StateMutex);
+      }
+      else
+      {
+        Now = uv_hrtime();
+
+        if (Now < Deadline)
+        {
+          uv_cond_timedwait(&TargetInstance->MailboxCondition, &TargetInstance->StateMutex, (Deadline - Now));
+        }
+        else
+        {
+          Expired = true;
+        }
+      }
+
+      if (!Expired)
+      {
+        Reserved = APP_ReserveMailbox(TargetInstance, SizeInBytes, true);
+      }
+    }
+
+    __atomic_sub_fetch(&TargetInstance->MailboxWaiters, 1, __ATOMIC_SEQ_CST);
+    uv_mutex_unlock(&TargetInstance->StateMutex);
+  }
+
+  return Reserved;
+}
+
+/* The target is only woken up when its mailbox was empty: if it was not, the
+ * target has not processed the previous messages yet and will see this one
+ * too */
+static void APP_DeliverMessage (struct LUA_Instance *TargetInstance,
+                                struct EM_Message   *Message)
+{
+  if (MQ_Push(&TargetInstance->Mailbox, EM_GetNode(Message)))
+  {
+    uv_mutex_lock(&TargetInstance->StateMutex);
+    APP_BIT_SET(TargetInstance->State, INSTANCE_MASK_EVENTS_PENDING);
+    uv_cond_signal(&TargetInstance->StateCondition);
+    APP_WakeUpLoop(TargetInstance);
+    uv_mutex_unlock(&TargetInstance->StateMutex);
+  }
+}
+
+/* Like APP_DeliverMessage for the senders racing with the end of the module:
+ * the target closes its mailbox under StateMutex before discarding it, so
+ * checking MailboxClosed and pushing under StateMutex guarantees that the
+ * message is either discarded by the target or not pushed at all. When the
+ * mailbox is closed, the message is freed, the room reserved for it is
+ * released and false is returned. */
+static bool APP_DeliverMessageIfOpen (struct LUA_Instance *TargetInstance,
+                                      struct EM_Message   *Message)
+{
+  size_t SizeInBytes = EM_GetSizeInBytes(Message);
+  bool   Delivered;
+
+  uv_mutex_lock(&TargetInstance->StateMutex);
+  if (TargetInstance->MailboxClosed)
+  {
+    Delivered = false;
+  }
+  else
+  {
+    if (MQ_Push(&TargetInstance->Mailbox, EM_GetNode(Message)))
+    {
+      APP_BIT_SET(TargetInstance->State, INSTANCE_MASK_EVENTS_PENDING);
+      uv_cond_signal(&TargetInstance->StateCondition);
+      APP_WakeUpLoop(TargetInstance);
+    }
+    Delivered = true;
+  }
+  uv_mutex_unlock(&TargetInstance->StateMutex);
+
+  if (!Delivered)
+  {
+    EM_FreeMessage(Message);
+    APP_ReleaseMailbox(TargetInstance, SizeInBytes);
+  }
+
+  return Delivered;
+}
+
+/* The reply is dropped if the caller is gone or not waiting for this call
+ * anymore. Holding InstanceArrayMutex, the caller can't be released. */
+static void APP_DeliverReply (struct LUA_Application *Application,
+                              struct EM_Message      *Call,
+                              struct EM_Writer       *Writer)
+{
+  struct EM_Message   *Reply = EM_NewMessage(Writer);
+  struct LUA_Instance *CallerInstance;
+
+  uv_mutex_lock(&Application->InstanceArrayMutex);
+  if (TA_IsValid(Application->InstanceArray, EM_GetCallerId(Call)))
+  {
+    CallerInstance = TA_GetObject(Application->InstanceArray, EM_GetCallerId(Call));
+  }
+  else
+  {
+    CallerInstance = NULL;
+  }
+
+  if (CallerInstance)
+  {
+    uv_mutex_lock(&CallerInstance->StateMutex);
+    if ((CallerInstance->PendingCallId == EM_GetCallId(Call)) && (CallerInstance->Reply == NULL))
+    {
+      CallerInstance->Reply = Reply;
+      Reply                 = NULL;
+      uv_cond_signal(&CallerInstance->ReplyCondition);
+    }
+    uv_mutex_unlock(&CallerInstance->StateMutex);
+  }
+  uv_mutex_unlock(&Application->InstanceArrayMutex);
+
+  if (Reply)
+  {
+    EM_FreeMessage(Reply);
+  }
+}
+
+/* Reply false and ErrorMessage, this thread might have no writer */
+static void APP_DeliverErrorReply (struct LUA_Application *Application,
+                                   struct EM_Message      *Call,
+                                   const char             *ErrorMessage)
+{
+  struct EM_Writer Writer;
+
+  EM_InitWriter(&Writer);
+  EM_WriteBoolean(&Writer, false);
+  EM_WriteString(&Writer, ErrorMessage, strlen(ErrorMessage));
+  APP_DeliverReply(Application, Call, &Writer);
+  EM_FreeWriter(&Writer);
+}
+
+/* Only called by the thread owning the mailbox, or once the thread is done.
+ * The callers waiting for a discarded call get an error immediately. */
+static void APP_DiscardMessages (struct LUA_Instance *Instance)
+{
+  struct MQ_Node    *Node;
+  struct EM_Message *Message;
+  size_t             SizeInBytes;
+
+  while ((Node = MQ_Pop(&Instance->Mailbox)) != NULL)
+  {
+    Message     = EM_GetMessage(Node);
+    SizeInBytes = EM_GetSizeInBytes(Message);
+
+    if (EM_GetCallId(Message) != 0)
+    {
+      APP_DeliverErrorReply(Instance->Application, Message, "thread finished");
+    }
+
+    EM_FreeMessage(Message);
+    APP_ReleaseMailbox(Instance, SizeInBytes);
+  }
+}
+
+/* Send the event EventIndex..top to the target at TargetIndex, a thread ID or
+ * a name. Return false when the target does not exist or finishes its module,
+ * false and "full" when the mailbox of the target stays full for TimeoutMs
+ * milliseconds. The target is pinned while waiting, Thread.join can't release
+ * it meanwhile. */
+static int APP_SendEvent (lua_State *LuaState,
+                          int32_t    TargetIndex,
+                          int32_t    EventIndex,
+                          int64_t    TimeoutMs)
+{
+  int32_t                 ArgumentCount = lua_gettop(LuaState);
+  struct LUA_Instance    *Instance      = LUA_GetInstance(LuaState);
+  struct LUA_Application *Application   = Instance->Application;
+  struct EM_Writer       *Writer        = &Instance->MessageWriter;
+  struct LUA_Instance    *TargetInstance;
+  bool                    Reserved;
+  int                     ResultCount;
+
+  APP_CheckEventName(LuaState, EventIndex);
+  APP_EncodeEvent(LuaState, Instance, EventIndex, ArgumentCount);
+
+  /* Pinned once nothing can raise an error anymore */
+  TargetInstance = APP_PinTarget(LuaState, TargetIndex);
+
+  if (TargetInstance == NULL)
+  {
+    lua_pushboolean(LuaState, false);
+    ResultCount = 1;
+  }
+  else
+  {
+    /* Waiting for its own mailbox would never end */
+    if (TargetInstance == Instance)
+    {
+      TimeoutMs = 0;
+    }
+
+    Reserved = (!APP_IsMailboxClosed(TargetInstance)
+                && APP_WaitForMailbox(TargetInstance, Writer->SizeInBytes, TimeoutMs));
+
+    /* The target might have finished while the sender was waiting */
+    if (Reserved && APP_DeliverMessageIfOpen(TargetInstance, EM_NewMessage(Writer)))
+    {
+      lua_pushboolean(LuaState, true);
+      ResultCount = 1;
+    }
+    else if (APP_IsMailboxClosed(TargetInstance))
+    {
+      lua_pushboolean(LuaState, false);
+      ResultCount = 1;
+    }
+    else
+    {
+      __atomic_add_fetch(&TargetInstance->MailboxDropped, 1, __ATOMIC_RELAXED);
+      lua_pushboolean(LuaState, false);
+      lua_pushliteral(LuaState, "full");
+      ResultCount = 2;
+    }
+
+    APP_UnpinInstances(Application, &TargetInstance, 1);
+  }
+
+  return ResultCount; /* Number of values returned on the stack */
+}
+
+/* PostEvent(ThreadId, EventName, ...), never blocks */
+static int LUA_PostEvent (lua_State *LuaState)
+{
+  int32_t ArgumentCount = lua_gettop(LuaState);
+  int     ResultCount;
+
+  if ((ArgumentCount >= 2)
+      && (lua_isinteger(LuaState, 1) || (lua_type(LuaState, 1) == LUA_TSTRING)))
+  {
+    ResultCount = APP_SendEvent(LuaState, 1, 2, 0);
+  }
+  else
+  {
+    lua_pushboolean(LuaState, false);
+    ResultCount = 1;
+  }
+
+  return ResultCount; /* Number of values returned on the stack */
+}
+
+/* PostEventTimeout(ThreadId, TimeoutMs, EventName, ...), wait for some room
+ * in the mailbox of the target, forever if TimeoutMs is negative */
+static int LUA_PostEventTimeout (lua_State *LuaState)
+{
+  lua_Integer TimeoutMs;
+
+  APP_CheckTarget(LuaState, 1);
+  TimeoutMs = luaL_checkinteger(LuaState, 2);
+
+  return APP_SendEvent(LuaState, 1, 3, TimeoutMs);
+}
+
+/* GetMailboxStats([ThreadId]), the current thread by default */
+static int LUA_GetMailboxStats (lua_State *LuaState)
+{
+  struct LUA_Instance    *Instance    = LUA_GetInstance(LuaState);
+  struct LUA_Application *Application = Instance->Application;
+  lua_Integer             InstanceId  = luaL_optinteger(LuaState, 1, (lua_Integer)Instance->Offset);
+  struct LUA_Instance    *TargetInstance;
+
+  lua_createtable(LuaState, 0, 9); /* State, Array, Keys */
+
+  /* The target can't be released while InstanceArrayMutex is locked */
+  uv_mutex_lock(&Application->InstanceArrayMutex);
+  if (TA_IsValid(Application->InstanceArray, InstanceId))
+  {
+    TargetInstance = TA_GetObject(Application->InstanceArray, InstanceId);
+  }
+  else
+  {
+    TargetInstance = NULL;
+  }
+
+  if (TargetInstance)
+  {
+    APP_SetIntegerField(LuaState, "depth",         (lua_Integer)__atomic_load_n(&TargetInstance->MailboxMessages,      __ATOMIC_RELAXED));
+    APP_SetIntegerField(LuaState, "bytes",         (lua_Integer)__atomic_load_n(&TargetInstance->MailboxBytes,         __ATOMIC_RELAXED));
+    APP_SetIntegerField(LuaState, "highwater",     (lua_Integer)__atomic_load_n(&TargetInstance->MailboxHighWater,     __ATOMIC_RELAXED));
+    APP_SetIntegerField(LuaState, "maxmessages",   (lua_Integer)TargetInstance->MailboxMaxMessages);
+    APP_SetIntegerField(LuaState, "maxbytes",      (lua_Integer)TargetInstance->MailboxMaxBytes);
+    APP_SetIntegerField(LuaState, "enqueued",      (lua_Integer)__atomic_load_n(&TargetInstance->MailboxEnqueued,      __ATOMIC_RELAXED));
+    APP_SetIntegerField(LuaState, "bytesenqueued", (lua_Integer)__atomic_load_n(&TargetInstance->MailboxBytesEnqueued, __ATOMIC_RELAXED));
+    APP_SetIntegerField(LuaState, "dropped",       (lua_Integer)__atomic_load_n(&TargetInstance->MailboxDropped,       __ATOMIC_RELAXED));
+    APP_SetIntegerField(LuaState, "blocked",       (lua_Integer)__atomic_load_n(&TargetInstance->MailboxBlocked,       __ATOMIC_RELAXED));
+  }
+  uv_mutex_unlock(&Application->InstanceArrayMutex);
+
+  if (TargetInstance == NULL)
+  {
+    lua_pushnil(LuaState);
+  }
+
+  return 1; /* Number of values returned on the stack */
+}
+
+/* Must be called with InstanceArrayMutex locked, the target is pinned until
+ * APP_UnpinInstances */
+static void APP_AddBroadcastTarget (struct LUA_Instance *Instance,
+                                    struct LUA_Instance *TargetInstance,
+                                    size_t               TargetCount)
+{
+  if (TargetCount == Instance->BroadcastCapacity)
+  {
+    Instance->BroadcastCapacity = ((TargetCount == 0) ? 16 : (TargetCount * 2));
+    Instance->BroadcastTargets  = PLAT_SafeRealloc(Instance->BroadcastTargets,
+                                                   (Instance->BroadcastCapacity * sizeof(struct LUA_Instance *)));
+  }
+
+  TargetInstance->PinCount++;
+  Instance->BroadcastTargets[TargetCount] = TargetInstance;
+}
+
+/* The payload is shared by all the targets. The message given to the first
+ * target is delivered last: once delivered, it can be freed by its target at
+ * any time, so it can't be shared anymore. The targets with a full or closed
+ * mailbox are skipped, return the number of targets reached. The reached
+ * targets are moved at the beginning of BroadcastTargets, the skipped ones at
+ * the end: all of them must be unpinned. */
+static size_t APP_DeliverToTargets (struct LUA_Instance *Instance, size_t TargetCount)
+{
+  size_t               SizeInBytes   = Instance->MessageWriter.SizeInBytes;
+  size_t               AcceptedCount = 0;
+  size_t               ReachedCount;
+  struct LUA_Instance *TargetInstance;
+  struct EM_Message   *Message;
+  size_t               TargetIndex;
+
+  for (TargetIndex = 0; TargetIndex < TargetCount; TargetIndex++)
+  {
+    TargetInstance = Instance->BroadcastTargets[TargetIndex];
+
+    if (APP_IsMailboxClosed(TargetInstance))
+    {
+      /* Finished module, the message would only be discarded */
+    }
+    else if (APP_ReserveMailbox(TargetInstance, SizeInBytes, true))
+    {
+      Instance->BroadcastTargets[TargetIndex]     = Instance->BroadcastTargets[AcceptedCount];
+      Instance->BroadcastTargets[AcceptedCount++] = TargetInstance;
+    }
+    else
+    {
+      __atomic_add_fetch(&TargetInstance->MailboxDropped, 1, __ATOMIC_RELAXED);
+    }
+  }
+
+  /* A target can still finish its module before the delivery */
+  ReachedCount = AcceptedCount;
+
+  if (AcceptedCount > 0)
+  {
+    Message = EM_NewMessage(&Instance->MessageWriter);
+
+    for (TargetIndex = 1; TargetIndex < AcceptedCount; TargetIndex++)
+    {
+      if (!APP_DeliverMessageIfOpen(Instance->BroadcastTargets[TargetIndex], EM_ShareMessage(Message)))
+      {
+        ReachedCount--;
+      }
+    }
+
+    if (!APP_DeliverMessageIfOpen(Instance->BroadcastTargets[0], Message))
+    {
+      ReachedCount--;
+    }
+  }
+
+  return ReachedCount;
+}
+
+/* Broadcast(EventName, ...), queue the event for all the running instances.
+ * Return the number of instances reached: the instances with a full mailbox
+ * are skipped, the event is dropped for them and counted in their mailbox
+ * statistics. */
+static int LUA_BroadcastEvent (lua_State *LuaState)
+{
+  uint32_t                ArgumentCount = lua_gettop(LuaState);
+  struct LUA_Instance    *Instance      = LUA_GetInstance(LuaState);
+  struct LUA_Application *Application   = Instance->Application;
+  struct LUA_Instance    *TargetInstance;
+  size_t                  InstanceCapacity;
+  size_t                  InstanceOffset;
+  size_t                  TargetCount;
+  size_t                  ReachedCount  = 0;
+
+  if (ArgumentCount >= 1)
+  {
+    APP_CheckEventName(LuaState, 1);
+
+    /* Serialized once, before taking the lock */
+    APP_EncodeEvent(LuaState, Instance, 1, ArgumentCount);
+
+    /* Only the snapshot of the targets is done under the lock, the targets
+     * stay pinned until the delivery is done */
+    TargetCount = 0;
+
+    uv_mutex_lock(&Application->InstanceArrayMutex);
+    InstanceCapacity = TA_GetCapacity(Application->InstanceArray);
+
+    for (InstanceOffset = 1; InstanceOffset <= InstanceCapacity; InstanceOffset++)
+    {
+      if (TA_IsValid(Application->InstanceArray, InstanceOffset))
+      {
+        TargetInstance = TA_GetObject(Application->InstanceArray, InstanceOffset);
+
+        if (TargetInstance)
+        {
+          APP_AddBroadcastTarget(Instance, TargetInstance, TargetCount++);
+        }
+      }
+    }
+    uv_mutex_unlock(&Application->InstanceArrayMutex);
+
+    ReachedCount = APP_DeliverToTargets(Instance, TargetCount);
+    APP_UnpinInstances(Application, Instance->BroadcastTargets, TargetCount);
+  }
+
+  lua_pushinteger(LuaState, (lua_Integer)ReachedCount);
+
+  return 1; /* Number of values returned on the stack */
+}
+
+/* Publish(Topic, EventName, ...), like Broadcast but only to the subscribers
+ * of Topic. Return the number of instances reached, the subscribers with a
+ * full mailbox are not reached. */
+static int LUA_PublishEvent (lua_State *LuaState)
+{
+  uint32_t                ArgumentCount = lua_gettop(LuaState);
+  struct LUA_Instance    *Instance      = LUA_GetInstance(LuaState);
+  struct LUA_Application *Application   = Instance->Application;
+  size_t                  TopicLength;
+  const char             *TopicName     = luaL_checklstring(LuaState, 1, &TopicLength);
+  struct APP_Topic       *Topic;
+  size_t                  TargetCount;
+  size_t                  ReachedCount;
+  size_t                  SubscriberIndex;
+
+  APP_CheckEventName(LuaState, 2);
+  APP_EncodeEvent(LuaState, Instance, 2, ArgumentCount);
+
+  TargetCount = 0;
+
+  uv_mutex_lock(&Application->InstanceArrayMutex);
+  Topic = TH_GetObject(Application->TopicMap, TopicName, TopicLength);
+
+  if (Topic)
+  {
+    for (SubscriberIndex = 0; SubscriberIndex < Topic->SubscriberCount; SubscriberIndex++)
+    {
+      APP_AddBroadcastTarget(Instance, Topic->Subscribers[SubscriberIndex], TargetCount++);
+    }
+  }
+  uv_mutex_unlock(&Application->InstanceArrayMutex);
+
+  ReachedCount = APP_DeliverToTargets(Instance, TargetCount);
+  APP_UnpinInstances(Application, Instance->BroadcastTargets, TargetCount);
+
+  lua_pushinteger(LuaState, (lua_Integer)ReachedCount);
+
+  return 1; /* Number of values returned on the stack */
+}
+
+/* Must be called with InstanceArrayMutex locked, return true if Instance was
+ * subscribed */
+static bool APP_RemoveSubscriber (struct APP_Topic *Topic, struct LUA_Instance *Instance)
+{
+  size_t SubscriberIndex = 0;
+  bool   Found           = false;
+
+  while (!Found && (SubscriberIndex < Topic->SubscriberCount))
+  {
+    if (Topic->Subscribers[SubscriberIndex] == Instance)
+    {
+      Topic->SubscriberCount--;
+      Topic->Subscribers[SubscriberIndex] = Topic->Subscribers[Topic->SubscriberCount];
+      Found = true;
+    }
+    else
+    {
+      SubscriberIndex++;
+    }
+  }
+
+  return Found;
+}
+
+/* Must be called with InstanceArrayMutex locked, when the instance is removed
+ * from InstanceArray */
+static void APP_UnsubscribeInstance (struct LUA_Application *Application,
+                                     struct LUA_Instance    *Instance)
+{
+  size_t      Cursor = 0;
+  const char *Key;
+  size_t      KeyLength;
+  void       *Object;
+
+  while (TH_GetNext(Application->TopicMap, &Cursor, &Key, &KeyLength, &Object))
+  {
+    APP_RemoveSubscriber(Object, Instance);
+  }
+}
+
+/* Subscribe(Topic), return false if already subscribed */
+static int LUA_Subscribe (lua_State *LuaState)
+{
+  struct LUA_Instance    *Instance    = LUA_GetInstance(LuaState);
+  struct LUA_Application *Application = Instance->Application;
+  size_t                  TopicLength;
+  const char             *TopicName   = luaL_checklstring(LuaState, 1, &TopicLength);
+  struct APP_Topic       *Topic;
+  bool                    Success;
+
+  uv_mutex_lock(&Application->InstanceArrayMutex);
+  Topic = TH_GetObject(Application->TopicMap, TopicName, TopicLength);
+
+  if (Topic == NULL)
+  {
+    Topic = PLAT_SafeAlloc0(1, sizeof(struct APP_Topic));
+    TH_SetObject(Application->TopicMap, TopicName, TopicLength, Topic);
+  }
+
+  /* Remove and add back, the order of the subscribers doesn't matter */
+  Success = !APP_RemoveSubscriber(Topic, Instance);
+
+  if (Topic->SubscriberCount == Topic->Capacity)
+  {
+    Topic->Capacity    = ((Topic->Capacity == 0) ? 4 : (Topic->Capacity * 2));
+    Topic->Subscribers = PLAT_SafeRealloc(Topic->Subscribers,
+                                          (Topic->Capacity * sizeof(struct LUA_Instance *)));
+  }
+  Topic->Subscribers[Topic->SubscriberCount++] = Instance;
+  uv_mutex_unlock(&Application->InstanceArrayMutex);
+
+  lua_pushboolean(LuaState, Success);
+
+  return 1; /* Number of values returned on the stack */
+}
+
+/* Unsubscribe(Topic), return false if not subscribed */
+static int LUA_Unsubscribe (lua_State *LuaState)
+{
+  struct LUA_Instance    *Instance    = LUA_GetInstance(LuaState);
+  struct LUA_Application *Application = Instance->Application;
+  size_t                  TopicLength;
+  const char             *TopicName   = luaL_checklstring(LuaState, 1, &TopicLength);
+  struct APP_Topic       *Topic;
+  bool                    Success;
+
+  uv_mutex_lock(&Application->InstanceArrayMutex);
+  Topic = TH_GetObject(Application->TopicMap, TopicName, TopicLength);
+
+  if (Topic)
+  {
+    Success = APP_RemoveSubscriber(Topic, Instance);
+  }
+  else
+  {
+    Success = false;
+  }
+  uv_mutex_unlock(&Application->InstanceArrayMutex);
+
+  lua_pushboolean(LuaState, Success);
+
+  return 1; /* Number of values returned on the stack */
+}
+
+/* One could imagine that we could PostEvent an "ExitLoop" event to self but
+ * this seems a bad idea. In LUA_RunEventLoop, we need an exit condition. This
+ * exit condition is good to put the instance state. If we don't use that, we
+ * would need an additional information such as ExitLoopProcessed, with
+ * potentially another mutex/condition.
+ */ 
+static int LUA_CloseEventLoop (lua_State *LuaState)
+{
+  struct LUA_Instance *Instance = LUA_GetInstance(LuaState);
+
+  uv_mutex_lock(&Instance->StateMutex);
+  APP_BIT_SET(Instance->State, INSTANCE_MASK_LOOP_CLOSE_REQUEST);
+  uv_cond_signal(&Instance->StateCondition);
+  uv_mutex_unlock(&Instance->StateMutex);
+
+  /* Called from a handler, leave uv_run as soon as possible */
+  if (Instance->UvLoopRunning)
+  {
+    uv_stop(luv_loop(LuaState));
+  }
+
+  return 0; /* Number of values returned on the stack */
+}
+
+/* The reply is true followed by the values returned by the handler, starting
+ * at ResultIndex, or false and the error message */
+static void APP_SendReply (lua_State           *LuaState,
+                           struct LUA_Instance *Instance,
+                           struct EM_Message   *Call,
+                           int32_t              Status,
+                           int32_t              ResultIndex)
+{
+  struct EM_Writer *Writer   = &Instance->MessageWriter;
+  int32_t           TopIndex = lua_gettop(LuaState);
+  const char       *ErrorMessage;
+  int32_t           Index;
+
+  EM_ResetWriter(Writer);
+
+  if (Status == LUA_OK)
+  {
+    EM_WriteBoolean(Writer, true);
+
+    for (Index = ResultIndex; Index <= TopIndex; Index++)
+    {
+      if (!EM_WriteLuaValue(Writer, LuaState, Index))
+      {
+        ErrorMessage = lua_pushfstring(LuaState,
+                                       "reply value %d: %s '%s'",
+                                       (Index - ResultIndex + 1),
+                                       Writer->ErrorReason,
+                                       lua_typename(LuaState, Writer->ErrorType));
+        EM_ResetWriter(Writer);
+        EM_WriteBoolean(Writer, false);
+        EM_WriteString(Writer, ErrorMessage, strlen(ErrorMessage));
+        break;
+      }
+    }
+  }
+  else
+  {
+    ErrorMessage = lua_tostring(LuaState, -1);
+
+    if (ErrorMessage == NULL)
+    {
+      ErrorMessage = "error object is not a string";
+    }
+
+    EM_WriteBoolean(Writer, false);
+    EM_WriteString(Writer, ErrorMessage, strlen(ErrorMessage));
+  }
+
+  APP_DeliverReply(Instance->Application, Call, Writer);
+}
+
+/* Push the handler registered for EventId, nil if there is none */
+static void APP_PushHandler (lua_State           *LuaState,
+                             struct LUA_Instance *Instance,
+                             lua_Integer          EventId)
+{
+  if ((EventId > 0)
+      && ((size_t)EventId < Instance->HandlerCapacity)
+      && (Instance->HandlerRefs[EventId] != LUA_NOREF))
+  {
+    lua_rawgeti(LuaState, LUA_REGISTRYINDEX, Instance->HandlerRefs[EventId]);
+  }
+  else
+  {
+    lua_pushnil(LuaState);
+  }
+}
+
+/* The message is the event name or ID followed by the arguments. An event sent
+ * by ID is dispatched with an array index, an event sent by name still looks
+ * for a global function first. When there is no handler, the fallback is
+ * called with the event name (or the unknown ID) followed by the arguments. */
+static void LUA_ProcessSingleEvent (lua_State           *LuaState,
+                                    struct LUA_Instance *Instance,
+                                    struct EM_Message   *Message)
+{
+  struct LUA_Application *Application = Instance->Application;
+  int32_t                 BaseIndex   = lua_gettop(LuaState);
+  int32_t                 EventIndex  = (BaseIndex + 1);
+  int32_t                 ResultCount = ((EM_GetCallId(Message) != 0) ? LUA_MULTRET : 0);
+  int32_t                 ValueCount;
+  int32_t                 FunctionIndex;
+  const char             *FunctionName;
+  size_t                  FunctionNameLength;
+  lua_Integer             EventId;
+  int32_t                 Status;
+
+  ValueCount = EM_PushValues(LuaState, Message);
+
+  if (lua_type(LuaState, EventIndex) == LUA_TSTRING)
+  {
+    FunctionName = lua_tolstring(LuaState, EventIndex, &FunctionNameLength);
+
+    if (lua_getglobal(LuaState, FunctionName) == LUA_TNIL)
+    {
+      lua_pop(LuaState, 1);
+      EventId = APP_FindEventId(Application, FunctionName, FunctionNameLength);
+      APP_PushHandler(LuaState, Instance, EventId);
+    }
+  }
+  else
+  {
+    /* The name of the event is only needed when there is no handler */
+    EventId      = lua_tointeger(LuaState, EventIndex);
+    FunctionName = NULL;
+    APP_PushHandler(LuaState, Instance, EventId);
+
+    if (lua_isnil(LuaState, -1))
+    {
+      FunctionName = APP_GetEventName(Application, EventId);
+
+      if (FunctionName)
+      {
+        lua_pop(LuaState, 1);
+        lua_getglobal(LuaState, FunctionName);
+
+        /* The fallback receives the name instead of the ID */
+        if (lua_isnil(LuaState, -1))
+        {
+          lua_pushstring(LuaState, FunctionName);
+          lua_replace(LuaState, EventIndex);
+        }
+      }
+    }
+  }
+
+  if (!lua_isnil(LuaState, -1))
+  {
+    /* Move the handler below the arguments, the event stays on the stack */
+    FunctionIndex = (BaseIndex + 2);
+    lua_rotate(LuaState, FunctionIndex, 1);
+    Status = lua_pcall(LuaState, (ValueCount - 1), ResultCount, 0);
+  }
+  else if (Instance->FallbackRef != LUA_NOREF)
+  {
+    FunctionIndex = EventIndex;
+    lua_pop(LuaState, 1);
+    lua_rawgeti(LuaState, LUA_REGISTRYINDEX, Instance->FallbackRef);
+    lua_rotate(LuaState, FunctionIndex, 1);
+    Status = lua_pcall(LuaState, ValueCount, ResultCount, 0);
+  }
+  else
+  {
+    FunctionIndex = lua_gettop(LuaState);
+    Status        = LUA_ERRRUN;
+    lua_pushliteral(LuaState, "function not found, event discarded");
+  }
+
+  if (Status != LUA_OK)
+  {
+    /* The interned names are never freed */
+    if (FunctionName == NULL)
+    {
+      FunctionName = APP_GetEventName(Application, EventId);
+    }
+
+    fprintf(stderr, "ERROR: Failed to call function '%s': %s\n",
+            ((FunctionName != NULL) ? FunctionName : "<unknown event ID>"),
+            lua_tostring(LuaState, -1));
+  }
+
+  if (ResultCount == LUA_MULTRET)
+  {
+    APP_SendReply(LuaState, Instance, Message, Status, FunctionIndex);
+  }
+
+  lua_settop(LuaState, BaseIndex);
+}
+
+static void LUA_ProcessEventsIfNeeded (lua_State           *LuaState,
+                                       struct LUA_Instance *Instance)
+{
+  struct MQ_Node    *Node;
+  struct EM_Message *Message;
+  size_t             SizeInBytes;
+  size_t             MessageCount;
+  size_t             MessageIndex;
+
+  MessageCount = MQ_GetCount(&Instance->Mailbox);
+
+  if (MessageCount > 0)
+  {
+    /* Cleared before the pop: a sender which finds the mailbox empty after
+     * this point will set it again */
+    uv_mutex_lock(&Instance->StateMutex);
+    APP_BIT_CLEAR(Instance->State, INSTANCE_MASK_EVENTS_PENDING);
+    uv_mutex_unlock(&Instance->StateMutex);
+
+    /* Only the messages already there, the handlers can send new ones */
+    for (MessageIndex = 0; MessageIndex < MessageCount; MessageIndex++)
+    {
+      Node = MQ_Pop(&Instance->Mailbox);
+
+      /* The handlers might have called runonce */
+      if (Node == NULL)
+      {
+        break;
+      }
+
+      Message     = EM_GetMessage(Node);
+      SizeInBytes = EM_GetSizeInBytes(Message);
+
+      LUA_ProcessSingleEvent(LuaState, Instance, Message);
+      EM_FreeMessage(Message);
+      APP_ReleaseMailbox(Instance, SizeInBytes);
+    }
+
+    /* Messages pushed in a non-empty mailbox did not wake us up */
+    if (MQ_GetCount(&Instance->Mailbox) > 0)
+    {
+      uv_mutex_lock(&Instance->StateMutex);
+      APP_BIT_SET(Instance->State, INSTANCE_MASK_EVENTS_PENDING);
+      APP_WakeUpLoop(Instance);
+      uv_mutex_unlock(&Instance->StateMutex);
+    }
+  }
+}
+
+static int LUA_ProcessEvents (lua_State *LuaState)
+{
+  struct LUA_Instance *Instance = LUA_GetInstance(LuaState);
+
+  LUA_ProcessEventsIfNeeded(LuaState, Instance);
+
+  return 0; /* Number of values returned on the stack */
+}
+
+static void APP_OnEventAsync (uv_async_t *Handle)
+{
+  struct LUA_Instance *Instance;
+
+  Instance = (struct LUA_Instance *)((uint8_t *)Handle - offsetof(struct LUA_Instance, EventAsync));
+
+  LUA_ProcessEventsIfNeeded(Instance->LuaState, Instance);
+}
+
+/* The async handle is created in the luv loop of the instance, luv closes it
+ * with the other handles when the lua_State is closed. Data must be NULL,
+ * luv_close_cb ignores the handles which are not created by luv. */
+static void APP_EnableEventAsync (lua_State           *LuaState,
+                                  struct LUA_Instance *Instance)
+{
+  uv_loop_t *Loop;
+
+  if (!Instance->AsyncEnabled)
+  {
+    /* luv is loaded by comexe/init.lua */
+    Loop = luv_loop(LuaState);
+
+    uv_async_init(Loop, &Instance->EventAsync, APP_OnEventAsync);
+    Instance->EventAsync.data = NULL;
+    uv_unref((uv_handle_t *)&Instance->EventAsync);
+
+    __atomic_store_n(&Instance->AsyncEnabled, true, __ATOMIC_RELEASE);
+  }
+}
+
+static void APP_RunConditionLoop (lua_State           *LuaState,
+                                  struct LUA_Instance *Instance)
+{
+  bool Continue = true;
+
+  const uint32_t MASK_STOP = (INSTANCE_MASK_EVENTS_PENDING | INSTANCE_MASK_LOOP_CLOSE_REQUEST);
+
+  while (Continue)
+  {
+    LUA_ProcessEventsIfNeeded(LuaState, Instance);
+
+    uv_mutex_lock(&Instance->StateMutex);
+    while ((Instance->State & MASK_STOP) == 0)
+    {
+      uv_cond_wait(&Instance->StateCondition, &Instance->StateMutex);
+    }
+    Continue = ((Instance->State & INSTANCE_MASK_LOOP_CLOSE_REQUEST) == 0);
+    uv_mutex_unlock(&Instance->StateMutex);
+  }
+}
+
+/* The events and the luv handles are serviced by the same uv_run. The async
+ * handle is referenced only here, so it does not keep uv.run() alive. */
+static void APP_RunUvLoop (lua_State           *LuaState,
+                           struct LUA_Instance *Instance)
+{
+  uv_loop_t *Loop     = luv_loop(LuaState);
+  bool       Continue = true;
+
+  APP_EnableEventAsync(LuaState, Instance);
+
+  uv_ref((uv_handle_t *)&Instance->EventAsync);
+  Instance->UvLoopRunning = true;
+
+  while (Continue)
+  {
+    /* Events received before the async handle was enabled */
+    LUA_ProcessEventsIfNeeded(LuaState, Instance);
+
+    uv_mutex_lock(&Instance->StateMutex);
+    Continue = ((Instance->State & INSTANCE_MASK_LOOP_CLOSE_REQUEST) == 0);
+    uv_mutex_unlock(&Instance->StateMutex);
+
+    if (Continue)
+    {
+      uv_run(Loop, UV_RUN_ONCE);
+    }
+  }
+
+  Instance->UvLoopRunning = false;
+  uv_unref((uv_handle_t *)&Instance->EventAsync);
+}
+
+/* RunEventLoop([Mode]), Mode is "cond" (default) or "uv" */
+static int LUA_RunEventLoop (lua_State *LuaState)
+{
+  static const char *const LOOP_MODES[] = { "cond", "uv", NULL };
+
+  struct LUA_Instance *Instance = LUA_GetInstance(LuaState);
+  int                  Mode     = luaL_checkoption(LuaState, 1, "cond", LOOP_MODES);
+
+  if (Mode == 0)
+  {
+    APP_RunConditionLoop(LuaState, Instance);
+  }
+  else
+  {
+    APP_RunUvLoop(LuaState, Instance);
+  }
+
+  /* The close request is consumed, runloop can be called again */
+  uv_mutex_lock(&Instance->StateMutex);
+  APP_BIT_CLEAR(Instance->State, INSTANCE_MASK_LOOP_CLOSE_REQUEST);
+  uv_mutex_unlock(&Instance->StateMutex);
+
+  return 0; /* Number of values returned on the stack */
+}
+
+/* GetEventId(EventName), the IDs are the same in all the threads */
+static int LUA_GetEventId (lua_State *LuaState)
+{
+  struct LUA_Instance *Instance = LUA_GetInstance(LuaState);
+  size_t               EventNameLength;
+  const char          *EventName = luaL_checklstring(LuaState, 1, &EventNameLength);
+
+  lua_pushinteger(LuaState, APP_InternEventName(Instance->Application, EventName, EventNameLength));
+
+  return 1; /* Number of values returned on the stack */
+}
+
+/* GetEventName(EventId), return nil if EventId is unknown */
+static int LUA_GetEventName (lua_State *LuaState)
+{
+  struct LUA_Instance *Instance  = LUA_GetInstance(LuaState);
+  const char          *EventName = APP_GetEventName(Instance->Application, luaL_checkinteger(LuaState, 1));
+
+  if (EventName)
+  {
+    lua_pushstring(LuaState, EventName);
+  }
+  else
+  {
+    lua_pushnil(LuaState);
+  }
+
+  return 1; /* Number of values returned on the stack */
+}
+
+/* Register(EventName, Function), a nil Function removes the handler. Return
+ * the event ID. */
+static int LUA_RegisterHandler (lua_State *LuaState)
+{
+  struct LUA_Instance *Instance = LUA_GetInstance(LuaState);
+  size_t               EventNameLength;
+  const char          *EventName = luaL_checklstring(LuaState, 1, &EventNameLength);
+  lua_Integer          EventId;
+  size_t               NewCapacity;
+  size_t               HandlerIndex;
+
+  if (!lua_isnoneornil(LuaState, 2))
+  {
+    luaL_checktype(LuaState, 2, LUA_TFUNCTION);
+  }
+
+  EventId = APP_InternEventName(Instance->Application, EventName, EventNameLength);
+
+  if ((size_t)EventId >= Instance->HandlerCapacity)
+  {
+    NewCapacity = ((Instance->HandlerCapacity == 0) ? APP_INITIAL_EVENT_NAME_CAPACITY : Instance->HandlerCapacity);
+    while ((size_t)EventId >= NewCapacity)
+    {
+      NewCapacity = (NewCapacity * 2);
+    }
+
+    Instance->HandlerRefs = PLAT_SafeRealloc(Instance->HandlerRefs, (NewCapacity * sizeof(int)));
+
+    for (HandlerIndex = Instance->HandlerCapacity; HandlerIndex < NewCapacity; HandlerIndex++)
+    {
+      Instance->HandlerRefs[HandlerIndex] = LUA_NOREF;
+    }
+    Instance->HandlerCapacity = NewCapacity;
+  }
+
+  luaL_unref(LuaState, LUA_REGISTRYINDEX, Instance->HandlerRefs[EventId]);
+
+  if (lua_isnoneornil(LuaState, 2))
+  {
+    Instance->HandlerRefs[EventId] = LUA_NOREF;
+  }
+  else
+  {
+    lua_pushvalue(LuaState, 2);
+    Instance->HandlerRefs[EventId] = luaL_ref(LuaState, LUA_REGISTRYINDEX);
+  }
+
+  lua_pushinteger(LuaState, EventId);
+
+  return 1; /* Number of values returned on the stack */
+}
+
+/* SetFallback(Function), called as Function(EventName, ...) for the events
+ * without handler. A nil Function removes the fallback. */
+static int LUA_SetFallback (lua_State *LuaState)
+{
+  struct LUA_Instance *Instance = LUA_GetInstance(LuaState);
+
+  if (!lua_isnoneornil(LuaState, 1))
+  {
+    luaL_checktype(LuaState, 1, LUA_TFUNCTION);
+  }
+
+  luaL_unref(LuaState, LUA_REGISTRYINDEX, Instance->FallbackRef);
+
+  if (lua_isnoneornil(LuaState, 1))
+  {
+    Instance->FallbackRef = LUA_NOREF;
+  }
+  else
+  {
+    lua_pushvalue(LuaState, 1);
+    Instance->FallbackRef = luaL_ref(LuaState, LUA_REGISTRYINDEX);
+  }
+
+  return 0; /* Number of values returned on the stack */
+}
+
+/* Called when the instance goes back to the pool */
+static void APP_ClearHandlers (lua_State *LuaState, struct LUA_Instance *Instance)
+{
+  size_t HandlerIndex;
+
+  for (HandlerIndex = 0; HandlerIndex < Instance->HandlerCapacity; HandlerIndex++)
+  {
+    luaL_unref(LuaState, LUA_REGISTRYINDEX, Instance->HandlerRefs[HandlerIndex]);
+    Instance->HandlerRefs[HandlerIndex] = LUA_NOREF;
+  }
+
+  luaL_unref(LuaState, LUA_REGISTRYINDEX, Instance->FallbackRef);
+  Instance->FallbackRef = LUA_NOREF;
+}
+
+/* API will be reworked at runtime by init.lua */
+static const struct luaL_Reg EVENTS_FUNCTIONS[] =
+{
+  { "runloop",         LUA_RunEventLoop     },
+  { "stoploop",        LUA_CloseEventLoop   },
+  { "runonce",         LUA_ProcessEvents    },
+  { "send",            LUA_PostEvent        },
+  { "sendtimeout",     LUA_PostEventTimeout },
+  { "broadcast",       LUA_BroadcastEvent   },
+  { "publish",         LUA_PublishEvent     },
+  { "subscribe",       LUA_Subscribe        },
+  { "unsubscribe",     LUA_Unsubscribe      },
+  { "getmailboxstats", LUA_GetMailboxStats  },
+  { "getid",           LUA_GetEventId       },
+  { "getname",         LUA_GetEventName     },
+  { "register",        LUA_RegisterHandler  },
+  { "setfallback",     LUA_SetFallback      },
+  { NULL,              NULL                 }
+};
+
+static int luaopen_events (lua_State *LuaState)
+{
+  luaL_newlib(LuaState, EVENTS_FUNCTIONS);
+  
+  return 1; /* Number of values returned on the stack */
+}
+
+/*============================================================================*/
+/* CALL API                                                                   */
+/*============================================================================*/
+
+/* Send the call EventIndex..top to the target at TargetIndex, the previous
+ * pending call of the instance is abandoned: its reply will be dropped.
+ * Return NULL on success, otherwise an error message. The target is pinned
+ * while waiting for its mailbox, Thread.join can't release it meanwhile. */
+static const char *APP_PostCall (lua_State *LuaState,
+                                 int32_t    TargetIndex,
+                                 int32_t    EventIndex,
+                                 int64_t    TimeoutMs)
+{
+  int32_t                 ArgumentCount = lua_gettop(LuaState);
+  struct LUA_Instance    *Instance      = LUA_GetInstance(LuaState);
+  struct LUA_Application *Application   = Instance->Application;
+  struct EM_Writer       *Writer        = &Instance->MessageWriter;
+  struct LUA_Instance    *TargetInstance;
+  struct EM_Message      *Message;
+  struct EM_Message      *StaleReply;
+  uint64_t                CallId;
+  bool                    Reserved;
+  bool                    Delivered;
+  const char             *ErrorMessage;
+
+  APP_CheckEventName(LuaState, EventIndex);
+  APP_EncodeEvent(LuaState, Instance, EventIndex, ArgumentCount);
+
+  CallId = __atomic_add_fetch(&Application->NextCallId, 1, __ATOMIC_RELAXED);
+
+  uv_mutex_lock(&Instance->StateMutex);
+  StaleReply              = Instance->Reply;
+  Instance->Reply         = NULL;
+  Instance->PendingCallId = CallId;
+  uv_mutex_unlock(&Instance->StateMutex);
+
+  if (StaleReply)
+  {
+    EM_FreeMessage(StaleReply);
+  }
+
+  TargetInstance = APP_PinTarget(LuaState, TargetIndex);
+
+  if (TargetInstance == NULL)
+  {
+    ErrorMessage = "invalid thread ID";
+  }
+  else
+  {
+    if (TargetInstance == Instance)
+    {
+      ErrorMessage = "a thread can't call itself";
+    }
+    else
+    {
+      Reserved = (!APP_IsMailboxClosed(TargetInstance)
+                  && APP_WaitForMailbox(TargetInstance, Writer->SizeInBytes, TimeoutMs));
+
+      if (Reserved)
+      {
+        Message = EM_NewMessage(Writer);
+        EM_SetCall(Message, (int64_t)Instance->Offset, CallId);
+        /* The target might have finished while the caller was waiting */
+        Delivered = APP_DeliverMessageIfOpen(TargetInstance, Message);
+      }
+      else
+      {
+        Delivered = false;
+      }
+
+      if (Delivered)
+      {
+        ErrorMessage = NULL;
+      }
+      else if (APP_IsMailboxClosed(TargetInstance))
+      {
+        ErrorMessage = "target gone";
+      }
+      else
+      {
+        __atomic_add_fetch(&TargetInstance->MailboxDropped, 1, __ATOMIC_RELAXED);
+        ErrorMessage = "full";
+      }
+    }
+
+    APP_UnpinInstances(Application, &TargetInstance, 1);
+  }
+
+  if (ErrorMessage)
+  {
+    uv_mutex_lock(&Instance->StateMutex);
+    Instance->PendingCallId = 0;
+    uv_mutex_unlock(&Instance->StateMutex);
+  }
+
+  return ErrorMessage;
+}
+
+/* Wait at most TimeoutMs milliseconds for the reply of the pending call,
+ * forever if TimeoutMs is negative. Push the reply: true and the results, or
+ * false and an error message. Push nil if there is no reply yet, the call is
+ * still pending. */
+static int APP_WaitForReply (lua_State           *LuaState,
+                             struct LUA_Instance *Instance,
+                             int64_t              TimeoutMs)
+{
+  uint64_t           Deadline = (uv_hrtime() + ((uint64_t)TimeoutMs * 1000000));
+  bool               Expired  = false;
+  struct EM_Message *Reply;
+  uint64_t           Now;
+  int                ResultCount;
+
+  uv_mutex_lock(&Instance->StateMutex);
+  while ((Instance->PendingCallId != 0) && (Instance->Reply == NULL) && !Expired)
+  {
+    if (TimeoutMs < 0)
+    {
+      uv_cond_wait(&Instance->ReplyCondition, &Instance->StateMutex);
+    }
+    else
+    {
+      Now = uv_hrtime();
+
+      if (Now < Deadline)
+      {
+        uv_cond_timedwait(&Instance->ReplyCondition, &Instance->StateMutex, (Deadline - Now));
+      }
+      else
+      {
+        Expired = true;
+      }
+    }
+  }
+
+  Reply = Instance->Reply;
+
+  if (Reply)
+  {
+    Instance->Reply         = NULL;
+    Instance->PendingCallId = 0;
+  }
+  uv_mutex_unlock(&Instance->StateMutex);
+
+  if (Reply)
+  {
+    /* The reply is freed even if pushing the values raises an error */
+    ResultCount = EM_PushValuesAndFree(LuaState, Reply);
+  }
+  else
+  {
+    lua_pushnil(LuaState);
+    ResultCount = 1;
+  }
+
+  return ResultCount; /* Number of values returned on the stack */
+}
+
+/* Post the call and wait for the reply. On timeout, the call is abandoned. */
+static int APP_CallThread (lua_State   *LuaState,
+                           int32_t      TargetIndex,
+                           int32_t      EventIndex,
+                           lua_Integer  TimeoutMs)
+{
+  struct LUA_Instance *Instance     = LUA_GetInstance(LuaState);
+  uint64_t             StartTime    = uv_hrtime();
+  const char          *ErrorMessage = APP_PostCall(LuaState, TargetIndex, EventIndex, TimeoutMs);
+  int64_t              ElapsedMs;
+  int                  ResultCount;
+
+  if (ErrorMessage == NULL)
+  {
+    /* The time spent waiting for the mailbox is part of the timeout */
+    if (TimeoutMs > 0)
+    {
+      ElapsedMs = (int64_t)((uv_hrtime() - StartTime) / 1000000);
+      TimeoutMs = ((ElapsedMs < TimeoutMs) ? (TimeoutMs - ElapsedMs) : 0);
+    }
+
+    ResultCount = APP_WaitForReply(LuaState, Instance, TimeoutMs);
+
+    if (lua_isnil(LuaState, -1))
+    {
+      uv_mutex_lock(&Instance->StateMutex);
+      Instance->PendingCallId = 0;
+      uv_mutex_unlock(&Instance->StateMutex);
+
+      ErrorMessage = "timeout";
+    }
+  }
+
+  if (ErrorMessage)
+  {
+    lua_pushboolean(LuaState, false);
+    lua_pushstring(LuaState, ErrorMessage);
+    ResultCount = 2;
+  }
+
+  return ResultCount; /* Number of values returned on the stack */
+}
+
+/* Call(ThreadId, EventName, ...), return true and the values returned by the
+ * handler, or false and an error message */
+static int LUA_CallThread (lua_State *LuaState)
+{
+  APP_CheckTarget(LuaState, 1);
+
+  return APP_CallThread(LuaState, 1, 2, -1);
+}
+
+/* CallTimeout(ThreadId, TimeoutMs, EventName, ...) */
+static int LUA_CallThreadTimeout (lua_State *LuaState)
+{
+  lua_Integer TimeoutMs;
+
+  APP_CheckTarget(LuaState, 1);
+  TimeoutMs = luaL_checkinteger(LuaState, 2);
+
+  return APP_CallThread(LuaState, 1, 3, TimeoutMs);
+}
+
+/* PostCall(ThreadId, EventName, ...), don't wait for the reply. Return true,
+ * or false and an error message. */
+static int LUA_PostCall (lua_State *LuaState)
+{
+  const char *ErrorMessage;
+  int         ResultCount;
+
+  APP_CheckTarget(LuaState, 1);
+  ErrorMessage = APP_PostCall(LuaState, 1, 2, 0);
+
+  if (ErrorMessage)
+  {
+    lua_pushboolean(LuaState, false);
+    lua_pushstring(LuaState, ErrorMessage);
+    ResultCount = 2;
+  }
+  else
+  {
+    lua_pushboolean(LuaState, true);
+    ResultCount = 1;
+  }
+
+  return ResultCount; /* Number of values returned on the stack */
+}
+
+/* GetReply([TimeoutMs]), the reply of the last PostCall. Return nil while the
+ * reply is not there, by default it does not wait. */
+static int LUA_GetReply (lua_State *LuaState)
+{
+  struct LUA_Instance *Instance  = LUA_GetInstance(LuaState);
+  lua_Integer          TimeoutMs = luaL_optinteger(LuaState, 1, 0);
+
+  return APP_WaitForReply(LuaState, Instance, TimeoutMs);
+}
+
+/*============================================================================*/
+/* RUNTIME API                                                                */
+/*============================================================================*/
+
+static int LUA_GetLoaderConfiguration (lua_State *LuaState)
+{
+  struct LUA_Instance    *Instance    = LUA_GetInstance(LuaState);
+  struct LUA_Application *Application = Instance->Application;
+
+  lua_pushstring(LuaState, (const char *)Application->LoaderConfiguration);
+
+  return 1; /* Number of values returned on the stack */
+}
+
+static void APP_WarningCallback (void *ud, const char *msg, int tocont) 
+{
+  struct LUA_Instance *Instance = (struct LUA_Instance *)ud;
+  lua_State           *LuaState = Instance->LuaState;
+  int                  LuaType;
+  const char          *ErrorMessage;
+    
+  /* Get the stored Lua warning function */
+  if (Instance->WarningFunctionRef != LUA_REFNIL)
+  {
+    LuaType = lua_rawgeti(LuaState, LUA_REGISTRYINDEX, Instance->WarningFunctionRef);
+    
     if (LuaType == LUA_TFUNCTION)
     {
       lua_pushstring(LuaState, msg);
@@ -978,41 +3037,356 @@ static int LUA_IsAtty (lua_State *LuaState)
   
   lua_pushboolean(LuaState, PLAT_IsAtty(File));
 
-  return 1; /* Number of values returned on the stack */
+  return 1; /* Number of values returned on the stack */
+}
+
+static int LUA_Ref (lua_State *LuaState)
+{
+  int Reference;
+
+  luaL_checkany(LuaState, 1);
+  lua_pushvalue(LuaState, 1);
+  Reference = luaL_ref(LuaState, LUA_REGISTRYINDEX);
+  lua_pushinteger(LuaState, Reference);
+
+  return 1; /* Number of values returned on the stack */
+}
+
+/* Together LUA_Ref, LUA_GetRef and LUA_Unref are useful when one want to save
+ * an object reference "somewhere" (here in the REGISTRY), an integer Lua
+ * reference will be given, that integer can be sent over threads with
+ * thread. */
+static int LUA_GetRef (lua_State *LuaState)
+{
+  int Reference = luaL_checkinteger(LuaState, 1);
+
+  lua_rawgeti(LuaState, LUA_REGISTRYINDEX, Reference);
+
+  return 1; /* Number of values returned on the stack */
+}
+
+static int LUA_Unref (lua_State *LuaState)
+{
+  int Reference = luaL_checkinteger(LuaState, 1);
+
+  luaL_unref(LuaState, LUA_REGISTRYINDEX, Reference);
+
+  return 0; /* Number of values returned on the stack */
+}
+
+/* Return a reference on the decompressed entry, read it from the ZIP if
+ * needed and store it in the cache if CacheEntry is true. Return NULL if the
+ * entry does not exist. */
+static struct MC_Blob *APP_AcquireZipEntry (struct LUA_Application *Application,
+                                            const char             *EntryName,
+                                            size_t                  EntryNameLength,
+                                            bool                    CacheEntry)
+{
+  struct MC_Blob *Blob = MC_AcquireBlob(Application->ModuleCache, EntryName, EntryNameLength);
+  uint8_t        *Content;
+  size_t          ContentSize;
+
+  if ((Blob == NULL) && Application->ZipIndex)
+  {
+    Content = ZI_ReadEntry(Application->ZipIndex, EntryName, EntryNameLength, &ContentSize);
+
+    if (Content)
+    {
+      Blob = MC_NewBlob(Content, ContentSize);
+      if (CacheEntry)
+      {
+        MC_InsertBlob(Application->ModuleCache, EntryName, EntryNameLength, Blob);
+      }
+      PLAT_Free(Content);
+    }
+  }
+
+  return Blob;
+}
+
+/* ReadZipEntry(EntryName) return the content of the entry or nil */
+static int LUA_ReadZipEntry (lua_State *LuaState)
+{
+  struct LUA_Instance    *Instance    = LUA_GetInstance(LuaState);
+  struct LUA_Application *Application = Instance->Application;
+  size_t                  EntryNameLength;
+  const char             *EntryName = luaL_checklstring(LuaState, 1, &EntryNameLength);
+  struct MC_Blob         *Blob;
+
+  Blob = APP_AcquireZipEntry(Application, EntryName, EntryNameLength, true);
+
+  if (Blob)
+  {
+    lua_pushlstring(LuaState, (const char *)MC_GetBlobData(Blob), MC_GetBlobSize(Blob));
+    MC_ReleaseBlob(Blob);
+  }
+  else
+  {
+    lua_pushnil(LuaState);
+  }
+
+  return 1; /* Number of values returned on the stack */
+}
+
+static int APP_DumpWriter (lua_State  *LuaState,
+                           const void *Data,
+                           size_t      SizeInBytes,
+                           void       *UserData)
+{
+  struct APP_DumpBuffer *Buffer = UserData;
+  size_t                 NeededCapacity;
+
+  (void)LuaState; /* unused parameter */
+
+  if (Data && (SizeInBytes > 0))
+  {
+    NeededCapacity = (Buffer->SizeInBytes + SizeInBytes);
+
+    if (NeededCapacity > Buffer->CapacityInBytes)
+    {
+      Buffer->CapacityInBytes = (NeededCapacity * 2);
+      Buffer->Data            = PLAT_SafeRealloc(Buffer->Data, Buffer->CapacityInBytes);
+    }
+
+    memcpy(Buffer->Data + Buffer->SizeInBytes, Data, SizeInBytes);
+    Buffer->SizeInBytes = NeededCapacity;
+  }
+
+  return 0;
+}
+
+/* Dump the function on the top of the stack, the debug information is kept.
+ * The caller must free Buffer->Data */
+static void APP_DumpFunction (lua_State             *LuaState,
+                              struct APP_DumpBuffer *Buffer)
+{
+  Buffer->Data            = NULL;
+  Buffer->SizeInBytes     = 0;
+  Buffer->CapacityInBytes = 0;
+
+  lua_dump(LuaState, APP_DumpWriter, Buffer, 0);
+}
+
+/* The bytecode key is "EntryName\0ChunkName", ZIP entry names cannot contain
+ * NUL so it never collides with a source entry */
+static void APP_PushBytecodeKey (lua_State  *LuaState,
+                                 const char *EntryName,
+                                 size_t      EntryNameLength,
+                                 const char *ChunkName)
+{
+  luaL_Buffer KeyBuffer;
+
+  luaL_buffinit(LuaState, &KeyBuffer);
+  luaL_addlstring(&KeyBuffer, EntryName, EntryNameLength);
+  luaL_addchar(&KeyBuffer, '\0');
+  luaL_addstring(&KeyBuffer, ChunkName);
+  luaL_pushresult(&KeyBuffer);
+}
+
+/* LoadZipEntry(EntryName, ChunkName) return a function, nil if the entry
+ * does not exist, or nil and an error message if the chunk is invalid */
+static int LUA_LoadZipEntry (lua_State *LuaState)
+{
+  struct LUA_Instance    *Instance    = LUA_GetInstance(LuaState);
+  struct LUA_Application *Application = Instance->Application;
+  size_t                  EntryNameLength;
+  const char             *EntryName = luaL_checklstring(LuaState, 1, &EntryNameLength);
+  const char             *ChunkName = luaL_checkstring(LuaState, 2);
+  const char             *Key;
+  size_t                  KeyLength;
+  struct MC_Blob         *Blob;
+  struct MC_Blob         *BytecodeBlob;
+  struct APP_DumpBuffer   Bytecode;
+  const char             *Content;
+  size_t                  ContentSize;
+  int                     Status;
+  int                     ResultCount;
+
+  APP_PushBytecodeKey(LuaState, EntryName, EntryNameLength, ChunkName);
+  Key = lua_tolstring(LuaState, -1, &KeyLength);
+
+  /* Fast path: bytecode already produced by another instance */
+  Blob = MC_AcquireBlob(Application->ModuleCache, Key, KeyLength);
+
+  if (Blob)
+  {
+    Status = luaL_loadbufferx(LuaState,
+                              (const char *)MC_GetBlobData(Blob),
+                              MC_GetBlobSize(Blob),
+                              ChunkName,
+                              "b");
+    MC_ReleaseBlob(Blob);
+  }
+  else
+  {
+    Status = LUA_ERRERR;
+  }
+
+  if (Status == LUA_OK)
+  {
+    MC_CountLoad(Application->ModuleCache, true);
+    ResultCount = 1;
+  }
+  else
+  {
+    /* Pop error message if any */
+    if (Blob)
+    {
+      lua_pop(LuaState, 1);
+    }
+
+    /* Slow path: load from the decompressed entry. Only the bytecode of the
+     * chunk is cached, the next loads don't inflate the entry again. */
+    Blob = APP_AcquireZipEntry(Application, EntryName, EntryNameLength, false);
+
+    if (Blob)
+    {
+      Content     = (const char *)MC_GetBlobData(Blob);
+      ContentSize = MC_GetBlobSize(Blob);
+      Status      = luaL_loadbufferx(LuaState, Content, ContentSize, ChunkName, "bt");
+
+      if (Status == LUA_OK)
+      {
+        MC_CountLoad(Application->ModuleCache, false);
+
+        /* Entries which are already bytecode are cached as they are */
+        if ((ContentSize > 0) && (Content[0] == LUA_SIGNATURE[0]))
+        {
+          MC_InsertBlob(Application->ModuleCache, Key, KeyLength, Blob);
+        }
+        else
+        {
+          APP_DumpFunction(LuaState, &Bytecode);
+          BytecodeBlob = MC_NewBlob(Bytecode.Data, Bytecode.SizeInBytes);
+          MC_InsertBlob(Application->ModuleCache, Key, KeyLength, BytecodeBlob);
+          MC_ReleaseBlob(BytecodeBlob);
+          PLAT_Free(Bytecode.Data);
+        }
+
+        /* Read by readzipentry before, don't keep both */
+        MC_RemoveBlob(Application->ModuleCache, EntryName, EntryNameLength);
+        ResultCount = 1;
+      }
+      else
+      {
+        /* Keep the rejected entry, the next probes don't inflate it again */
+        MC_InsertBlob(Application->ModuleCache, EntryName, EntryNameLength, Blob);
+        lua_pushnil(LuaState);
+        lua_insert(LuaState, -2); /* nil, ErrorMessage */
+        ResultCount = 2;
+      }
+
+      MC_ReleaseBlob(Blob);
+    }
+    else
+    {
+      lua_pushnil(LuaState);
+      ResultCount = 1;
+    }
+  }
+
+  return ResultCount; /* Number of values returned on the stack */
+}
+
+/* GetZipEntryInfo(EntryName) return UncompressedSize, CompressedSize, Method
+ * or nil if the entry does not exist */
+static int LUA_GetZipEntryInfo (lua_State *LuaState)
+{
+  struct LUA_Instance    *Instance    = LUA_GetInstance(LuaState);
+  struct LUA_Application *Application = Instance->Application;
+  size_t                  EntryNameLength;
+  const char             *EntryName = luaL_checklstring(LuaState, 1, &EntryNameLength);
+  uint64_t                UncompressedSize;
+  uint64_t                CompressedSize;
+  uint32_t                Method;
+  int                     ResultCount;
+
+  if (Application->ZipIndex
+      && ZI_GetEntryInfo(Application->ZipIndex,
+                         EntryName,
+                         EntryNameLength,
+                         &UncompressedSize,
+                         &CompressedSize,
+                         &Method))
+  {
+    lua_pushinteger(LuaState, (lua_Integer)UncompressedSize);
+    lua_pushinteger(LuaState, (lua_Integer)CompressedSize);
+    lua_pushinteger(LuaState, (lua_Integer)Method);
+    ResultCount = 3;
+  }
+  else
+  {
+    lua_pushnil(LuaState);
+    ResultCount = 1;
+  }
+
+  return ResultCount; /* Number of values returned on the stack */
 }
 
-static int LUA_Ref (lua_State *LuaState)
+static int LUA_GetModuleCacheStats (lua_State *LuaState)
 {
-  int Reference;
+  struct LUA_Instance    *Instance    = LUA_GetInstance(LuaState);
+  struct LUA_Application *Application = Instance->Application;
+  struct MC_Statistics    Statistics;
 
-  luaL_checkany(LuaState, 1);
-  lua_pushvalue(LuaState, 1);
-  Reference = luaL_ref(LuaState, LUA_REGISTRYINDEX);
-  lua_pushinteger(LuaState, Reference);
+  MC_GetStatistics(Application->ModuleCache, &Statistics);
+
+  lua_createtable(LuaState, 0, 7); /* State, Array, Keys */
+  APP_SetIntegerField(LuaState, "hits",       (lua_Integer)Statistics.Hits);
+  APP_SetIntegerField(LuaState, "misses",     (lua_Integer)Statistics.Misses);
+  APP_SetIntegerField(LuaState, "insertions", (lua_Integer)Statistics.Insertions);
+  APP_SetIntegerField(LuaState, "evictions",  (lua_Integer)Statistics.Evictions);
+  APP_SetIntegerField(LuaState, "entries",    (lua_Integer)Statistics.EntryCount);
+  APP_SetIntegerField(LuaState, "size",       (lua_Integer)Statistics.SizeInBytes);
+  APP_SetIntegerField(LuaState, "capacity",   (lua_Integer)Statistics.CapacityInBytes);
 
   return 1; /* Number of values returned on the stack */
 }
 
-/* Together LUA_Ref, LUA_GetRef and LUA_Unref are useful when one want to save
- * an object reference "somewhere" (here in the REGISTRY), an integer Lua
- * reference will be given, that integer can be sent over threads with
- * thread. */
-static int LUA_GetRef (lua_State *LuaState)
+/* A capacity of 0 disable the cache */
+static int LUA_SetModuleCacheCapacity (lua_State *LuaState)
 {
-  int Reference = luaL_checkinteger(LuaState, 1);
+  struct LUA_Instance    *Instance    = LUA_GetInstance(LuaState);
+  struct LUA_Application *Application = Instance->Application;
+  lua_Integer             Capacity    = luaL_checkinteger(LuaState, 1);
 
-  lua_rawgeti(LuaState, LUA_REGISTRYINDEX, Reference);
+  luaL_argcheck(LuaState, (Capacity >= 0), 1, "capacity must be non-negative");
 
-  return 1; /* Number of values returned on the stack */
+  MC_SetCapacity(Application->ModuleCache, (size_t)Capacity);
+
+  return 0; /* Number of values returned on the stack */
 }
 
-static int LUA_Unref (lua_State *LuaState)
+/* The counters are updated by MAIN_MutexLock */
+static void APP_SetMutexStatsField (lua_State                 *LuaState,
+                                    const char                *Name,
+                                    mbedtls_threading_mutex_t *ThreadingMutex)
 {
-  int Reference = luaL_checkinteger(LuaState, 1);
+  mbedtls_platform_mutex_t *Mutex = &ThreadingMutex->MBEDTLS_PRIVATE(mutex);
 
-  luaL_unref(LuaState, LUA_REGISTRYINDEX, Reference);
+  lua_createtable(LuaState, 0, 3); /* State, Array, Keys */
+  APP_SetIntegerField(LuaState, "locks",     (lua_Integer)__atomic_load_n(&Mutex->LockCount,      __ATOMIC_RELAXED));
+  APP_SetIntegerField(LuaState, "contended", (lua_Integer)__atomic_load_n(&Mutex->ContendedCount, __ATOMIC_RELAXED));
+  APP_SetIntegerField(LuaState, "waitns",    (lua_Integer)__atomic_load_n(&Mutex->WaitTimeNs,     __ATOMIC_RELAXED));
+  lua_setfield(LuaState, -2, Name);
+}
 
-  return 0; /* Number of values returned on the stack */
+/* Lock statistics of the mutexes shared by the TLS handshakes of all the
+ * threads, since the start of the process */
+static int LUA_GetTlsLockStats (lua_State *LuaState)
+{
+  /* The global mutexes of PSA, declared in threading_internal.h which is not
+   * a public header of TF-PSA-Crypto */
+  extern mbedtls_threading_mutex_t mbedtls_threading_key_slot_mutex;
+  extern mbedtls_threading_mutex_t mbedtls_threading_psa_globaldata_mutex;
+  extern mbedtls_threading_mutex_t mbedtls_threading_psa_rngdata_mutex;
+
+  lua_createtable(LuaState, 0, 3); /* State, Array, Keys */
+  APP_SetMutexStatsField(LuaState, "keyslot",    &mbedtls_threading_key_slot_mutex);
+  APP_SetMutexStatsField(LuaState, "globaldata", &mbedtls_threading_psa_globaldata_mutex);
+  APP_SetMutexStatsField(LuaState, "rngdata",    &mbedtls_threading_psa_rngdata_mutex);
+
+  return 1; /* Number of values returned on the stack */
 }
 
 static const struct luaL_Reg COMRUNTIME_FUNCTIONS[] = 
@@ -1024,6 +3398,13 @@ static const struct luaL_Reg COMRUNTIME_FUNCTIONS[] =
   { "ref",                    LUA_Ref                    },
   { "getref",                 LUA_GetRef                 },
   { "unref",                  LUA_Unref                  },
+  { "readzipentry",           LUA_ReadZipEntry           },
+  { "getzipentryinfo",        LUA_GetZipEntryInfo        },
+  { "loadzipentry",           LUA_LoadZipEntry           },
+  { "getmodulecachestats",    LUA_GetModuleCacheStats    },
+  { "setmodulecachecapacity", LUA_SetModuleCacheCapacity },
+  { "getmemorystats",         LUA_GetMemoryStats         },
+  { "gettlslockstats",        LUA_GetTlsLockStats        },
   { NULL, NULL }
 };
 
@@ -1066,6 +3447,10 @@ static void APP_PreloadLibraries (lua_State *LuaState)
   APP_RegisterPreload(LuaState, "com.thread",            luaopen_threads);
   APP_RegisterPreload(LuaState, "com.event",             luaopen_events);
   APP_RegisterPreload(LuaState, "com.raw.buffer",        luaopen_buffer);
+  APP_RegisterPreload(LuaState, "com.blob",              luaopen_blob);
+  APP_RegisterPreload(LuaState, "com.channel",           luaopen_channel);
+  APP_RegisterPreload(LuaState, "com.shared",            luaopen_shared);
+  APP_RegisterPreload(LuaState, "com.raw.http",          luaopen_http);
   APP_RegisterPreload(LuaState, "com.raw.minizip",       luaopen_libminizip);
   APP_RegisterPreload(LuaState, "com.raw.libffi",        luaopen_libffiraw);
   APP_RegisterPreload(LuaState, "luv",                   luaopen_luv);
@@ -1084,161 +3469,619 @@ static void APP_PreloadLibraries (lua_State *LuaState)
   lua_settop(LuaState, 0);
 }
 
-static bool APP_LoadComexeApi (lua_State *LuaState, struct LUA_Application *Application)
-{
-  bool Success;
-  
-  if (luaL_loadbuffer(LuaState, 
-                      (const char *)Application->ComexeApi,
-                      Application->ComexeApiSizeInBytes,
-                      LUA_EMBEDDED_ENTRY_NAME) != LUA_OK)
+/* comexe/init.lua returns the runner and the reset functions of the instance,
+ * they are kept in the registry */
+static bool APP_LoadComexeApi (lua_State *LuaState, struct LUA_Application *Application)
+{
+  struct LUA_Instance *Instance = LUA_GetInstance(LuaState);
+  const char *Chunk;
+  size_t      ChunkSizeInBytes;
+  bool        Success;
+
+  /* Prefer the bytecode compiled by LUA_CreateApplication */
+  if (Application->ComexeApiBytecode)
+  {
+    Chunk            = (const char *)Application->ComexeApiBytecode;
+    ChunkSizeInBytes = Application->ComexeApiBytecodeSizeInBytes;
+  }
+  else
+  {
+    Chunk            = (const char *)Application->ComexeApi;
+    ChunkSizeInBytes = Application->ComexeApiSizeInBytes;
+  }
+
+  if (luaL_loadbuffer(LuaState, 
+                      Chunk,
+                      ChunkSizeInBytes,
+                      LUA_EMBEDDED_ENTRY_NAME) != LUA_OK)
+  {
+    fprintf(stderr, "ERROR: Failed to load ComexeApi: %s\n", lua_tostring(LuaState, -1));
+    lua_pop(LuaState, 1);
+    Success = false;
+  }
+  else if (lua_pcall(LuaState, 0, 2, 0) != LUA_OK)
+  {
+    fprintf(stderr, "ERROR: Failed to run ComexeApi: %s\n", lua_tostring(LuaState, -1));
+    lua_pop(LuaState, 1);
+    Success = false;
+  }
+  else if (!(lua_isfunction(LuaState, -2) && lua_isfunction(LuaState, -1)))
+  {
+    fprintf(stderr, "ERROR: ComexeApi must return the runner and reset functions\n");
+    lua_pop(LuaState, 2);
+    Success = false;
+  }
+  else
+  {
+    Instance->ResetRef  = luaL_ref(LuaState, LUA_REGISTRYINDEX);
+    Instance->RunnerRef = luaL_ref(LuaState, LUA_REGISTRYINDEX);
+    Success             = true;
+  }
+
+  return Success;
+}
+
+/* Call the function Reference from the registry, used for the runner and the
+ * reset functions returned by comexe/init.lua */
+static bool APP_CallComexeFunction (lua_State *LuaState, int Reference)
+{
+  bool Success;
+  int  Status;
+
+  lua_rawgeti(LuaState, LUA_REGISTRYINDEX, Reference);
+  Status = lua_pcall(LuaState, 0, 0, 0);
+
+  if (Status == LUA_ERRMEM)
+  {
+    /* Only the memory limit of Thread.create can refuse an allocation, the
+     * thread finishes but the application continues */
+    fprintf(stderr, "ERROR: Thread '%s' reached its memory limit\n", LUA_GetInstance(LuaState)->ModuleName);
+    lua_pop(LuaState, 1);
+    Success = true;
+  }
+  else if (Status != LUA_OK)
+  {
+    fprintf(stderr, "ERROR: Failed to run ComexeApi: %s\n", lua_tostring(LuaState, -1));
+    lua_pop(LuaState, 1);
+    Success = false;
+  }
+  else
+  {
+    Success = true;
+  }
+
+  return Success;
+}
+
+/*============================================================================*/
+/* LUA INSTANCE                                                               */
+/*============================================================================*/
+
+static void APP_PrintThreadHierarchy (struct LUA_Instance *Instance,
+                                      int32_t              Level)
+{
+  char                 Indent[256] = "";
+  int32_t              Index;
+  struct LUA_Instance *ChildInstance;
+
+  /* Create indentation with tree branches */
+  if (Level == 0)
+  {
+    strcat(Indent, "* ");
+  }
+  else
+  {
+    strcat(Indent, "|");
+    for (Index = 1; Index < Level; Index++)
+    {
+      strcat(Indent, "   |");
+    }
+    strcat(Indent, "---");
+  }
+
+  /* Print current instance info */
+  printf("%s[%s] ThreadId=%zu\n", Indent, Instance->ModuleName, Instance->Offset);
+
+  /* Recursively print children */
+  for (ChildInstance = Instance->FirstChild; ChildInstance; ChildInstance = ChildInstance->NextSibling)
+  {
+    APP_PrintThreadHierarchy(ChildInstance, Level + 1);
+  }
+}
+
+/* The parent can be joined meanwhile, InstanceArrayMutex keeps it alive. The
+ * exit event of an orphan goes to RootInstance. */
+static void APP_SendExitEventToParent (struct LUA_Instance *Instance)
+{
+  struct LUA_Application *Application = Instance->Application;
+  struct EM_Writer       *Writer      = &Instance->MessageWriter;
+
+  /* EventName + InstanceId */
+  EM_ResetWriter(Writer);
+  EM_WriteString(Writer, Instance->ExitEventName, strlen(Instance->ExitEventName));
+  EM_WriteInteger(Writer, Instance->Offset);
+
+  uv_mutex_lock(&Application->InstanceArrayMutex);
+  APP_ReserveMailbox(Instance->Parent, Writer->SizeInBytes, false);
+  APP_DeliverMessage(Instance->Parent, EM_NewMessage(Writer));
+  uv_mutex_unlock(&Application->InstanceArrayMutex);
+}
+
+/* Set positive arguments: arg[1], arg[2], ... */
+static void APP_CreateArguments (lua_State   *LuaState,
+                                 int32_t      ArgCount,
+                                 const char **Argv)
+{
+  int32_t Offset;
+
+  /* Create argument table */
+  lua_createtable(LuaState, ArgCount, 0); /* State, Array, Keys */
+
+  for (Offset = 0; Offset < ArgCount; Offset++)
+  {
+    lua_pushinteger(LuaState, (Offset + 1));
+    lua_pushstring(LuaState, Argv[Offset]);
+    lua_settable(LuaState, -3);
+  }
+  
+  /* Override in the Lua standard "arg" variable */
+  lua_setglobal(LuaState, "arg");
+}
+
+/*============================================================================*/
+/* THREAD POOL                                                                */
+/*============================================================================*/
+
+/* Called by the instance thread when it's ready to run a module. Return false
+ * if the pool is shut down while the instance is idle. */
+static bool APP_WaitForAssignment (struct LUA_Instance *Instance)
+{
+  struct APP_Pool *Pool = &Instance->Application->Pool;
+  bool             Assigned;
+
+  uv_mutex_lock(&Instance->StateMutex);
+  Assigned = ((Instance->State & INSTANCE_MASK_ASSIGNED) != 0);
+  uv_mutex_unlock(&Instance->StateMutex);
+
+  if (!Assigned)
+  {
+    /* Become idle, the capacity is reserved by WarmingCount */
+    uv_mutex_lock(&Pool->PoolMutex);
+    Pool->IdleInstances[Pool->IdleCount++] = Instance;
+    Pool->WarmingCount--;
+    uv_cond_broadcast(&Pool->PoolCondition);
+    uv_mutex_unlock(&Pool->PoolMutex);
+
+    /* Wait for APP_ClaimPooledInstance or APP_ShutdownPool */
+    uv_mutex_lock(&Instance->StateMutex);
+    while ((Instance->State & (INSTANCE_MASK_ASSIGNED | INSTANCE_MASK_POOL_SHUTDOWN)) == 0)
+    {
+      uv_cond_wait(&Instance->StateCondition, &Instance->StateMutex);
+    }
+    Assigned = ((Instance->State & INSTANCE_MASK_ASSIGNED) != 0);
+    uv_mutex_unlock(&Instance->StateMutex);
+  }
+
+  return Assigned;
+}
+
+/* Restore the instance as it was after APP_LoadComexeApi */
+static void APP_ResetInstance (struct LUA_Instance *Instance)
+{
+  lua_State *LuaState = Instance->LuaState;
+
+  if (!APP_CallComexeFunction(LuaState, Instance->ResetRef))
+  {
+    fprintf(stderr, "ERROR: Failed to reset ComEXE instance\n");
+    exit(5);
+  }
+
+  /* Events sent to the previous module are discarded */
+  APP_DiscardMessages(Instance);
+  APP_ClearHandlers(LuaState, Instance);
+
+  uv_mutex_lock(&Instance->StateMutex);
+  if (Instance->Reply)
+  {
+    EM_FreeMessage(Instance->Reply);
+  }
+  if (Instance->Arguments)
+  {
+    EM_FreeMessage(Instance->Arguments);
+  }
+  Instance->Reply         = NULL;
+  Instance->Arguments     = NULL;
+  Instance->PendingCallId = 0;
+  PLAT_Free((void *)Instance->ModuleName);    /* Discard const */
+  PLAT_Free((void *)Instance->ExitEventName); /* Discard const */
+  PLAT_Free((void *)Instance->ThreadName);    /* Discard const */
+  PLAT_Free(Instance->CpuMask);
+  Instance->ModuleName    = NULL;
+  Instance->ExitEventName = NULL;
+  Instance->ThreadName    = NULL;
+  Instance->CpuMask       = NULL;
+  Instance->HasPriority   = false;
+  Instance->Parent        = NULL;
+  Instance->Offset        = 0;
+  Instance->State         = INSTANCE_MASK_ACTIVE;
+  uv_mutex_unlock(&Instance->StateMutex);
+}
+
+/* Called by the instance thread when the module is finished. Block until
+ * Thread.join, return true if the instance has been assigned again. */
+static bool APP_WaitForRecycle (struct LUA_Instance *Instance)
+{
+  bool Recycle;
+  bool Assigned;
+
+  uv_mutex_lock(&Instance->StateMutex);
+  APP_BIT_SET(Instance->State, INSTANCE_MASK_FINISHED);
+  uv_cond_broadcast(&Instance->JoinCondition);
+  while ((Instance->State & INSTANCE_MASK_JOINED) == 0)
+  {
+    uv_cond_wait(&Instance->JoinCondition, &Instance->StateMutex);
+  }
+  Recycle = ((Instance->State & INSTANCE_MASK_RECYCLE) != 0);
+  uv_mutex_unlock(&Instance->StateMutex);
+
+  if (Recycle)
+  {
+    APP_ResetInstance(Instance);
+    Assigned = APP_WaitForAssignment(Instance);
+  }
+  else
+  {
+    Assigned = false;
+  }
+
+  return Assigned;
+}
+
+/* Called by Thread.join. Return true if the joined instance must go back to
+ * the pool, the slot is then reserved in WarmingCount. */
+static bool APP_ReservePoolSlot (struct LUA_Application *Application)
+{
+  struct APP_Pool *Pool = &Application->Pool;
+  bool             Recycle;
+
+  uv_mutex_lock(&Pool->PoolMutex);
+  if (!Pool->Shutdown && ((Pool->IdleCount + Pool->WarmingCount) < Pool->PoolSize))
+  {
+    Pool->WarmingCount++;
+    Pool->Recycled++;
+    Recycle = true;
+  }
+  else
+  {
+    Recycle = false;
+  }
+  uv_mutex_unlock(&Pool->PoolMutex);
+
+  return Recycle;
+}
+
+static void APP_TerminateIdleInstance (struct LUA_Instance *Instance)
+{
+  uv_mutex_lock(&Instance->StateMutex);
+  APP_BIT_SET(Instance->State, INSTANCE_MASK_POOL_SHUTDOWN);
+  uv_cond_signal(&Instance->StateCondition);
+  uv_mutex_unlock(&Instance->StateMutex);
+
+  uv_thread_join(&Instance->Thread);
+  APP_ReleaseInstance(Instance);
+}
+
+/* Return NULL if there is no idle instance (pool miss) */
+static struct LUA_Instance *APP_ClaimPooledInstance (struct LUA_Application         *Application,
+                                                     struct LUA_Instance            *ParentInstance,
+                                                     const char                     *ComponentName,
+                                                     const char                     *ExitEventName,
+                                                     const struct APP_ThreadOptions *Options)
+{
+  struct APP_Pool     *Pool = &Application->Pool;
+  struct LUA_Instance *Instance;
+  size_t               InstanceOffset;
+
+  uv_mutex_lock(&Pool->PoolMutex);
+  if (!Pool->Shutdown && (Pool->IdleCount > 0))
+  {
+    Instance = Pool->IdleInstances[--Pool->IdleCount];
+    Pool->Hits++;
+  }
+  else
+  {
+    Instance = NULL;
+    if (Pool->PoolSize > 0)
+    {
+      Pool->Misses++;
+    }
+  }
+  uv_mutex_unlock(&Pool->PoolMutex);
+
+  if (Instance)
+  {
+    /* The instance is idle, nobody can send events to it yet */
+    Instance->MailboxMaxMessages   = Options->MaxMessages;
+    Instance->MailboxMaxBytes      = Options->MaxBytes;
+    Instance->MailboxHighWater     = 0;
+    Instance->MailboxEnqueued      = 0;
+    Instance->MailboxBytesEnqueued = 0;
+    Instance->MailboxDropped       = 0;
+    Instance->MailboxBlocked       = 0;
+    __atomic_store_n(&Instance->MailboxClosed, false, __ATOMIC_SEQ_CST);
+    Instance->Arguments            = Options->Arguments;
+    Instance->MaxMemory            = Options->MaxMemory;
+    Instance->CpuMask              = Options->CpuMask;
+    Instance->Priority             = Options->Priority;
+    Instance->HasPriority          = Options->HasPriority;
+    __atomic_store_n(&Instance->MemoryPeak, __atomic_load_n(&Instance->MemoryBytes, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_store_n(&Instance->MemoryRefused, 0, __ATOMIC_RELAXED);
+
+    /* Update application */
+    uv_mutex_lock(&Application->InstanceArrayMutex);
+    InstanceOffset = TA_AddObject(Application->InstanceArray, Instance);
+    APP_LinkChild(ParentInstance, Instance);
+    uv_mutex_unlock(&Application->InstanceArrayMutex);
+
+    /* Hand the module to the idle instance */
+    uv_mutex_lock(&Instance->StateMutex);
+    Instance->Offset     = InstanceOffset;
+    Instance->ModuleName = PLAT_StrDup(ComponentName);
+    if (ExitEventName)
+    {
+      Instance->ExitEventName = PLAT_StrDup(ExitEventName);
+    }
+    if (Options->ThreadName)
+    {
+      Instance->ThreadName = PLAT_StrDup(Options->ThreadName);
+    }
+    APP_BIT_SET(Instance->State, INSTANCE_MASK_ASSIGNED);
+    uv_cond_signal(&Instance->StateCondition);
+    uv_mutex_unlock(&Instance->StateMutex);
+  }
+
+  return Instance;
+}
+
+static void APP_SetPoolSize (struct LUA_Application *Application, size_t PoolSize)
+{
+  struct APP_Pool      *Pool = &Application->Pool;
+  struct LUA_Instance **ExtraInstances;
+  size_t                ExtraCount;
+  size_t                MissingCount;
+  size_t                Index;
+
+  ExtraInstances = NULL;
+  ExtraCount     = 0;
+  MissingCount   = 0;
+
+  uv_mutex_lock(&Pool->PoolMutex);
+
+  if (!Pool->Shutdown)
+  {
+    if (PoolSize > Pool->Capacity)
+    {
+      Pool->IdleInstances = PLAT_SafeRealloc(Pool->IdleInstances,
+                                             PoolSize * sizeof(struct LUA_Instance *));
+      Pool->Capacity      = PoolSize;
+    }
+
+    Pool->PoolSize = PoolSize;
+
+    if ((Pool->IdleCount + Pool->WarmingCount) < PoolSize)
+    {
+      MissingCount        = (PoolSize - (Pool->IdleCount + Pool->WarmingCount));
+      Pool->WarmingCount += MissingCount;
+    }
+    else if (Pool->IdleCount > PoolSize)
+    {
+      ExtraCount      = (Pool->IdleCount - PoolSize);
+      ExtraInstances  = PLAT_SafeAlloc0(ExtraCount, sizeof(struct LUA_Instance *));
+      Pool->IdleCount = PoolSize;
+      memcpy(ExtraInstances,
+             &Pool->IdleInstances[PoolSize],
+             ExtraCount * sizeof(struct LUA_Instance *));
+    }
+  }
+
+  uv_mutex_unlock(&Pool->PoolMutex);
+
+  /* New instances add themselves to the pool once comexe/init.lua is loaded */
+  for (Index = 0; Index < MissingCount; Index++)
   {
-    fprintf(stderr, "ERROR: Failed to load ComexeApi: %s\n", lua_tostring(LuaState, -1));
-    lua_pop(LuaState, 1);
-    Success = false;
+    APP_CreateInstance(Application, NULL, NULL, NULL, NULL);
   }
-  else if (lua_pcall(LuaState, 0, 0, 0) != LUA_OK)
+
+  for (Index = 0; Index < ExtraCount; Index++)
   {
-    fprintf(stderr, "ERROR: Failed to run ComexeApi: %s\n", lua_tostring(LuaState, -1));
-    lua_pop(LuaState, 1);
-    Success = false;
+    APP_TerminateIdleInstance(ExtraInstances[Index]);
   }
-  else
+
+  PLAT_Free(ExtraInstances);
+}
+
+/* Wait for the warming instances and terminate all the idle instances */
+static void APP_ShutdownPool (struct LUA_Application *Application)
+{
+  struct APP_Pool *Pool = &Application->Pool;
+  size_t           IdleCount;
+  size_t           Index;
+
+  uv_mutex_lock(&Pool->PoolMutex);
+  Pool->Shutdown = true;
+  while (Pool->WarmingCount > 0)
   {
-    Success = true;
+    uv_cond_wait(&Pool->PoolCondition, &Pool->PoolMutex);
   }
+  IdleCount       = Pool->IdleCount;
+  Pool->IdleCount = 0;
+  uv_mutex_unlock(&Pool->PoolMutex);
 
-  return Success;
+  /* Shutdown is set, the idle instances can't be claimed anymore */
+  for (Index = 0; Index < IdleCount; Index++)
+  {
+    APP_TerminateIdleInstance(Pool->IdleInstances[Index]);
+  }
 }
 
 /*============================================================================*/
-/* LUA INSTANCE                                                               */
+/* LUA THREAD                                                                 */
 /*============================================================================*/
 
-static void APP_PrintThreadHierarchy (struct LUA_Application *Application,
-                                      struct LUA_Instance    *Instance,
-                                      int32_t                 Level)
+/* ud is the instance, NULL for a temporary lua_State which uses the default
+ * heap. Only the thread of the instance allocates, the counters are atomic
+ * because Runtime.getmemorystats reads them from other threads.
+ *
+ * Above MemoryLimit, the allocation fails: Lua runs an emergency GC, retries,
+ * then raises a memory error. A block is never refused when it shrinks. */
+static void *APP_LuaAllocator (void* ud, void* ptr, size_t osize, size_t nsize)
 {
-  char                 Indent[256] = "";
-  int32_t              Index;
-  size_t               InstanceCapacity;
-  size_t               InstanceOffset;
-  struct LUA_Instance *ChildInstance;
+  struct LUA_Instance *Instance = ud;
+  size_t               OldSize  = (ptr ? osize : 0);
+  size_t               Bytes;
+  void                *NewBlock;
 
-  /* Create indentation with tree branches */
-  if (Level == 0)
+  if (Instance == NULL)
   {
-    strcat(Indent, "* ");
+    if (nsize == 0)
+    {
+      PLAT_Free(ptr);
+      NewBlock = NULL;
+    }
+    else
+    {
+      NewBlock = PLAT_SafeRealloc(ptr, nsize);
+    }
   }
   else
   {
-    strcat(Indent, "|");
-    for (Index = 1; Index < Level; Index++)
+    Bytes = Instance->MemoryBytes;
+
+    if (nsize == 0)
     {
-      strcat(Indent, "   |");
+      PLAT_Free(ptr);
+      NewBlock = NULL;
+      Bytes    = (Bytes - OldSize);
     }
-    strcat(Indent, "---");
-  }
-
-  /* Print current instance info */
-  printf("%s[%s] ThreadId=%zu\n", Indent, Instance->ModuleName, Instance->Offset);
-
-  /* Recursively print children */
-  InstanceCapacity = TA_GetCapacity(Application->InstanceArray);
-  for (InstanceOffset = 1; InstanceOffset <= InstanceCapacity; InstanceOffset++)
-  {
-    if (TA_IsValid(Application->InstanceArray, InstanceOffset))
+    else if ((nsize > OldSize)
+             && (Instance->MemoryLimit > 0)
+             && ((Bytes - OldSize + nsize) > Instance->MemoryLimit))
     {
-      ChildInstance = TA_GetObject(Application->InstanceArray, InstanceOffset);
-      if ((ChildInstance != Instance) && (ChildInstance->Parent == Instance))
+      NewBlock = NULL;
+      __atomic_store_n(&Instance->MemoryRefused, (Instance->MemoryRefused + 1), __ATOMIC_RELAXED);
+    }
+    else
+    {
+      NewBlock = PLAT_HeapRealloc(Instance->Heap, ptr, nsize);
+      Bytes    = (Bytes - OldSize + nsize);
+
+      if (ptr == NULL)
       {
-        APP_PrintThreadHierarchy(Application, ChildInstance, Level + 1);
+        __atomic_store_n(&Instance->MemoryAllocations, (Instance->MemoryAllocations + 1), __ATOMIC_RELAXED);
+      }
+      if (Bytes > Instance->MemoryPeak)
+      {
+        __atomic_store_n(&Instance->MemoryPeak, Bytes, __ATOMIC_RELAXED);
       }
     }
+
+    __atomic_store_n(&Instance->MemoryBytes, Bytes, __ATOMIC_RELAXED);
   }
+
+  return NewBlock;
 }
 
-static void APP_SendExitEventToParent (struct LUA_Instance *Instance)
+/* Called by the thread of the instance before running its module. A pooled
+ * thread keeps the affinity of its previous module, so the affinity at
+ * startup is restored when the new module doesn't set it. The threads with a
+ * priority are never pooled: on Linux, a lowered priority can only be raised
+ * back with a privilege. Placement failures are warnings. */
+static void APP_ApplyPlacement (struct LUA_Instance *Instance)
 {
-  struct LUA_Instance *ParentInstance = Instance->Parent;
-  struct MAIN_Event    Event;
-  struct BA_Allocator *PendingEvents;
-  BA_Key_t             NewEventKey;
-  size_t               EventNameLength;
-  uint8_t             *NewEventData;
-  struct MAIN_Event   *pEvent;
-
-  /* Lock parent's event mutex for event operations */
-  uv_mutex_lock(&ParentInstance->EventMutex);
-    
-  PendingEvents   = ParentInstance->EventBufferReceive;
-  EventNameLength = strlen(Instance->ExitEventName);
+  uv_thread_t  Self           = uv_thread_self();
+  char        *DefaultCpuMask = Instance->Application->DefaultCpuMask;
+  const char  *ThreadName;
+  int          Result;
 
-  /* Send normal function call event first */
-  Event.Type                     = INSTANCE_EVENT_START;
-  Event.Data.Start.ArgumentCount = 2; /* EventName + InstanceId */
-  BA_PushBlob(PendingEvents, &Event, sizeof(Event));
+  /* Visible in top and perf, truncated by the platform */
+  ThreadName = (Instance->ThreadName ? Instance->ThreadName : Instance->ModuleName);
+  uv_thread_setname(ThreadName);
 
-  /* Send EventName */
-  Event.Type               = INSTANCE_EVENT_PARAM_STRING;
-  Event.Data.String.Length = EventNameLength;
-  BA_AllocateBlob(PendingEvents,
-                  sizeof(struct MAIN_Event) + EventNameLength + 1,
-                  &NewEventKey,
-                  &NewEventData);
-
-  /* Copy event structure and string data */
-  pEvent = (struct MAIN_Event *)NewEventData;
-  memcpy(pEvent, &Event, sizeof(struct MAIN_Event));
-  memcpy(pEvent->Data.String.Value, Instance->ExitEventName, EventNameLength + 1);
-
-  /* Send Instance ID */
-  Event.Type = INSTANCE_EVENT_PARAM_INTEGER;
-  Event.Data.Integer.Value = Instance->Offset;
-  BA_PushBlob(PendingEvents, &Event, sizeof(Event));
-
-  /* Send END event */
-  Event.Type = INSTANCE_EVENT_END;
-  BA_PushBlob(PendingEvents, &Event, sizeof(Event));
-
-  uv_mutex_unlock(&ParentInstance->EventMutex);
+  if (Instance->CpuMask)
+  {
+    Result = uv_thread_setaffinity(&Self, Instance->CpuMask, NULL, (size_t)uv_cpumask_size());
+    if (Result < 0)
+    {
+      fprintf(stderr, "WARNING: Thread '%s': failed to set the CPU affinity (%s)\n", ThreadName, uv_strerror(Result));
+    }
+    Instance->AffinitySet = true;
+  }
+  else if (Instance->AffinitySet && DefaultCpuMask)
+  {
+    Result = uv_thread_setaffinity(&Self, DefaultCpuMask, NULL, (size_t)uv_cpumask_size());
+    if (Result < 0)
+    {
+      fprintf(stderr, "WARNING: Thread '%s': failed to restore the CPU affinity (%s)\n", ThreadName, uv_strerror(Result));
+    }
+    Instance->AffinitySet = false;
+  }
 
-  /* Wake up thread */
-  uv_mutex_lock(&ParentInstance->StateMutex);
-  APP_BIT_SET(ParentInstance->State, INSTANCE_MASK_EVENTS_PENDING);
-  uv_cond_signal(&ParentInstance->StateCondition);
-  uv_mutex_unlock(&ParentInstance->StateMutex);
+  if (Instance->HasPriority)
+  {
+    Result = uv_thread_setpriority(Self, Instance->Priority);
+    if (Result < 0)
+    {
+      fprintf(stderr, "WARNING: Thread '%s': failed to set the priority (%s)\n", ThreadName, uv_strerror(Result));
+    }
+  }
 }
 
-/* Set positive arguments: arg[1], arg[2], ... */
-static void APP_CreateArguments (lua_State   *LuaState,
-                                 int32_t      ArgCount,
-                                 const char **Argv)
+/* Affinity of the calling thread, restored by the pooled threads. NULL if the
+ * platform doesn't support the CPU affinity. */
+static char *APP_GetDefaultCpuMask (void)
 {
-  int32_t Offset;
-
-  /* Create argument table */
-  lua_createtable(LuaState, ArgCount, 0); /* State, Array, Keys */
+  uv_thread_t  Self     = uv_thread_self();
+  int          MaskSize = uv_cpumask_size();
+  char        *CpuMask;
 
-  for (Offset = 0; Offset < ArgCount; Offset++)
+  if (MaskSize > 0)
   {
-    lua_pushinteger(LuaState, (Offset + 1));
-    lua_pushstring(LuaState, Argv[Offset]);
-    lua_settable(LuaState, -3);
+    CpuMask = PLAT_SafeAlloc0((size_t)MaskSize, sizeof(char));
+    if (uv_thread_getaffinity(&Self, CpuMask, (size_t)MaskSize) < 0)
+    {
+      PLAT_Free(CpuMask);
+      CpuMask = NULL;
+    }
   }
-  
-  /* Override in the Lua standard "arg" variable */
-  lua_setglobal(LuaState, "arg");
+  else
+  {
+    CpuMask = NULL;
+  }
+
+  return CpuMask;
 }
 
 static void LUA_LuaThread (void *UserData)
 {
   struct LUA_Instance    *Instance    = UserData;
   struct LUA_Application *Application = Instance->Application;
-  lua_State              *LuaState    = Instance->LuaState;
+  lua_State              *LuaState;
+  bool                    Continue;
 
   PLAT_ThreadInitalize();
-  
+
+  /* The heap belongs to this thread: the allocations of the lua_State don't
+   * contend with the other instances, and the lua_State is closed here */
+  Instance->Heap     = PLAT_NewHeap();
+  LuaState           = lua_newstate(APP_LuaAllocator, Instance, luaL_makeseed(NULL));
+  Instance->LuaState = LuaState;
+
+  /* Stop GC while building state, like lua.c, will be restarted in init.lua */
+  lua_gc(LuaState, LUA_GCSTOP);
+
+  /* Attach important references to the LuaState */
+  LUA_SetInstance(LuaState, Instance);
+
   /* Unblock APP_CreateInstance using StateMutex/StateCondition */
   uv_mutex_lock(&Instance->StateMutex);
   APP_BIT_SET(Instance->State, INSTANCE_MASK_ACTIVE);
@@ -1257,51 +4100,126 @@ static void LUA_LuaThread (void *UserData)
     fprintf(stderr, "ERROR: Failed to load ComEXE (%s)\n", LUA_EMBEDDED_ENTRY_NAME);
     exit(5);
   }
-  
-  /* Notify the parent event loop */
-  if (Instance->ExitEventName)
+
+  /* Idle instances wait in the pool until they are claimed */
+  Continue = APP_WaitForAssignment(Instance);
+
+  while (Continue)
   {
-    APP_SendExitEventToParent(Instance);
+    APP_ApplyPlacement(Instance);
+
+    /* The limit doesn't apply to comexe/init.lua and to the reset */
+    Instance->MemoryLimit = Instance->MaxMemory;
+
+    /* Run the module */
+    if (!APP_CallComexeFunction(LuaState, Instance->RunnerRef))
+    {
+      fprintf(stderr, "ERROR: Failed to load ComEXE (%s)\n", LUA_EMBEDDED_ENTRY_NAME);
+      exit(5);
+    }
+
+    Instance->MemoryLimit = 0;
+
+    /* Release the senders blocked on a full mailbox */
+    uv_mutex_lock(&Instance->StateMutex);
+    __atomic_store_n(&Instance->MailboxClosed, true, __ATOMIC_SEQ_CST);
+    uv_cond_broadcast(&Instance->MailboxCondition);
+    uv_mutex_unlock(&Instance->StateMutex);
+
+    /* The callers don't wait for Thread.join to get an error */
+    APP_DiscardMessages(Instance);
+
+    /* Notify the parent event loop */
+    if (Instance->ExitEventName)
+    {
+      APP_SendExitEventToParent(Instance);
+    }
+
+    /* Pooled instances wait for Thread.join and might run another module */
+    if (Instance->Poolable)
+    {
+      Continue = APP_WaitForRecycle(Instance);
+    }
+    else
+    {
+      Continue = false;
+    }
   }
 
+  /* No more wake up, luv closes the async handle in lua_close */
+  uv_mutex_lock(&Instance->StateMutex);
+  __atomic_store_n(&Instance->AsyncEnabled, false, __ATOMIC_RELEASE);
+  uv_mutex_unlock(&Instance->StateMutex);
+
+  /* The finalizers run in this thread, then the remaining pages of the heap
+   * are released at once */
+  lua_close(LuaState);
+  PLAT_DestroyHeap(Instance->Heap);
+
+  Instance->LuaState = NULL;
+  Instance->Heap     = NULL;
+
   PLAT_ThreadDeinitialize();
 }
 
-static void *APP_LuaAllocator (void* ud, void* ptr, size_t osize, size_t nsize)
+/* When ComponentName is NULL, the new instance is an idle instance of the pool:
+ * it is not registered in InstanceArray until it is claimed. Options can be
+ * NULL, the mailbox is then unbounded. */
+static struct LUA_Instance *APP_CreateInstance (struct LUA_Application         *Application,
+                                                struct LUA_Instance            *ParentInstance,
+                                                const char                     *ComponentName,
+                                                const char                     *ExitEventName,
+                                                const struct APP_ThreadOptions *Options)
 {
-  (void)ud;    /* unused parameter */
-  (void)osize; /* unused parameter */
+  struct LUA_Instance *NewInstance = PLAT_SafeAlloc0(1, sizeof(struct LUA_Instance));
+  size_t               InstanceOffset;
+  uv_thread_options_t  ThreadOptions;
 
-  if (nsize == 0)
+  /* Before InstanceArray, Event.broadcast can find the instance there */
+  if (Options)
   {
-    PLAT_Free(ptr);
-    return NULL;
+    NewInstance->MailboxMaxMessages = Options->MaxMessages;
+    NewInstance->MailboxMaxBytes    = Options->MaxBytes;
+    NewInstance->Arguments          = Options->Arguments;
+    NewInstance->MaxMemory          = Options->MaxMemory;
+    NewInstance->CpuMask            = Options->CpuMask;
+    NewInstance->Priority           = Options->Priority;
+    NewInstance->HasPriority        = Options->HasPriority;
+    if (Options->ThreadName)
+    {
+      NewInstance->ThreadName = PLAT_StrDup(Options->ThreadName);
+    }
   }
-  else
+
+  if (ComponentName)
   {
-    return PLAT_SafeRealloc(ptr, nsize);
-  }
-}
+    /* Update application */
+    uv_mutex_lock(&Application->InstanceArrayMutex);
+    InstanceOffset = TA_AddObject(Application->InstanceArray, NewInstance);
+    APP_LinkChild(ParentInstance, NewInstance);
+    uv_mutex_unlock(&Application->InstanceArrayMutex);
 
-static struct LUA_Instance *APP_CreateInstance (struct LUA_Application *Application,
-                                                struct LUA_Instance    *ParentInstance,
-                                                const char             *ComponentName,
-                                                const char             *ExitEventName)
-{
-  struct LUA_Instance *NewInstance = PLAT_SafeAlloc0(1, sizeof(struct LUA_Instance));
-  size_t               InstanceOffset;
-  unsigned int         Seed;
+    NewInstance->State      = INSTANCE_MASK_ASSIGNED;
+    NewInstance->ModuleName = PLAT_StrDup(ComponentName);
 
-  /* Update application */
-  uv_mutex_lock(&Application->InstanceArrayMutex);
-  InstanceOffset = TA_AddObject(Application->InstanceArray, NewInstance);
-  uv_mutex_unlock(&Application->InstanceArrayMutex);
+    /* Instances created while the pool is enabled can be recycled, except
+     * with a stack size or a priority which can't be reverted */
+    uv_mutex_lock(&Application->Pool.PoolMutex);
+    NewInstance->Poolable = ((Application->Pool.PoolSize > 0)
+                             && !(Options && ((Options->StackSize > 0) || Options->HasPriority)));
+    uv_mutex_unlock(&Application->Pool.PoolMutex);
+  }
+  else
+  {
+    InstanceOffset          = 0;
+    NewInstance->State      = 0;
+    NewInstance->ModuleName = NULL;
+    NewInstance->Poolable   = true;
+  }
 
   /* Set new instance */
   NewInstance->Application = Application;
   NewInstance->Offset      = InstanceOffset;
-  NewInstance->State       = 0;
-  NewInstance->ModuleName  = PLAT_StrDup(ComponentName);
 
   if (ExitEventName)
   {
@@ -1312,30 +4230,33 @@ static struct LUA_Instance *APP_CreateInstance (struct LUA_Application *Applicat
     NewInstance->ExitEventName = NULL;
   }
 
-  Seed = luaL_makeseed(NULL);
-
-  NewInstance->LuaState           = lua_newstate(APP_LuaAllocator, NULL, Seed);
-  NewInstance->Parent             = ParentInstance;
+  /* The lua_State is created by the thread, see LUA_LuaThread */
   NewInstance->WarningFunctionRef = LUA_REFNIL;
+  NewInstance->FallbackRef        = LUA_NOREF;
+  NewInstance->RunnerRef          = LUA_REFNIL;
+  NewInstance->ResetRef           = LUA_REFNIL;
 
-  /* Stop GC while building state, like lua.c, will be restarted in init.lua */
-  lua_gc(NewInstance->LuaState, LUA_GCSTOP);
-
-  NewInstance->EventBufferReceive = BA_NewAllocator(LUA_INSTANCE_PENDING_EVENT_COUNT,
-                                                    LUA_INSTANCE_PENDING_EVENT_SIZE);
-
-  NewInstance->EventBufferTemp = BA_NewAllocator(LUA_INSTANCE_PENDING_EVENT_COUNT,
-                                                 LUA_INSTANCE_PENDING_EVENT_SIZE);
-
-  /* Attach important references to the LuaState */
-  LUA_SetInstance(NewInstance->LuaState, NewInstance);
+  MQ_InitQueue(&NewInstance->Mailbox);
+  EM_InitWriter(&NewInstance->MessageWriter);
 
   uv_mutex_init(&NewInstance->StateMutex);
   uv_cond_init(&NewInstance->StateCondition);
-  uv_mutex_init(&NewInstance->EventMutex);
+  uv_cond_init(&NewInstance->MailboxCondition);
+  uv_cond_init(&NewInstance->ReplyCondition);
+  uv_cond_init(&NewInstance->JoinCondition);
 
-  /* Start thread */
-  uv_thread_create(&NewInstance->Thread, LUA_LuaThread, NewInstance);
+  /* Start thread, see APP_ApplyPlacement for the other options */
+  if (Options && (Options->StackSize > 0))
+  {
+    ThreadOptions.flags      = UV_THREAD_HAS_STACK_SIZE;
+    ThreadOptions.stack_size = Options->StackSize;
+  }
+  else
+  {
+    ThreadOptions.flags      = UV_THREAD_NO_FLAGS;
+    ThreadOptions.stack_size = 0;
+  }
+  uv_thread_create_ex(&NewInstance->Thread, &ThreadOptions, LUA_LuaThread, NewInstance);
 
   /* Blocking wait to ensure Instance->State is valid, before returning the
    * new instance */
@@ -1349,95 +4270,57 @@ static struct LUA_Instance *APP_CreateInstance (struct LUA_Application *Applicat
   return NewInstance;
 }
 
+/* The thread has been joined, its lua_State is closed */
 static void APP_ReleaseInstance (struct LUA_Instance *Instance)
 {
+  APP_DiscardMessages(Instance);
+
   uv_mutex_destroy(&Instance->StateMutex);
   uv_cond_destroy(&Instance->StateCondition);
-  uv_mutex_destroy(&Instance->EventMutex);
-
-  BA_FreeAllocator(Instance->EventBufferReceive);
-  BA_FreeAllocator(Instance->EventBufferTemp);
-  Instance->EventBufferReceive = NULL;
-  Instance->EventBufferTemp    = NULL;
+  uv_cond_destroy(&Instance->MailboxCondition);
+  uv_cond_destroy(&Instance->ReplyCondition);
+  uv_cond_destroy(&Instance->JoinCondition);
+  EM_FreeWriter(&Instance->MessageWriter);
+  PLAT_Free(Instance->BroadcastTargets);
+  PLAT_Free(Instance->HandlerRefs);
+
+  if (Instance->Reply)
+  {
+    EM_FreeMessage(Instance->Reply);
+  }
 
-  lua_close(Instance->LuaState);
+  if (Instance->Arguments)
+  {
+    EM_FreeMessage(Instance->Arguments);
+  }
 
   /* Free the duplicated strings */
   PLAT_Free((void *)Instance->ModuleName);    /* Discard const */
   PLAT_Free((void *)Instance->ExitEventName); /* Discard const */
+  PLAT_Free((void *)Instance->ThreadName);    /* Discard const */
+  PLAT_Free(Instance->CpuMask);
 
   PLAT_Free(Instance);
 }
 
-static uint8_t *APP_LoadEmbeddedFile (struct LUA_Application *Application,
-                                      const char             *ZipEntryName,
-                                      size_t                 *FileSize)
+/* Compile comexe/init.lua in a temporary lua_State, the resulting bytecode
+ * does not depend on the state and is shared by all the instances */
+static void APP_CompileComexeApi (struct LUA_Application *Application)
 {
-  const char      *ExeFilename = Application->Argv[0];
-  unzFile          UnzFile     = unzOpen64(ExeFilename);
-  char             CurrentFilename[256]; /* UNZ_MAXFILENAMEINZIP */
-  bool             FileFound;
-  uint8_t         *FileBuffer;
-  unz_file_info64  FileInfo;
-  size_t           BytesRead;
-  int              Result;
-  
-  /* Initialize output  */
-  FileBuffer = 0;
+  lua_State             *LuaState = lua_newstate(APP_LuaAllocator, NULL, luaL_makeseed(NULL));
+  struct APP_DumpBuffer  Bytecode;
 
-  if (UnzFile)
+  if (luaL_loadbuffer(LuaState,
+                      (const char *)Application->ComexeApi,
+                      Application->ComexeApiSizeInBytes,
+                      LUA_EMBEDDED_ENTRY_NAME) == LUA_OK)
   {
-    Result    = unzGoToFirstFile(UnzFile);
-    FileFound = false;
-
-    while (!FileFound && (Result == UNZ_OK))
-    {
-      /* Get current file info */
-      if (unzGetCurrentFileInfo64(UnzFile,
-                                  &FileInfo,
-                                  CurrentFilename, 
-                                  sizeof(CurrentFilename),
-                                  NULL,
-                                  0,
-                                  NULL,
-                                  0) == UNZ_OK)
-      {
-        if (STRING_Equals(CurrentFilename, ZipEntryName))
-        {
-          /* Found the requested file */
-          if (unzOpenCurrentFile(UnzFile) == UNZ_OK)
-          {
-            /* Read file content */
-            FileBuffer = PLAT_SafeAlloc0(1, FileInfo.uncompressed_size);
-            BytesRead  = unzReadCurrentFile(UnzFile, FileBuffer, (unsigned int)FileInfo.uncompressed_size);
-
-            if (BytesRead > 0)
-            {
-              *FileSize = BytesRead;
-              FileFound = true;
-            }
-            else
-            {
-              /* Failed to read, cleanup */
-              PLAT_Free(FileBuffer);
-              FileBuffer = NULL;
-            }
-            
-            unzCloseCurrentFile(UnzFile);
-          }
-        }
-      }
-      
-      if (!FileFound)
-      {
-        Result = unzGoToNextFile(UnzFile);
-      }
-    }
-    
-    unzClose(UnzFile);
+    APP_DumpFunction(LuaState, &Bytecode);
+    Application->ComexeApiBytecode            = Bytecode.Data;
+    Application->ComexeApiBytecodeSizeInBytes = Bytecode.SizeInBytes;
   }
-  
-  return FileBuffer;
+
+  lua_close(LuaState);
 }
 
 extern struct LUA_Application *LUA_CreateApplication (size_t Argc, const char **Argv)
@@ -1453,89 +4336,64 @@ extern struct LUA_Application *LUA_CreateApplication (size_t Argc, const char **
    * comexe/init.lua */
   strcpy(NewApplication->LoaderConfiguration, "1RZ");
 
+  /* Parse the ZIP central directory once for all the instances */
+  NewApplication->ZipIndex    = ZI_CreateIndex(Argv[0]);
+  NewApplication->ModuleCache = MC_CreateCache(APP_MODULE_CACHE_CAPACITY);
+
   /* Load API from file embedded in ZIP */
-  NewApplication->ComexeApi = APP_LoadEmbeddedFile(NewApplication,
-                                                   LUA_EMBEDDED_ENTRY_NAME,
-                                                   &NewApplication->ComexeApiSizeInBytes);
+  if (NewApplication->ZipIndex)
+  {
+    NewApplication->ComexeApi = ZI_ReadEntry(NewApplication->ZipIndex,
+                                             LUA_EMBEDDED_ENTRY_NAME,
+                                             strlen(LUA_EMBEDDED_ENTRY_NAME),
+                                             &NewApplication->ComexeApiSizeInBytes);
+  }
+
+  if (NewApplication->ComexeApi)
+  {
+    APP_CompileComexeApi(NewApplication);
+  }
 
   /* Regardless the result, we start the thread for this instance, the choice
    * between STANDARD or SIMPLE mode will be done later */
   
   /* Initialize thread synchronization */
   uv_mutex_init(&NewApplication->InstanceArrayMutex);
+  uv_cond_init(&NewApplication->UnpinCondition);
 
   /* Initialize instance array */
   NewApplication->InstanceArray = TA_CreateArray(APP_INITIAL_INSTANCE_CAPACITY);
+  NewApplication->TopicMap      = TH_CreateMap(APP_INITIAL_TOPIC_CAPACITY);
+
+  /* Thread.register */
+  uv_rwlock_init(&NewApplication->NameLock);
+  NewApplication->NameMap = TH_CreateMap(APP_INITIAL_NAME_CAPACITY);
+
+  /* The event ID 0 is never used */
+  uv_mutex_init(&NewApplication->EventNameMutex);
+  NewApplication->EventIdMap        = TH_CreateMap(APP_INITIAL_EVENT_NAME_CAPACITY);
+  NewApplication->EventNameCapacity = APP_INITIAL_EVENT_NAME_CAPACITY;
+  NewApplication->EventNames        = PLAT_SafeAlloc0(APP_INITIAL_EVENT_NAME_CAPACITY, sizeof(char *));
+  NewApplication->EventNameCount    = 1;
+
+  /* The pool is disabled until Thread.setpoolsize */
+  uv_mutex_init(&NewApplication->Pool.PoolMutex);
+  uv_cond_init(&NewApplication->Pool.PoolCondition);
+  NewApplication->DefaultCpuMask = APP_GetDefaultCpuMask();
 
   /* Initialize RootInstance buffers and synchronization */
   uv_mutex_init(&NewApplication->RootInstance.StateMutex);
   uv_cond_init(&NewApplication->RootInstance.StateCondition);
-  uv_mutex_init(&NewApplication->RootInstance.EventMutex);
+  uv_cond_init(&NewApplication->RootInstance.MailboxCondition);
+  uv_cond_init(&NewApplication->RootInstance.ReplyCondition);
+  MQ_InitQueue(&NewApplication->RootInstance.Mailbox);
 
   /* Create the initial instance (will execute LUA_LuaThread) */
-  APP_CreateInstance(NewApplication, &NewApplication->RootInstance, "main", NULL);
+  APP_CreateInstance(NewApplication, &NewApplication->RootInstance, "main", NULL, NULL);
 
   return NewApplication;
 }
 
-static bool APP_ContainsInstance (struct LUA_Application *Application,
-                                  struct LUA_Instance    *Instance)
-{
-  size_t InstanceCapacity = TA_GetCapacity(Application->InstanceArray);
-  size_t InstanceOffset   = 1;
-  bool   Found            = false;
-  
-  struct LUA_Instance *CurrentInstance;
-  
-  while (!Found && (InstanceOffset <= InstanceCapacity))
-  {
-    if (TA_IsValid(Application->InstanceArray, InstanceOffset))
-    {
-      CurrentInstance = TA_GetObject(Application->InstanceArray, InstanceOffset);
-      if (CurrentInstance == Instance)
-      {
-        Found = true;
-      }
-      else
-      {
-        InstanceOffset++;
-      }
-    }
-    else
-    {
-      InstanceOffset++;
-    }
-  }
-
-  return Found;
-}
-
-static void APP_CleanupOrphanedInstances (struct LUA_Application *Application,
-                                          struct LUA_Instance    *OrphansRoot) 
-{
-  size_t InstanceCapacity = TA_GetCapacity(Application->InstanceArray);
-  size_t Offset;
-  
-  struct LUA_Instance *CurrentInstance;
-  struct LUA_Instance *ParentInstance;
-  
-  /* Reparent top-level orphaned instances (those whose parent is invalid) */
-  for (Offset = 1; Offset <= InstanceCapacity; Offset++)
-  {
-    if (TA_IsValid(Application->InstanceArray, Offset))
-    {
-      CurrentInstance = TA_GetObject(Application->InstanceArray, Offset);
-      ParentInstance  = CurrentInstance->Parent;
-      
-      if ((ParentInstance != OrphansRoot)
-          && !APP_ContainsInstance(Application, ParentInstance))
-      {
-        CurrentInstance->Parent = OrphansRoot;
-      }
-    }
-  }
-}
-
 static size_t APP_GetInstanceCount (struct LUA_Application *Application)
 {
   size_t Count = 0;
@@ -1555,8 +4413,8 @@ static size_t APP_GetInstanceCount (struct LUA_Application *Application)
 
 extern void LUA_RunApplication (struct LUA_Application *Application)
 {
-  struct LUA_Instance  OrphansRoot;
   struct LUA_Instance *MainInstance;
+  struct LUA_Instance *OrphansRoot;
   size_t               OrphanCount;
 
   /* Get the main instance (first created instance) */
@@ -1566,6 +4424,9 @@ extern void LUA_RunApplication (struct LUA_Application *Application)
 
   /* Wait for thread exit and cleanup resources */
   LUA_WaitAndRelease(Application, MainInstance);
+
+  /* Idle instances are not in InstanceArray, they are not orphans */
+  APP_ShutdownPool(Application);
   
   uv_mutex_lock(&Application->InstanceArrayMutex);
   
@@ -1573,17 +4434,14 @@ extern void LUA_RunApplication (struct LUA_Application *Application)
   OrphanCount = APP_GetInstanceCount(Application);
   if (OrphanCount > 0)
   {
-    /* Initialize OrphansRoot */
-    memset(&OrphansRoot, 0, sizeof(struct LUA_Instance));
-    OrphansRoot.Offset     = 1;
-    OrphansRoot.Parent     = NULL;
-    OrphansRoot.ModuleName = "Orphans";
-    
-    /* Clean up orphaned instances before printing hierarchy */
-    APP_CleanupOrphanedInstances(Application, &OrphansRoot);
-    
+    /* The main instance is joined, all the remaining instances are children
+     * of RootInstance, see APP_RemoveFromTree */
+    OrphansRoot             = &Application->RootInstance;
+    OrphansRoot->Offset     = 1;
+    OrphansRoot->ModuleName = "Orphans";
+
     printf("WARNING: %zu thread(s) are still active\n", OrphanCount);
-    APP_PrintThreadHierarchy(Application, &OrphansRoot, 0);
+    APP_PrintThreadHierarchy(OrphansRoot, 0);
   }
 
   uv_mutex_unlock(&Application->InstanceArrayMutex);
@@ -1594,9 +4452,7 @@ void SERVICE_NotifyInstance (struct LUA_Application *Application,
                              unsigned int            ControlCode)
 {
   struct LUA_Instance *TargetInstance;
-  struct BA_Allocator *PendingEvents;
-  struct MAIN_Event    Event;
-  size_t               EventNameLength;
+  struct EM_Writer     Writer;
   
   uv_mutex_lock(&Application->InstanceArrayMutex);
   if (TA_IsValid(Application->InstanceArray, 1))
@@ -1611,45 +4467,65 @@ void SERVICE_NotifyInstance (struct LUA_Application *Application,
 
   if (TargetInstance)
   {
-    /* Retrieve a lock EventQueue */
-    uv_mutex_lock(&TargetInstance->EventMutex);
-    PendingEvents = TargetInstance->EventBufferReceive;
-    
-    /* Enqueue START: function name + ctrlCode */
-    Event.Type = INSTANCE_EVENT_START;
-    Event.Data.Start.ArgumentCount = 2;
-    APP_EnqueueEventArgument(PendingEvents, &Event);
-
-    /* Enqueue function name as string */
-    EventNameLength                = strlen(EventName);
-    Event.Type                     = INSTANCE_EVENT_PARAM_STRING;
-    Event.Data.String.ValuePointer = (char *)EventName;
-    Event.Data.String.Length       = EventNameLength;
-    APP_EnqueueEventArgument(PendingEvents, &Event);
-
-    /* Enqueue ControlCode as integer */
-    Event.Type               = INSTANCE_EVENT_PARAM_INTEGER;
-    Event.Data.Integer.Value = ControlCode;
-    APP_EnqueueEventArgument(PendingEvents, &Event);
-
-    /* Enqueue END */
-    Event.Type = INSTANCE_EVENT_END;
-    APP_EnqueueEventArgument(PendingEvents, &Event);
-
-    uv_mutex_unlock(&TargetInstance->EventMutex);
-
-    /* Notify the event loop */
-    uv_mutex_lock(&TargetInstance->StateMutex);
-    APP_BIT_SET(TargetInstance->State, INSTANCE_MASK_EVENTS_PENDING);
-    uv_cond_signal(&TargetInstance->StateCondition);
-    uv_mutex_unlock(&TargetInstance->StateMutex);
+    /* Function name + ControlCode, this thread has no writer */
+    EM_InitWriter(&Writer);
+    EM_WriteString(&Writer, EventName, strlen(EventName));
+    EM_WriteInteger(&Writer, ControlCode);
+    APP_ReserveMailbox(TargetInstance, Writer.SizeInBytes, false);
+    APP_DeliverMessage(TargetInstance, EM_NewMessage(&Writer));
+    EM_FreeWriter(&Writer);
+  }
+}
+
+static void APP_FreeTopics (struct TH_Map *TopicMap)
+{
+  size_t            Cursor = 0;
+  const char       *Key;
+  size_t            KeyLength;
+  void             *Object;
+  struct APP_Topic *Topic;
+
+  while (TH_GetNext(TopicMap, &Cursor, &Key, &KeyLength, &Object))
+  {
+    Topic = Object;
+    PLAT_Free(Topic->Subscribers);
+    PLAT_Free(Topic);
   }
+
+  TH_FreeMap(TopicMap);
+}
+
+static void APP_FreeEventNames (struct LUA_Application *Application)
+{
+  size_t EventId;
+
+  for (EventId = 1; EventId < Application->EventNameCount; EventId++)
+  {
+    PLAT_Free(Application->EventNames[EventId]);
+  }
+
+  PLAT_Free(Application->EventNames);
+  TH_FreeMap(Application->EventIdMap);
+  uv_mutex_destroy(&Application->EventNameMutex);
 }
 
 extern void LUA_FreeApplication (struct LUA_Application *Application)
 {
+  APP_DiscardMessages(&Application->RootInstance);
   uv_mutex_destroy(&Application->InstanceArrayMutex);
+  uv_cond_destroy(&Application->UnpinCondition);
   TA_FreeArray(Application->InstanceArray);
+  APP_FreeTopics(Application->TopicMap);
+  uv_rwlock_destroy(&Application->NameLock);
+  TH_FreeMap(Application->NameMap);
+  APP_FreeEventNames(Application);
+  uv_mutex_destroy(&Application->Pool.PoolMutex);
+  uv_cond_destroy(&Application->Pool.PoolCondition);
+  PLAT_Free(Application->Pool.IdleInstances);
+  PLAT_Free(Application->DefaultCpuMask);
+  ZI_FreeIndex(Application->ZipIndex);
+  MC_FreeCache(Application->ModuleCache);
   PLAT_Free(Application->ComexeApi);
+  PLAT_Free(Application->ComexeApiBytecode);
   PLAT_Free(Application);
 }
@@ -0,0 +1,423 @@
+/*----------------------------------------------------------------------------*
+ * PROJECT  ComEXE                                                            *
+ * FILENAME lua-libblob.c                                                     *
+ * CONTENT  Immutable reference-counted blobs shared between Lua instances    *
+ *----------------------------------------------------------------------------*
+ * Copyright (c) 2020-2026 Pascal COMBIER                                     *
+ * This source code is licensed under the BSD 2-clause license found in the   *
+ * LICENSE file in the root directory of this source tree.                    *
+ *----------------------------------------------------------------------------*/
+
+/*============================================================================*/
+/* DOCUMENTATION                                                              */
+/*============================================================================*/
+
+/**
+ * A SB_Blob is an immutable array of bytes allocated once, outside of any
+ * lua_State. Each Lua instance holding the blob owns one reference on it: the
+ * full userdata "com.blob", a message in a mailbox (see event-message.c) and
+ * the external strings returned by blob:tostring(). The blob is freed when the
+ * last reference is released, whatever the thread.
+ *
+ * Sending a blob in an event only copies the pointer. blob:tostring() returns
+ * a Lua string which points to the data of the blob (lua_pushexternalstring),
+ * so the content can be given to string.find, socket:send or file:write
+ * without being copied.
+ *
+ * The data is always followed by a zero byte, lua_pushexternalstring requires
+ * it.
+ */
+
+/*============================================================================*/
+/* MAKEHEADERS PUBLIC INTERFACE                                               */
+/*============================================================================*/
+
+#if MKH_INTERFACE
+
+#include <stddef.h> /* size_t */
+
+/* The external function luaopen_XXX rely on the type lua_State */
+#include <lua.h>
+
+struct SB_Blob;
+
+#endif
+
+/*============================================================================*/
+/* IMPLEMENTATION                                                             */
+/*============================================================================*/
+
+#include <stdint.h>  /* uint8_t     */
+#include <stdbool.h> /* bool        */
+#include <string.h>  /* memcpy      */
+#include <lauxlib.h> /* luaL_newlib */
+
+#include "comexe.h"
+
+/*============================================================================*/
+/* PRIVATE TYPES                                                              */
+/*============================================================================*/
+
+#define BLOB_METATABLE_NAME "com.blob"
+
+struct SB_Blob
+{
+  size_t  ReferenceCount;
+  size_t  SizeInBytes;
+  uint8_t Data[]; /* SizeInBytes + 1 for the final zero */
+};
+
+/*============================================================================*/
+/* PRIVATE API                                                                */
+/*============================================================================*/
+
+static void BLOB_PushMetatable (lua_State *LuaState);
+
+static struct SB_Blob *BLOB_CheckBlob (lua_State *LuaState, int Index)
+{
+  struct SB_Blob **Userdata = luaL_checkudata(LuaState, Index, BLOB_METATABLE_NAME);
+
+  return *Userdata;
+}
+
+/* Convert the Lua indexes Start..End, like string.sub, into Offset/Count */
+static size_t BLOB_GetRange (lua_Integer  Start,
+                             lua_Integer  End,
+                             size_t       SizeInBytes,
+                             size_t      *Offset)
+{
+  lua_Integer Size = (lua_Integer)SizeInBytes;
+  size_t      Count;
+
+  if (Start < 0)
+  {
+    Start = (Size + Start + 1);
+  }
+  if (End < 0)
+  {
+    End = (Size + End + 1);
+  }
+  if (Start < 1)
+  {
+    Start = 1;
+  }
+  if (End > Size)
+  {
+    End = Size;
+  }
+
+  if (Start > End)
+  {
+    *Offset = 0;
+    Count   = 0;
+  }
+  else
+  {
+    *Offset = (size_t)(Start - 1);
+    Count   = (size_t)(End - Start + 1);
+  }
+
+  return Count;
+}
+
+/* lua_Alloc used to release the reference of an external string */
+static void *BLOB_FreeExternalString (void *UserData, void *Pointer, size_t OldSize, size_t NewSize)
+{
+  (void)Pointer;
+  (void)OldSize;
+  (void)NewSize;
+
+  SB_ReleaseBlob(UserData);
+
+  return NULL;
+}
+
+/*============================================================================*/
+/* BLOB API                                                                   */
+/*============================================================================*/
+
+/* The new blob has 1 reference, owned by the caller */
+struct SB_Blob *SB_NewBlob (const void *Data, size_t SizeInBytes)
+{
+  struct SB_Blob *NewBlob = PLAT_SafeRealloc(NULL, sizeof(struct SB_Blob) + SizeInBytes + 1);
+
+  NewBlob->ReferenceCount = 1;
+  NewBlob->SizeInBytes    = SizeInBytes;
+
+  memcpy(NewBlob->Data, Data, SizeInBytes);
+  NewBlob->Data[SizeInBytes] = 0;
+
+  return NewBlob;
+}
+
+void SB_RetainBlob (struct SB_Blob *Blob)
+{
+  __atomic_add_fetch(&Blob->ReferenceCount, 1, __ATOMIC_RELAXED);
+}
+
+void SB_ReleaseBlob (struct SB_Blob *Blob)
+{
+  if (__atomic_sub_fetch(&Blob->ReferenceCount, 1, __ATOMIC_ACQ_REL) == 0)
+  {
+    PLAT_Free(Blob);
+  }
+}
+
+const uint8_t *SB_GetData (struct SB_Blob *Blob)
+{
+  return Blob->Data;
+}
+
+size_t SB_GetSize (struct SB_Blob *Blob)
+{
+  return Blob->SizeInBytes;
+}
+
+/* Push a new userdata holding a new reference on Blob. A blob can be received
+ * in an event before com.blob is required, so the metatable is created here if
+ * needed. */
+void SB_PushBlob (lua_State *LuaState, struct SB_Blob *Blob)
+{
+  struct SB_Blob **Userdata = lua_newuserdatauv(LuaState, sizeof(struct SB_Blob *), 0);
+
+  SB_RetainBlob(Blob);
+  *Userdata = Blob;
+
+  BLOB_PushMetatable(LuaState);
+  lua_setmetatable(LuaState, -2);
+}
+
+/* Return NULL if the value at Index is not a blob */
+struct SB_Blob *SB_ToBlob (lua_State *LuaState, int Index)
+{
+  struct SB_Blob **Userdata = luaL_testudata(LuaState, Index, BLOB_METATABLE_NAME);
+  struct SB_Blob  *Blob;
+
+  if (Userdata)
+  {
+    Blob = *Userdata;
+  }
+  else
+  {
+    Blob = NULL;
+  }
+
+  return Blob;
+}
+
+/*============================================================================*/
+/* LUA API                                                                    */
+/*============================================================================*/
+
+/* new(String) or new(RawBuffer, Start, End) */
+static int BLOB_NewBlob (lua_State *LuaState)
+{
+  const uint8_t    *Data;
+  size_t            SizeInBytes;
+  struct GB_Buffer *Buffer;
+  size_t            Offset;
+  struct SB_Blob   *NewBlob;
+
+  if (lua_islightuserdata(LuaState, 1))
+  {
+    Buffer      = lua_touserdata(LuaState, 1);
+    SizeInBytes = BLOB_GetRange(luaL_checkinteger(LuaState, 2),
+                                luaL_checkinteger(LuaState, 3),
+                                GB_GetCapacity(Buffer),
+                                &Offset);
+    Data        = ((const uint8_t *)GB_GetData(Buffer) + Offset);
+  }
+  else
+  {
+    Data = (const uint8_t *)luaL_checklstring(LuaState, 1, &SizeInBytes);
+  }
+
+  NewBlob = SB_NewBlob(Data, SizeInBytes);
+  SB_PushBlob(LuaState, NewBlob);
+  SB_ReleaseBlob(NewBlob); /* The userdata owns the blob now */
+
+  return 1; /* Number of values pushed on the stack */
+}
+
+static int BLOB_IsBlob (lua_State *LuaState)
+{
+  lua_pushboolean(LuaState, (SB_ToBlob(LuaState, 1) != NULL));
+
+  return 1; /* Number of values pushed on the stack */
+}
+
+static int BLOB_GetSize (lua_State *LuaState)
+{
+  struct SB_Blob *Blob = BLOB_CheckBlob(LuaState, 1);
+
+  lua_pushinteger(LuaState, (lua_Integer)Blob->SizeInBytes);
+
+  return 1; /* Number of values pushed on the stack */
+}
+
+/* The string shares the data of the blob, it holds its own reference */
+static int BLOB_ToString (lua_State *LuaState)
+{
+  struct SB_Blob *Blob = BLOB_CheckBlob(LuaState, 1);
+
+  SB_RetainBlob(Blob);
+  lua_pushexternalstring(LuaState,
+                         (const char *)Blob->Data,
+                         Blob->SizeInBytes,
+                         BLOB_FreeExternalString,
+                         Blob);
+
+  return 1; /* Number of values pushed on the stack */
+}
+
+/* sub(Blob, Start, [End]), only the range is copied */
+static int BLOB_Sub (lua_State *LuaState)
+{
+  struct SB_Blob *Blob  = BLOB_CheckBlob(LuaState, 1);
+  lua_Integer     Start = luaL_checkinteger(LuaState, 2);
+  lua_Integer     End   = luaL_optinteger(LuaState, 3, -1);
+  size_t          Offset;
+  size_t          Count;
+
+  Count = BLOB_GetRange(Start, End, Blob->SizeInBytes, &Offset);
+  lua_pushlstring(LuaState, (const char *)&Blob->Data[Offset], Count);
+
+  return 1; /* Number of values pushed on the stack */
+}
+
+/* find(Blob, Needle, [Init]), plain search, return Start, End or nil */
+static int BLOB_Find (lua_State *LuaState)
+{
+  struct SB_Blob *Blob   = BLOB_CheckBlob(LuaState, 1);
+  size_t          NeedleSize;
+  const char     *Needle = luaL_checklstring(LuaState, 2, &NeedleSize);
+  lua_Integer     Init   = luaL_optinteger(LuaState, 3, 1);
+  const uint8_t  *Cursor;
+  const uint8_t  *Last;
+  size_t          Offset;
+  size_t          Count;
+  bool            Found;
+
+  Count = BLOB_GetRange(Init, -1, Blob->SizeInBytes, &Offset);
+  Found = false;
+
+  if (NeedleSize == 0)
+  {
+    Found  = true;
+    Cursor = &Blob->Data[Offset];
+  }
+  else if (NeedleSize <= Count)
+  {
+    Cursor = &Blob->Data[Offset];
+    Last   = &Blob->Data[Blob->SizeInBytes - NeedleSize];
+
+    while (!Found && Cursor && (Cursor <= Last))
+    {
+      Cursor = memchr(Cursor, Needle[0], (size_t)(Last - Cursor) + 1);
+      if (Cursor)
+      {
+        if (memcmp(Cursor, Needle, NeedleSize) == 0)
+        {
+          Found = true;
+        }
+        else
+        {
+          Cursor++;
+        }
+      }
+    }
+  }
+  else
+  {
+    Cursor = NULL;
+  }
+
+  if (Found)
+  {
+    Offset = (size_t)(Cursor - Blob->Data);
+    lua_pushinteger(LuaState, (lua_Integer)(Offset + 1));
+    lua_pushinteger(LuaState, (lua_Integer)(Offset + NeedleSize));
+  }
+  else
+  {
+    lua_pushnil(LuaState);
+    lua_pushnil(LuaState);
+  }
+
+  return 2; /* Number of values pushed on the stack */
+}
+
+static int BLOB_GarbageCollect (lua_State *LuaState)
+{
+  struct SB_Blob **Userdata = luaL_checkudata(LuaState, 1, BLOB_METATABLE_NAME);
+
+  if (*Userdata)
+  {
+    SB_ReleaseBlob(*Userdata);
+    *Userdata = NULL;
+  }
+
+  return 0; /* Number of values pushed on the stack */
+}
+
+static int BLOB_Describe (lua_State *LuaState)
+{
+  struct SB_Blob *Blob = BLOB_CheckBlob(LuaState, 1);
+
+  lua_pushfstring(LuaState, "blob: %p (%I bytes)", (void *)Blob, (lua_Integer)Blob->SizeInBytes);
+
+  return 1; /* Number of values pushed on the stack */
+}
+
+/*============================================================================*/
+/* PUBLIC INTERFACE                                                           */
+/*============================================================================*/
+
+static const struct luaL_Reg BLOB_METHODS[] =
+{
+  { "size",     BLOB_GetSize  },
+  { "tostring", BLOB_ToString },
+  { "sub",      BLOB_Sub      },
+  { "find",     BLOB_Find     },
+  { NULL,       NULL          }
+};
+
+static const struct luaL_Reg BLOB_METAMETHODS[] =
+{
+  { "__len",      BLOB_GetSize        },
+  { "__gc",       BLOB_GarbageCollect },
+  { "__tostring", BLOB_Describe       },
+  { NULL,         NULL                }
+};
+
+static const struct luaL_Reg BLOB_FUNCTIONS[] =
+{
+  { "new",      BLOB_NewBlob  },
+  { "isblob",   BLOB_IsBlob   },
+  { "size",     BLOB_GetSize  },
+  { "tostring", BLOB_ToString },
+  { "sub",      BLOB_Sub      },
+  { "find",     BLOB_Find     },
+  { NULL,       NULL          }
+};
+
+/* Metatable shared by all the blobs of this lua_State */
+static void BLOB_PushMetatable (lua_State *LuaState)
+{
+  if (luaL_newmetatable(LuaState, BLOB_METATABLE_NAME))
+  {
+    luaL_setfuncs(LuaState, BLOB_METAMETHODS, 0);
+    luaL_newlib(LuaState, BLOB_METHODS);
+    lua_setfield(LuaState, -2, "__index");
+  }
+}
+
+int luaopen_blob (lua_State *LuaState)
+{
+  BLOB_PushMetatable(LuaState);
+  lua_pop(LuaState, 1);
+
+  luaL_newlib(LuaState, BLOB_FUNCTIONS);
+
+  return 1; /* Number of values pushed on the stack */
+}
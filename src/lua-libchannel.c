@@ -0,0 +1,755 @@
+/*----------------------------------------------------------------------------*
+ * PROJECT  ComEXE                                                            *
+ * FILENAME lua-libchannel.c                                                  *
+ * CONTENT  Channels shared between Lua instances                             *
+ *----------------------------------------------------------------------------*
+ * Copyright (c) 2020-2026 Pascal COMBIER                                     *
+ * This source code is licensed under the BSD 2-clause license found in the   *
+ * LICENSE file in the root directory of this source tree.                    *
+ *----------------------------------------------------------------------------*/
+
+/*============================================================================*/
+/* DOCUMENTATION                                                              */
+/*============================================================================*/
+
+/**
+ * A CH_Channel is a queue of messages which does not belong to any Lua
+ * instance. Any number of instances can push and pop, so several workers can
+ * pull their jobs from the same channel. Like a blob, a channel is reference
+ * counted: each full userdata "com.channel" and each message containing the
+ * channel (see event-message.c) owns a reference.
+ *
+ * The values pushed are serialized like the arguments of an event, in the
+ * writer of the instance, then a single message is stored in a ring buffer.
+ * The ring buffer starts small and doubles when it's full, up to the capacity
+ * of a bounded channel: a large capacity costs nothing until it's used.
+ *
+ * The blocking operations wait on NotEmpty/NotFull with the mutex of the
+ * channel. Channel.select waits on several channels: it can't wait on the
+ * conditions of all of them, so the selects share CH_SelectCondition. A push
+ * only takes CH_SelectMutex when a select is waiting. The waiting select
+ * registers itself in CH_SelectWaiters before its last attempt, so a push
+ * can't be missed.
+ *
+ * A channel which contains itself, directly or not, is never freed.
+ */
+
+/*============================================================================*/
+/* MAKEHEADERS PUBLIC INTERFACE                                               */
+/*============================================================================*/
+
+#if MKH_INTERFACE
+
+#include <stddef.h> /* size_t */
+
+/* The external function luaopen_XXX rely on the type lua_State */
+#include <lua.h>
+
+struct CH_Channel;
+
+/* Result of the push and pop operations */
+enum CH_Status
+{
+  CH_STATUS_OK,
+  CH_STATUS_CLOSED,
+  CH_STATUS_FULL,
+  CH_STATUS_EMPTY,
+  CH_STATUS_TIMEOUT
+};
+
+#endif
+
+/*============================================================================*/
+/* IMPLEMENTATION                                                             */
+/*============================================================================*/
+
+#include <stdint.h>  /* uint64_t    */
+#include <stdbool.h> /* bool        */
+#include <string.h>  /* memcpy      */
+#include <lauxlib.h> /* luaL_newlib */
+#include <uv.h>
+
+#include "comexe.h"
+
+/*============================================================================*/
+/* PRIVATE TYPES                                                              */
+/*============================================================================*/
+
+#define CHANNEL_METATABLE_NAME "com.channel"
+
+#define CHANNEL_INITIAL_CAPACITY 16
+
+#define CHANNEL_MAX_SELECT 64
+
+struct CH_Channel
+{
+  size_t              ReferenceCount;
+  uv_mutex_t          Mutex;
+  uv_cond_t           NotEmpty;
+  uv_cond_t           NotFull;
+  struct EM_Message **Items;    /* Ring buffer                */
+  size_t              Head;     /* Index of the oldest item   */
+  size_t              Count;
+  size_t              Capacity;
+  size_t              MaxCount; /* 0 when unbounded           */
+  bool                Closed;
+};
+
+/*============================================================================*/
+/* PRIVATE DATA                                                               */
+/*============================================================================*/
+
+static uv_once_t  CH_SelectOnce = UV_ONCE_INIT;
+static uv_mutex_t CH_SelectMutex;
+static uv_cond_t  CH_SelectCondition;
+static uint32_t   CH_SelectWaiters;
+
+/*============================================================================*/
+/* PRIVATE API                                                                */
+/*============================================================================*/
+
+static void CHAN_PushMetatable (lua_State *LuaState);
+
+static void CH_InitSelect (void)
+{
+  uv_mutex_init(&CH_SelectMutex);
+  uv_cond_init(&CH_SelectCondition);
+}
+
+static void CH_NotifySelect (void)
+{
+  if (__atomic_load_n(&CH_SelectWaiters, __ATOMIC_SEQ_CST) > 0)
+  {
+    uv_mutex_lock(&CH_SelectMutex);
+    uv_cond_broadcast(&CH_SelectCondition);
+    uv_mutex_unlock(&CH_SelectMutex);
+  }
+}
+
+static uint64_t CH_GetDeadline (int64_t TimeoutMs)
+{
+  return (uv_hrtime() + ((uint64_t)TimeoutMs * 1000000));
+}
+
+/* Wait on Condition until the deadline, forever if TimeoutMs is negative.
+ * Return false once the deadline is reached. */
+static bool CH_Wait (uv_cond_t  *Condition,
+                     uv_mutex_t *Mutex,
+                     int64_t     TimeoutMs,
+                     uint64_t    Deadline)
+{
+  uint64_t Now;
+  bool     Continue;
+
+  if (TimeoutMs < 0)
+  {
+    uv_cond_wait(Condition, Mutex);
+    Continue = true;
+  }
+  else
+  {
+    Now = uv_hrtime();
+
+    if (Now < Deadline)
+    {
+      uv_cond_timedwait(Condition, Mutex, (Deadline - Now));
+      Continue = true;
+    }
+    else
+    {
+      Continue = false;
+    }
+  }
+
+  return Continue;
+}
+
+/* Must be called with the mutex locked */
+static bool CH_IsFull (struct CH_Channel *Channel)
+{
+  return ((Channel->MaxCount > 0) && (Channel->Count >= Channel->MaxCount));
+}
+
+/* Must be called with the mutex locked and some room in the channel */
+static void CH_Enqueue (struct CH_Channel *Channel, struct EM_Message *Message)
+{
+  struct EM_Message **NewItems;
+  size_t              NewCapacity;
+  size_t              Index;
+
+  if (Channel->Count == Channel->Capacity)
+  {
+    /* The items are moved at the start of the new buffer */
+    NewCapacity = (Channel->Capacity * 2);
+    if ((Channel->MaxCount > 0) && (NewCapacity > Channel->MaxCount))
+    {
+      NewCapacity = Channel->MaxCount;
+    }
+    NewItems    = PLAT_SafeRealloc(NULL, (NewCapacity * sizeof(struct EM_Message *)));
+
+    for (Index = 0; Index < Channel->Count; Index++)
+    {
+      NewItems[Index] = Channel->Items[(Channel->Head + Index) % Channel->Capacity];
+    }
+
+    PLAT_Free(Channel->Items);
+    Channel->Items    = NewItems;
+    Channel->Head     = 0;
+    Channel->Capacity = NewCapacity;
+  }
+
+  Channel->Items[(Channel->Head + Channel->Count) % Channel->Capacity] = Message;
+  Channel->Count++;
+}
+
+/* Must be called with the mutex locked, return NULL if the channel is empty */
+static struct EM_Message *CH_Dequeue (struct CH_Channel *Channel)
+{
+  struct EM_Message *Message;
+
+  if (Channel->Count > 0)
+  {
+    Message       = Channel->Items[Channel->Head];
+    Channel->Head = ((Channel->Head + 1) % Channel->Capacity);
+    Channel->Count--;
+    uv_cond_signal(&Channel->NotFull);
+  }
+  else
+  {
+    Message = NULL;
+  }
+
+  return Message;
+}
+
+/*============================================================================*/
+/* CHANNEL API                                                                */
+/*============================================================================*/
+
+/* The new channel has 1 reference, owned by the caller. MaxCount 0 is
+ * unbounded. */
+struct CH_Channel *CH_NewChannel (size_t MaxCount)
+{
+  struct CH_Channel *NewChannel = PLAT_SafeAlloc0(1, sizeof(struct CH_Channel));
+
+  uv_once(&CH_SelectOnce, CH_InitSelect);
+
+  NewChannel->ReferenceCount = 1;
+  NewChannel->MaxCount       = MaxCount;
+  NewChannel->Capacity       = (((MaxCount > 0) && (MaxCount < CHANNEL_INITIAL_CAPACITY)) ? MaxCount : CHANNEL_INITIAL_CAPACITY);
+  NewChannel->Items          = PLAT_SafeRealloc(NULL, (NewChannel->Capacity * sizeof(struct EM_Message *)));
+
+  uv_mutex_init(&NewChannel->Mutex);
+  uv_cond_init(&NewChannel->NotEmpty);
+  uv_cond_init(&NewChannel->NotFull);
+
+  return NewChannel;
+}
+
+void CH_RetainChannel (struct CH_Channel *Channel)
+{
+  __atomic_add_fetch(&Channel->ReferenceCount, 1, __ATOMIC_RELAXED);
+}
+
+/* The messages left in the channel are freed with it */
+void CH_ReleaseChannel (struct CH_Channel *Channel)
+{
+  struct EM_Message *Message;
+
+  if (__atomic_sub_fetch(&Channel->ReferenceCount, 1, __ATOMIC_ACQ_REL) == 0)
+  {
+    while ((Message = CH_Dequeue(Channel)) != NULL)
+    {
+      EM_FreeMessage(Message);
+    }
+
+    uv_mutex_destroy(&Channel->Mutex);
+    uv_cond_destroy(&Channel->NotEmpty);
+    uv_cond_destroy(&Channel->NotFull);
+    PLAT_Free(Channel->Items);
+    PLAT_Free(Channel);
+  }
+}
+
+/* Push a new userdata holding a new reference on Channel. A channel can be
+ * received in an event before com.channel is required, so the metatable is
+ * created here if needed. */
+void CH_PushChannel (lua_State *LuaState, struct CH_Channel *Channel)
+{
+  struct CH_Channel **Userdata = lua_newuserdatauv(LuaState, sizeof(struct CH_Channel *), 0);
+
+  CH_RetainChannel(Channel);
+  *Userdata = Channel;
+
+  CHAN_PushMetatable(LuaState);
+  lua_setmetatable(LuaState, -2);
+}
+
+/* Return NULL if the value at Index is not a channel */
+struct CH_Channel *CH_ToChannel (lua_State *LuaState, int Index)
+{
+  struct CH_Channel **Userdata = luaL_testudata(LuaState, Index, CHANNEL_METATABLE_NAME);
+  struct CH_Channel  *Channel;
+
+  if (Userdata)
+  {
+    Channel = *Userdata;
+  }
+  else
+  {
+    Channel = NULL;
+  }
+
+  return Channel;
+}
+
+/* Wait at most TimeoutMs milliseconds for some room, forever if TimeoutMs is
+ * negative. On CH_STATUS_OK the channel takes the message, otherwise the
+ * message is not taken. */
+enum CH_Status CH_PushMessage (struct CH_Channel *Channel,
+                               struct EM_Message *Message,
+                               int64_t            TimeoutMs)
+{
+  uint64_t       Deadline = CH_GetDeadline(TimeoutMs);
+  bool           Continue = true;
+  enum CH_Status Status;
+
+  uv_mutex_lock(&Channel->Mutex);
+  while (Continue && !Channel->Closed && CH_IsFull(Channel))
+  {
+    Continue = CH_Wait(&Channel->NotFull, &Channel->Mutex, TimeoutMs, Deadline);
+  }
+
+  if (Channel->Closed)
+  {
+    Status = CH_STATUS_CLOSED;
+  }
+  else if (CH_IsFull(Channel))
+  {
+    Status = ((TimeoutMs == 0) ? CH_STATUS_FULL : CH_STATUS_TIMEOUT);
+  }
+  else
+  {
+    CH_Enqueue(Channel, Message);
+    uv_cond_signal(&Channel->NotEmpty);
+    Status = CH_STATUS_OK;
+  }
+  uv_mutex_unlock(&Channel->Mutex);
+
+  if (Status == CH_STATUS_OK)
+  {
+    CH_NotifySelect();
+  }
+
+  return Status;
+}
+
+/* Wait at most TimeoutMs milliseconds for a message, forever if TimeoutMs is
+ * negative. Return NULL and set Status if there is none. */
+struct EM_Message *CH_PopMessage (struct CH_Channel *Channel,
+                                  int64_t            TimeoutMs,
+                                  enum CH_Status    *Status)
+{
+  uint64_t           Deadline = CH_GetDeadline(TimeoutMs);
+  bool               Continue = true;
+  struct EM_Message *Message;
+
+  uv_mutex_lock(&Channel->Mutex);
+  while (Continue && !Channel->Closed && (Channel->Count == 0))
+  {
+    Continue = CH_Wait(&Channel->NotEmpty, &Channel->Mutex, TimeoutMs, Deadline);
+  }
+
+  /* A closed channel can still be drained */
+  Message = CH_Dequeue(Channel);
+
+  if (Message)
+  {
+    *Status = CH_STATUS_OK;
+  }
+  else if (Channel->Closed)
+  {
+    *Status = CH_STATUS_CLOSED;
+  }
+  else
+  {
+    *Status = ((TimeoutMs == 0) ? CH_STATUS_EMPTY : CH_STATUS_TIMEOUT);
+  }
+  uv_mutex_unlock(&Channel->Mutex);
+
+  return Message;
+}
+
+void CH_CloseChannel (struct CH_Channel *Channel)
+{
+  uv_mutex_lock(&Channel->Mutex);
+  Channel->Closed = true;
+  uv_cond_broadcast(&Channel->NotEmpty);
+  uv_cond_broadcast(&Channel->NotFull);
+  uv_mutex_unlock(&Channel->Mutex);
+
+  CH_NotifySelect();
+}
+
+/*============================================================================*/
+/* LUA API                                                                    */
+/*============================================================================*/
+
+/* The error strings returned to Lua */
+static const char *CHAN_GetStatusName (enum CH_Status Status)
+{
+  const char *Name;
+
+  switch (Status)
+  {
+    case CH_STATUS_OK:      Name = "ok";      break;
+    case CH_STATUS_CLOSED:  Name = "closed";  break;
+    case CH_STATUS_FULL:    Name = "full";    break;
+    case CH_STATUS_EMPTY:   Name = "empty";   break;
+    case CH_STATUS_TIMEOUT: Name = "timeout"; break;
+    default:                Name = "unknown"; break;
+  }
+
+  return Name;
+}
+
+static struct CH_Channel *CHAN_CheckChannel (lua_State *LuaState, int Index)
+{
+  struct CH_Channel **Userdata = luaL_checkudata(LuaState, Index, CHANNEL_METATABLE_NAME);
+
+  return *Userdata;
+}
+
+/* new([MaxCount]), a channel is unbounded by default */
+static int CHAN_NewChannel (lua_State *LuaState)
+{
+  lua_Integer        MaxCount = luaL_optinteger(LuaState, 1, 0);
+  struct CH_Channel *NewChannel;
+
+  luaL_argcheck(LuaState, (MaxCount >= 0), 1, "capacity must be non-negative");
+
+  NewChannel = CH_NewChannel((size_t)MaxCount);
+  CH_PushChannel(LuaState, NewChannel);
+  CH_ReleaseChannel(NewChannel); /* The userdata owns the channel now */
+
+  return 1; /* Number of values pushed on the stack */
+}
+
+static int CHAN_IsChannel (lua_State *LuaState)
+{
+  lua_pushboolean(LuaState, (CH_ToChannel(LuaState, 1) != NULL));
+
+  return 1; /* Number of values pushed on the stack */
+}
+
+/* Push the values ValueIndex..top, return true or false and an error */
+static int CHAN_PushValues (lua_State *LuaState,
+                            int32_t    ValueIndex,
+                            int64_t    TimeoutMs)
+{
+  struct CH_Channel *Channel       = CHAN_CheckChannel(LuaState, 1);
+  int32_t            ArgumentCount = lua_gettop(LuaState);
+  struct EM_Writer  *Writer        = LUA_GetMessageWriter(LuaState);
+  struct EM_Message *Message;
+  enum CH_Status     Status;
+  int32_t            Index;
+  int                ResultCount;
+
+  EM_ResetWriter(Writer);
+
+  for (Index = ValueIndex; Index <= ArgumentCount; Index++)
+  {
+    if (!EM_WriteLuaValue(Writer, LuaState, Index))
+    {
+      luaL_error(LuaState,
+                 "push value %d: %s '%s'",
+                 (Index - ValueIndex + 1),
+                 Writer->ErrorReason,
+                 lua_typename(LuaState, Writer->ErrorType));
+    }
+  }
+
+  Message = EM_NewMessage(Writer);
+  Status  = CH_PushMessage(Channel, Message, TimeoutMs);
+
+  if (Status == CH_STATUS_OK)
+  {
+    lua_pushboolean(LuaState, true);
+    ResultCount = 1;
+  }
+  else
+  {
+    EM_FreeMessage(Message);
+    lua_pushboolean(LuaState, false);
+    lua_pushstring(LuaState, CHAN_GetStatusName(Status));
+    ResultCount = 2;
+  }
+
+  return ResultCount; /* Number of values pushed on the stack */
+}
+
+/* Return true and the values, or false and an error */
+static int CHAN_PopValues (lua_State *LuaState, int64_t TimeoutMs)
+{
+  struct CH_Channel *Channel = CHAN_CheckChannel(LuaState, 1);
+  struct EM_Message *Message;
+  enum CH_Status     Status;
+  int                ResultCount;
+
+  Message = CH_PopMessage(Channel, TimeoutMs, &Status);
+
+  if (Message)
+  {
+    lua_pushboolean(LuaState, true);
+    ResultCount = (1 + EM_PushValuesAndFree(LuaState, Message));
+  }
+  else
+  {
+    lua_pushboolean(LuaState, false);
+    lua_pushstring(LuaState, CHAN_GetStatusName(Status));
+    ResultCount = 2;
+  }
+
+  return ResultCount; /* Number of values pushed on the stack */
+}
+
+/* push(Channel, ...), wait while the channel is full */
+static int CHAN_Push (lua_State *LuaState)
+{
+  return CHAN_PushValues(LuaState, 2, -1);
+}
+
+/* trypush(Channel, ...), never wait */
+static int CHAN_TryPush (lua_State *LuaState)
+{
+  return CHAN_PushValues(LuaState, 2, 0);
+}
+
+/* pushtimeout(Channel, TimeoutMs, ...) */
+static int CHAN_PushTimeout (lua_State *LuaState)
+{
+  lua_Integer TimeoutMs = luaL_checkinteger(LuaState, 2);
+
+  return CHAN_PushValues(LuaState, 3, TimeoutMs);
+}
+
+/* pop(Channel), wait while the channel is empty */
+static int CHAN_Pop (lua_State *LuaState)
+{
+  return CHAN_PopValues(LuaState, -1);
+}
+
+/* trypop(Channel), never wait */
+static int CHAN_TryPop (lua_State *LuaState)
+{
+  return CHAN_PopValues(LuaState, 0);
+}
+
+/* poptimeout(Channel, TimeoutMs) */
+static int CHAN_PopTimeout (lua_State *LuaState)
+{
+  lua_Integer TimeoutMs = luaL_checkinteger(LuaState, 2);
+
+  return CHAN_PopValues(LuaState, TimeoutMs);
+}
+
+/* select(Channels, [TimeoutMs]), pop from the first channel which is not
+ * empty. Return the index of the channel and the values, or nil and an
+ * error: "timeout", or "closed" when all the channels are closed. */
+static int CHAN_Select (lua_State *LuaState)
+{
+  struct CH_Channel  *Channels[CHANNEL_MAX_SELECT];
+  lua_Integer         TimeoutMs    = luaL_optinteger(LuaState, 2, -1);
+  uint64_t            Deadline     = CH_GetDeadline(TimeoutMs);
+  struct EM_Message  *Message      = NULL;
+  bool                Continue     = true;
+  bool                AllClosed    = false;
+  enum CH_Status      Status;
+  size_t              ChannelCount;
+  size_t              ChannelIndex = 0;
+  size_t              Index;
+  size_t              ClosedCount;
+  int                 ResultCount;
+
+  luaL_checktype(LuaState, 1, LUA_TTABLE);
+
+  ChannelCount = (size_t)luaL_len(LuaState, 1);
+  luaL_argcheck(LuaState, ((ChannelCount > 0) && (ChannelCount <= CHANNEL_MAX_SELECT)), 1, "1 to 64 channels expected");
+
+  for (Index = 0; Index < ChannelCount; Index++)
+  {
+    lua_rawgeti(LuaState, 1, (lua_Integer)(Index + 1));
+    Channels[Index] = CH_ToChannel(LuaState, -1);
+    luaL_argcheck(LuaState, (Channels[Index] != NULL), 1, "channel expected");
+    lua_pop(LuaState, 1);
+  }
+
+  uv_mutex_lock(&CH_SelectMutex);
+  __atomic_add_fetch(&CH_SelectWaiters, 1, __ATOMIC_SEQ_CST);
+
+  while ((Message == NULL) && !AllClosed && Continue)
+  {
+    ClosedCount = 0;
+
+    for (Index = 0; ((Message == NULL) && (Index < ChannelCount)); Index++)
+    {
+      Message = CH_PopMessage(Channels[Index], 0, &Status);
+
+      if (Message)
+      {
+        ChannelIndex = Index;
+      }
+      else if (Status == CH_STATUS_CLOSED)
+      {
+        ClosedCount++;
+      }
+    }
+
+    AllClosed = (ClosedCount == ChannelCount);
+
+    if ((Message == NULL) && !AllClosed)
+    {
+      Continue = CH_Wait(&CH_SelectCondition, &CH_SelectMutex, TimeoutMs, Deadline);
+    }
+  }
+
+  __atomic_sub_fetch(&CH_SelectWaiters, 1, __ATOMIC_SEQ_CST);
+  uv_mutex_unlock(&CH_SelectMutex);
+
+  if (Message)
+  {
+    lua_pushinteger(LuaState, (lua_Integer)(ChannelIndex + 1));
+    ResultCount = (1 + EM_PushValuesAndFree(LuaState, Message));
+  }
+  else
+  {
+    lua_pushnil(LuaState);
+    lua_pushstring(LuaState, (AllClosed ? "closed" : "timeout"));
+    ResultCount = 2;
+  }
+
+  return ResultCount; /* Number of values pushed on the stack */
+}
+
+static int CHAN_Close (lua_State *LuaState)
+{
+  CH_CloseChannel(CHAN_CheckChannel(LuaState, 1));
+
+  return 0; /* Number of values pushed on the stack */
+}
+
+static int CHAN_IsClosed (lua_State *LuaState)
+{
+  struct CH_Channel *Channel = CHAN_CheckChannel(LuaState, 1);
+  bool               Closed;
+
+  uv_mutex_lock(&Channel->Mutex);
+  Closed = Channel->Closed;
+  uv_mutex_unlock(&Channel->Mutex);
+
+  lua_pushboolean(LuaState, Closed);
+
+  return 1; /* Number of values pushed on the stack */
+}
+
+static int CHAN_GetCount (lua_State *LuaState)
+{
+  struct CH_Channel *Channel = CHAN_CheckChannel(LuaState, 1);
+  size_t             Count;
+
+  uv_mutex_lock(&Channel->Mutex);
+  Count = Channel->Count;
+  uv_mutex_unlock(&Channel->Mutex);
+
+  lua_pushinteger(LuaState, (lua_Integer)Count);
+
+  return 1; /* Number of values pushed on the stack */
+}
+
+/* Return 0 for an unbounded channel */
+static int CHAN_GetCapacity (lua_State *LuaState)
+{
+  struct CH_Channel *Channel = CHAN_CheckChannel(LuaState, 1);
+
+  lua_pushinteger(LuaState, (lua_Integer)Channel->MaxCount);
+
+  return 1; /* Number of values pushed on the stack */
+}
+
+static int CHAN_GarbageCollect (lua_State *LuaState)
+{
+  struct CH_Channel **Userdata = luaL_checkudata(LuaState, 1, CHANNEL_METATABLE_NAME);
+
+  if (*Userdata)
+  {
+    CH_ReleaseChannel(*Userdata);
+    *Userdata = NULL;
+  }
+
+  return 0; /* Number of values pushed on the stack */
+}
+
+static int CHAN_Describe (lua_State *LuaState)
+{
+  struct CH_Channel *Channel = CHAN_CheckChannel(LuaState, 1);
+
+  lua_pushfstring(LuaState, "channel: %p", (void *)Channel);
+
+  return 1; /* Number of values pushed on the stack */
+}
+
+/*============================================================================*/
+/* PUBLIC INTERFACE                                                           */
+/*============================================================================*/
+
+static const struct luaL_Reg CHANNEL_METHODS[] =
+{
+  { "push",        CHAN_Push        },
+  { "trypush",     CHAN_TryPush     },
+  { "pushtimeout", CHAN_PushTimeout },
+  { "pop",         CHAN_Pop         },
+  { "trypop",      CHAN_TryPop      },
+  { "poptimeout",  CHAN_PopTimeout  },
+  { "close",       CHAN_Close       },
+  { "isclosed",    CHAN_IsClosed    },
+  { "count",       CHAN_GetCount    },
+  { "capacity",    CHAN_GetCapacity },
+  { NULL,          NULL             }
+};
+
+static const struct luaL_Reg CHANNEL_METAMETHODS[] =
+{
+  { "__len",      CHAN_GetCount       },
+  { "__gc",       CHAN_GarbageCollect },
+  { "__tostring", CHAN_Describe       },
+  { NULL,         NULL                }
+};
+
+static const struct luaL_Reg CHANNEL_FUNCTIONS[] =
+{
+  { "new",       CHAN_NewChannel },
+  { "ischannel", CHAN_IsChannel  },
+  { "select",    CHAN_Select     },
+  { NULL,        NULL            }
+};
+
+/* Metatable shared by all the channels of this lua_State */
+static void CHAN_PushMetatable (lua_State *LuaState)
+{
+  if (luaL_newmetatable(LuaState, CHANNEL_METATABLE_NAME))
+  {
+    luaL_setfuncs(LuaState, CHANNEL_METAMETHODS, 0);
+    luaL_newlib(LuaState, CHANNEL_METHODS);
+    lua_setfield(LuaState, -2, "__index");
+  }
+}
+
+int luaopen_channel (lua_State *LuaState)
+{
+  CHAN_PushMetatable(LuaState);
+  lua_pop(LuaState, 1);
+
+  luaL_newlib(LuaState, CHANNEL_FUNCTIONS);
+
+  return 1; /* Number of values pushed on the stack */
+}
@@ -0,0 +1,318 @@
+/*----------------------------------------------------------------------------*
+ * PROJECT  ComEXE                                                            *
+ * FILENAME lua-libhttp.c                                                     *
+ * CONTENT  Parser of the head of the HTTP/1.x requests                       *
+ *----------------------------------------------------------------------------*
+ * Copyright (c) 2020-2026 Pascal COMBIER                                     *
+ * This source code is licensed under the BSD 2-clause license found in the   *
+ * LICENSE file in the root directory of this source tree.                    *
+ *----------------------------------------------------------------------------*/
+
+/*============================================================================*/
+/* DOCUMENTATION                                                              */
+/*============================================================================*/
+
+/**
+ * The head of a request is the request line and the header fields, up to the
+ * empty line. mini-httpd receives the bytes available on the socket and
+ * parses the whole head at once, instead of one receive("*l") and one pattern
+ * matching per line.
+ *
+ * parsehead(Buffer [, MaxHeaders [, MaxSize]]) returns Method, Target,
+ * Version, Headers and the length of the head in Buffer. The names of the
+ * headers are converted to lower case and the values are trimmed. When a
+ * header is repeated, the last value is kept like mini-httpd always did.
+ *
+ * On failure it returns false and a reason:
+ *   "incomplete"           the empty line is not in Buffer yet
+ *   "head too large"       no empty line in the first MaxSize bytes
+ *   "too many headers"     more than MaxHeaders header fields
+ *   "invalid request line" not "Method SP Target SP HTTP/x.y"
+ *   "invalid header"       no colon, empty name, space in the name or
+ *                          obsolete line folding
+ *
+ * The lines end with LF or CRLF, the empty lines before the request line are
+ * ignored (RFC 9112, section 2.2). The lines are found with memchr, which the
+ * C libraries vectorize.
+ */
+
+/*============================================================================*/
+/* MAKEHEADERS PUBLIC INTERFACE                                               */
+/*============================================================================*/
+
+#if MKH_INTERFACE
+
+/* The external function luaopen_XXX rely on the type lua_State */
+#include <lua.h>
+
+#endif
+
+/*============================================================================*/
+/* IMPLEMENTATION                                                             */
+/*============================================================================*/
+
+#include <stddef.h>  /* size_t      */
+#include <stdbool.h> /* bool        */
+#include <string.h>  /* memchr      */
+#include <lauxlib.h> /* luaL_newlib */
+
+#include "comexe.h"
+
+/*============================================================================*/
+/* PRIVATE TYPES                                                              */
+/*============================================================================*/
+
+#define HTTP_DEFAULT_MAX_HEADERS  100
+#define HTTP_DEFAULT_MAX_SIZE    8192
+
+#define HTTP_VERSION_PREFIX        "HTTP/"
+#define HTTP_VERSION_PREFIX_LENGTH (sizeof(HTTP_VERSION_PREFIX) - 1)
+
+struct HTTP_Parser
+{
+  const char *Cursor;      /* Start of the next line                      */
+  const char *Limit;       /* End of Buffer or MaxSize bytes, the smaller */
+  bool        SizeLimited; /* Limit is MaxSize, not the end of Buffer     */
+  const char *Reason;      /* Set on failure                              */
+};
+
+/*============================================================================*/
+/* PRIVATE API                                                                */
+/*============================================================================*/
+
+static bool HTTP_IsBlank (char Character)
+{
+  return ((Character == ' ') || (Character == '\t'));
+}
+
+/* Take the next line, without its LF or CRLF */
+static bool HTTP_NextLine (struct HTTP_Parser  *Parser,
+                           const char         **Line,
+                           size_t              *Length)
+{
+  const char *LineStart = Parser->Cursor;
+  const char *LineEnd   = memchr(LineStart, '\n', (size_t)(Parser->Limit - LineStart));
+  bool        Found     = (LineEnd != NULL);
+
+  if (Found)
+  {
+    *Line          = LineStart;
+    *Length        = (size_t)(LineEnd - LineStart);
+    Parser->Cursor = (LineEnd + 1);
+
+    if ((*Length > 0) && (LineStart[*Length - 1] == '\r'))
+    {
+      *Length = (*Length - 1);
+    }
+  }
+  else if (Parser->SizeLimited)
+  {
+    Parser->Reason = "head too large";
+  }
+  else
+  {
+    Parser->Reason = "incomplete";
+  }
+
+  return Found;
+}
+
+/* Push Method, Target and Version */
+static bool HTTP_PushRequestLine (lua_State          *LuaState,
+                                  struct HTTP_Parser *Parser,
+                                  const char         *Line,
+                                  size_t              Length)
+{
+  const char *LineEnd   = (Line + Length);
+  const char *MethodEnd = memchr(Line, ' ', Length);
+  const char *Target    = NULL;
+  const char *TargetEnd = NULL;
+  const char *Version   = NULL;
+  bool        Valid     = false;
+
+  if ((MethodEnd != NULL) && (MethodEnd > Line))
+  {
+    Target    = (MethodEnd + 1);
+    TargetEnd = memchr(Target, ' ', (size_t)(LineEnd - Target));
+  }
+
+  if ((TargetEnd != NULL) && (TargetEnd > Target))
+  {
+    Version = (TargetEnd + 1);
+    Valid   = (((size_t)(LineEnd - Version) > HTTP_VERSION_PREFIX_LENGTH)
+               && (memcmp(Version, HTTP_VERSION_PREFIX, HTTP_VERSION_PREFIX_LENGTH) == 0)
+               && (memchr(Version, ' ', (size_t)(LineEnd - Version)) == NULL));
+  }
+
+  if (Valid)
+  {
+    lua_pushlstring(LuaState, Line,    (size_t)(MethodEnd - Line));
+    lua_pushlstring(LuaState, Target,  (size_t)(TargetEnd - Target));
+    lua_pushlstring(LuaState, Version, (size_t)(LineEnd - Version));
+  }
+  else
+  {
+    Parser->Reason = "invalid request line";
+  }
+
+  return Valid;
+}
+
+static void HTTP_PushLowerCase (lua_State  *LuaState,
+                                const char *String,
+                                size_t      Length)
+{
+  luaL_Buffer Buffer;
+  char       *Output = luaL_buffinitsize(LuaState, &Buffer, Length);
+  size_t      Index;
+  char        Character;
+
+  for (Index = 0; Index < Length; Index++)
+  {
+    Character = String[Index];
+    if ((Character >= 'A') && (Character <= 'Z'))
+    {
+      Character = (char)(Character + ('a' - 'A'));
+    }
+    Output[Index] = Character;
+  }
+
+  luaL_pushresultsize(&Buffer, Length);
+}
+
+/* Store the header in the table on the top of the stack */
+static bool HTTP_SetHeader (lua_State          *LuaState,
+                            struct HTTP_Parser *Parser,
+                            const char         *Line,
+                            size_t              Length)
+{
+  const char *LineEnd = (Line + Length);
+  const char *Colon   = memchr(Line, ':', Length);
+  const char *Value;
+  const char *ValueEnd;
+  const char *Character;
+  bool        Valid   = ((Colon != NULL) && (Colon > Line));
+
+  /* No space in the name, it also rejects the obsolete line folding */
+  for (Character = Line; Valid && (Character < Colon); Character++)
+  {
+    Valid = (((unsigned char)*Character > ' ') && (*Character != 0x7F));
+  }
+
+  if (Valid)
+  {
+    Value    = (Colon + 1);
+    ValueEnd = LineEnd;
+    while ((Value < ValueEnd) && HTTP_IsBlank(*Value))
+    {
+      Value++;
+    }
+    while ((ValueEnd > Value) && HTTP_IsBlank(ValueEnd[-1]))
+    {
+      ValueEnd--;
+    }
+
+    HTTP_PushLowerCase(LuaState, Line, (size_t)(Colon - Line));
+    lua_pushlstring(LuaState, Value, (size_t)(ValueEnd - Value));
+    lua_rawset(LuaState, -3);
+  }
+  else
+  {
+    Parser->Reason = "invalid header";
+  }
+
+  return Valid;
+}
+
+/* parsehead(Buffer [, MaxHeaders [, MaxSize]]) */
+static int HTTP_ParseHead (lua_State *LuaState)
+{
+  struct HTTP_Parser Parser;
+  size_t             BufferSize;
+  const char        *Buffer     = luaL_checklstring(LuaState, 1, &BufferSize);
+  lua_Integer        MaxHeaders = luaL_optinteger(LuaState, 2, HTTP_DEFAULT_MAX_HEADERS);
+  lua_Integer        MaxSize    = luaL_optinteger(LuaState, 3, HTTP_DEFAULT_MAX_SIZE);
+  lua_Integer        HeaderCount;
+  const char        *Line;
+  size_t             Length;
+  bool               Success;
+  bool               Done;
+  int                ResultCount;
+
+  luaL_argcheck(LuaState, (MaxHeaders >= 0), 2, "negative header count");
+  luaL_argcheck(LuaState, (MaxSize > 0),     3, "size must be positive");
+
+  Parser.Cursor      = Buffer;
+  Parser.SizeLimited = (BufferSize >= (size_t)MaxSize);
+  Parser.Limit       = (Buffer + (Parser.SizeLimited ? (size_t)MaxSize : BufferSize));
+  Parser.Reason      = NULL;
+
+  /* Request line, after the empty lines */
+  do
+  {
+    Success = HTTP_NextLine(&Parser, &Line, &Length);
+  }
+  while (Success && (Length == 0));
+
+  if (Success)
+  {
+    Success = HTTP_PushRequestLine(LuaState, &Parser, Line, Length);
+  }
+
+  /* Header fields, up to the empty line */
+  if (Success)
+  {
+    lua_createtable(LuaState, 0, 16);
+    HeaderCount = 0;
+    Done        = false;
+    while (Success && (!Done))
+    {
+      Success = HTTP_NextLine(&Parser, &Line, &Length);
+      if (Success && (Length == 0))
+      {
+        Done = true;
+      }
+      else if (Success && (HeaderCount >= MaxHeaders))
+      {
+        Parser.Reason = "too many headers";
+        Success       = false;
+      }
+      else if (Success)
+      {
+        Success     = HTTP_SetHeader(LuaState, &Parser, Line, Length);
+        HeaderCount = (HeaderCount + 1);
+      }
+    }
+  }
+
+  if (Success)
+  {
+    lua_pushinteger(LuaState, (lua_Integer)(Parser.Cursor - Buffer));
+    ResultCount = 5;
+  }
+  else
+  {
+    lua_pushboolean(LuaState, false);
+    lua_pushstring(LuaState, Parser.Reason);
+    ResultCount = 2;
+  }
+
+  return ResultCount; /* Number of values returned on the stack */
+}
+
+/*============================================================================*/
+/* LUA MODULE                                                                 */
+/*============================================================================*/
+
+static const struct luaL_Reg HTTP_FUNCTIONS[] =
+{
+  { "parsehead", HTTP_ParseHead },
+  { NULL,        NULL           }
+};
+
+int luaopen_http (lua_State *LuaState)
+{
+  luaL_newlib(LuaState, HTTP_FUNCTIONS);
+
+  return 1; /* Number of values pushed on the stack */
+}
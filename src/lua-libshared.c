@@ -0,0 +1,1050 @@
+/*----------------------------------------------------------------------------*
+ * PROJECT  ComEXE                                                            *
+ * FILENAME lua-libshared.c                                                   *
+ * CONTENT  Key/value stores shared between Lua instances                     *
+ *----------------------------------------------------------------------------*
+ * Copyright (c) 2020-2026 Pascal COMBIER                                     *
+ * This source code is licensed under the BSD 2-clause license found in the   *
+ * LICENSE file in the root directory of this source tree.                    *
+ *----------------------------------------------------------------------------*/
+
+/*============================================================================*/
+/* DOCUMENTATION                                                              */
+/*============================================================================*/
+
+/**
+ * A SS_Store is a hash map readable and writable from every Lua instance
+ * without going through the event loop of another thread. The stores are
+ * named and created on the first Shared.open, they live until the end of the
+ * process.
+ *
+ * The keys are split between SS_STRIPE_COUNT stripes, each stripe is a
+ * TH_Map protected by a read/write lock. The readers of different keys rarely
+ * share a lock, and the readers of the same key don't exclude each other.
+ *
+ * A SS_Entry is immutable, except the numbers updated in place by incr under
+ * the write lock. A new value replaces the entry. The Lua API must never raise
+ * an error while a lock is held: the values are converted before locking, the
+ * numbers are copied under the lock, and the strings and encoded values are
+ * retained under the lock then pushed after unlocking.
+ *
+ * Tables, blobs and channels are stored encoded like the arguments of an
+ * event (see event-message.c), a get returns a new copy of the table.
+ *
+ * The expired entries are invisible. They are removed by the next write on
+ * the same key, or by store:flushexpired().
+ */
+
+/*============================================================================*/
+/* MAKEHEADERS PUBLIC INTERFACE                                               */
+/*============================================================================*/
+
+#if MKH_INTERFACE
+
+/* The external function luaopen_XXX rely on the type lua_State */
+#include <lua.h>
+
+#endif
+
+/*============================================================================*/
+/* IMPLEMENTATION                                                             */
+/*============================================================================*/
+
+#include <stdint.h>  /* uint64_t    */
+#include <stdbool.h> /* bool        */
+#include <string.h>  /* memcmp      */
+#include <lauxlib.h> /* luaL_newlib */
+#include <uv.h>
+
+#include "comexe.h"
+
+/*============================================================================*/
+/* PRIVATE TYPES                                                              */
+/*============================================================================*/
+
+#define SHARED_METATABLE_NAME "com.shared"
+
+#define SS_STRIPE_COUNT 64 /* Power of 2 */
+
+enum SS_Type
+{
+  SS_TYPE_NIL,
+  SS_TYPE_BOOLEAN,
+  SS_TYPE_INTEGER,
+  SS_TYPE_NUMBER,
+  SS_TYPE_STRING,
+  SS_TYPE_MESSAGE
+};
+
+/* Also used for the expected value of cas, with a string on the Lua stack */
+struct SS_Entry
+{
+  size_t             ReferenceCount;
+  enum SS_Type       Type;
+  bool               Boolean;
+  lua_Integer        Integer;
+  lua_Number         Number;
+  const char        *String;
+  size_t             StringLength;
+  struct EM_Message *Message;
+  uint64_t           ExpireTime; /* uv_hrtime, 0 without TTL */
+};
+
+struct SS_Stripe
+{
+  uv_rwlock_t    Lock;
+  struct TH_Map *Map;
+};
+
+struct SS_Store
+{
+  struct SS_Stripe Stripes[SS_STRIPE_COUNT];
+};
+
+/*============================================================================*/
+/* PRIVATE DATA                                                               */
+/*============================================================================*/
+
+static uv_once_t      SS_StoresOnce = UV_ONCE_INIT;
+static uv_mutex_t     SS_StoresMutex;
+static struct TH_Map *SS_Stores;
+
+/*============================================================================*/
+/* ENTRIES                                                                    */
+/*============================================================================*/
+
+static uint64_t SS_GetExpireTime (lua_Integer TtlMs)
+{
+  uint64_t ExpireTime;
+
+  if (TtlMs > 0)
+  {
+    ExpireTime = (uv_hrtime() + ((uint64_t)TtlMs * 1000000));
+  }
+  else
+  {
+    ExpireTime = 0;
+  }
+
+  return ExpireTime;
+}
+
+/* Now is only read when the entry has a TTL */
+static bool SS_IsExpired (struct SS_Entry *Entry, uint64_t *Now)
+{
+  bool Expired;
+
+  if (Entry->ExpireTime == 0)
+  {
+    Expired = false;
+  }
+  else
+  {
+    if (*Now == 0)
+    {
+      *Now = uv_hrtime();
+    }
+    Expired = (*Now >= Entry->ExpireTime);
+  }
+
+  return Expired;
+}
+
+static void SS_RetainEntry (struct SS_Entry *Entry)
+{
+  __atomic_add_fetch(&Entry->ReferenceCount, 1, __ATOMIC_RELAXED);
+}
+
+static void SS_ReleaseEntry (struct SS_Entry *Entry)
+{
+  if (Entry && (__atomic_sub_fetch(&Entry->ReferenceCount, 1, __ATOMIC_ACQ_REL) == 0))
+  {
+    if (Entry->Type == SS_TYPE_STRING)
+    {
+      PLAT_Free((void *)Entry->String); /* Discard const */
+    }
+    else if (Entry->Type == SS_TYPE_MESSAGE)
+    {
+      EM_FreeMessage(Entry->Message);
+    }
+    PLAT_Free(Entry);
+  }
+}
+
+static struct SS_Entry *SS_NewNumberEntry (bool        IsInteger,
+                                           lua_Integer Integer,
+                                           lua_Number  Number)
+{
+  struct SS_Entry *NewEntry = PLAT_SafeAlloc0(1, sizeof(struct SS_Entry));
+
+  NewEntry->ReferenceCount = 1;
+  NewEntry->Type           = (IsInteger ? SS_TYPE_INTEGER : SS_TYPE_NUMBER);
+  NewEntry->Integer        = Integer;
+  NewEntry->Number         = Number;
+
+  return NewEntry;
+}
+
+/* Convert the value at Index, can raise an error. Return NULL for nil. */
+static struct SS_Entry *SS_NewEntry (lua_State   *LuaState,
+                                     int          Index,
+                                     lua_Integer  TtlMs)
+{
+  struct SS_Entry  *NewEntry;
+  struct EM_Writer *Writer;
+  const char       *String;
+  size_t            StringLength;
+  char             *StringCopy;
+
+  if (lua_isnoneornil(LuaState, Index))
+  {
+    return NULL;
+  }
+
+  NewEntry                 = PLAT_SafeAlloc0(1, sizeof(struct SS_Entry));
+  NewEntry->ReferenceCount = 1;
+
+  switch (lua_type(LuaState, Index))
+  {
+    case LUA_TBOOLEAN:
+      NewEntry->Type    = SS_TYPE_BOOLEAN;
+      NewEntry->Boolean = lua_toboolean(LuaState, Index);
+      break;
+
+    case LUA_TNUMBER:
+      if (lua_isinteger(LuaState, Index))
+      {
+        NewEntry->Type    = SS_TYPE_INTEGER;
+        NewEntry->Integer = lua_tointeger(LuaState, Index);
+      }
+      else
+      {
+        NewEntry->Type   = SS_TYPE_NUMBER;
+        NewEntry->Number = lua_tonumber(LuaState, Index);
+      }
+      break;
+
+    case LUA_TSTRING:
+      String     = lua_tolstring(LuaState, Index, &StringLength);
+      StringCopy = PLAT_SafeAlloc0(1, (StringLength + 1));
+      memcpy(StringCopy, String, StringLength);
+      NewEntry->Type         = SS_TYPE_STRING;
+      NewEntry->String       = StringCopy;
+      NewEntry->StringLength = StringLength;
+      break;
+
+    default:
+      Writer = LUA_GetMessageWriter(LuaState);
+      EM_ResetWriter(Writer);
+      if (!EM_WriteLuaValue(Writer, LuaState, Index))
+      {
+        PLAT_Free(NewEntry);
+        luaL_error(LuaState,
+                   "shared value: %s '%s'",
+                   Writer->ErrorReason,
+                   lua_typename(LuaState, Writer->ErrorType));
+      }
+      NewEntry->Type    = SS_TYPE_MESSAGE;
+      NewEntry->Message = EM_NewMessage(Writer);
+      break;
+  }
+
+  NewEntry->ExpireTime = SS_GetExpireTime(TtlMs);
+
+  return NewEntry;
+}
+
+/* Read the expected value of cas, the string stays on the stack */
+static void SS_ReadExpected (lua_State       *LuaState,
+                             int              Index,
+                             struct SS_Entry *Expected)
+{
+  memset(Expected, 0, sizeof(struct SS_Entry));
+
+  switch (lua_type(LuaState, Index))
+  {
+    case LUA_TNONE:
+    case LUA_TNIL:
+      Expected->Type = SS_TYPE_NIL;
+      break;
+
+    case LUA_TBOOLEAN:
+      Expected->Type    = SS_TYPE_BOOLEAN;
+      Expected->Boolean = lua_toboolean(LuaState, Index);
+      break;
+
+    case LUA_TNUMBER:
+      if (lua_isinteger(LuaState, Index))
+      {
+        Expected->Type    = SS_TYPE_INTEGER;
+        Expected->Integer = lua_tointeger(LuaState, Index);
+      }
+      else
+      {
+        Expected->Type   = SS_TYPE_NUMBER;
+        Expected->Number = lua_tonumber(LuaState, Index);
+      }
+      break;
+
+    case LUA_TSTRING:
+      Expected->Type   = SS_TYPE_STRING;
+      Expected->String = lua_tolstring(LuaState, Index, &Expected->StringLength);
+      break;
+
+    default:
+      luaL_argerror(LuaState, Index, "nil, boolean, number or string expected");
+      break;
+  }
+}
+
+/* Entry is NULL when the key is not set. Integers and floats are compared
+ * like in Lua, 1 == 1.0 */
+static bool SS_Matches (struct SS_Entry *Entry, struct SS_Entry *Expected)
+{
+  bool Matches;
+
+  if (Entry == NULL)
+  {
+    Matches = (Expected->Type == SS_TYPE_NIL);
+  }
+  else if ((Entry->Type == SS_TYPE_INTEGER) && (Expected->Type == SS_TYPE_INTEGER))
+  {
+    Matches = (Entry->Integer == Expected->Integer);
+  }
+  else if (((Entry->Type == SS_TYPE_INTEGER) || (Entry->Type == SS_TYPE_NUMBER))
+           && ((Expected->Type == SS_TYPE_INTEGER) || (Expected->Type == SS_TYPE_NUMBER)))
+  {
+    Matches = (((Entry->Type == SS_TYPE_INTEGER) ? (lua_Number)Entry->Integer : Entry->Number)
+               == ((Expected->Type == SS_TYPE_INTEGER) ? (lua_Number)Expected->Integer : Expected->Number));
+  }
+  else if (Entry->Type != Expected->Type)
+  {
+    Matches = false;
+  }
+  else if (Entry->Type == SS_TYPE_BOOLEAN)
+  {
+    Matches = (Entry->Boolean == Expected->Boolean);
+  }
+  else if (Entry->Type == SS_TYPE_STRING)
+  {
+    Matches = ((Entry->StringLength == Expected->StringLength)
+               && (memcmp(Entry->String, Expected->String, Entry->StringLength) == 0));
+  }
+  else
+  {
+    Matches = false;
+  }
+
+  return Matches;
+}
+
+/* Push the value of Entry. The numbers and booleans are pushed from a copy
+ * made under the lock, the other entries are retained. */
+static int SS_PushEntry (lua_State *LuaState, struct SS_Entry *Entry)
+{
+  int ResultCount = 1;
+
+  if (Entry == NULL)
+  {
+    lua_pushnil(LuaState);
+  }
+  else
+  {
+    switch (Entry->Type)
+    {
+      case SS_TYPE_BOOLEAN:
+        lua_pushboolean(LuaState, Entry->Boolean);
+        break;
+
+      case SS_TYPE_INTEGER:
+        lua_pushinteger(LuaState, Entry->Integer);
+        break;
+
+      case SS_TYPE_NUMBER:
+        lua_pushnumber(LuaState, Entry->Number);
+        break;
+
+      case SS_TYPE_STRING:
+        lua_pushlstring(LuaState, Entry->String, Entry->StringLength);
+        break;
+
+      case SS_TYPE_MESSAGE:
+        ResultCount = EM_PushValues(LuaState, Entry->Message);
+        break;
+
+      default:
+        lua_pushnil(LuaState);
+        break;
+    }
+  }
+
+  return ResultCount;
+}
+
+/* Called by lua_pcall, the argument is the retained entry */
+static int SS_PushEntryProtected (lua_State *LuaState)
+{
+  struct SS_Entry *Entry = lua_touserdata(LuaState, 1);
+
+  lua_pop(LuaState, 1);
+
+  return SS_PushEntry(LuaState, Entry); /* Number of values pushed on the stack */
+}
+
+/* Push the value of a retained Entry and release it, even if the push raises
+ * a memory error */
+static int SS_PushEntryAndRelease (lua_State *LuaState, struct SS_Entry *Entry)
+{
+  int Top = lua_gettop(LuaState);
+  int Status;
+
+  lua_pushcfunction(LuaState, SS_PushEntryProtected);
+  lua_pushlightuserdata(LuaState, Entry);
+  Status = lua_pcall(LuaState, 1, LUA_MULTRET, 0);
+
+  SS_ReleaseEntry(Entry);
+
+  if (Status != LUA_OK)
+  {
+    lua_error(LuaState);
+  }
+
+  return (lua_gettop(LuaState) - Top);
+}
+
+/*============================================================================*/
+/* STORES                                                                     */
+/*============================================================================*/
+
+static void SS_InitStores (void)
+{
+  uv_mutex_init(&SS_StoresMutex);
+  SS_Stores = TH_CreateMap(0);
+}
+
+/* The stores are never freed */
+static struct SS_Store *SS_OpenStore (const char *Name, size_t NameLength)
+{
+  struct SS_Store *Store;
+  size_t           Index;
+
+  uv_once(&SS_StoresOnce, SS_InitStores);
+
+  uv_mutex_lock(&SS_StoresMutex);
+  Store = TH_GetObject(SS_Stores, Name, NameLength);
+
+  if (Store == NULL)
+  {
+    Store = PLAT_SafeAlloc0(1, sizeof(struct SS_Store));
+
+    for (Index = 0; Index < SS_STRIPE_COUNT; Index++)
+    {
+      uv_rwlock_init(&Store->Stripes[Index].Lock);
+      Store->Stripes[Index].Map = TH_CreateMap(0);
+    }
+
+    TH_SetObject(SS_Stores, Name, NameLength, Store);
+  }
+  uv_mutex_unlock(&SS_StoresMutex);
+
+  return Store;
+}
+
+/* The top bits of the hash select the stripe, TH_Map uses the low bits */
+static struct SS_Stripe *SS_GetStripe (struct SS_Store *Store,
+                                       const char      *Key,
+                                       size_t           KeyLength)
+{
+  uint64_t Hash = TH_Hash(Key, KeyLength);
+
+  return &Store->Stripes[(Hash >> 58) & (SS_STRIPE_COUNT - 1)];
+}
+
+/* Must be called with the write lock, return the previous entry which must be
+ * released after unlocking. NewEntry NULL removes the key. */
+static struct SS_Entry *SS_ReplaceEntry (struct SS_Stripe *Stripe,
+                                         const char       *Key,
+                                         size_t            KeyLength,
+                                         struct SS_Entry  *NewEntry)
+{
+  struct SS_Entry *PreviousEntry;
+
+  if (NewEntry)
+  {
+    PreviousEntry = TH_SetObject(Stripe->Map, Key, KeyLength, NewEntry);
+  }
+  else
+  {
+    PreviousEntry = TH_RemoveObject(Stripe->Map, Key, KeyLength);
+  }
+
+  return PreviousEntry;
+}
+
+/* Must be called with a lock, return NULL for an expired entry */
+static struct SS_Entry *SS_GetEntry (struct SS_Stripe *Stripe,
+                                     const char       *Key,
+                                     size_t            KeyLength,
+                                     uint64_t         *Now)
+{
+  struct SS_Entry *Entry = TH_GetObject(Stripe->Map, Key, KeyLength);
+
+  if (Entry && SS_IsExpired(Entry, Now))
+  {
+    Entry = NULL;
+  }
+
+  return Entry;
+}
+
+/*============================================================================*/
+/* LUA API                                                                    */
+/*============================================================================*/
+
+static struct SS_Store *SHARED_CheckStore (lua_State *LuaState, int Index)
+{
+  struct SS_Store **Userdata = luaL_checkudata(LuaState, Index, SHARED_METATABLE_NAME);
+
+  return *Userdata;
+}
+
+/* open(Name) */
+static int SHARED_Open (lua_State *LuaState)
+{
+  size_t            NameLength;
+  const char       *Name     = luaL_checklstring(LuaState, 1, &NameLength);
+  struct SS_Store  *Store    = SS_OpenStore(Name, NameLength);
+  struct SS_Store **Userdata = lua_newuserdatauv(LuaState, sizeof(struct SS_Store *), 0);
+
+  *Userdata = Store;
+  luaL_setmetatable(LuaState, SHARED_METATABLE_NAME);
+
+  return 1; /* Number of values pushed on the stack */
+}
+
+/* get(Store, Key) */
+static int SHARED_Get (lua_State *LuaState)
+{
+  struct SS_Store  *Store  = SHARED_CheckStore(LuaState, 1);
+  uint64_t          Now    = 0;
+  size_t            KeyLength;
+  const char       *Key    = luaL_checklstring(LuaState, 2, &KeyLength);
+  struct SS_Stripe *Stripe = SS_GetStripe(Store, Key, KeyLength);
+  struct SS_Entry  *Entry;
+  struct SS_Entry   Copy;
+  int               ResultCount;
+
+  uv_rwlock_rdlock(&Stripe->Lock);
+  Entry = SS_GetEntry(Stripe, Key, KeyLength, &Now);
+
+  if (Entry && ((Entry->Type == SS_TYPE_STRING) || (Entry->Type == SS_TYPE_MESSAGE)))
+  {
+    SS_RetainEntry(Entry);
+  }
+  else if (Entry)
+  {
+    /* incr can update the number after unlocking */
+    Copy  = *Entry;
+    Entry = &Copy;
+  }
+  uv_rwlock_rdunlock(&Stripe->Lock);
+
+  if (Entry && (Entry != &Copy))
+  {
+    ResultCount = SS_PushEntryAndRelease(LuaState, Entry);
+  }
+  else
+  {
+    ResultCount = SS_PushEntry(LuaState, Entry);
+  }
+
+  return ResultCount; /* Number of values pushed on the stack */
+}
+
+/* set(Store, Key, Value, [TtlMs]), a nil value removes the key */
+static int SHARED_Set (lua_State *LuaState)
+{
+  struct SS_Store  *Store = SHARED_CheckStore(LuaState, 1);
+  size_t            KeyLength;
+  const char       *Key   = luaL_checklstring(LuaState, 2, &KeyLength);
+  lua_Integer       TtlMs = luaL_optinteger(LuaState, 4, 0);
+  struct SS_Entry  *NewEntry;
+  struct SS_Entry  *PreviousEntry;
+  struct SS_Stripe *Stripe;
+
+  NewEntry = SS_NewEntry(LuaState, 3, TtlMs);
+  Stripe   = SS_GetStripe(Store, Key, KeyLength);
+
+  uv_rwlock_wrlock(&Stripe->Lock);
+  PreviousEntry = SS_ReplaceEntry(Stripe, Key, KeyLength, NewEntry);
+  uv_rwlock_wrunlock(&Stripe->Lock);
+
+  SS_ReleaseEntry(PreviousEntry);
+
+  lua_pushboolean(LuaState, true);
+
+  return 1; /* Number of values pushed on the stack */
+}
+
+/* add(Store, Key, Value, [TtlMs]), only set the value if Key is not set */
+static int SHARED_Add (lua_State *LuaState)
+{
+  struct SS_Store  *Store = SHARED_CheckStore(LuaState, 1);
+  uint64_t          Now   = 0;
+  size_t            KeyLength;
+  const char       *Key   = luaL_checklstring(LuaState, 2, &KeyLength);
+  lua_Integer       TtlMs = luaL_optinteger(LuaState, 4, 0);
+  struct SS_Entry  *NewEntry;
+  struct SS_Entry  *PreviousEntry;
+  struct SS_Stripe *Stripe;
+  bool              Added;
+
+  luaL_checkany(LuaState, 3);
+  luaL_argcheck(LuaState, !lua_isnil(LuaState, 3), 3, "value expected");
+
+  NewEntry = SS_NewEntry(LuaState, 3, TtlMs);
+  Stripe   = SS_GetStripe(Store, Key, KeyLength);
+
+  uv_rwlock_wrlock(&Stripe->Lock);
+  if (SS_GetEntry(Stripe, Key, KeyLength, &Now))
+  {
+    PreviousEntry = NewEntry;
+    Added         = false;
+  }
+  else
+  {
+    PreviousEntry = SS_ReplaceEntry(Stripe, Key, KeyLength, NewEntry);
+    Added         = true;
+  }
+  uv_rwlock_wrunlock(&Stripe->Lock);
+
+  SS_ReleaseEntry(PreviousEntry);
+
+  lua_pushboolean(LuaState, Added);
+
+  if (!Added)
+  {
+    lua_pushstring(LuaState, "exists");
+  }
+
+  return (Added ? 1 : 2); /* Number of values pushed on the stack */
+}
+
+/* delete(Store, Key) */
+static int SHARED_Delete (lua_State *LuaState)
+{
+  struct SS_Store  *Store  = SHARED_CheckStore(LuaState, 1);
+  size_t            KeyLength;
+  const char       *Key    = luaL_checklstring(LuaState, 2, &KeyLength);
+  struct SS_Stripe *Stripe = SS_GetStripe(Store, Key, KeyLength);
+  struct SS_Entry  *PreviousEntry;
+
+  uv_rwlock_wrlock(&Stripe->Lock);
+  PreviousEntry = SS_ReplaceEntry(Stripe, Key, KeyLength, NULL);
+  uv_rwlock_wrunlock(&Stripe->Lock);
+
+  SS_ReleaseEntry(PreviousEntry);
+
+  return 0; /* Number of values pushed on the stack */
+}
+
+/* incr(Store, Key, [Delta], [TtlMs]), a missing key starts at 0. The TTL is
+ * only set when the key is created. Return the new value, or nil and an
+ * error if the value is not a number. */
+static int SHARED_Increment (lua_State *LuaState)
+{
+  struct SS_Store  *Store        = SHARED_CheckStore(LuaState, 1);
+  uint64_t          Now          = 0;
+  size_t            KeyLength;
+  const char       *Key          = luaL_checklstring(LuaState, 2, &KeyLength);
+  bool              IsInteger    = (lua_isnoneornil(LuaState, 3) || lua_isinteger(LuaState, 3));
+  lua_Integer       Delta        = (IsInteger ? luaL_optinteger(LuaState, 3, 1) : 0);
+  lua_Number        FloatDelta   = (IsInteger ? 0 : luaL_checknumber(LuaState, 3));
+  lua_Integer       TtlMs        = luaL_optinteger(LuaState, 4, 0);
+  struct SS_Stripe *Stripe       = SS_GetStripe(Store, Key, KeyLength);
+  struct SS_Entry  *ExpiredEntry = NULL;
+  struct SS_Entry  *Entry;
+  struct SS_Entry   Copy;
+  bool              Success      = true;
+
+  uv_rwlock_wrlock(&Stripe->Lock);
+  Entry = SS_GetEntry(Stripe, Key, KeyLength, &Now);
+
+  if (Entry == NULL)
+  {
+    Entry             = SS_NewNumberEntry(IsInteger, Delta, FloatDelta);
+    Entry->ExpireTime = SS_GetExpireTime(TtlMs);
+    ExpiredEntry      = SS_ReplaceEntry(Stripe, Key, KeyLength, Entry);
+  }
+  else if ((Entry->Type == SS_TYPE_INTEGER) && IsInteger)
+  {
+    /* Wrap around like Lua integers */
+    Entry->Integer = (lua_Integer)((lua_Unsigned)Entry->Integer + (lua_Unsigned)Delta);
+  }
+  else if (Entry->Type == SS_TYPE_INTEGER)
+  {
+    Entry->Type   = SS_TYPE_NUMBER;
+    Entry->Number = ((lua_Number)Entry->Integer + FloatDelta);
+  }
+  else if (Entry->Type == SS_TYPE_NUMBER)
+  {
+    Entry->Number += (IsInteger ? (lua_Number)Delta : FloatDelta);
+  }
+  else
+  {
+    Success = false;
+  }
+
+  if (Success)
+  {
+    Copy = *Entry;
+  }
+  uv_rwlock_wrunlock(&Stripe->Lock);
+
+  SS_ReleaseEntry(ExpiredEntry);
+
+  if (Success)
+  {
+    SS_PushEntry(LuaState, &Copy);
+  }
+  else
+  {
+    lua_pushnil(LuaState);
+    lua_pushstring(LuaState, "not a number");
+  }
+
+  return (Success ? 1 : 2); /* Number of values pushed on the stack */
+}
+
+/* cas(Store, Key, Expected, NewValue, [TtlMs]), set NewValue if the current
+ * value is Expected. Expected nil means that Key is not set. */
+static int SHARED_CompareAndSwap (lua_State *LuaState)
+{
+  struct SS_Store  *Store = SHARED_CheckStore(LuaState, 1);
+  uint64_t          Now   = 0;
+  size_t            KeyLength;
+  const char       *Key   = luaL_checklstring(LuaState, 2, &KeyLength);
+  lua_Integer       TtlMs = luaL_optinteger(LuaState, 5, 0);
+  struct SS_Entry   Expected;
+  struct SS_Entry  *NewEntry;
+  struct SS_Entry  *PreviousEntry;
+  struct SS_Stripe *Stripe;
+  bool              Swapped;
+
+  SS_ReadExpected(LuaState, 3, &Expected);
+
+  NewEntry = SS_NewEntry(LuaState, 4, TtlMs);
+  Stripe   = SS_GetStripe(Store, Key, KeyLength);
+
+  uv_rwlock_wrlock(&Stripe->Lock);
+  if (SS_Matches(SS_GetEntry(Stripe, Key, KeyLength, &Now), &Expected))
+  {
+    PreviousEntry = SS_ReplaceEntry(Stripe, Key, KeyLength, NewEntry);
+    Swapped       = true;
+  }
+  else
+  {
+    PreviousEntry = NewEntry;
+    Swapped       = false;
+  }
+  uv_rwlock_wrunlock(&Stripe->Lock);
+
+  SS_ReleaseEntry(PreviousEntry);
+
+  lua_pushboolean(LuaState, Swapped);
+
+  return 1; /* Number of values pushed on the stack */
+}
+
+/* ttl(Store, Key), return the remaining milliseconds, -1 without TTL, or nil
+ * if Key is not set */
+static int SHARED_GetTtl (lua_State *LuaState)
+{
+  struct SS_Store  *Store      = SHARED_CheckStore(LuaState, 1);
+  uint64_t          Now        = uv_hrtime();
+  size_t            KeyLength;
+  const char       *Key        = luaL_checklstring(LuaState, 2, &KeyLength);
+  struct SS_Stripe *Stripe     = SS_GetStripe(Store, Key, KeyLength);
+  uint64_t          ExpireTime = 0;
+  struct SS_Entry  *Entry;
+  bool              Found;
+
+  uv_rwlock_rdlock(&Stripe->Lock);
+  Entry = SS_GetEntry(Stripe, Key, KeyLength, &Now);
+  Found = (Entry != NULL);
+  if (Found)
+  {
+    ExpireTime = Entry->ExpireTime;
+  }
+  uv_rwlock_rdunlock(&Stripe->Lock);
+
+  if (!Found)
+  {
+    lua_pushnil(LuaState);
+  }
+  else if (ExpireTime == 0)
+  {
+    lua_pushinteger(LuaState, -1);
+  }
+  else
+  {
+    lua_pushinteger(LuaState, (lua_Integer)((ExpireTime - Now) / 1000000));
+  }
+
+  return 1; /* Number of values pushed on the stack */
+}
+
+/* expire(Store, Key, TtlMs), a TTL of 0 removes the TTL. Return false if Key
+ * is not set. */
+static int SHARED_Expire (lua_State *LuaState)
+{
+  struct SS_Store  *Store  = SHARED_CheckStore(LuaState, 1);
+  uint64_t          Now    = 0;
+  size_t            KeyLength;
+  const char       *Key    = luaL_checklstring(LuaState, 2, &KeyLength);
+  lua_Integer       TtlMs  = luaL_checkinteger(LuaState, 3);
+  struct SS_Stripe *Stripe = SS_GetStripe(Store, Key, KeyLength);
+  struct SS_Entry  *Entry;
+
+  uv_rwlock_wrlock(&Stripe->Lock);
+  Entry = SS_GetEntry(Stripe, Key, KeyLength, &Now);
+  if (Entry)
+  {
+    /* Readers only read ExpireTime under the lock */
+    Entry->ExpireTime = SS_GetExpireTime(TtlMs);
+  }
+  uv_rwlock_wrunlock(&Stripe->Lock);
+
+  lua_pushboolean(LuaState, (Entry != NULL));
+
+  return 1; /* Number of values pushed on the stack */
+}
+
+/* keys(Store), return an array of the keys. The stripes are read one by one,
+ * the array is not a snapshot of the whole store. */
+static int SHARED_GetKeys (lua_State *LuaState)
+{
+  struct SS_Store   *Store      = SHARED_CheckStore(LuaState, 1);
+  uint64_t           Now        = 0;
+  char             **Keys       = NULL;
+  size_t            *Lengths    = NULL;
+  size_t             KeyCount   = 0;
+  size_t             Capacity   = 0;
+  lua_Integer        ArrayIndex = 1;
+  struct SS_Stripe  *Stripe;
+  size_t             StripeIndex;
+  size_t             Cursor;
+  const char        *Key;
+  size_t             KeyLength;
+  void              *Object;
+  size_t             Index;
+
+  lua_newtable(LuaState);
+
+  for (StripeIndex = 0; StripeIndex < SS_STRIPE_COUNT; StripeIndex++)
+  {
+    Stripe = &Store->Stripes[StripeIndex];
+    Cursor = 0;
+
+    /* Copy the keys, Lua can't be called with the lock */
+    uv_rwlock_rdlock(&Stripe->Lock);
+    while (TH_GetNext(Stripe->Map, &Cursor, &Key, &KeyLength, &Object))
+    {
+      if (!SS_IsExpired(Object, &Now))
+      {
+        if (KeyCount == Capacity)
+        {
+          Capacity = ((Capacity == 0) ? 64 : (Capacity * 2));
+          Keys     = PLAT_SafeRealloc(Keys, (Capacity * sizeof(char *)));
+          Lengths  = PLAT_SafeRealloc(Lengths, (Capacity * sizeof(size_t)));
+        }
+        Keys[KeyCount]    = PLAT_SafeAlloc0(1, KeyLength);
+        Lengths[KeyCount] = KeyLength;
+        memcpy(Keys[KeyCount], Key, KeyLength);
+        KeyCount++;
+      }
+    }
+    uv_rwlock_rdunlock(&Stripe->Lock);
+
+    for (Index = 0; Index < KeyCount; Index++)
+    {
+      lua_pushlstring(LuaState, Keys[Index], Lengths[Index]);
+      lua_rawseti(LuaState, -2, ArrayIndex++);
+      PLAT_Free(Keys[Index]);
+    }
+    KeyCount = 0;
+  }
+
+  PLAT_Free(Keys);
+  PLAT_Free(Lengths);
+
+  return 1; /* Number of values pushed on the stack */
+}
+
+/* Remove all the entries, or only the expired ones. Return the number of
+ * entries removed. */
+static size_t SS_RemoveEntries (struct SS_Store *Store, bool ExpiredOnly)
+{
+  struct SS_Entry  **Removed      = NULL;
+  size_t             RemovedCount = 0;
+  size_t             Capacity     = 0;
+  size_t             Total        = 0;
+  uint64_t           Now          = 0;
+  struct SS_Stripe  *Stripe;
+  size_t             StripeIndex;
+  size_t             Cursor;
+  const char        *Key;
+  size_t             KeyLength;
+  void              *Object;
+  size_t             Index;
+
+  for (StripeIndex = 0; StripeIndex < SS_STRIPE_COUNT; StripeIndex++)
+  {
+    Stripe = &Store->Stripes[StripeIndex];
+    Cursor = 0;
+
+    uv_rwlock_wrlock(&Stripe->Lock);
+    while (TH_GetNext(Stripe->Map, &Cursor, &Key, &KeyLength, &Object))
+    {
+      if (!ExpiredOnly || SS_IsExpired(Object, &Now))
+      {
+        if (RemovedCount == Capacity)
+        {
+          Capacity = ((Capacity == 0) ? 64 : (Capacity * 2));
+          Removed  = PLAT_SafeRealloc(Removed, (Capacity * sizeof(struct SS_Entry *)));
+        }
+        Removed[RemovedCount++] = Object;
+      }
+    }
+
+    /* The map can't be modified during TH_GetNext */
+    if (!ExpiredOnly)
+    {
+      TH_FreeMap(Stripe->Map);
+      Stripe->Map = TH_CreateMap(0);
+    }
+    else
+    {
+      Cursor = 0;
+      while (TH_GetNext(Stripe->Map, &Cursor, &Key, &KeyLength, &Object))
+      {
+        if (SS_IsExpired(Object, &Now))
+        {
+          TH_RemoveObject(Stripe->Map, Key, KeyLength);
+          /* The backward shift can move an entry to the current slot */
+          Cursor--;
+        }
+      }
+    }
+    uv_rwlock_wrunlock(&Stripe->Lock);
+
+    for (Index = 0; Index < RemovedCount; Index++)
+    {
+      SS_ReleaseEntry(Removed[Index]);
+    }
+    Total       += RemovedCount;
+    RemovedCount = 0;
+  }
+
+  PLAT_Free(Removed);
+
+  return Total;
+}
+
+/* flushexpired(Store), return the number of entries removed */
+static int SHARED_FlushExpired (lua_State *LuaState)
+{
+  struct SS_Store *Store = SHARED_CheckStore(LuaState, 1);
+
+  lua_pushinteger(LuaState, (lua_Integer)SS_RemoveEntries(Store, true));
+
+  return 1; /* Number of values pushed on the stack */
+}
+
+/* clear(Store), remove all the entries */
+static int SHARED_Clear (lua_State *LuaState)
+{
+  struct SS_Store *Store = SHARED_CheckStore(LuaState, 1);
+
+  SS_RemoveEntries(Store, false);
+
+  return 0; /* Number of values pushed on the stack */
+}
+
+/* count(Store), the expired entries not flushed yet are counted */
+static int SHARED_GetCount (lua_State *LuaState)
+{
+  struct SS_Store  *Store = SHARED_CheckStore(LuaState, 1);
+  size_t            Count = 0;
+  struct SS_Stripe *Stripe;
+  size_t            StripeIndex;
+
+  for (StripeIndex = 0; StripeIndex < SS_STRIPE_COUNT; StripeIndex++)
+  {
+    Stripe = &Store->Stripes[StripeIndex];
+    uv_rwlock_rdlock(&Stripe->Lock);
+    Count += TH_GetCount(Stripe->Map);
+    uv_rwlock_rdunlock(&Stripe->Lock);
+  }
+
+  lua_pushinteger(LuaState, (lua_Integer)Count);
+
+  return 1; /* Number of values pushed on the stack */
+}
+
+static int SHARED_Describe (lua_State *LuaState)
+{
+  struct SS_Store *Store = SHARED_CheckStore(LuaState, 1);
+
+  lua_pushfstring(LuaState, "shared store: %p", (void *)Store);
+
+  return 1; /* Number of values pushed on the stack */
+}
+
+/*============================================================================*/
+/* PUBLIC INTERFACE                                                           */
+/*============================================================================*/
+
+static const struct luaL_Reg SHARED_METHODS[] =
+{
+  { "get",          SHARED_Get            },
+  { "set",          SHARED_Set            },
+  { "add",          SHARED_Add            },
+  { "delete",       SHARED_Delete         },
+  { "incr",         SHARED_Increment      },
+  { "cas",          SHARED_CompareAndSwap },
+  { "ttl",          SHARED_GetTtl         },
+  { "expire",       SHARED_Expire         },
+  { "keys",         SHARED_GetKeys        },
+  { "count",        SHARED_GetCount       },
+  { "flushexpired", SHARED_FlushExpired   },
+  { "clear",        SHARED_Clear          },
+  { NULL,           NULL                  }
+};
+
+static const struct luaL_Reg SHARED_METAMETHODS[] =
+{
+  { "__tostring", SHARED_Describe },
+  { NULL,         NULL            }
+};
+
+static const struct luaL_Reg SHARED_FUNCTIONS[] =
+{
+  { "open", SHARED_Open },
+  { NULL,   NULL        }
+};
+
+int luaopen_shared (lua_State *LuaState)
+{
+  if (luaL_newmetatable(LuaState, SHARED_METATABLE_NAME))
+  {
+    luaL_setfuncs(LuaState, SHARED_METAMETHODS, 0);
+    luaL_newlib(LuaState, SHARED_METHODS);
+    lua_setfield(LuaState, -2, "__index");
+  }
+  lua_pop(LuaState, 1);
+
+  luaL_newlib(LuaState, SHARED_FUNCTIONS);
+
+  return 1; /* Number of values pushed on the stack */
+}
@@ -92,6 +92,9 @@ static struct GB_Allocator MAIN_Allocator =
 static int MAIN_MutexInitialize (mbedtls_platform_mutex_t *Mutex)
 {
   uv_mutex_init(&Mutex->Mutex);
+  Mutex->LockCount      = 0;
+  Mutex->ContendedCount = 0;
+  Mutex->WaitTimeNs     = 0;
 
   return 0;
 }
@@ -101,9 +104,23 @@ static void MAIN_MutexFree (mbedtls_platform_mutex_t *Mutex)
   uv_mutex_destroy(&Mutex->Mutex);
 }
 
+/* Count the lock calls, and the time spent waiting when the mutex is already
+ * locked. The counters are updated with the mutex locked: relaxed stores are
+ * enough for LUA_GetTlsLockStats which reads them from other threads. */
 static int MAIN_MutexLock (mbedtls_platform_mutex_t *Mutex)
 {
-  uv_mutex_lock(&Mutex->Mutex);
+  uint64_t StartTime;
+  uint64_t WaitTime;
+
+  if (uv_mutex_trylock(&Mutex->Mutex) != 0)
+  {
+    StartTime = uv_hrtime();
+    uv_mutex_lock(&Mutex->Mutex);
+    WaitTime  = (uv_hrtime() - StartTime);
+    __atomic_store_n(&Mutex->ContendedCount, (Mutex->ContendedCount + 1),     __ATOMIC_RELAXED);
+    __atomic_store_n(&Mutex->WaitTimeNs,     (Mutex->WaitTimeNs + WaitTime), __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&Mutex->LockCount, (Mutex->LockCount + 1), __ATOMIC_RELAXED);
   
   return 0;
 }
@@ -173,6 +190,37 @@ static void MAIN_FreeMbedtls ()
   mbedtls_threading_free_alt();
 }
 
+/*============================================================================*/
+/* MBEDTLS RANDOM GENERATOR                                                   */
+/*============================================================================*/
+
+/* MBEDTLS_PSA_CRYPTO_EXTERNAL_RNG is defined: PSA takes its random bytes here
+ * instead of its global CTR_DRBG, which is locked for each request. The
+ * threads don't wait for each other to get random bytes anymore.
+ * Context is shared by all the threads, it is not used. */
+psa_status_t mbedtls_psa_external_get_random (mbedtls_psa_external_random_context_t *Context,
+                                              uint8_t                               *Output,
+                                              size_t                                 OutputSize,
+                                              size_t                                *OutputLength)
+{
+  psa_status_t Status;
+
+  (void)Context; /* unused parameter */
+
+  if (PLAT_GetRandom(Output, OutputSize))
+  {
+    *OutputLength = OutputSize;
+    Status        = PSA_SUCCESS;
+  }
+  else
+  {
+    *OutputLength = 0;
+    Status        = PSA_ERROR_INSUFFICIENT_ENTROPY;
+  }
+
+  return Status;
+}
+
 /*============================================================================*/
 /* PRIVATE FUNCTIONS                                                          */
 /*============================================================================*/
@@ -0,0 +1,342 @@
+/*----------------------------------------------------------------------------*
+ * PROJECT  ComEXE                                                            *
+ * FILENAME module-cache.c                                                    *
+ * CONTENT  Process-wide cache of immutable refcounted blobs                  *
+ *----------------------------------------------------------------------------*
+ * Copyright (c) 2020-2026 Pascal COMBIER                                     *
+ * This source code is licensed under the BSD 2-clause license found in the   *
+ * LICENSE file in the root directory of this source tree.                    *
+ *----------------------------------------------------------------------------*/
+
+/*============================================================================*/
+/* INFORMATION                                                                */
+/*============================================================================*/
+
+/* The cache is shared by all the LUA_Instance of the application. It is used
+ * to store decompressed ZIP entries and the bytecode of the loaded chunks, so
+ * that only the first instance pays for the inflate and the parsing.
+ *
+ * A blob is immutable once inserted. The cache holds one reference on each
+ * blob and MC_Acquire gives an additional reference to the caller. When the
+ * cache exceeds its capacity, the least recently used entries are evicted:
+ * the blobs themselves are only freed when the last reference is released,
+ * so a blob being used by an instance is never freed under its feet.
+ *
+ * Hits and misses are counted per module load by MC_CountLoad, not per key
+ * probe: a load probes several keys (bytecode then source) and the searchers
+ * probe paths which don't exist.
+ *
+ * The reference count is updated with atomic builtins, the map and the
+ * statistics are protected by CacheMutex.
+ */
+
+/*============================================================================*/
+/* MAKEHEADERS PUBLIC INTERFACE                                               */
+/*============================================================================*/
+
+#if MKH_INTERFACE
+
+/*---------*/
+/* HEADERS */
+/*---------*/
+
+#include <stdbool.h> /* bool     */
+#include <stddef.h>  /* size_t   */
+#include <stdint.h>  /* uint64_t */
+
+/*-------*/
+/* TYPES */
+/*-------*/
+
+struct MC_Cache;
+struct MC_Blob;
+
+struct MC_Statistics
+{
+  uint64_t Hits;
+  uint64_t Misses;
+  uint64_t Insertions;
+  uint64_t Evictions;
+  size_t   EntryCount;
+  size_t   SizeInBytes;
+  size_t   CapacityInBytes;
+};
+
+#endif
+
+/*============================================================================*/
+/* IMPLEMENTATION HEADERS                                                     */
+/*============================================================================*/
+
+#include <string.h> /* memcpy */
+
+#include <uv.h>
+
+#include "comexe.h"
+
+/*============================================================================*/
+/* TYPES                                                                      */
+/*============================================================================*/
+
+struct MC_Blob
+{
+  int32_t RefCount;
+  size_t  SizeInBytes;
+  uint8_t Data[];
+};
+
+struct MC_Entry
+{
+  struct MC_Blob *Blob;
+  uint64_t        LastUse;
+};
+
+struct MC_Cache
+{
+  uv_mutex_t           CacheMutex;
+  struct TH_Map       *EntryMap;
+  uint64_t             Tick;
+  struct MC_Statistics Statistics;
+};
+
+#define MC_INITIAL_ENTRY_COUNT 256
+
+/*============================================================================*/
+/* PRIVATE API                                                                */
+/*============================================================================*/
+
+static void MC_RetainBlob (struct MC_Blob *Blob)
+{
+  __atomic_add_fetch(&Blob->RefCount, 1, __ATOMIC_RELAXED);
+}
+
+/* Must be called with CacheMutex locked */
+static void MC_RemoveEntry (struct MC_Cache *Cache,
+                            const char      *Key,
+                            size_t           KeyLength)
+{
+  struct MC_Entry *Entry = TH_RemoveObject(Cache->EntryMap, Key, KeyLength);
+
+  Cache->Statistics.EntryCount--;
+  Cache->Statistics.SizeInBytes -= Entry->Blob->SizeInBytes;
+
+  MC_ReleaseBlob(Entry->Blob);
+  PLAT_Free(Entry);
+}
+
+/* Must be called with CacheMutex locked. The map is small (a few thousand
+ * entries at most) and eviction is rare, a linear search is enough. */
+static void MC_EvictIfNeeded (struct MC_Cache *Cache)
+{
+  size_t           Cursor;
+  const char      *Key;
+  size_t           KeyLength;
+  void            *Object;
+  struct MC_Entry *Entry;
+  struct MC_Entry *OldestEntry;
+  const char      *OldestKey;
+  size_t           OldestKeyLength;
+
+  while ((Cache->Statistics.SizeInBytes > Cache->Statistics.CapacityInBytes)
+         && (Cache->Statistics.EntryCount > 0))
+  {
+    Cursor          = 0;
+    OldestEntry     = NULL;
+    OldestKey       = NULL;
+    OldestKeyLength = 0;
+
+    while (TH_GetNext(Cache->EntryMap, &Cursor, &Key, &KeyLength, &Object))
+    {
+      Entry = Object;
+      if ((OldestEntry == NULL) || (Entry->LastUse < OldestEntry->LastUse))
+      {
+        OldestEntry     = Entry;
+        OldestKey       = Key;
+        OldestKeyLength = KeyLength;
+      }
+    }
+
+    MC_RemoveEntry(Cache, OldestKey, OldestKeyLength);
+    Cache->Statistics.Evictions++;
+  }
+}
+
+/*============================================================================*/
+/* BLOB API                                                                   */
+/*============================================================================*/
+
+struct MC_Blob *MC_NewBlob (const void *Data, size_t SizeInBytes)
+{
+  struct MC_Blob *Blob = PLAT_SafeAlloc0(1, sizeof(struct MC_Blob) + SizeInBytes + 1);
+
+  Blob->RefCount    = 1;
+  Blob->SizeInBytes = SizeInBytes;
+  memcpy(Blob->Data, Data, SizeInBytes);
+
+  return Blob;
+}
+
+void MC_ReleaseBlob (struct MC_Blob *Blob)
+{
+  if (__atomic_sub_fetch(&Blob->RefCount, 1, __ATOMIC_ACQ_REL) == 0)
+  {
+    PLAT_Free(Blob);
+  }
+}
+
+const uint8_t *MC_GetBlobData (struct MC_Blob *Blob)
+{
+  return Blob->Data;
+}
+
+size_t MC_GetBlobSize (struct MC_Blob *Blob)
+{
+  return Blob->SizeInBytes;
+}
+
+/*============================================================================*/
+/* CACHE API                                                                  */
+/*============================================================================*/
+
+struct MC_Cache *MC_CreateCache (size_t CapacityInBytes)
+{
+  struct MC_Cache *Cache = PLAT_SafeAlloc0(1, sizeof(struct MC_Cache));
+
+  uv_mutex_init(&Cache->CacheMutex);
+  Cache->EntryMap                   = TH_CreateMap(MC_INITIAL_ENTRY_COUNT);
+  Cache->Tick                       = 0;
+  Cache->Statistics.CapacityInBytes = CapacityInBytes;
+
+  return Cache;
+}
+
+void MC_FreeCache (struct MC_Cache *Cache)
+{
+  size_t           Cursor = 0;
+  const char      *Key;
+  size_t           KeyLength;
+  void            *Object;
+  struct MC_Entry *Entry;
+
+  while (TH_GetNext(Cache->EntryMap, &Cursor, &Key, &KeyLength, &Object))
+  {
+    Entry = Object;
+    MC_ReleaseBlob(Entry->Blob);
+    PLAT_Free(Entry);
+  }
+
+  TH_FreeMap(Cache->EntryMap);
+  uv_mutex_destroy(&Cache->CacheMutex);
+  PLAT_Free(Cache);
+}
+
+/* Return a new reference on the cached blob, the caller must release it with
+ * MC_ReleaseBlob. Return NULL if Key is not in the cache. */
+struct MC_Blob *MC_AcquireBlob (struct MC_Cache *Cache,
+                                const char      *Key,
+                                size_t           KeyLength)
+{
+  struct MC_Entry *Entry;
+  struct MC_Blob  *Blob;
+
+  uv_mutex_lock(&Cache->CacheMutex);
+
+  Entry = TH_GetObject(Cache->EntryMap, Key, KeyLength);
+
+  if (Entry)
+  {
+    Blob           = Entry->Blob;
+    Entry->LastUse = ++Cache->Tick;
+    MC_RetainBlob(Blob);
+  }
+  else
+  {
+    Blob = NULL;
+  }
+
+  uv_mutex_unlock(&Cache->CacheMutex);
+
+  return Blob;
+}
+
+/* The cache takes a reference on Blob. If another instance inserted the same
+ * Key in the meantime, the existing blob is kept. */
+void MC_InsertBlob (struct MC_Cache *Cache,
+                    const char      *Key,
+                    size_t           KeyLength,
+                    struct MC_Blob  *Blob)
+{
+  struct MC_Entry *Entry;
+
+  uv_mutex_lock(&Cache->CacheMutex);
+
+  /* Entries larger than the whole cache are not stored */
+  if ((TH_GetObject(Cache->EntryMap, Key, KeyLength) == NULL)
+      && (Blob->SizeInBytes <= Cache->Statistics.CapacityInBytes))
+  {
+    Entry          = PLAT_SafeAlloc0(1, sizeof(struct MC_Entry));
+    Entry->Blob    = Blob;
+    Entry->LastUse = ++Cache->Tick;
+    MC_RetainBlob(Blob);
+
+    TH_SetObject(Cache->EntryMap, Key, KeyLength, Entry);
+
+    Cache->Statistics.Insertions++;
+    Cache->Statistics.EntryCount++;
+    Cache->Statistics.SizeInBytes += Blob->SizeInBytes;
+
+    MC_EvictIfNeeded(Cache);
+  }
+
+  uv_mutex_unlock(&Cache->CacheMutex);
+}
+
+/* Remove Key from the cache if present, the blob stays alive while another
+ * reference exists */
+void MC_RemoveBlob (struct MC_Cache *Cache,
+                    const char      *Key,
+                    size_t           KeyLength)
+{
+  uv_mutex_lock(&Cache->CacheMutex);
+
+  if (TH_GetObject(Cache->EntryMap, Key, KeyLength))
+  {
+    MC_RemoveEntry(Cache, Key, KeyLength);
+  }
+
+  uv_mutex_unlock(&Cache->CacheMutex);
+}
+
+/* Count one module load, IsHit is true when the load was served from the
+ * cache */
+void MC_CountLoad (struct MC_Cache *Cache, bool IsHit)
+{
+  uv_mutex_lock(&Cache->CacheMutex);
+
+  if (IsHit)
+  {
+    Cache->Statistics.Hits++;
+  }
+  else
+  {
+    Cache->Statistics.Misses++;
+  }
+
+  uv_mutex_unlock(&Cache->CacheMutex);
+}
+
+void MC_SetCapacity (struct MC_Cache *Cache, size_t CapacityInBytes)
+{
+  uv_mutex_lock(&Cache->CacheMutex);
+  Cache->Statistics.CapacityInBytes = CapacityInBytes;
+  MC_EvictIfNeeded(Cache);
+  uv_mutex_unlock(&Cache->CacheMutex);
+}
+
+void MC_GetStatistics (struct MC_Cache      *Cache,
+                       struct MC_Statistics *Statistics)
+{
+  uv_mutex_lock(&Cache->CacheMutex);
+  *Statistics = Cache->Statistics;
+  uv_mutex_unlock(&Cache->CacheMutex);
+}
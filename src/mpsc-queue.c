@@ -0,0 +1,179 @@
+/*----------------------------------------------------------------------------*
+ * PROJECT  ComEXE                                                            *
+ * FILENAME mpsc-queue.c                                                      *
+ * CONTENT  Intrusive multi-producer single-consumer lock-free queue          *
+ *----------------------------------------------------------------------------*
+ * Copyright (c) 2020-2026 Pascal COMBIER                                     *
+ * This source code is licensed under the BSD 2-clause license found in the   *
+ * LICENSE file in the root directory of this source tree.                    *
+ *----------------------------------------------------------------------------*/
+
+/*============================================================================*/
+/* INFORMATION                                                                */
+/*============================================================================*/
+
+/* This is the intrusive MPSC queue described by Dmitry Vyukov. A producer only
+ * does one atomic exchange on Head, the consumer works on Tail and never
+ * blocks the producers. The nodes are owned by the caller: the queue never
+ * allocates anything.
+ *
+ * Count is incremented by the producer *before* the node is linked. So Count
+ * is an upper bound of the number of visible nodes, MQ_Pop might spin for a
+ * very short time when a producer has been preempted between the exchange and
+ * the link. The value returned by MQ_Push tells if the queue was empty, the
+ * caller can use it to wake up the consumer only when needed.
+ *
+ * MQ_Push can be called from any thread, MQ_Pop and MQ_GetCount only from the
+ * consumer thread.
+ */
+
+/*============================================================================*/
+/* MAKEHEADERS PUBLIC INTERFACE                                               */
+/*============================================================================*/
+
+#if MKH_INTERFACE
+
+/*---------*/
+/* HEADERS */
+/*---------*/
+
+#include <stddef.h>  /* size_t */
+#include <stdbool.h> /* bool   */
+
+/*-------*/
+/* TYPES */
+/*-------*/
+
+struct MQ_Node
+{
+  struct MQ_Node *Next;
+};
+
+struct MQ_Queue
+{
+  struct MQ_Node *Head; /* Producers */
+  struct MQ_Node *Tail; /* Consumer  */
+  struct MQ_Node  Stub;
+  size_t          Count;
+};
+
+#endif
+
+/*============================================================================*/
+/* IMPLEMENTATION HEADERS                                                     */
+/*============================================================================*/
+
+#include "comexe.h"
+
+/*============================================================================*/
+/* PRIVATE API                                                                */
+/*============================================================================*/
+
+static void MQ_LinkNode (struct MQ_Queue *Queue, struct MQ_Node *Node)
+{
+  struct MQ_Node *PreviousNode;
+
+  __atomic_store_n(&Node->Next, NULL, __ATOMIC_RELAXED);
+  PreviousNode = __atomic_exchange_n(&Queue->Head, Node, __ATOMIC_ACQ_REL);
+  __atomic_store_n(&PreviousNode->Next, Node, __ATOMIC_RELEASE);
+}
+
+/* Return NULL if the queue is empty or if a producer is linking a node */
+static struct MQ_Node *MQ_TryPop (struct MQ_Queue *Queue)
+{
+  struct MQ_Node *Tail = Queue->Tail;
+  struct MQ_Node *Next = __atomic_load_n(&Tail->Next, __ATOMIC_ACQUIRE);
+  struct MQ_Node *Result;
+
+  /* Skip the stub */
+  if ((Tail == &Queue->Stub) && (Next != NULL))
+  {
+    Queue->Tail = Next;
+    Tail        = Next;
+    Next        = __atomic_load_n(&Next->Next, __ATOMIC_ACQUIRE);
+  }
+
+  if (Tail == &Queue->Stub)
+  {
+    /* Empty queue */
+    Result = NULL;
+  }
+  else if (Next != NULL)
+  {
+    Queue->Tail = Next;
+    Result      = Tail;
+  }
+  else if (Tail != __atomic_load_n(&Queue->Head, __ATOMIC_ACQUIRE))
+  {
+    /* A producer is linking a node behind Tail */
+    Result = NULL;
+  }
+  else
+  {
+    /* Tail is the last node: put back the stub behind it to detach it */
+    MQ_LinkNode(Queue, &Queue->Stub);
+    Next = __atomic_load_n(&Tail->Next, __ATOMIC_ACQUIRE);
+
+    if (Next != NULL)
+    {
+      Queue->Tail = Next;
+      Result      = Tail;
+    }
+    else
+    {
+      Result = NULL;
+    }
+  }
+
+  return Result;
+}
+
+/*============================================================================*/
+/* PUBLIC API                                                                 */
+/*============================================================================*/
+
+void MQ_InitQueue (struct MQ_Queue *Queue)
+{
+  Queue->Stub.Next = NULL;
+  Queue->Head      = &Queue->Stub;
+  Queue->Tail      = &Queue->Stub;
+  Queue->Count     = 0;
+}
+
+/* Return true if the queue was empty before this push */
+bool MQ_Push (struct MQ_Queue *Queue, struct MQ_Node *Node)
+{
+  size_t PreviousCount = __atomic_fetch_add(&Queue->Count, 1, __ATOMIC_ACQ_REL);
+
+  MQ_LinkNode(Queue, Node);
+
+  return (PreviousCount == 0);
+}
+
+/* Return NULL if the queue is empty */
+struct MQ_Node *MQ_Pop (struct MQ_Queue *Queue)
+{
+  struct MQ_Node *Node;
+
+  if (__atomic_load_n(&Queue->Count, __ATOMIC_ACQUIRE) == 0)
+  {
+    Node = NULL;
+  }
+  else
+  {
+    /* The node is counted, it will be linked very soon */
+    do
+    {
+      Node = MQ_TryPop(Queue);
+    } while (Node == NULL);
+
+    __atomic_sub_fetch(&Queue->Count, 1, __ATOMIC_ACQ_REL);
+  }
+
+  return Node;
+}
+
+size_t MQ_GetCount (struct MQ_Queue *Queue)
+{
+  return __atomic_load_n(&Queue->Count, __ATOMIC_ACQUIRE);
+}
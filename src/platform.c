@@ -18,7 +18,14 @@
 /* HEADERS */
 /*---------*/
 
-#include <stddef.h> /* size_t  */
+#include <stddef.h>  /* size_t  */
+#include <stdbool.h> /* bool    */
+
+/*-------*/
+/* TYPES */
+/*-------*/
+
+struct mi_heap_s;
 
 #endif
 
@@ -35,8 +42,12 @@
 #include <windows.h>
 #include <io.h>         /* _isatty */
 #include <combaseapi.h> /* CoInitializeEx, CoUninitialize */
+#include <bcrypt.h>     /* BCryptGenRandom */
+#define PLAT_RANDOM_MAX_REQUEST ((ULONG)0x10000000)
 #else
 #include <unistd.h>
+#include <errno.h>      /* errno, EINTR */
+#include <sys/random.h> /* getrandom */
 #endif
 
 /*============================================================================*/
@@ -123,3 +134,91 @@ char *PLAT_StrDup (const char *String)
 {
   return mi_strdup(String);
 }
+
+/*============================================================================*/
+/* MIMALLOC HEAPS                                                             */
+/*============================================================================*/
+
+/* A heap only allocates in the thread which created it, its blocks can be
+ * freed by PLAT_Free in any thread */
+struct mi_heap_s *PLAT_NewHeap ()
+{
+  mi_heap_t *Heap = mi_heap_new();
+
+  if (Heap == NULL)
+  {
+    fprintf(stderr, "heap creation failed\n");
+    exit(1);
+  }
+
+  return Heap;
+}
+
+void *PLAT_HeapRealloc (struct mi_heap_s *Heap, void *Object, size_t ObjectSizeInBytes)
+{
+  void *NewBlock = mi_heap_realloc(Heap, Object, ObjectSizeInBytes);
+
+  if (NewBlock == NULL)
+  {
+    fprintf(stderr, "memory reallocation failed (%zu bytes)\n", ObjectSizeInBytes);
+    exit(1);
+  }
+
+  return NewBlock;
+}
+
+/* Release the pages of the heap at once, the blocks left are freed too. Must
+ * be called by the thread which created the heap. */
+void PLAT_DestroyHeap (struct mi_heap_s *Heap)
+{
+  mi_heap_destroy(Heap);
+}
+
+/*============================================================================*/
+/* RANDOM NUMBERS                                                             */
+/*============================================================================*/
+
+/* Random bytes of the operating system: getrandom on Linux, BCryptGenRandom
+ * on Windows. The generators of the kernels are thread safe and fork safe,
+ * the threads share no state and no lock in the process. */
+
+bool PLAT_GetRandom (void *Output, size_t Size)
+{
+  unsigned char *Bytes   = Output;
+  bool           Success = true;
+#ifdef _WIN32
+  ULONG          Count;
+
+  while (Success && (Size > 0))
+  {
+    /* The size is a ULONG */
+    Count   = ((Size < PLAT_RANDOM_MAX_REQUEST) ? (ULONG)Size : PLAT_RANDOM_MAX_REQUEST);
+    Success = BCRYPT_SUCCESS(BCryptGenRandom(NULL, Bytes, Count, BCRYPT_USE_SYSTEM_PREFERRED_RNG));
+    Bytes   = (Bytes + Count);
+    Size    = (Size - Count);
+  }
+#else
+  ssize_t        Count;
+
+  while (Success && (Size > 0))
+  {
+    /* Large requests might be partial, and interrupted by a signal */
+    Count = getrandom(Bytes, Size, 0);
+    if (Count > 0)
+    {
+      Bytes = (Bytes + Count);
+      Size  = (Size - (size_t)Count);
+    }
+    else if ((Count < 0) && (errno == EINTR))
+    {
+      /* Try again */
+    }
+    else
+    {
+      Success = false;
+    }
+  }
+#endif
+
+  return Success;
+}
@@ -0,0 +1,312 @@
+/*----------------------------------------------------------------------------*
+ * PROJECT  ComEXE                                                            *
+ * FILENAME trivial-hashmap.c                                                 *
+ * CONTENT  Hash map of objects indexed by binary strings                     *
+ *----------------------------------------------------------------------------*
+ * Copyright (c) 2020-2026 Pascal COMBIER                                     *
+ * This source code is licensed under the BSD 2-clause license found in the   *
+ * LICENSE file in the root directory of this source tree.                    *
+ *----------------------------------------------------------------------------*/
+
+/*============================================================================*/
+/* INFORMATION                                                                */
+/*============================================================================*/
+
+/* Open addressing with linear probing. Removal use backward shift deletion, so
+ * there is no tombstone and a lookup stops on the first empty slot.
+ *
+ * The keys are copied in the map, the objects are not owned by the map. The
+ * map is not thread-safe, the caller is responsible for the locking.
+ */
+
+/*============================================================================*/
+/* MAKEHEADERS PUBLIC INTERFACE                                               */
+/*============================================================================*/
+
+#if MKH_INTERFACE
+
+/*---------*/
+/* HEADERS */
+/*---------*/
+
+#include <stddef.h>  /* size_t   */
+#include <stdint.h>  /* uint64_t */
+#include <stdbool.h> /* bool     */
+
+/*-------*/
+/* TYPES */
+/*-------*/
+
+struct TH_Map;
+
+#endif
+
+/*============================================================================*/
+/* IMPLEMENTATION HEADERS                                                     */
+/*============================================================================*/
+
+#include <string.h> /* memcmp, memcpy */
+
+#include "comexe.h"
+
+/*============================================================================*/
+/* TYPES                                                                      */
+/*============================================================================*/
+
+struct TH_Slot
+{
+  uint64_t  Hash;
+  char     *Key; /* NULL for empty slot */
+  size_t    KeyLength;
+  void     *Object;
+};
+
+struct TH_Map
+{
+  struct TH_Slot *Slots;
+  size_t          Count;
+  size_t          Capacity; /* Always a power of 2 */
+};
+
+#define TH_MINIMUM_CAPACITY 16
+
+/*============================================================================*/
+/* PRIVATE API                                                                */
+/*============================================================================*/
+
+static size_t TH_GetSlotIndex (struct TH_Map *Map, uint64_t Hash)
+{
+  return (size_t)(Hash & (Map->Capacity - 1));
+}
+
+static bool TH_SlotMatches (struct TH_Slot *Slot,
+                            uint64_t        Hash,
+                            const void     *Key,
+                            size_t          KeyLength)
+{
+  return (Slot->Hash == Hash)
+    && (Slot->KeyLength == KeyLength)
+    && (memcmp(Slot->Key, Key, KeyLength) == 0);
+}
+
+/* Return the slot containing Key, or the empty slot where it should go */
+static struct TH_Slot *TH_FindSlot (struct TH_Map *Map,
+                                    uint64_t       Hash,
+                                    const void    *Key,
+                                    size_t         KeyLength)
+{
+  size_t          Index = TH_GetSlotIndex(Map, Hash);
+  struct TH_Slot *Slot  = &Map->Slots[Index];
+
+  while (Slot->Key && !TH_SlotMatches(Slot, Hash, Key, KeyLength))
+  {
+    Index = ((Index + 1) & (Map->Capacity - 1));
+    Slot  = &Map->Slots[Index];
+  }
+
+  return Slot;
+}
+
+static void TH_ResizeMap (struct TH_Map *Map)
+{
+  struct TH_Slot *OldSlots    = Map->Slots;
+  size_t          OldCapacity = Map->Capacity;
+  size_t          Index;
+  struct TH_Slot *OldSlot;
+  struct TH_Slot *NewSlot;
+
+  Map->Capacity = (OldCapacity * 2);
+  Map->Slots    = PLAT_SafeAlloc0(Map->Capacity, sizeof(struct TH_Slot));
+
+  /* Keys are moved, not copied */
+  for (Index = 0; Index < OldCapacity; Index++)
+  {
+    OldSlot = &OldSlots[Index];
+    if (OldSlot->Key)
+    {
+      NewSlot  = TH_FindSlot(Map, OldSlot->Hash, OldSlot->Key, OldSlot->KeyLength);
+      *NewSlot = *OldSlot;
+    }
+  }
+
+  PLAT_Free(OldSlots);
+}
+
+/*============================================================================*/
+/* PUBLIC API                                                                 */
+/*============================================================================*/
+
+/* FNV-1a 64 bits */
+uint64_t TH_Hash (const void *Key, size_t KeyLength)
+{
+  const uint8_t *Bytes = Key;
+  uint64_t       Hash  = 14695981039346656037ULL;
+  size_t         Index;
+
+  for (Index = 0; Index < KeyLength; Index++)
+  {
+    Hash = (Hash ^ Bytes[Index]);
+    Hash = (Hash * 1099511628211ULL);
+  }
+
+  return Hash;
+}
+
+struct TH_Map *TH_CreateMap (size_t InitialCapacity)
+{
+  struct TH_Map *Map      = PLAT_SafeAlloc0(1, sizeof(struct TH_Map));
+  size_t         Capacity = TH_MINIMUM_CAPACITY;
+
+  while (Capacity < InitialCapacity)
+  {
+    Capacity = (Capacity * 2);
+  }
+
+  Map->Slots    = PLAT_SafeAlloc0(Capacity, sizeof(struct TH_Slot));
+  Map->Count    = 0;
+  Map->Capacity = Capacity;
+
+  return Map;
+}
+
+void TH_FreeMap (struct TH_Map *Map)
+{
+  size_t Index;
+
+  for (Index = 0; Index < Map->Capacity; Index++)
+  {
+    PLAT_Free(Map->Slots[Index].Key);
+  }
+
+  PLAT_Free(Map->Slots);
+  PLAT_Free(Map);
+}
+
+size_t TH_GetCount (struct TH_Map *Map)
+{
+  return Map->Count;
+}
+
+void *TH_GetObject (struct TH_Map *Map, const void *Key, size_t KeyLength)
+{
+  uint64_t        Hash = TH_Hash(Key, KeyLength);
+  struct TH_Slot *Slot = TH_FindSlot(Map, Hash, Key, KeyLength);
+
+  return Slot->Object; /* NULL for empty slot */
+}
+
+/* Return the previous object associated to Key, NULL if there was none */
+void *TH_SetObject (struct TH_Map *Map,
+                    const void    *Key,
+                    size_t         KeyLength,
+                    void          *Object)
+{
+  uint64_t        Hash = TH_Hash(Key, KeyLength);
+  struct TH_Slot *Slot;
+  void           *PreviousObject;
+
+  /* Keep the load factor under 3/4 */
+  if (((Map->Count + 1) * 4) > (Map->Capacity * 3))
+  {
+    TH_ResizeMap(Map);
+  }
+
+  Slot = TH_FindSlot(Map, Hash, Key, KeyLength);
+
+  if (Slot->Key)
+  {
+    PreviousObject = Slot->Object;
+  }
+  else
+  {
+    PreviousObject  = NULL;
+    Slot->Hash      = Hash;
+    Slot->Key       = PLAT_SafeAlloc0(1, KeyLength + 1);
+    Slot->KeyLength = KeyLength;
+    memcpy(Slot->Key, Key, KeyLength);
+    Map->Count++;
+  }
+
+  Slot->Object = Object;
+
+  return PreviousObject;
+}
+
+/* Return the removed object, NULL if Key was not found */
+void *TH_RemoveObject (struct TH_Map *Map, const void *Key, size_t KeyLength)
+{
+  uint64_t        Hash  = TH_Hash(Key, KeyLength);
+  struct TH_Slot *Slot  = TH_FindSlot(Map, Hash, Key, KeyLength);
+  size_t          Mask  = (Map->Capacity - 1);
+  void           *RemovedObject;
+  size_t          Index;
+  size_t          NextIndex;
+  size_t          HomeIndex;
+  struct TH_Slot *NextSlot;
+
+  if (Slot->Key)
+  {
+    RemovedObject = Slot->Object;
+    PLAT_Free(Slot->Key);
+    Map->Count--;
+
+    /* Backward shift: move back the following entries of the cluster which
+     * are not at their home slot */
+    Index     = (size_t)(Slot - Map->Slots);
+    NextIndex = ((Index + 1) & Mask);
+    NextSlot  = &Map->Slots[NextIndex];
+
+    while (NextSlot->Key)
+    {
+      HomeIndex = TH_GetSlotIndex(Map, NextSlot->Hash);
+
+      /* Distance from home is cyclic */
+      if (((NextIndex - HomeIndex) & Mask) >= ((NextIndex - Index) & Mask))
+      {
+        Map->Slots[Index] = *NextSlot;
+        Index             = NextIndex;
+      }
+
+      NextIndex = ((NextIndex + 1) & Mask);
+      NextSlot  = &Map->Slots[NextIndex];
+    }
+
+    memset(&Map->Slots[Index], 0, sizeof(struct TH_Slot));
+  }
+  else
+  {
+    RemovedObject = NULL;
+  }
+
+  return RemovedObject;
+}
+
+/* Iterate over the map, Cursor must be initialized to 0. The map must not be
+ * modified during the iteration. */
+bool TH_GetNext (struct TH_Map  *Map,
+                 size_t         *Cursor,
+                 const char    **Key,
+                 size_t         *KeyLength,
+                 void          **Object)
+{
+  size_t          Index = *Cursor;
+  bool            Found = false;
+  struct TH_Slot *Slot;
+
+  while (!Found && (Index < Map->Capacity))
+  {
+    Slot = &Map->Slots[Index++];
+
+    if (Slot->Key)
+    {
+      *Key       = Slot->Key;
+      *KeyLength = Slot->KeyLength;
+      *Object    = Slot->Object;
+      Found      = true;
+    }
+  }
+
+  *Cursor = Index;
+
+  return Found;
+}
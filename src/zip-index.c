@@ -0,0 +1,267 @@
+/*----------------------------------------------------------------------------*
+ * PROJECT  ComEXE                                                            *
+ * FILENAME zip-index.c                                                       *
+ * CONTENT  Read-only index of the ZIP archive embedded in the executable     *
+ *----------------------------------------------------------------------------*
+ * Copyright (c) 2020-2026 Pascal COMBIER                                     *
+ * This source code is licensed under the BSD 2-clause license found in the   *
+ * LICENSE file in the root directory of this source tree.                    *
+ *----------------------------------------------------------------------------*/
+
+/*============================================================================*/
+/* INFORMATION                                                                */
+/*============================================================================*/
+
+/* The central directory of the ZIP archive is parsed only once when the
+ * application is created. Each entry name is associated to its position in the
+ * central directory (unzGetOffset64), so that an entry can be located with
+ * unzSetOffset64 without walking the whole directory.
+ *
+ * The index is immutable once created, so lookups don't need any lock and can
+ * be done concurrently from any LUA_Instance. Only the extraction is
+ * serialized, because the unzFile handle is shared by all the instances.
+ */
+
+/*============================================================================*/
+/* MAKEHEADERS PUBLIC INTERFACE                                               */
+/*============================================================================*/
+
+#if MKH_INTERFACE
+
+/*---------*/
+/* HEADERS */
+/*---------*/
+
+#include <stddef.h>  /* size_t   */
+#include <stdint.h>  /* uint8_t  */
+#include <stdbool.h> /* bool     */
+
+/*-------*/
+/* TYPES */
+/*-------*/
+
+struct ZI_Index;
+
+#endif
+
+/*============================================================================*/
+/* IMPLEMENTATION HEADERS                                                     */
+/*============================================================================*/
+
+#include <uv.h>
+
+#include "unzip.h" /* minizip headers */
+
+#include "comexe.h"
+
+/*============================================================================*/
+/* TYPES                                                                      */
+/*============================================================================*/
+
+struct ZI_Entry
+{
+  ZPOS64_T DirectoryOffset;
+  uint64_t UncompressedSize;
+  uint64_t CompressedSize;
+  uint32_t Method;
+};
+
+struct ZI_Index
+{
+  unzFile          File;
+  uv_mutex_t       FileMutex;
+  struct TH_Map   *EntryMap;
+  struct ZI_Entry *Entries;
+  size_t           EntryCount;
+};
+
+/*============================================================================*/
+/* PRIVATE API                                                                */
+/*============================================================================*/
+
+static size_t ZI_GetDirectoryEntryCount (unzFile File)
+{
+  unz_global_info64 GlobalInfo;
+  size_t            EntryCount;
+
+  if (unzGetGlobalInfo64(File, &GlobalInfo) == UNZ_OK)
+  {
+    EntryCount = (size_t)GlobalInfo.number_entry;
+  }
+  else
+  {
+    EntryCount = 0;
+  }
+
+  return EntryCount;
+}
+
+/* The names longer than UNZ_MAXFILENAMEINZIP are not truncated: the buffer
+ * grows to the length given by the central directory */
+static void ZI_ParseDirectory (struct ZI_Index *Index)
+{
+  size_t           NameCapacity = 256; /* UNZ_MAXFILENAMEINZIP */
+  char            *EntryName    = PLAT_SafeAlloc0(NameCapacity, sizeof(char));
+  size_t           Capacity     = ZI_GetDirectoryEntryCount(Index->File);
+  unz_file_info64  FileInfo;
+  struct ZI_Entry *Entry;
+  size_t           NameLength;
+  int              Result;
+
+  Index->Entries    = PLAT_SafeAlloc0(Capacity + 1, sizeof(struct ZI_Entry));
+  Index->EntryMap   = TH_CreateMap(Capacity * 2);
+  Index->EntryCount = 0;
+
+  Result = unzGoToFirstFile(Index->File);
+
+  while ((Result == UNZ_OK) && (Index->EntryCount < Capacity))
+  {
+    /* Read the length of the name first */
+    Result = unzGetCurrentFileInfo64(Index->File, &FileInfo, NULL, 0, NULL, 0, NULL, 0);
+    if (Result == UNZ_OK)
+    {
+      NameLength = (size_t)FileInfo.size_filename;
+      if (NameLength >= NameCapacity)
+      {
+        NameCapacity = (NameLength + 1);
+        EntryName    = PLAT_SafeRealloc(EntryName, NameCapacity);
+      }
+      Result = unzGetCurrentFileInfo64(Index->File,
+                                       &FileInfo,
+                                       EntryName,
+                                       NameCapacity,
+                                       NULL,
+                                       0,
+                                       NULL,
+                                       0);
+    }
+
+    if (Result == UNZ_OK)
+    {
+      /* Keep the first entry in case of duplicates, like the linear scan */
+      if (TH_GetObject(Index->EntryMap, EntryName, NameLength) == NULL)
+      {
+        Entry                   = &Index->Entries[Index->EntryCount++];
+        Entry->DirectoryOffset  = unzGetOffset64(Index->File);
+        Entry->UncompressedSize = FileInfo.uncompressed_size;
+        Entry->CompressedSize   = FileInfo.compressed_size;
+        Entry->Method           = (uint32_t)FileInfo.compression_method;
+
+        TH_SetObject(Index->EntryMap, EntryName, NameLength, Entry);
+      }
+    }
+
+    Result = unzGoToNextFile(Index->File);
+  }
+
+  PLAT_Free(EntryName);
+}
+
+/*============================================================================*/
+/* PUBLIC API                                                                 */
+/*============================================================================*/
+
+/* Return NULL if the file is not a valid ZIP archive */
+struct ZI_Index *ZI_CreateIndex (const char *ZipFilename)
+{
+  unzFile          File = unzOpen64(ZipFilename);
+  struct ZI_Index *Index;
+
+  if (File)
+  {
+    Index       = PLAT_SafeAlloc0(1, sizeof(struct ZI_Index));
+    Index->File = File;
+    uv_mutex_init(&Index->FileMutex);
+    ZI_ParseDirectory(Index);
+  }
+  else
+  {
+    Index = NULL;
+  }
+
+  return Index;
+}
+
+void ZI_FreeIndex (struct ZI_Index *Index)
+{
+  if (Index)
+  {
+    unzClose(Index->File);
+    uv_mutex_destroy(&Index->FileMutex);
+    TH_FreeMap(Index->EntryMap);
+    PLAT_Free(Index->Entries);
+    PLAT_Free(Index);
+  }
+}
+
+size_t ZI_GetEntryCount (struct ZI_Index *Index)
+{
+  return Index->EntryCount;
+}
+
+bool ZI_GetEntryInfo (struct ZI_Index *Index,
+                      const char      *EntryName,
+                      size_t           EntryNameLength,
+                      uint64_t        *UncompressedSize,
+                      uint64_t        *CompressedSize,
+                      uint32_t        *Method)
+{
+  struct ZI_Entry *Entry = TH_GetObject(Index->EntryMap, EntryName, EntryNameLength);
+
+  if (Entry)
+  {
+    *UncompressedSize = Entry->UncompressedSize;
+    *CompressedSize   = Entry->CompressedSize;
+    *Method           = Entry->Method;
+  }
+
+  return (Entry != NULL);
+}
+
+/* Return a buffer allocated with PLAT_SafeAlloc0 or NULL if the entry is not
+ * found. The buffer is NUL-terminated for convenience, the terminator is not
+ * included in SizeInBytes. */
+uint8_t *ZI_ReadEntry (struct ZI_Index *Index,
+                       const char      *EntryName,
+                       size_t           EntryNameLength,
+                       size_t          *SizeInBytes)
+{
+  struct ZI_Entry *Entry = TH_GetObject(Index->EntryMap, EntryName, EntryNameLength);
+  uint8_t         *Buffer;
+  size_t           BufferSize;
+  int              BytesRead;
+
+  /* Initialize output */
+  Buffer = NULL;
+
+  if (Entry)
+  {
+    BufferSize = (size_t)Entry->UncompressedSize;
+
+    uv_mutex_lock(&Index->FileMutex);
+
+    if ((unzSetOffset64(Index->File, Entry->DirectoryOffset) == UNZ_OK)
+        && (unzOpenCurrentFile(Index->File) == UNZ_OK))
+    {
+      Buffer    = PLAT_SafeAlloc0(1, BufferSize + 1);
+      BytesRead = unzReadCurrentFile(Index->File, Buffer, (unsigned int)BufferSize);
+
+      /* unzCloseCurrentFile check the CRC when the whole entry is read */
+      if ((unzCloseCurrentFile(Index->File) == UNZ_OK)
+          && (BytesRead >= 0)
+          && ((size_t)BytesRead == BufferSize))
+      {
+        *SizeInBytes = BufferSize;
+      }
+      else
+      {
+        PLAT_Free(Buffer);
+        Buffer = NULL;
+      }
+    }
+
+    uv_mutex_unlock(&Index->FileMutex);
+  }
+
+  return Buffer;
+}
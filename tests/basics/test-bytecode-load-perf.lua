@@ -0,0 +1,129 @@
+--------------------------------------------------------------------------------
+-- TESTS BOILERPLATE FOR PACKAGE.PATH                                         --
+--------------------------------------------------------------------------------
+
+-- This kind of code should not appear in the real use of ComEXE
+--
+-- Initialize package.path to include ..\lib\xxx because test libraries are in
+-- this directory
+
+local function TEST_UpdatePackagePath (RelativeDirectory)
+  -- Retrieve package confiuration (file loadlib.c, function luaopen_package)
+  local Configuration = package.config
+  local LUA_DIRSEP    = Configuration:sub(1, 1)
+  local LUA_PATH_SEP  = Configuration:sub(3, 3)
+  local LUA_PATH_MARK = Configuration:sub(5, 5)
+  -- Load required modules
+  local Runtime   = require("com.runtime")
+  local Directory = Runtime.getrelativepath(RelativeDirectory) -- relative to arg[0] directory
+  -- Prepend path in a Linux/Windows compatible way
+  package.path = string.format("%s%s%s.lua%s%s", Directory, LUA_DIRSEP, LUA_PATH_MARK, LUA_PATH_SEP, package.path)
+end
+
+TEST_UpdatePackagePath("../lib")
+
+--------------------------------------------------------------------------------
+-- IMPORTS                                                                    --
+--------------------------------------------------------------------------------
+
+local Runtime  = require("com.runtime")
+local reporter = require("mini-reporter")
+
+local format       = string.format
+local readzipentry = Runtime.readzipentry
+
+--------------------------------------------------------------------------------
+-- BENCHMARK                                                                  --
+--------------------------------------------------------------------------------
+
+-- Compare the cost of loading the bundled runtime from the sources (what the
+-- searchers did before "make" embedded the bytecode) and from the precompiled
+-- bytecode with the debug information (what "make" embeds now).
+
+local RUNTIME_MODULES = {
+  "fennel",
+  "copas",
+  "socket",
+  "ssl",
+  "com.runtime",
+  "com.minizip",
+  "com.mini-httpd",
+  "com.mini-httpd-lib",
+  "com.websocket",
+}
+
+local Iterations = 20
+
+-- Bytecode loads about 6x faster than the sources, the check only catches a
+-- bytecode path which would not be faster at all. The best of a few runs is
+-- kept, os.clock measures the CPU time: a loaded machine must not fail the
+-- test.
+local RUN_COUNT   = 3
+local MIN_SPEEDUP = 1.5
+
+local function LoadAll (Contents, Mode)
+  local StartTime = os.clock()
+  for Iteration = 1, Iterations do
+    for Index, Entry in ipairs(Contents) do
+      local Chunk = load(Entry.content, Entry.chunkname, Mode)
+      assert(Chunk, Entry.chunkname)
+    end
+  end
+  local ElapsedSeconds = (os.clock() - StartTime)
+  -- Return value
+  return ElapsedSeconds
+end
+
+local function LoadAllBest (Contents, Mode)
+  local BestSeconds = math.huge
+  for Run = 1, RUN_COUNT do
+    BestSeconds = math.min(BestSeconds, LoadAll(Contents, Mode))
+  end
+  -- Return value
+  return BestSeconds
+end
+
+local Reporter = reporter.new()
+
+Reporter:block("BYTECODE LOAD")
+
+local Sources   = {}
+local Binaries  = {}
+local TotalSize = 0
+
+for Index, ModuleName in ipairs(RUNTIME_MODULES) do
+  local Path     = ModuleName:gsub("%.", "/")
+  local ZipEntry = format("comexe/usr/share/lua/5.5/%s.lua", Path)
+  local Content  = readzipentry(ZipEntry)
+  if Content then
+    local ChunkName = format("@%s", ModuleName)
+    local Chunk     = load(Content, ChunkName, "t")
+    Sources[#Sources + 1]   = { chunkname = ChunkName, content = Content }
+    Binaries[#Binaries + 1] = { chunkname = ChunkName, content = string.dump(Chunk, false) }
+    TotalSize = (TotalSize + #Content)
+  end
+end
+
+Reporter:expect("BYTECODE-001-runtime-modules", (#Sources > 0))
+
+local SourceSeconds = LoadAllBest(Sources, "t")
+local BinarySeconds = LoadAllBest(Binaries, "b")
+
+Reporter:printf("%d modules, %.2f KiB of sources, %d iterations", #Sources, (TotalSize / 1024), Iterations)
+Reporter:printf("LOAD SOURCE:   %6.3f sec", SourceSeconds)
+Reporter:printf("LOAD BYTECODE: %6.3f sec (%.1fx faster)", BinarySeconds, (SourceSeconds / BinarySeconds))
+
+-- The searchers are checked by test-bytecode-searcher.lua
+Reporter:expect("BYTECODE-002-faster-than-source", ((BinarySeconds * MIN_SPEEDUP) < SourceSeconds))
+
+-- Bytecode with a wrong header must be rejected, the searchers then fallback
+-- to the source entry
+local Broken = format("%s%s", "\27Lux", Binaries[1].content:sub(5))
+Reporter:expect("BYTECODE-003-bad-header", (load(Broken, "@broken", "b") == nil))
+
+--------------------------------------------------------------------------------
+-- SUMMARY
+--------------------------------------------------------------------------------
+
+Reporter:printf("== SUMMARY ==")
+Reporter:summary("os.exit")
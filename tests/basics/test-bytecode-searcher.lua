@@ -0,0 +1,146 @@
+--------------------------------------------------------------------------------
+-- TESTS BOILERPLATE FOR PACKAGE.PATH                                         --
+--------------------------------------------------------------------------------
+
+-- This kind of code should not appear in the real use of ComEXE
+--
+-- Initialize package.path to include ..\lib\xxx because test libraries are in
+-- this directory
+
+local function TEST_UpdatePackagePath (RelativeDirectory)
+  -- Retrieve package confiuration (file loadlib.c, function luaopen_package)
+  local Configuration = package.config
+  local LUA_DIRSEP    = Configuration:sub(1, 1)
+  local LUA_PATH_SEP  = Configuration:sub(3, 3)
+  local LUA_PATH_MARK = Configuration:sub(5, 5)
+  -- Load required modules
+  local Runtime   = require("com.runtime")
+  local Directory = Runtime.getrelativepath(RelativeDirectory) -- relative to arg[0] directory
+  -- Prepend path in a Linux/Windows compatible way
+  package.path = string.format("%s%s%s.lua%s%s", Directory, LUA_DIRSEP, LUA_PATH_MARK, LUA_PATH_SEP, package.path)
+end
+
+TEST_UpdatePackagePath("../lib")
+
+--------------------------------------------------------------------------------
+-- IMPORTS                                                                    --
+--------------------------------------------------------------------------------
+
+local Runtime  = require("com.runtime")
+local Minizip  = require("com.minizip")
+local reporter = require("mini-reporter")
+
+local format          = string.format
+local getparam        = Runtime.getparam
+local getrelativepath = Runtime.getrelativepath
+local makedirectory   = Runtime.makedirectory
+local writefile       = Runtime.writefile
+local deletefile      = Runtime.deletefile
+local deletedirectory = Runtime.deletedirectory
+local newreader       = Minizip.newreader
+
+--------------------------------------------------------------------------------
+-- END-TO-END SEARCHERS                                                       --
+--------------------------------------------------------------------------------
+
+-- Build small executables with "make" and run them: the ZIP searchers load
+-- "module-ARCH-OS.bin" before "module.lua", and fallback to the source when
+-- the bytecode is rejected or missing.
+
+local LuaExe       = getparam("LUA-EXE")
+local OS           = getparam("OS")
+local BinarySuffix = format("-%s-%s.bin", getparam("ARCH"), OS)
+local ExeSuffix    = ((OS == "windows") and ".exe" or "")
+
+local MAIN_SEARCHERS = [[
+local Probe   = require("bytecode-probe")
+local Broken  = require("bytecode-broken")
+local Missing = require("bytecode-missing")
+print(Probe, Broken, Missing)
+os.exit((Probe == "bytecode") and (Broken == "source") and (Missing == "source"))
+]]
+
+local MAIN_DEFAULT = [[
+local Missing = require("bytecode-missing")
+os.exit(Missing == "source")
+]]
+
+local CreatedFiles       = {}
+local CreatedDirectories = {}
+
+local function WriteTestFile (Directory, Filename, Content)
+  local Pathname = format("%s/%s", Directory, Filename)
+  assert(writefile(Pathname, Content))
+  CreatedFiles[#CreatedFiles + 1] = Pathname
+end
+
+local function NewAppDirectory (Name)
+  local Directory = getrelativepath(format(".comexe/cache/%s", Name))
+  assert(makedirectory(Directory))
+  CreatedDirectories[#CreatedDirectories + 1] = Directory
+  return Directory
+end
+
+-- Return true when the executable exits with 0
+local function MakeAndRun (Directory, Options)
+  local ExeFilename = format("%s/app%s", Directory, ExeSuffix)
+  local MakeCommand = format([[%s -x --make "%s" --nostdlib %s -o "%s"]], LuaExe, Directory, Options, ExeFilename)
+  local MakeSuccess, MakeReason, MakeCode = os.execute(MakeCommand)
+  local Success = false
+  if (MakeCode == 0) then
+    CreatedFiles[#CreatedFiles + 1] = ExeFilename
+    local RunSuccess, RunReason, RunCode = os.execute(format([["%s"]], ExeFilename))
+    Success = (RunCode == 0)
+  end
+  return Success, ExeFilename
+end
+
+local Reporter = reporter.new()
+
+Reporter:block("BYTECODE SEARCHERS")
+
+-- Hand-made bytecode entries, one valid and one with a wrong header: make must
+-- not generate the bytecode
+local SearcherDirectory = NewAppDirectory("bytecode-searcher")
+local BytecodeProbe     = string.dump(load([[return "bytecode"]], "@bytecode-probe"), false)
+local BrokenProbe       = format("%s%s", "\27Lux", BytecodeProbe:sub(5))
+
+WriteTestFile(SearcherDirectory, "main.lua", MAIN_SEARCHERS)
+WriteTestFile(SearcherDirectory, "bytecode-probe.lua", [[return "source"]])
+WriteTestFile(SearcherDirectory, format("bytecode-probe%s", BinarySuffix), BytecodeProbe)
+WriteTestFile(SearcherDirectory, "bytecode-broken.lua", [[return "source"]])
+WriteTestFile(SearcherDirectory, format("bytecode-broken%s", BinarySuffix), BrokenProbe)
+WriteTestFile(SearcherDirectory, "bytecode-missing.lua", [[return "source"]])
+
+Reporter:expect("SEARCHER-001-bin-first-bad-header-and-missing-fallback", MakeAndRun(SearcherDirectory, "--nobytecode"))
+
+-- Bytecode generated by make for the running platform
+local DefaultDirectory = NewAppDirectory("bytecode-default")
+
+WriteTestFile(DefaultDirectory, "main.lua", MAIN_DEFAULT)
+WriteTestFile(DefaultDirectory, "bytecode-missing.lua", [[return "source"]])
+
+local DefaultSuccess, DefaultExe = MakeAndRun(DefaultDirectory, "")
+Reporter:expect("SEARCHER-002-make-bytecode-runs", DefaultSuccess)
+
+local Reader = newreader(DefaultExe)
+local Entry  = (Reader and Reader:Read(format("bytecode-missing%s", BinarySuffix)))
+if Reader then
+  Reader:Close()
+end
+Reporter:expect("SEARCHER-003-make-bytecode-entry", (Entry ~= nil))
+
+-- Clean up
+for Index = #CreatedFiles, 1, -1 do
+  deletefile(CreatedFiles[Index])
+end
+for Index = #CreatedDirectories, 1, -1 do
+  deletedirectory(CreatedDirectories[Index])
+end
+
+--------------------------------------------------------------------------------
+-- SUMMARY
+--------------------------------------------------------------------------------
+
+Reporter:printf("== SUMMARY ==")
+Reporter:summary("os.exit")
@@ -0,0 +1,64 @@
+--------------------------------------------------------------------------------
+-- TESTS BOILERPLATE FOR PACKAGE.PATH                                         --
+--------------------------------------------------------------------------------
+
+-- This kind of code should not appear in the real use of ComEXE
+--
+-- Initialize package.path to include ..\lib\xxx because test libraries are in
+-- this directory
+
+local function TEST_UpdatePackagePath (RelativeDirectory)
+  -- Retrieve package confiuration (file loadlib.c, function luaopen_package)
+  local Configuration = package.config
+  local LUA_DIRSEP    = Configuration:sub(1, 1)
+  local LUA_PATH_SEP  = Configuration:sub(3, 3)
+  local LUA_PATH_MARK = Configuration:sub(5, 5)
+  -- Load required modules
+  local Runtime   = require("com.runtime")
+  local Directory = Runtime.getrelativepath(RelativeDirectory) -- relative to arg[0] directory
+  -- Prepend path in a Linux/Windows compatible way
+  package.path = string.format("%s%s%s.lua%s%s", Directory, LUA_DIRSEP, LUA_PATH_MARK, LUA_PATH_SEP, package.path)
+end
+
+TEST_UpdatePackagePath("../lib")
+
+--------------------------------------------------------------------------------
+-- IMPORTS                                                                    --
+--------------------------------------------------------------------------------
+
+local Runtime  = require("com.runtime")
+local reporter = require("mini-reporter")
+
+local readzipentry    = Runtime.readzipentry
+local getzipentryinfo = Runtime.getzipentryinfo
+
+--------------------------------------------------------------------------------
+-- TESTS                                                                      --
+--------------------------------------------------------------------------------
+
+local Reporter = reporter.new()
+
+Reporter:block("ZIP INDEX")
+
+local INIT_ENTRY = "comexe/init.lua"
+
+local Size, CompressedSize, Method = getzipentryinfo(INIT_ENTRY)
+Reporter:expect("INFO-001-existing-entry", (Size ~= nil) and (Size > 0))
+Reporter:expect("INFO-002-compressed-size", (CompressedSize ~= nil) and (CompressedSize > 0))
+Reporter:expect("INFO-003-method", (Method == 0) or (Method == 8))
+Reporter:expect("INFO-004-missing-entry", getzipentryinfo("comexe/does-not-exist.lua") == nil)
+
+local Content = readzipentry(INIT_ENTRY)
+Reporter:expect("READ-001-existing-entry", (type(Content) == "string") and (#Content == Size))
+Reporter:expect("READ-002-missing-entry", readzipentry("comexe/does-not-exist.lua") == nil)
+Reporter:expect("READ-003-same-content", readzipentry(INIT_ENTRY) == Content)
+
+-- Runtime modules are resolved by the ZIP searchers through the same index
+Reporter:expect("REQUIRE-001-runtime-module", (type(require("com.chunk-buffer")) == "table"))
+
+--------------------------------------------------------------------------------
+-- SUMMARY
+--------------------------------------------------------------------------------
+
+Reporter:printf("== SUMMARY ==")
+Reporter:summary("os.exit")
@@ -0,0 +1,235 @@
+--------------------------------------------------------------------------------
+-- TESTS BOILERPLATE FOR PACKAGE.PATH                                         --
+--------------------------------------------------------------------------------
+
+-- This kind of code should not appear in the real use of ComEXE
+--
+-- Initialize package.path to include ..\lib\xxx because test libraries are in
+-- this directory
+
+local function TEST_UpdatePackagePath (RelativeDirectory)
+  -- Retrieve package confiuration (file loadlib.c, function luaopen_package)
+  local Configuration = package.config
+  local LUA_DIRSEP    = Configuration:sub(1, 1)
+  local LUA_PATH_SEP  = Configuration:sub(3, 3)
+  local LUA_PATH_MARK = Configuration:sub(5, 5)
+  -- Load required modules
+  local Runtime   = require("com.runtime")
+  local Directory = Runtime.getrelativepath(RelativeDirectory) -- relative to arg[0] directory
+  -- Prepend path in a Linux/Windows compatible way
+  package.path = string.format("%s%s%s.lua%s%s", Directory, LUA_DIRSEP, LUA_PATH_MARK, LUA_PATH_SEP, package.path)
+end
+
+TEST_UpdatePackagePath("../lib")
+
+--------------------------------------------------------------------------------
+-- IMPORTS                                                                    --
+--------------------------------------------------------------------------------
+
+-- Copas with the luv poller: up to 10000 idle connections stay open while an
+-- active client measures the round-trip latency. socket.select would fail
+-- beyond FD_SETSIZE sockets and would scan all of them at each step. The
+-- average latency is below 0.1 ms on a desktop machine, MAX_AVERAGE_LATENCY
+-- leaves room for slow CI machines and only catches a poller which scans the
+-- idle connections or waits for a timeout.
+--
+-- The process needs about 2 descriptors per connection. On Linux, the test
+-- raises its soft descriptor limit up to the hard limit and opens as many
+-- connections as the limit allows. It is skipped, before opening any socket,
+-- when the limit doesn't allow more than FD_SETSIZE connections
+-- (ulimit -Hn).
+
+local Copas    = require("copas")
+local CopasUv  = require("com.copas-uv")
+local Runtime  = require("com.runtime")
+local socket   = require("socket")
+local reporter = require("mini-reporter")
+
+local format   = string.format
+local ult      = math.ult
+local gettime  = socket.gettime
+local getparam = Runtime.getparam
+
+local HOST                  = "127.0.0.1"
+local PORT                  = 8805
+local IDLE_CONNECTION_COUNT = 10000
+local FD_SETSIZE            = 1024
+local PING_COUNT            = 1000
+local RESERVED_DESCRIPTORS  = 100
+local ACCEPT_TIMEOUT        = 5 -- Seconds
+local MAX_AVERAGE_LATENCY   = 0.02 -- Seconds
+local RLIMIT_NOFILE         = 7
+
+local Reporter = reporter.new()
+
+--------------------------------------------------------------------------------
+-- DESCRIPTOR LIMIT                                                           --
+--------------------------------------------------------------------------------
+
+-- Raise the soft limit of descriptors to Count, or to the hard limit, and
+-- return the new limit. The limits are unsigned, RLIM_INFINITY is -1.
+local function RaiseDescriptorLimit (Count)
+  local ffi       = require("com.ffi")
+  local libc      = assert(ffi.loadlib("linux", "libc.so.6", "linux", "libc.so"))
+  local getrlimit = libc:bind(ffi.sint32, "getrlimit", ffi.sint32, ffi.pointer)
+  local setrlimit = libc:bind(ffi.sint32, "setrlimit", ffi.sint32, ffi.pointer)
+  local Limits    = ffi.newarray(ffi.uint64, 2) -- struct rlimit: soft, hard
+  assert(getrlimit(RLIMIT_NOFILE, Limits:getpointer()) == 0)
+  local SoftLimit = Limits:get(1)
+  local HardLimit = Limits:get(2)
+  if ult(SoftLimit, Count) then
+    local NewLimit = (ult(HardLimit, Count) and HardLimit or Count)
+    Limits:set(1, NewLimit)
+    if (setrlimit(RLIMIT_NOFILE, Limits:getpointer()) == 0) then
+      SoftLimit = NewLimit
+    end
+  end
+  return SoftLimit
+end
+
+-- Windows has no descriptor limit for the sockets
+local IdleTarget = IDLE_CONNECTION_COUNT
+
+if (getparam("OS") == "linux") then
+  local DescriptorCount = ((2 * IDLE_CONNECTION_COUNT) + RESERVED_DESCRIPTORS)
+  local DescriptorLimit = RaiseDescriptorLimit(DescriptorCount)
+  if ult(DescriptorLimit, DescriptorCount) then
+    IdleTarget = ((DescriptorLimit - RESERVED_DESCRIPTORS) // 2)
+  end
+  Reporter:printf("Descriptor limit: %d, %d idle connections", DescriptorLimit, IdleTarget)
+end
+
+if (IdleTarget <= FD_SETSIZE) then
+  Reporter:printf("SKIPPED: descriptor limit too low, raise ulimit -Hn")
+  os.exit(0)
+end
+
+--------------------------------------------------------------------------------
+-- IDLE CONNECTIONS                                                           --
+--------------------------------------------------------------------------------
+
+Reporter:block("IDLE CONNECTIONS")
+
+CopasUv.install()
+Reporter:expect("IDLE-001-isinstalled", CopasUv.isinstalled())
+
+-- Echo server, one line per request
+local ServerSocket  = assert(socket.bind(HOST, PORT, 1024))
+local AcceptedCount = 0
+
+Copas.addserver(ServerSocket, function (RawClient)
+  local Client = Copas.wrap(RawClient)
+  AcceptedCount = (AcceptedCount + 1)
+  local Line = Client:receive("*l")
+  while Line do
+    Client:send(Line .. "\n")
+    Line = Client:receive("*l")
+  end
+  Client:close()
+end)
+
+-- Let the server accept the pending connections, false on timeout
+local function WaitAccepted (Count)
+  local Deadline = (gettime() + ACCEPT_TIMEOUT)
+  while (AcceptedCount < Count) and (gettime() < Deadline) do
+    Copas.step(0.01)
+  end
+  return (AcceptedCount >= Count)
+end
+
+-- Idle connections: connected and accepted, never used
+local IdleSockets = {}
+local Opened      = true
+
+while Opened and (#IdleSockets < IdleTarget) do
+  local Socket = socket.tcp()
+  Opened = (Socket ~= nil)
+  if Opened then
+    Socket:settimeout(0)
+    local Result, ErrorMessage = Socket:connect(HOST, PORT)
+    Opened = (Result ~= nil) or (ErrorMessage == "timeout")
+    if Opened then
+      IdleSockets[#IdleSockets + 1] = Socket
+    else
+      Socket:close()
+    end
+  end
+  -- Let the server accept before the backlog is full
+  if Opened and ((#IdleSockets % 100) == 0) then
+    Opened = WaitAccepted(#IdleSockets)
+  end
+end
+
+local IdleCount = #IdleSockets
+Reporter:printf("Idle connections: %d", IdleCount)
+Reporter:expect("IDLE-002-all-opened", (IdleCount == IdleTarget))
+
+-- The loop finishes once the server and the connections are closed
+local function CloseAll ()
+  for Index = 1, IdleCount do
+    IdleSockets[Index]:close()
+  end
+  Copas.removeserver(ServerSocket)
+end
+
+--------------------------------------------------------------------------------
+-- ACTIVE CLIENT                                                              --
+--------------------------------------------------------------------------------
+
+Reporter:block("ACTIVE CLIENT")
+
+-- The latency of each round-trip
+local TotalLatency = 0
+local MaxLatency   = 0
+local Received     = 0
+
+local function PingServer ()
+  local Client = Copas.wrap(socket.tcp())
+  assert(Client:connect(HOST, PORT))
+  for Index = 1, PING_COUNT do
+    local StartTime = gettime()
+    Client:send(format("ping %d\n", Index))
+    local Line = Client:receive("*l")
+    local Latency = (gettime() - StartTime)
+    if (Line == format("ping %d", Index)) then
+      Received = (Received + 1)
+    end
+    TotalLatency = (TotalLatency + Latency)
+    if (Latency > MaxLatency) then
+      MaxLatency = Latency
+    end
+  end
+  Client:close()
+end
+
+-- Don't measure with the connections missing, but always close them
+if (IdleCount == IdleTarget) then
+  Copas.addthread(function ()
+    local Ok, ErrorMessage = pcall(PingServer)
+    if (not Ok) then
+      Reporter:printf("Active client failed: %s", ErrorMessage)
+    end
+    CloseAll()
+  end)
+else
+  CloseAll()
+end
+
+Copas.loop()
+
+local AverageLatency = (TotalLatency / PING_COUNT)
+Reporter:printf("Latency: average %.3f ms, max %.3f ms", (AverageLatency * 1000), (MaxLatency * 1000))
+
+Reporter:expect("ACTIVE-001-replies-received", (Received == PING_COUNT))
+Reporter:expect("ACTIVE-002-all-accepted",     (AcceptedCount == (IdleCount + 1)))
+Reporter:expect("ACTIVE-003-average-latency",  (AverageLatency < MAX_AVERAGE_LATENCY))
+
+CopasUv.uninstall()
+Reporter:expect("ACTIVE-004-uninstall", (not CopasUv.isinstalled()))
+
+--------------------------------------------------------------------------------
+-- SUMMARY
+--------------------------------------------------------------------------------
+
+Reporter:printf("== SUMMARY ==")
+Reporter:summary("os.exit")
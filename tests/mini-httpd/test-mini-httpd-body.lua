@@ -0,0 +1,147 @@
+--------------------------------------------------------------------------------
+-- TESTS BOILERPLATE FOR PACKAGE.PATH                                         --
+--------------------------------------------------------------------------------
+
+-- This kind of code should not appear in the real use of ComEXE
+--
+-- Initialize package.path to include ..\lib\xxx because test libraries are in
+-- this directory
+
+local function TEST_UpdatePackagePath (RelativeDirectory)
+  -- Retrieve package confiuration (file loadlib.c, function luaopen_package)
+  local Configuration = package.config
+  local LUA_DIRSEP    = Configuration:sub(1, 1)
+  local LUA_PATH_SEP  = Configuration:sub(3, 3)
+  local LUA_PATH_MARK = Configuration:sub(5, 5)
+  -- Load required modules
+  local Runtime   = require("com.runtime")
+  local Directory = Runtime.getrelativepath(RelativeDirectory) -- relative to arg[0] directory
+  -- Prepend path in a Linux/Windows compatible way
+  package.path = string.format("%s%s%s.lua%s%s", Directory, LUA_DIRSEP, LUA_PATH_MARK, LUA_PATH_SEP, package.path)
+end
+
+TEST_UpdatePackagePath("../lib")
+
+--------------------------------------------------------------------------------
+-- IMPORTS                                                                    --
+--------------------------------------------------------------------------------
+
+-- Request bodies received with the head: the head is read in chunks, so the
+-- start of the body can arrive in the same read. The body must be complete,
+-- and the next request on the connection must start after it.
+
+local MiniHttpd = require("com.mini-httpd")
+local Copas     = require("copas")
+local socket    = require("socket")
+local reporter  = require("mini-reporter")
+
+local format = string.format
+local sub    = string.sub
+local rep    = string.rep
+local lower  = string.lower
+local match  = string.match
+
+local HOST = "127.0.0.1"
+
+local Reporter = reporter.new()
+
+--------------------------------------------------------------------------------
+-- SERVER APP                                                                 --
+--------------------------------------------------------------------------------
+
+-- Echo the body of the POST requests, the path of the others
+local EchoApp = {}
+
+function EchoApp:request (Request)
+  local Body
+  if (Request.method == "POST") then
+    Body = (Request.data or "")
+  else
+    Body = Request.path
+  end
+  Request:send(Request:formatresponse(200, Body, nil, "text/plain"))
+end
+
+function EchoApp:event (EventType, Value)
+end
+
+--------------------------------------------------------------------------------
+-- CLIENT                                                                     --
+--------------------------------------------------------------------------------
+
+-- Return the status code and the body of a response
+local function ReadResponse (Client)
+  local StatusLine = Client:receive("*l")
+  local Code       = (StatusLine and tonumber(match(StatusLine, "^HTTP/1%.%d (%d+)")))
+  local Length     = 0
+  local Line       = Client:receive("*l")
+  while Line and (Line ~= "") do
+    local Name, Value = match(Line, "^([^:]+):%s*(.*)$")
+    if Name and (lower(Name) == "content-length") then
+      Length = tonumber(Value)
+    end
+    Line = Client:receive("*l")
+  end
+  local Body = ((Length > 0) and Client:receive(Length) or "")
+  return Code, Body
+end
+
+local function FormatPost (Body)
+  return format("POST /echo HTTP/1.1\r\nHost: %s\r\nContent-Length: %d\r\n\r\n%s", HOST, #Body, Body)
+end
+
+--------------------------------------------------------------------------------
+-- TESTS                                                                      --
+--------------------------------------------------------------------------------
+
+Reporter:block("BODY WITH HEAD")
+
+local Server = MiniHttpd.newserver()
+Server:bind({ host = HOST, port = 0 }, EchoApp)
+local Success, ErrorString = Server:listen(EchoApp)
+Reporter:expect("BODY-001-listen", Success)
+
+local Port = tonumber(match((Server:geturi(EchoApp) or ""), ":(%d+)$"))
+
+-- Bodies larger than the pending bytes, and received at once with the head
+local LargeBody = rep("0123456789", 1000)
+local SmallBody = "small body"
+local Results   = {}
+
+local function ClientThread ()
+  local Client = Copas.wrap(socket.tcp())
+  assert(Client:connect(HOST, Port))
+  -- The head and the first 100 bytes of the body in the same read
+  local Request = FormatPost(LargeBody)
+  local Split   = (#Request - #LargeBody + 100)
+  Client:send(sub(Request, 1, Split))
+  Copas.pause(0.1)
+  Client:send(sub(Request, (Split + 1)))
+  Results.LargeCode, Results.LargeBody = ReadResponse(Client)
+  -- The whole body with the head, followed by the next request
+  Client:send(format("%sGET /next HTTP/1.1\r\nHost: %s\r\n\r\n", FormatPost(SmallBody), HOST))
+  Results.SmallCode, Results.SmallBody = ReadResponse(Client)
+  Results.NextCode, Results.NextBody   = ReadResponse(Client)
+  Client:close()
+  Server:stop(EchoApp)
+end
+
+if Success then
+  Server:newthread(ClientThread)
+  Server:runloop()
+else
+  Reporter:printf("listen failed: %s", ErrorString)
+end
+
+Reporter:expect("BODY-002-partial-body-code", (Results.LargeCode == 200))
+Reporter:expect("BODY-003-partial-body",      (Results.LargeBody == LargeBody))
+Reporter:expect("BODY-004-whole-body-code",   (Results.SmallCode == 200))
+Reporter:expect("BODY-005-whole-body",        (Results.SmallBody == SmallBody))
+Reporter:expect("BODY-006-next-request",      ((Results.NextCode == 200) and (Results.NextBody == "/next")))
+
+--------------------------------------------------------------------------------
+-- SUMMARY
+--------------------------------------------------------------------------------
+
+Reporter:printf("== SUMMARY ==")
+Reporter:summary("os.exit")
@@ -30,8 +30,13 @@ local MiniReporter = require("mini-reporter")
 local MiniHttpLib  = require("com.mini-httpd-lib")
 
 local format = string.format
+local gmatch = string.gmatch
+local gsub   = string.gsub
+local concat = table.concat
+local clock  = os.clock
 
 local parserequestline   = MiniHttpLib.parserequestline
+local parserequesthead   = MiniHttpLib.parserequesthead
 local parserequesttarget = MiniHttpLib.parserequesttarget
 local parseheaderline    = MiniHttpLib.parseheaderline
 local parseheadervalue   = MiniHttpLib.parseheadervalue
@@ -39,6 +44,7 @@ local parseformdata      = MiniHttpLib.parseformdata
 local parsechunkeddata   = MiniHttpLib.parsechunkeddata
 
 assert(parserequestline,   "Missing API")
+assert(parserequesthead,   "Missing API")
 assert(parserequesttarget, "Missing API")
 assert(parseheaderline,    "Missing API")
 assert(parseheadervalue,   "Missing API")
@@ -225,6 +231,106 @@ for Index = 1, #ParseHeaderLineCases do
   end
 end
 
+--------------------------------------------------------------------------------
+-- TESTS parserequesthead                                                     --
+--------------------------------------------------------------------------------
+
+Reporter:block("parserequesthead")
+
+local ParseRequestHeadCases = {
+  {
+    Input           = "GET /a?b=1 HTTP/1.1\r\nHost: x\r\nCONTENT-LENGTH:  4 \r\n\r\nBODY",
+    ExpectedMethod  = "GET",
+    ExpectedTarget  = "/a?b=1",
+    ExpectedVersion = "HTTP/1.1",
+    ExpectedHeaders = { ["host"] = "x", ["content-length"] = "4" },
+    ExpectedSize    = 53,
+  },
+  {
+    Input           = "\r\nPOST / HTTP/1.0\nX-Empty:\n\n",
+    ExpectedMethod  = "POST",
+    ExpectedTarget  = "/",
+    ExpectedVersion = "HTTP/1.0",
+    ExpectedHeaders = { ["x-empty"] = "" },
+    ExpectedSize    = 28,
+  },
+  { Input = "GET / HTTP/1.1\r\nHost: x\r\n",         ExpectedError = "incomplete"           },
+  { Input = "GET /HTTP/1.1\r\n\r\n",                 ExpectedError = "invalid request line" },
+  { Input = "GET / HTTP/1.1\r\nBad Name: x\r\n\r\n", ExpectedError = "invalid header"       },
+  { Input = "GET / HTTP/1.1\r\n folded\r\n\r\n",     ExpectedError = "invalid header"       },
+  { Input = "GET / HTTP/1.1\r\nNoColon\r\n\r\n",     ExpectedError = "invalid header"       },
+  { Input = "GET / HTTP/1.1\r\nA: 1\r\nB: 2\r\n\r\n", ExpectedError = "too many headers", MaxHeaders = 1 },
+  { Input = string.rep("a", 100),                     ExpectedError = "head too large", MaxSize = 50 },
+}
+
+for Index = 1, #ParseRequestHeadCases do
+  local TestName = format("parserequesthead-%2.2d", Index)
+  local TestCase = ParseRequestHeadCases[Index]
+  -- Call the API
+  local Method, Target, Version, Headers, HeadSize = parserequesthead(TestCase.Input, TestCase.MaxHeaders, TestCase.MaxSize)
+  -- Log for easy review
+  Reporter:printf("LOG Test %s", TestName)
+  Reporter:printf("LOG INPUT %q", TestCase.Input)
+  if TestCase.ExpectedError then
+    Reporter:printf("LOG ERROR %q", Target)
+    Reporter:printf("LOG   EXP %q", TestCase.ExpectedError)
+    Reporter:expect(format("%s-01", TestName), (Method == false))
+    Reporter:expect(format("%s-02", TestName), (Target == TestCase.ExpectedError))
+  else
+    Reporter:printf("LOG GOT %q %q %q %q", Method, Target, Version, HeadSize)
+    Reporter:expect(format("%s-01", TestName), (Method   == TestCase.ExpectedMethod))
+    Reporter:expect(format("%s-02", TestName), (Target   == TestCase.ExpectedTarget))
+    Reporter:expect(format("%s-03", TestName), (Version  == TestCase.ExpectedVersion))
+    Reporter:expect(format("%s-04", TestName), (HeadSize == TestCase.ExpectedSize))
+    Reporter:expect(format("%s-05", TestName), (TableCount(Headers) == TableCount(TestCase.ExpectedHeaders)))
+    for Key, Value in pairs(TestCase.ExpectedHeaders) do
+      Reporter:expect(format("%s-%s", TestName, Key), (Headers[Key] == Value))
+    end
+  end
+end
+
+-- Benchmark: the native parser against the former line by line parsing
+local BENCH_ITERATIONS = 100000
+local BenchHead = concat({
+  "GET /test-get-variables?var1=123&var2=hello&var3=world HTTP/1.1",
+  "Host: 127.0.0.1:8801",
+  "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 Firefox/128.0",
+  "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8",
+  "Accept-Language: en-US,en;q=0.5",
+  "Accept-Encoding: gzip, deflate",
+  "Connection: keep-alive",
+  "Upgrade-Insecure-Requests: 1",
+  "",
+  "",
+}, "\r\n")
+
+local function BenchLineByLine (Head)
+  local Lines   = gmatch(Head, "([^\n]*)\n")
+  local Method, Target, Version = parserequestline((gsub(Lines(), "\r$", "")))
+  local Headers = {}
+  local Line    = (gsub(Lines(), "\r$", ""))
+  while (Line ~= "") do
+    local Key, Value = parseheaderline(Line)
+    Headers[Key] = Value
+    Line = (gsub(Lines(), "\r$", ""))
+  end
+  return Method, Target, Version, Headers
+end
+
+local StartTime = clock()
+for Iteration = 1, BENCH_ITERATIONS do
+  BenchLineByLine(BenchHead)
+end
+local LineByLineDuration = (clock() - StartTime)
+
+StartTime = clock()
+for Iteration = 1, BENCH_ITERATIONS do
+  parserequesthead(BenchHead)
+end
+local NativeDuration = (clock() - StartTime)
+
+Reporter:printf("LOG BENCH line by line %.3fs, parserequesthead %.3fs for %d heads", LineByLineDuration, NativeDuration, BENCH_ITERATIONS)
+
 --------------------------------------------------------------------------------
 -- TESTS parseheadervalue                                                     --
 --------------------------------------------------------------------------------
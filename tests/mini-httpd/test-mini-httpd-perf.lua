@@ -7,10 +7,10 @@ local MiniHttpd    = require("com.mini-httpd")
 local HelloHttpd   = require("hello-httpd")
 local Thread       = require("com.thread")
 local Event        = require("com.event")
-local TrivialTimer = require("trivial-timer")
+local socket       = require("socket")
 
-local format   = string.format
-local NewTimer = TrivialTimer.NewTimer
+local format  = string.format
+local gettime = socket.gettime
 
 --------------------------------------------------------------------------------
 -- RESOURCES                                                                  --
@@ -35,17 +35,34 @@ assert(CertKeyFile, "Missing file")
 --
 -- With plain HTTP, we are able to output something close to 4000 request/sec.
 --
+-- TEST_PLAIN_WORKERS serves the same requests from 1, 2, 4 and 8 server
+-- threads sharing the port with SO_REUSEPORT (not available on Windows). The
+-- clients are 8 threads, so the results show how the server scales with the
+-- number of cores.
+--
 -- HTTPS performance of HTTPS is terrible. We could potentially serve something
 -- like 50% the performances of plain HTTP. Plain HTTP gives something like 4000
 -- request/sec, so we should have something close to 2000 request/sec with
 -- HTTPS. But we only have 50 request/sec, which means that our implementation
 -- serve HTTPS 100 times slower than plain HTTP.
 -- 
--- The mbedtls multithreading does not help much due to a kind of global locking
--- in the API (MBEDTLS_THREADING_ALT), implemented in main.c.
+-- The mbedtls multithreading used to not help much, because every random
+-- number came from the global generator of PSA and its mutex. The random
+-- numbers now come from the operating system, without lock in the process
+-- (MBEDTLS_PSA_CRYPTO_EXTERNAL_RNG). The key store of PSA is still global,
+-- there are no per-thread key contexts.
+-- TEST_SslWorkers serves full handshakes from 1, 2, 4 and 8 server threads and
+-- prints the statistics of the mutexes still shared by the handshakes
+-- (Runtime.gettlslockstats). It needs several cores to show the scaling.
 --
 -- This is mitigated with HTTP keep connection alive implementation.
 --
+-- It is also mitigated with the session resumption, enabled by default on
+-- both sides: a client coming back resumes its TLS session, which skips the
+-- certificate and its signature. The servers "file" and "mem" resume the
+-- sessions, the server "full" disables it so that every connection pays a
+-- full handshake. TEST_SslResumption compares them without keep-alive.
+--
 -- In general, the recommended way to use that mini-httpd would be behind a
 -- proxy like nginx, Caddy or HAProxy.
 --
@@ -58,7 +75,8 @@ assert(CertKeyFile, "Missing file")
 -- PERFORMANCE TEST STATE                                                     --
 --------------------------------------------------------------------------------
 
-local Timer = NewTimer()
+-- Wall clock: the server thread sleeps while it waits for the clients
+local GLOBAL_StartTime
 
 local GLOBAL_MainHttpServer
 local GLOBAL_App
@@ -96,13 +114,21 @@ function WORKER_COMPLETED (WorkerId, SuccessCount, FailureCount)
   GLOBAL_ResultsReceived = (GLOBAL_ResultsReceived + 1)
   -- Report results
   if (GLOBAL_ResultsReceived == ThreadCount) then
-    local ElapsedTimeSeconds   = (Timer:GetElapsedSeconds() - PerformanceConfig.InitDelaySeconds)
+    local ElapsedTimeSeconds   = ((gettime() - GLOBAL_StartTime) - PerformanceConfig.InitDelaySeconds)
     local TotalRequests        = (GLOBAL_SuccessCount + GLOBAL_ErrorCount)
     local RequestsPerSecondInt = (TotalRequests // ElapsedTimeSeconds)
     local ResultString         = format("%5d/%5d", GLOBAL_SuccessCount, TotalRequests)
-    -- Print results
+    -- Print results, the number of server threads and the kind of TLS
+    -- handshake are added to the mode
+    local Label = PerformanceConfig.mode
+    if PerformanceConfig.ServerWorkers then
+      Label = format("%s/w%d", Label, PerformanceConfig.ServerWorkers)
+    end
+    if PerformanceConfig.Handshake then
+      Label = format("%s/%s", Label, PerformanceConfig.Handshake)
+    end
     print(format("%-10s Thread=%02d Concu=%02d Resu=%s Dur=%05.2fs Req/s=%06d %s",
-                 PerformanceConfig.mode,
+                 Label,
                  PerformanceConfig.ThreadCount,
                  PerformanceConfig.InThreadConcurrency,
                  ResultString,
@@ -183,8 +209,8 @@ end
 local function TEST_Configuration (SslConfiguration, TestConfiguration)
   -- Use global variables for simplicity
   GLOBAL_PerformanceConfig = TestConfiguration
-  -- Create a new server
-  GLOBAL_MainHttpServer = MiniHttpd.newserver()
+  -- Create a new server, with worker threads the main App only gets events
+  GLOBAL_MainHttpServer = MiniHttpd.newserver(TestConfiguration.ServerWorkers)
   GLOBAL_App            = HelloHttpd.newserverapp(GLOBAL_MainHttpServer, "WAIT")
   GLOBAL_MainHttpServer:bind(SslConfiguration, GLOBAL_App)
   -- Bind and listen
@@ -193,7 +219,7 @@ local function TEST_Configuration (SslConfiguration, TestConfiguration)
   -- Run the test (will send WAIT_AND_START)
   RunPerformancesTest(TestConfiguration, SslConfiguration)
   -- Start the blocking server loop
-  Timer:Reset()
+  GLOBAL_StartTime = gettime()
   GLOBAL_MainHttpServer:runloop()
   -- Wait for all workers to exit
   while (GLOBAL_CurrentActiveWorkers > 0) do
@@ -228,19 +254,58 @@ local ConfigurationSslMemory = {
   key  = Key,
 }
 
+-- Same as ConfigurationSslFile, without session resumption
+local ConfigurationSslFull = {
+  host           = "127.0.0.1",
+  port           = 8806,
+  certkeyfile    = CertKeyFile,
+  sessioncache   = false,
+  sessiontickets = false,
+}
+
+-- hello-httpd is loaded by each server thread
+local ConfigurationPlainWorkers = {
+  host          = "127.0.0.1",
+  port          = 8804,
+  module        = "hello-httpd",
+  moduleoptions = "WAIT",
+}
+
+-- Same as ConfigurationSslFull, served by several threads
+local ConfigurationSslWorkers = {
+  host           = "127.0.0.1",
+  port           = 8807,
+  certkeyfile    = CertKeyFile,
+  sessioncache   = false,
+  sessiontickets = false,
+  module         = "hello-httpd",
+  moduleoptions  = "WAIT",
+}
+
 local INIT_DELAY = 2
 local REQUEST_COUNT
 
-local function TEST_ConfigurationSsl (Ssl, LoopMode, ThreadCount, RequestCount, Concurrency)
+local function TEST_ConfigurationSsl (Ssl, LoopMode, ThreadCount, RequestCount, Concurrency, ServerWorkers)
   local Config
-  if (Ssl == "plain") then
+  local Handshake
+  if (Ssl == "plain") and ServerWorkers then
+    Config = ConfigurationPlainWorkers
+  elseif (Ssl == "plain") then
     Config = ConfigurationPlain
   elseif (Ssl == "file") then
-    Config = ConfigurationSslFile
+    Config    = ConfigurationSslFile
+    Handshake = "resumed"
   elseif (Ssl == "mem") then
-    Config = ConfigurationSslMemory
+    Config    = ConfigurationSslMemory
+    Handshake = "resumed"
+  elseif (Ssl == "full") and ServerWorkers then
+    Config    = ConfigurationSslWorkers
+    Handshake = "full"
+  elseif (Ssl == "full") then
+    Config    = ConfigurationSslFull
+    Handshake = "full"
   else
-    error(format("Invalid Ssl: %s (must be 'plain', 'file' or 'mem')", Ssl))
+    error(format("Invalid Ssl: %s (must be 'plain', 'file', 'mem' or 'full')", Ssl))
   end
   TEST_Configuration(Config, {
     mode                = LoopMode,
@@ -248,6 +313,8 @@ local function TEST_ConfigurationSsl (Ssl, LoopMode, ThreadCount, RequestCount,
     Requests            = RequestCount,
     InThreadConcurrency = Concurrency,
     InitDelaySeconds    = INIT_DELAY,
+    ServerWorkers       = ServerWorkers,
+    Handshake           = Handshake,
   })
 end
 
@@ -273,6 +340,17 @@ function TEST_PLAIN ()
   TEST_ConfigurationSsl("plain", "copasloop",  4, REQUEST_COUNT, 4)
 end
 
+function TEST_PLAIN_WORKERS ()
+  TEST_ConfigurationSsl("plain", "simpleloop", 8, REQUEST_COUNT, 0, 1)
+  TEST_ConfigurationSsl("plain", "simpleloop", 8, REQUEST_COUNT, 0, 2)
+  TEST_ConfigurationSsl("plain", "simpleloop", 8, REQUEST_COUNT, 0, 4)
+  TEST_ConfigurationSsl("plain", "simpleloop", 8, REQUEST_COUNT, 0, 8)
+  TEST_ConfigurationSsl("plain", "keepalive",  8, REQUEST_COUNT, 0, 1)
+  TEST_ConfigurationSsl("plain", "keepalive",  8, REQUEST_COUNT, 0, 2)
+  TEST_ConfigurationSsl("plain", "keepalive",  8, REQUEST_COUNT, 0, 4)
+  TEST_ConfigurationSsl("plain", "keepalive",  8, REQUEST_COUNT, 0, 8)
+end
+
 function TEST_Ssl1Close ()
   TEST_ConfigurationSsl("file", "simpleloop", 1, REQUEST_COUNT, 0)
   TEST_ConfigurationSsl("file", "simpleloop", 2, REQUEST_COUNT, 0)
@@ -339,6 +417,42 @@ function TEST_Ssl2Keep ()
   TEST_ConfigurationSsl("mem", "keepalive", 8, REQUEST_COUNT, 0)
 end
 
+-- One connection per request: full handshakes, then resumed handshakes
+function TEST_SslResumption ()
+  TEST_ConfigurationSsl("full", "simpleloop", 1, REQUEST_COUNT, 0)
+  TEST_ConfigurationSsl("file", "simpleloop", 1, REQUEST_COUNT, 0)
+  TEST_ConfigurationSsl("full", "simpleloop", 4, REQUEST_COUNT, 0)
+  TEST_ConfigurationSsl("file", "simpleloop", 4, REQUEST_COUNT, 0)
+  TEST_ConfigurationSsl("full", "copasloop",  1, REQUEST_COUNT, 4)
+  TEST_ConfigurationSsl("file", "copasloop",  1, REQUEST_COUNT, 4)
+end
+
+-- Print the lock statistics of mbedtls since Before
+local function TEST_PrintTlsLockStats (Before)
+  local After = Runtime.gettlslockstats()
+  for _, Name in ipairs({ "keyslot", "globaldata", "rngdata" }) do
+    print(format("  %-10s locks=%07d contended=%06d wait=%08.3fms",
+                 Name,
+                 (After[Name].locks - Before[Name].locks),
+                 (After[Name].contended - Before[Name].contended),
+                 ((After[Name].waitns - Before[Name].waitns) / 1000000)))
+  end
+end
+
+local function TEST_SslWorkersWithStats (ServerWorkers)
+  local Before = Runtime.gettlslockstats()
+  TEST_ConfigurationSsl("full", "simpleloop", 8, REQUEST_COUNT, 0, ServerWorkers)
+  TEST_PrintTlsLockStats(Before)
+end
+
+-- One full handshake per request, from 1, 2, 4 and 8 server threads
+function TEST_SslWorkers ()
+  TEST_SslWorkersWithStats(1)
+  TEST_SslWorkersWithStats(2)
+  TEST_SslWorkersWithStats(4)
+  TEST_SslWorkersWithStats(8)
+end
+
 --------------------------------------------------------------------------------
 -- MAIN                                                                       --
 --------------------------------------------------------------------------------
@@ -346,12 +460,21 @@ end
 print("============= PLAIN ========================")
 REQUEST_COUNT = 1000
 TEST_PLAIN()
+print("============= PLAIN WORKERS ========================")
+REQUEST_COUNT = 8000
+TEST_PLAIN_WORKERS()
 print("============= SSL 1 CLOSE ========================")
 REQUEST_COUNT = 200
 TEST_Ssl1Close()
 print("============= SSL 2 CLOSE ========================")
 REQUEST_COUNT = 200
 TEST_Ssl2Close()
+print("============= SSL RESUMPTION ========================")
+REQUEST_COUNT = 200
+TEST_SslResumption()
+print("============= SSL WORKERS ========================")
+REQUEST_COUNT = 800
+TEST_SslWorkers()
 print("============= SSL 1 KEEP ========================")
 REQUEST_COUNT = 10000
 TEST_Ssl1Keep()
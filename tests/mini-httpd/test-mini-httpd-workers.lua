@@ -0,0 +1,137 @@
+--------------------------------------------------------------------------------
+-- TESTS BOILERPLATE FOR PACKAGE.PATH                                         --
+--------------------------------------------------------------------------------
+
+-- This kind of code should not appear in the real use of ComEXE
+--
+-- Initialize package.path to include ..\lib\xxx because test libraries are in
+-- this directory
+
+local function TEST_UpdatePackagePath (RelativeDirectory)
+  -- Retrieve package confiuration (file loadlib.c, function luaopen_package)
+  local Configuration = package.config
+  local LUA_DIRSEP    = Configuration:sub(1, 1)
+  local LUA_PATH_SEP  = Configuration:sub(3, 3)
+  local LUA_PATH_MARK = Configuration:sub(5, 5)
+  -- Load required modules
+  local Runtime   = require("com.runtime")
+  local Directory = Runtime.getrelativepath(RelativeDirectory) -- relative to arg[0] directory
+  -- Prepend path in a Linux/Windows compatible way
+  package.path = string.format("%s%s%s.lua%s%s", Directory, LUA_DIRSEP, LUA_PATH_MARK, LUA_PATH_SEP, package.path)
+end
+
+TEST_UpdatePackagePath("../lib")
+
+--------------------------------------------------------------------------------
+-- IMPORTS                                                                    --
+--------------------------------------------------------------------------------
+
+-- mini-httpd served by 2 worker threads: a few requests, then stop. The
+-- ServerApp of the calling thread receives a single Started and a single
+-- Closed for all the workers.
+
+local Runtime   = require("com.runtime")
+local MiniHttpd = require("com.mini-httpd")
+local http      = require("socket.http")
+local ltn12     = require("ltn12")
+local reporter  = require("mini-reporter")
+
+local format = string.format
+local concat = table.concat
+
+local WORKER_COUNT  = 2
+local REQUEST_COUNT = 8
+
+local Reporter = reporter.new()
+
+--------------------------------------------------------------------------------
+-- SERVER APP                                                                 --
+--------------------------------------------------------------------------------
+
+-- The requests are handled by the hello-httpd ServerApp of each worker, this
+-- one only receives the events
+local EventApp = {
+  started = {},
+  closed  = 0,
+}
+
+function EventApp:event (EventType, Value)
+  if (EventType == "Started") then
+    self.started[#self.started + 1] = Value
+  elseif (EventType == "Closed") then
+    self.closed = (self.closed + 1)
+  end
+end
+
+local Config = {
+  host          = "127.0.0.1",
+  port          = 0,
+  module        = "hello-httpd",
+  moduleoptions = "WAIT",
+}
+
+--------------------------------------------------------------------------------
+-- LISTEN                                                                     --
+--------------------------------------------------------------------------------
+
+Reporter:block("LISTEN")
+
+local Server = MiniHttpd.newserver(WORKER_COUNT)
+Server:bind(Config, EventApp)
+
+local Success, ErrorString = Server:listen(EventApp)
+if (not Success) then
+  Reporter:printf("listen failed: %s", ErrorString)
+end
+
+local Uri = Server:geturi(EventApp)
+Reporter:expect("LISTEN-001-listen",   Success)
+Reporter:expect("LISTEN-002-started",  ((#EventApp.started == 1) and (EventApp.started[1] == Uri)))
+Reporter:expect("LISTEN-003-port",     (Success and (tonumber(Uri:match(":(%d+)$")) > 0)))
+Reporter:expect("LISTEN-004-no-close", (EventApp.closed == 0))
+
+--------------------------------------------------------------------------------
+-- REQUESTS                                                                   --
+--------------------------------------------------------------------------------
+
+Reporter:block("REQUESTS")
+
+-- The workers run their own Copas loop, the blocking client doesn't stop them
+local Expected = Runtime.loadresource("test.css")
+local Served   = 0
+
+if Success then
+  for Index = 1, REQUEST_COUNT do
+    local Chunks = {}
+    local Ok, Code = http.request({
+      url  = format("%s/test.css", Uri),
+      sink = ltn12.sink.table(Chunks),
+    })
+    if Ok and (Code == 200) and (concat(Chunks) == Expected) then
+      Served = (Served + 1)
+    end
+  end
+end
+
+Reporter:expect("REQUEST-001-served", (Served == REQUEST_COUNT))
+
+--------------------------------------------------------------------------------
+-- STOP                                                                       --
+--------------------------------------------------------------------------------
+
+Reporter:block("STOP")
+
+-- runloop returns once all the workers have exited
+Server:stop(EventApp)
+Server:runloop()
+
+Reporter:expect("STOP-001-closed-once",  (EventApp.closed == 1))
+Reporter:expect("STOP-002-started-once", (#EventApp.started == 1))
+Reporter:expect("STOP-003-uri-cleared",  (Server:geturi(EventApp) == false))
+
+--------------------------------------------------------------------------------
+-- SUMMARY
+--------------------------------------------------------------------------------
+
+Reporter:printf("== SUMMARY ==")
+Reporter:summary("os.exit")
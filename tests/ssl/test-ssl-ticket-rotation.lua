@@ -0,0 +1,144 @@
+-- The workers of mini-httpd share a ticket secret: each one derives the key of
+-- the current period from it (com/ssl-server.lua updateticketkey) and rotates
+-- it before mbedtls replaces it by a random key, so a client keeps resuming
+-- its session on any worker after the lifetime of the first key. The
+-- handshakes are done in memory, a resumed handshake does not send the
+-- certificate of the server.
+
+local mbedtls   = require("mbedtls")
+local Ssl       = require("mbedtls.ssl")
+local SslServer = require("com.ssl-server")
+local uv        = require("luv")
+
+local format = string.format
+
+local TICKET_LIFETIME = 2 -- Seconds, the key changes every second
+
+local ClientConfig = Ssl.newconfig("tls-client")
+
+local function NewPipe ()
+  return { Data = "", Bytes = 0 }
+end
+
+local function NewReader (Pipe)
+  return function (SizeInBytes)
+    local Data = Pipe.Data:sub(1, SizeInBytes)
+    Pipe.Data  = Pipe.Data:sub(SizeInBytes + 1)
+    return Data
+  end
+end
+
+local function NewWriter (Pipe)
+  return function (Data)
+    Pipe.Data  = (Pipe.Data .. Data)
+    Pipe.Bytes = (Pipe.Bytes + #Data)
+    return #Data
+  end
+end
+
+local function Handshake (Context)
+  local Done, ErrorString = Context:handshake()
+  assert(Done or (ErrorString == "want-read") or (ErrorString == "want-write"), ErrorString)
+  return Done
+end
+
+-- Return the session for the next connection and the number of bytes sent by
+-- the server
+local function Connect (ServerConfig, Session)
+  local ClientToServer = NewPipe()
+  local ServerToClient = NewPipe()
+  local Server = Ssl.newcontext(ServerConfig, NewReader(ClientToServer), NewWriter(ServerToClient))
+  local Client = Ssl.newcontext(ClientConfig, NewReader(ServerToClient), NewWriter(ClientToServer))
+  Client:sethostname("localhost")
+  if Session then
+    assert(Client:setsession(Session))
+  end
+  local ClientDone = false
+  local ServerDone = false
+  local Steps      = 0
+  while (not (ClientDone and ServerDone)) and (Steps < 100) do
+    ClientDone = (ClientDone or Handshake(Client))
+    ServerDone = (ServerDone or Handshake(Server))
+    Steps      = (Steps + 1)
+  end
+  -- With TLS 1.3, the ticket is read after the handshake
+  assert(Server:write("hello"))
+  assert(Client:read(100) == "hello")
+  return Client:getsession(), ServerToClient.Bytes
+end
+
+local function NewServerConfig (Secret)
+  local Options = {
+    sessioncache   = false,
+    ticketlifetime = TICKET_LIFETIME,
+    ticketsecret   = Secret,
+  }
+  local ServerConfig = Ssl.newconfig("tls-server")
+  local Server = {
+    Config  = ServerConfig,
+    Options = Options,
+    Period  = SslServer.enableresumption(ServerConfig, Options),
+  }
+  return Server
+end
+
+-- Like mini-httpd, before each handshake
+local function UpdateKey (Server)
+  Server.Period = SslServer.updateticketkey(Server.Config, Server.Options, Server.Period)
+end
+
+local function WaitNextPeriods (Count)
+  local Target = (os.time() + Count)
+  while (os.time() < Target) do
+    uv.sleep(50)
+  end
+end
+
+local Success = true
+
+local function Check (Label, Condition)
+  print(format("%-40s %s", Label, (Condition and "OK" or "FAILED")))
+  Success = (Success and Condition)
+end
+
+local TicketName, Secret = Ssl.newticketkey()
+local WorkerA = NewServerConfig(Secret)
+local WorkerB = NewServerConfig(Secret)
+local Other   = NewServerConfig((Ssl.newticketkey()))
+
+-- Start at the beginning of a period, the tickets are valid 2 periods
+WaitNextPeriods(1)
+
+UpdateKey(WorkerA)
+local Session, FullBytes = Connect(WorkerA.Config)
+
+local function IsResumed (Server, Session)
+  UpdateKey(Server)
+  local NextSession, Bytes = Connect(Server.Config, Session)
+  return (Bytes < (FullBytes / 2))
+end
+
+Check("same period, other worker", IsResumed(WorkerB, Session))
+
+-- The key of the previous period is still accepted after the rotation
+WaitNextPeriods(1)
+Check("previous period, after rotation", IsResumed(WorkerB, Session))
+Check("period changed", (WorkerB.Period > WorkerA.Period))
+
+-- WorkerB has no handshake during a whole period
+WaitNextPeriods(2)
+UpdateKey(WorkerA)
+Session = Connect(WorkerA.Config)
+Check("worker idle for a period", IsResumed(WorkerB, Session))
+Check("same period on both workers", (WorkerA.Period == WorkerB.Period))
+
+-- Another secret: full handshake
+Check("other secret", (not IsResumed(Other, Session)))
+
+if Success then
+  print("OK")
+  os.exit(0)
+else
+  print("FAILED")
+  os.exit(1)
+end
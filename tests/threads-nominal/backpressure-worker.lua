@@ -0,0 +1,18 @@
+-- Worker of test-event-backpressure.lua: a slow consumer with a bounded
+-- mailbox
+local Event = require("com.event")
+local uv    = require("luv")
+
+local ReceivedCount = 0
+
+function ProcessItem (Item)
+  uv.sleep(1)
+  ReceivedCount = (ReceivedCount + 1)
+end
+
+function StopWorker ()
+  Event.send(1, "WorkerDone", ReceivedCount)
+  Event.stoploop()
+end
+
+Event.runloop()
@@ -0,0 +1,23 @@
+-- Worker of test-blob.lua: look for the marker in the record and send the
+-- result back. When the record is a blob, it is never copied.
+local Thread = require("com.thread")
+local Event  = require("com.event")
+local Blob   = require("com.blob")
+
+function ParseRecord (Record, Marker)
+  local Text  = Record
+  local Start = nil
+  if Blob.isblob(Record) then
+    Text  = Record:tostring()
+    Start = Record:find(Marker)
+  end
+  local Position = Text:find(Marker, 1, true)
+  Event.send(1, "RecordParsed", Thread.getid(), (Start or Position), Position, #Record)
+end
+
+function StopWorker ()
+  Event.stoploop()
+end
+
+Event.send(1, "WorkerReady", Thread.getid())
+Event.runloop()
@@ -0,0 +1,30 @@
+-- Worker of test-thread-call.lua: a small key/value service answering calls,
+-- and the handler of the two-event pattern
+local Event = require("com.event")
+local uv    = require("luv")
+
+local Values = { answer = 42, name = "comexe" }
+
+function Get (Key)
+  return Values[Key], Key
+end
+
+function Fail (Message)
+  error(Message, 0)
+end
+
+function Slow (DelayMs)
+  uv.sleep(DelayMs)
+  return "slow"
+end
+
+-- Two-event pattern: reply with another event
+function Ping (Value)
+  Event.send(1, "Pong", Value)
+end
+
+Event.register("Stop", function ()
+  Event.stoploop()
+end)
+
+Event.runloop()
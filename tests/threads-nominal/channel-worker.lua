@@ -0,0 +1,16 @@
+-- Worker of test-channel.lua: pull jobs from a shared channel until it is
+-- closed, push the results into another channel
+local Thread = require("com.thread")
+
+local Jobs, Results = Thread.getarguments()
+
+local Ok, Value = Jobs:pop()
+local Count     = 0
+
+while Ok do
+  Results:push(Thread.getid(), (Value * Value))
+  Count     = (Count + 1)
+  Ok, Value = Jobs:pop()
+end
+
+Results:push(Thread.getid(), "done", Count)
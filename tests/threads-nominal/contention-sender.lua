@@ -0,0 +1,12 @@
+-- Sender of test-event-contention.lua: flood the main thread with small events
+local Thread = require("com.thread")
+local Event  = require("com.event")
+
+local MESSAGE_COUNT = 20000
+
+local send     = Event.send
+local SenderId = Thread.getid()
+
+for Index = 1, MESSAGE_COUNT do
+  send(1, "ContentionEvent", SenderId, Index, "payload", 1.5)
+end
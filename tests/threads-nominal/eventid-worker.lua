@@ -0,0 +1,30 @@
+-- Worker of test-event-id.lua: handlers registered by name and a global
+-- handler, the replies are sent by ID
+local Event = require("com.event")
+
+local ReplyId = Event.getid("WorkerReply")
+local Count   = 0
+
+function PingGlobal (Value)
+  Count = (Count + 1)
+end
+
+Event.register("Ping", function (Value)
+  Count = (Count + 1)
+end)
+
+Event.register("Report", function (Label)
+  Event.send(1, ReplyId, Label, Count)
+  Count = 0
+end)
+
+Event.register("Stop", function ()
+  Event.stoploop()
+end)
+
+Event.setfallback(function (EventName, ...)
+  Event.send(1, ReplyId, "fallback", EventName, select("#", ...))
+end)
+
+Event.send(1, ReplyId, "ready")
+Event.runloop()
@@ -0,0 +1,18 @@
+-- Worker of test-thread-heap-perf.lua: table churn, then build a large state
+-- which is freed when the thread exits
+local Thread = require("com.thread")
+
+local ChurnCount, KeepCount = Thread.getarguments()
+
+-- Short lived tables
+local Sum = 0
+for Index = 1, ChurnCount do
+  local Record = { Index, tostring(Index), { Value = Index } }
+  Sum = (Sum + Record[3].Value)
+end
+
+-- Long lived objects, freed by lua_close
+Kept = {}
+for Index = 1, KeepCount do
+  Kept[Index] = { Name = ("object-" .. Index), Index }
+end
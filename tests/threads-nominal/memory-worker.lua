@@ -0,0 +1,24 @@
+-- Worker of test-thread-memory.lua: allocate until the memory limit is
+-- reached, report the error, then grow without limit until it is not caught
+local Thread = require("com.thread")
+local Event  = require("com.event")
+
+local Mode = Thread.getarguments()
+
+local Strings = {}
+
+local function Grow ()
+  for Index = 1, 100000000 do
+    Strings[Index] = string.rep("x", 1024) .. Index
+  end
+end
+
+if (Mode == "catch") then
+  local Ok, Message = pcall(Grow)
+  local Count = #Strings
+  Strings = nil
+  collectgarbage()
+  Event.send(1, "WorkerResult", Ok, Message, Count, Thread.getmemorystats())
+else
+  Grow()
+end
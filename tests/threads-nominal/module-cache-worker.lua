@@ -0,0 +1,4 @@
+-- Loaded from the bytecode cached by the main thread
+local ChunkBuffer = require("com.chunk-buffer")
+
+assert(type(ChunkBuffer.newchunkbuffer) == "function")
@@ -0,0 +1,9 @@
+-- Module loaded by the workers of test-parallel.lua for "module:function"
+-- tasks
+local function Square (Value)
+  return (Value * Value)
+end
+
+return {
+  Square = Square,
+}
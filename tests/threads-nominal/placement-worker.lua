@@ -0,0 +1,26 @@
+-- Worker of test-thread-placement.lua: report the placement of this thread
+local Event = require("com.event")
+local uv    = require("luv")
+
+local Self = uv.thread_self()
+
+-- Deep recursion, to use the stack given by the option stacksize
+local function Depth (Count)
+  if (Count == 0) then
+    return 0
+  else
+    return (1 + Depth(Count - 1))
+  end
+end
+
+local Affinity = Self:getaffinity()
+local CpuCount = 0
+if Affinity then
+  for Cpu = 1, #Affinity do
+    if Affinity[Cpu] then
+      CpuCount = (CpuCount + 1)
+    end
+  end
+end
+
+Event.send(1, "WorkerResult", uv.thread_getname(Self), (Affinity and Affinity[1]), CpuCount, Self:getpriority(), Depth(10000))
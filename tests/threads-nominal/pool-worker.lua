@@ -0,0 +1,12 @@
+-- A recycled instance must start like a new one: the globals, the modules and
+-- the changes in the standard libraries of the previous run have been removed
+-- by the reset
+assert(POOL_WORKER_GLOBAL == nil, "global of the previous run still defined")
+assert(package.loaded["pool-worker"] == nil, "module of the previous run still loaded")
+assert(string.poolworker == nil, "string field of the previous run still defined")
+assert(("").poolworker == nil, "string method of the previous run still defined")
+assert(table.insert ~= print, "table.insert of the previous run still patched")
+
+POOL_WORKER_GLOBAL = true
+string.poolworker  = true
+table.insert       = print
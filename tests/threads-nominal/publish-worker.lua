@@ -0,0 +1,22 @@
+-- Worker of test-event-publish.lua: the workers with an even thread ID
+-- subscribe to "config"
+local Thread = require("com.thread")
+local Event  = require("com.event")
+
+local ThreadId = Thread.getid()
+
+if ((ThreadId % 2) == 0) then
+  assert(Event.subscribe("config") == true)
+  assert(Event.subscribe("config") == false, "subscribed twice")
+end
+
+function ConfigEvent (Config)
+  Event.send(1, "ConfigReceived", ThreadId, #Config)
+end
+
+function StopWorker ()
+  Event.stoploop()
+end
+
+Event.send(1, "WorkerReady", ThreadId)
+Event.runloop()
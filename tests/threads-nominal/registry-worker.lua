@@ -0,0 +1,23 @@
+-- Worker of test-thread-registry.lua: a service registered under a name
+local Thread = require("com.thread")
+local Event  = require("com.event")
+
+local Values = {}
+
+function Set (Key, Value)
+  Values[Key] = Value
+end
+
+function Get (Key)
+  return Values[Key]
+end
+
+Event.register("Stop", function ()
+  Event.stoploop()
+end)
+
+local Name = Thread.getarguments()
+local Ok   = Thread.register(Name)
+
+Event.send(1, "WorkerReady", Ok)
+Event.runloop()
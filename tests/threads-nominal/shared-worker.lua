@@ -0,0 +1,21 @@
+-- Worker of test-shared.lua: mix of reads and writes on a shared store, one
+-- write every WriteRatio operations
+local Thread = require("com.thread")
+local Shared = require("com.shared")
+
+local StoreName, OperationCount, WriteRatio, KeyCount = Thread.getarguments()
+
+local Store    = Shared.open(StoreName)
+local ThreadId = Thread.getid()
+
+for Index = 1, OperationCount do
+  local Key = ("key-" .. (Index % KeyCount))
+  if ((Index % WriteRatio) == 0) then
+    Store:set(Key, ThreadId)
+    Store:incr("writes")
+  else
+    Store:get(Key)
+  end
+end
+
+Store:incr("done")
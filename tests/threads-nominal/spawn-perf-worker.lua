@@ -0,0 +1,2 @@
+-- Empty worker: the thread only pays for the creation of its lua_State and the
+-- loading of comexe/init.lua
@@ -0,0 +1,24 @@
+-- Sender of test-event-join-stress.lua: broadcast, publish, send and call the
+-- first thread IDs for a while, the IDs of the joined workers are reused
+local Thread = require("com.thread")
+local Event  = require("com.event")
+local uv     = require("luv")
+
+local DURATION_NS   = (1000 * 1e6)
+local MAX_THREAD_ID = 16
+
+local Payload   = string.rep("s", 256)
+local Deadline  = (uv.hrtime() + DURATION_NS)
+local SentCount = 0
+local TargetId  = 1
+
+while (uv.hrtime() < Deadline) do
+  Event.broadcast("StressEvent", Payload)
+  Event.publish("stress", "StressEvent", Payload)
+  TargetId = ((TargetId % MAX_THREAD_ID) + 1)
+  Event.sendtimeout(TargetId, 10, "StressEvent", Payload)
+  Thread.calltimeout(TargetId, 10, "StressEvent", Payload)
+  SentCount = (SentCount + 4)
+end
+
+Event.send(1, "SenderDone", SentCount)
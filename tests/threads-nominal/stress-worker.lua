@@ -0,0 +1,5 @@
+-- Worker of test-event-join-stress.lua: subscribe and finish immediately, the
+-- events received meanwhile are discarded
+local Event = require("com.event")
+
+Event.subscribe("stress")
@@ -0,0 +1,144 @@
+--------------------------------------------------------------------------------
+-- TESTS BOILERPLATE FOR PACKAGE.PATH                                         --
+--------------------------------------------------------------------------------
+
+-- This kind of code should not appear in the real use of ComEXE
+--
+-- Initialize package.path to include ..\lib\xxx because test libraries are in
+-- this directory
+
+local function TEST_UpdatePackagePath (RelativeDirectory)
+  -- Retrieve package confiuration (file loadlib.c, function luaopen_package)
+  local Configuration = package.config
+  local LUA_DIRSEP    = Configuration:sub(1, 1)
+  local LUA_PATH_SEP  = Configuration:sub(3, 3)
+  local LUA_PATH_MARK = Configuration:sub(5, 5)
+  -- Load required modules
+  local Runtime   = require("com.runtime")
+  local Directory = Runtime.getrelativepath(RelativeDirectory) -- relative to arg[0] directory
+  -- Prepend path in a Linux/Windows compatible way
+  package.path = string.format("%s%s%s.lua%s%s", Directory, LUA_DIRSEP, LUA_PATH_MARK, LUA_PATH_SEP, package.path)
+end
+
+TEST_UpdatePackagePath("../lib")
+
+--------------------------------------------------------------------------------
+-- IMPORTS                                                                    --
+--------------------------------------------------------------------------------
+
+-- Shared immutable blobs: one reader fans out a large record to several
+-- workers, the record is only copied once, in Blob.new
+
+local Thread   = require("com.thread")
+local Event    = require("com.event")
+local Blob     = require("com.blob")
+local uv       = require("luv")
+local reporter = require("mini-reporter")
+
+local WORKER_COUNT = 4
+local RECORD_SIZE  = (4 * 1024 * 1024)
+local SEND_COUNT   = 5
+local MARKER       = "<MARKER>"
+
+local MarkerPosition = (RECORD_SIZE - 100)
+local RecordString   = string.rep("x", (MarkerPosition - 1)) .. MARKER .. string.rep("y", (RECORD_SIZE - MarkerPosition - #MARKER + 1))
+
+--------------------------------------------------------------------------------
+-- LOCAL API                                                                  --
+--------------------------------------------------------------------------------
+
+local Reporter = reporter.new()
+
+Reporter:block("LOCAL API")
+
+local Record = Blob.new(RecordString)
+Reporter:expect("BLOB-001-isblob",        Blob.isblob(Record))
+Reporter:expect("BLOB-002-isblob-string", (not Blob.isblob(RecordString)))
+Reporter:expect("BLOB-003-length",        (#Record == RECORD_SIZE))
+Reporter:expect("BLOB-004-size",          (Record:size() == RECORD_SIZE))
+Reporter:expect("BLOB-005-sub",           (Record:sub(MarkerPosition, (MarkerPosition + #MARKER - 1)) == MARKER))
+Reporter:expect("BLOB-006-sub-negative",  (Record:sub(-3) == "yyy"))
+Reporter:expect("BLOB-007-find",          (Record:find(MARKER) == MarkerPosition))
+Reporter:expect("BLOB-008-find-missing",  (Record:find("not found") == nil))
+Reporter:expect("BLOB-009-tostring",      (Record:tostring() == RecordString))
+
+--------------------------------------------------------------------------------
+-- FAN OUT                                                                    --
+--------------------------------------------------------------------------------
+
+Reporter:block("FAN OUT")
+
+local Workers     = {}
+local ReadyCount  = 0
+local ParsedCount = 0
+local Expected    = (WORKER_COUNT * SEND_COUNT)
+local AllParsed   = true
+
+function WorkerReady (ThreadId)
+  ReadyCount = (ReadyCount + 1)
+  if (ReadyCount == WORKER_COUNT) then
+    Event.stoploop()
+  end
+end
+
+function RecordParsed (ThreadId, Start, Position, Size)
+  if (Start ~= MarkerPosition) or (Position ~= MarkerPosition) or (Size ~= RECORD_SIZE) then
+    AllParsed = false
+  end
+  ParsedCount = (ParsedCount + 1)
+  if (ParsedCount == Expected) then
+    Event.stoploop()
+  end
+end
+
+local JoinedCount = 0
+function WorkerExitEvent (ThreadId)
+  Thread.join(ThreadId)
+  JoinedCount = (JoinedCount + 1)
+  if (JoinedCount == WORKER_COUNT) then
+    Event.stoploop()
+  end
+end
+
+for Index = 1, WORKER_COUNT do
+  Workers[Index] = Thread.create("blob-worker", "WorkerExitEvent")
+end
+Event.runloop()
+
+local function FanOut (Label, Payload)
+  ParsedCount = 0
+  local StartTime = uv.hrtime()
+  for Iteration = 1, SEND_COUNT do
+    for Index, ThreadId in ipairs(Workers) do
+      Event.send(ThreadId, "ParseRecord", Payload, MARKER)
+    end
+  end
+  Event.runloop()
+  local ElapsedMs = ((uv.hrtime() - StartTime) / 1e6)
+  Reporter:printf("%-6s %d records of %d MiB in %.1f ms", Label, ParsedCount, (RECORD_SIZE // (1024 * 1024)), ElapsedMs)
+  -- Return value
+  return ElapsedMs
+end
+
+-- The string is copied in each event and again on the receiver side
+local StringMs = FanOut("STRING", RecordString)
+Reporter:expect("FANOUT-001-string-parsed", (ParsedCount == Expected))
+local BlobMs   = FanOut("BLOB", Record)
+Reporter:expect("FANOUT-002-blob-parsed",   (ParsedCount == Expected))
+
+Reporter:printf("BLOB/STRING: %.1fx faster", (StringMs / BlobMs))
+
+for Index, ThreadId in ipairs(Workers) do
+  Event.send(ThreadId, "StopWorker")
+end
+Event.runloop()
+
+Reporter:expect("FANOUT-003-records-found",  AllParsed)
+Reporter:expect("FANOUT-004-workers-joined", (JoinedCount == WORKER_COUNT))
+
+--------------------------------------------------------------------------------
+-- SUMMARY
+--------------------------------------------------------------------------------
+
+Reporter:printf("== SUMMARY ==")
+Reporter:summary("os.exit")
@@ -0,0 +1,182 @@
+--------------------------------------------------------------------------------
+-- TESTS BOILERPLATE FOR PACKAGE.PATH                                         --
+--------------------------------------------------------------------------------
+
+-- This kind of code should not appear in the real use of ComEXE
+--
+-- Initialize package.path to include ..\lib\xxx because test libraries are in
+-- this directory
+
+local function TEST_UpdatePackagePath (RelativeDirectory)
+  -- Retrieve package confiuration (file loadlib.c, function luaopen_package)
+  local Configuration = package.config
+  local LUA_DIRSEP    = Configuration:sub(1, 1)
+  local LUA_PATH_SEP  = Configuration:sub(3, 3)
+  local LUA_PATH_MARK = Configuration:sub(5, 5)
+  -- Load required modules
+  local Runtime   = require("com.runtime")
+  local Directory = Runtime.getrelativepath(RelativeDirectory) -- relative to arg[0] directory
+  -- Prepend path in a Linux/Windows compatible way
+  package.path = string.format("%s%s%s.lua%s%s", Directory, LUA_DIRSEP, LUA_PATH_MARK, LUA_PATH_SEP, package.path)
+end
+
+TEST_UpdatePackagePath("../lib")
+
+--------------------------------------------------------------------------------
+-- IMPORTS                                                                    --
+--------------------------------------------------------------------------------
+
+-- Channels shared by several threads: a work queue pulled by several workers,
+-- the non-blocking and timeout variants, select and close.
+
+local Thread   = require("com.thread")
+local Event    = require("com.event")
+local Channel  = require("com.channel")
+local Blob     = require("com.blob")
+local reporter = require("mini-reporter")
+
+local WORKER_COUNT = 4
+local JOB_COUNT    = 1000
+
+local Reporter = reporter.new()
+
+--------------------------------------------------------------------------------
+-- SINGLE THREAD                                                              --
+--------------------------------------------------------------------------------
+
+Reporter:block("SINGLE THREAD")
+
+local Queue = Channel.new(2)
+Reporter:expect("CHANNEL-001-ischannel",        Channel.ischannel(Queue))
+Reporter:expect("CHANNEL-002-ischannel-table",  (not Channel.ischannel({})))
+Reporter:expect("CHANNEL-003-capacity",         (Queue:capacity() == 2))
+Reporter:expect("CHANNEL-004-trypush",          Queue:trypush(1, "one", { 1, 2 }))
+Reporter:expect("CHANNEL-005-push",             Queue:push(2))
+local Ok, Reason = Queue:trypush(3)
+Reporter:expect("CHANNEL-006-trypush-full",     ((not Ok) and (Reason == "full")))
+Ok, Reason = Queue:pushtimeout(10, 3)
+Reporter:expect("CHANNEL-007-pushtimeout-full", ((not Ok) and (Reason == "timeout")))
+Reporter:expect("CHANNEL-008-count",            (#Queue == 2))
+
+local Number, Name, Array
+Ok, Number, Name, Array = Queue:pop()
+Reporter:expect("CHANNEL-009-pop",              (Ok and (Number == 1) and (Name == "one") and (Array[2] == 2)))
+Ok, Number = Queue:trypop()
+Reporter:expect("CHANNEL-010-trypop",           (Ok and (Number == 2)))
+Ok, Reason = Queue:trypop()
+Reporter:expect("CHANNEL-011-trypop-empty",     ((not Ok) and (Reason == "empty")))
+Ok, Reason = Queue:poptimeout(10)
+Reporter:expect("CHANNEL-012-poptimeout-empty", ((not Ok) and (Reason == "timeout")))
+
+-- Channels and blobs are shared, not copied
+local Record = Blob.new("payload")
+Queue:push(Queue, Record)
+local Self, SharedRecord
+Ok, Self, SharedRecord = Queue:pop()
+Reporter:expect("CHANNEL-013-channel-in-channel", (Ok and (tostring(Self) == tostring(Queue))))
+Reporter:expect("CHANNEL-014-blob-in-channel",    (SharedRecord:tostring() == "payload"))
+
+-- A huge capacity is not allocated upfront, the ring grows with the content
+local Huge = Channel.new(math.maxinteger)
+for Value = 1, 100 do
+  Huge:push(Value)
+end
+local HugeSum = 0
+for Value = 1, 100 do
+  local Popped, Item = Huge:trypop()
+  HugeSum = (HugeSum + Item)
+end
+Reporter:expect("CHANNEL-015-huge-capacity", (Huge:capacity() == math.maxinteger))
+Reporter:expect("CHANNEL-016-huge-grows",    (HugeSum == 5050))
+
+--------------------------------------------------------------------------------
+-- SELECT AND CLOSE                                                           --
+--------------------------------------------------------------------------------
+
+Reporter:block("SELECT AND CLOSE")
+
+local First  = Channel.new()
+local Second = Channel.new()
+Second:push("second")
+local Index, Value = Channel.select({ First, Second }, 0)
+Reporter:expect("SELECT-001-select",         ((Index == 2) and (Value == "second")))
+Index, Reason = Channel.select({ First, Second }, 10)
+Reporter:expect("SELECT-002-select-timeout", ((Index == nil) and (Reason == "timeout")))
+
+First:push("last")
+First:close()
+Reporter:expect("SELECT-003-isclosed", First:isclosed())
+Ok, Reason = First:push("late")
+Reporter:expect("SELECT-004-push-closed",       ((not Ok) and (Reason == "closed")))
+Ok, Value = First:pop()
+Reporter:expect("SELECT-005-pop-closed",        (Ok and (Value == "last")))
+Ok, Reason = First:pop()
+Reporter:expect("SELECT-006-pop-closed-empty",  ((not Ok) and (Reason == "closed")))
+
+-- One channel closed, the other still open
+Second:push("open")
+Index, Value = Channel.select({ First, Second }, 0)
+Reporter:expect("SELECT-007-select-one-closed", ((Index == 2) and (Value == "open")))
+
+Second:close()
+Index, Reason = Channel.select({ First, Second })
+Reporter:expect("SELECT-008-select-closed",     ((Index == nil) and (Reason == "closed")))
+
+--------------------------------------------------------------------------------
+-- WORK QUEUE                                                                 --
+--------------------------------------------------------------------------------
+
+Reporter:block("WORK QUEUE")
+
+local ExitedCount = 0
+
+function WorkerExitEvent (ThreadId)
+  Thread.join(ThreadId)
+  ExitedCount = (ExitedCount + 1)
+  if (ExitedCount == WORKER_COUNT) then
+    Event.stoploop()
+  end
+end
+
+-- Work queue with several consumers
+local Jobs    = Channel.new(16)
+local Results = Channel.new()
+
+for WorkerIndex = 1, WORKER_COUNT do
+  Thread.create("channel-worker", "WorkerExitEvent", { arguments = { Jobs, Results } })
+end
+
+for Job = 1, JOB_COUNT do
+  Jobs:push(Job)
+end
+Jobs:close()
+
+local Sum         = 0
+local JobsDone    = 0
+local DoneCount   = 0
+local AllReceived = true
+
+while (DoneCount < WORKER_COUNT) do
+  local Popped, ThreadId, Result, Count = Results:pop()
+  AllReceived = (AllReceived and Popped)
+  if (Result == "done") then
+    DoneCount = (DoneCount + 1)
+    JobsDone  = (JobsDone + Count)
+  else
+    Sum = (Sum + Result)
+  end
+end
+
+Event.runloop()
+
+Reporter:expect("QUEUE-001-pop-results",   AllReceived)
+Reporter:expect("QUEUE-002-jobs-done",     (JobsDone == JOB_COUNT))
+Reporter:expect("QUEUE-003-sum-of-squares", (Sum == ((JOB_COUNT * (JOB_COUNT + 1) * ((2 * JOB_COUNT) + 1)) // 6)))
+Reporter:expect("QUEUE-004-workers-joined", (ExitedCount == WORKER_COUNT))
+
+--------------------------------------------------------------------------------
+-- SUMMARY
+--------------------------------------------------------------------------------
+
+Reporter:printf("== SUMMARY ==")
+Reporter:summary("os.exit")
@@ -0,0 +1,132 @@
+--------------------------------------------------------------------------------
+-- TESTS BOILERPLATE FOR PACKAGE.PATH                                         --
+--------------------------------------------------------------------------------
+
+-- This kind of code should not appear in the real use of ComEXE
+--
+-- Initialize package.path to include ..\lib\xxx because test libraries are in
+-- this directory
+
+local function TEST_UpdatePackagePath (RelativeDirectory)
+  -- Retrieve package confiuration (file loadlib.c, function luaopen_package)
+  local Configuration = package.config
+  local LUA_DIRSEP    = Configuration:sub(1, 1)
+  local LUA_PATH_SEP  = Configuration:sub(3, 3)
+  local LUA_PATH_MARK = Configuration:sub(5, 5)
+  -- Load required modules
+  local Runtime   = require("com.runtime")
+  local Directory = Runtime.getrelativepath(RelativeDirectory) -- relative to arg[0] directory
+  -- Prepend path in a Linux/Windows compatible way
+  package.path = string.format("%s%s%s.lua%s%s", Directory, LUA_DIRSEP, LUA_PATH_MARK, LUA_PATH_SEP, package.path)
+end
+
+TEST_UpdatePackagePath("../lib")
+
+--------------------------------------------------------------------------------
+-- IMPORTS                                                                    --
+--------------------------------------------------------------------------------
+
+-- A producer faster than its consumer: with a bounded mailbox, Event.send
+-- returns false when the mailbox is full and Event.sendtimeout waits for the
+-- consumer instead of growing the memory.
+
+local Thread   = require("com.thread")
+local Event    = require("com.event")
+local reporter = require("mini-reporter")
+
+local MAX_MESSAGES = 16
+local ITEM_COUNT   = 200
+
+local Reporter      = reporter.new()
+local ReceivedCount = 0
+
+function WorkerDone (Count)
+  ReceivedCount = Count
+end
+
+function WorkerExitEvent (ThreadId)
+  Thread.join(ThreadId)
+  Event.stoploop()
+end
+
+--------------------------------------------------------------------------------
+-- OPTIONS                                                                    --
+--------------------------------------------------------------------------------
+
+Reporter:block("OPTIONS")
+
+Reporter:expect("OPTIONS-001-negative-limit", (not pcall(Thread.create, "backpressure-worker", "WorkerExitEvent", { maxmessages = -1 })))
+Reporter:expect("OPTIONS-002-invalid-options", (not pcall(Thread.create, "backpressure-worker", "WorkerExitEvent", 42)))
+
+--------------------------------------------------------------------------------
+-- NON-BLOCKING                                                               --
+--------------------------------------------------------------------------------
+
+Reporter:block("NON-BLOCKING")
+
+local WorkerId = Thread.create("backpressure-worker", "WorkerExitEvent", { maxmessages = MAX_MESSAGES })
+
+-- The worker takes 1 ms per item, the mailbox fills up
+local SentCount = 0
+local Sent, Reason
+repeat
+  Sent, Reason = Event.send(WorkerId, "ProcessItem", SentCount)
+  if Sent then
+    SentCount = (SentCount + 1)
+  end
+until (not Sent)
+
+Reporter:expect("SEND-001-full", (Reason == "full"))
+
+-- A timeout of 0 never waits, the worker might have made some room meanwhile
+if Event.sendtimeout(WorkerId, 0, "ProcessItem", SentCount) then
+  SentCount = (SentCount + 1)
+end
+
+-- The worker is processing its events: only bounds can be checked
+local Stats = Event.getmailboxstats(WorkerId)
+Reporter:expect("SEND-002-depth",         (Stats.depth <= MAX_MESSAGES))
+Reporter:expect("SEND-003-highwater",     (Stats.highwater <= MAX_MESSAGES))
+Reporter:expect("SEND-004-maxmessages",   (Stats.maxmessages == MAX_MESSAGES))
+Reporter:expect("SEND-005-dropped",       (Stats.dropped >= 1))
+Reporter:expect("SEND-006-bytesenqueued", (Stats.bytesenqueued >= Stats.bytes))
+
+--------------------------------------------------------------------------------
+-- BLOCKING                                                                   --
+--------------------------------------------------------------------------------
+
+Reporter:block("BLOCKING")
+
+-- The worker consumes slowly, the producer follows its pace
+local AllSent = true
+while (SentCount < ITEM_COUNT) do
+  Sent      = Event.sendtimeout(WorkerId, -1, "ProcessItem", SentCount)
+  AllSent   = (AllSent and Sent)
+  SentCount = (SentCount + 1)
+end
+Reporter:expect("SENDTIMEOUT-001-sent", AllSent)
+Reporter:expect("SENDTIMEOUT-002-stop", Event.sendtimeout(WorkerId, -1, "StopWorker"))
+
+Stats = Event.getmailboxstats(WorkerId)
+Reporter:expect("SENDTIMEOUT-003-highwater", (Stats.highwater <= MAX_MESSAGES))
+Reporter:expect("SENDTIMEOUT-004-blocked",   (Stats.blocked > 0))
+Reporter:expect("SENDTIMEOUT-005-enqueued",  (Stats.enqueued == (SentCount + 1)))
+
+Reporter:printf("SENT %d, DROPPED %d, BLOCKED %d, HIGHWATER %d",
+                SentCount, Stats.dropped, Stats.blocked, Stats.highwater)
+
+Event.runloop()
+
+Reporter:expect("SENDTIMEOUT-006-received",     (ReceivedCount == SentCount))
+Reporter:expect("SENDTIMEOUT-007-joined-stats", (Event.getmailboxstats(WorkerId) == nil))
+
+-- The main thread is unbounded
+Stats = Event.getmailboxstats()
+Reporter:expect("SENDTIMEOUT-008-main-unbounded", ((Stats.maxmessages == 0) and (Stats.maxbytes == 0)))
+
+--------------------------------------------------------------------------------
+-- SUMMARY
+--------------------------------------------------------------------------------
+
+Reporter:printf("== SUMMARY ==")
+Reporter:summary("os.exit")
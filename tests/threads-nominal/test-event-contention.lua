@@ -0,0 +1,98 @@
+--------------------------------------------------------------------------------
+-- TESTS BOILERPLATE FOR PACKAGE.PATH                                         --
+--------------------------------------------------------------------------------
+
+-- This kind of code should not appear in the real use of ComEXE
+--
+-- Initialize package.path to include ..\lib\xxx because test libraries are in
+-- this directory
+
+local function TEST_UpdatePackagePath (RelativeDirectory)
+  -- Retrieve package confiuration (file loadlib.c, function luaopen_package)
+  local Configuration = package.config
+  local LUA_DIRSEP    = Configuration:sub(1, 1)
+  local LUA_PATH_SEP  = Configuration:sub(3, 3)
+  local LUA_PATH_MARK = Configuration:sub(5, 5)
+  -- Load required modules
+  local Runtime   = require("com.runtime")
+  local Directory = Runtime.getrelativepath(RelativeDirectory) -- relative to arg[0] directory
+  -- Prepend path in a Linux/Windows compatible way
+  package.path = string.format("%s%s%s.lua%s%s", Directory, LUA_DIRSEP, LUA_PATH_MARK, LUA_PATH_SEP, package.path)
+end
+
+TEST_UpdatePackagePath("../lib")
+
+--------------------------------------------------------------------------------
+-- IMPORTS                                                                    --
+--------------------------------------------------------------------------------
+
+-- Event throughput with many senders and one receiver: N threads send M events
+-- each to the main thread. With the lock-free mailbox, a sender never waits
+-- for the other senders nor for the receiver, only the first event sent to an
+-- empty mailbox wakes up the receiver.
+--
+-- To compare with the previous implementation (double buffer protected by a
+-- mutex), run this test on the previous commit.
+
+local Thread   = require("com.thread")
+local Event    = require("com.event")
+local uv       = require("luv")
+local reporter = require("mini-reporter")
+
+local SENDER_COUNT  = 8
+local MESSAGE_COUNT = 20000 -- Must match contention-sender.lua
+
+local Reporter      = reporter.new()
+local ReceivedCount = 0
+local FinishedCount = 0
+local LastIndex     = {}
+local OrderIsValid  = true
+
+-- Events of a given sender are received in the order they were sent
+function ContentionEvent (SenderId, Index, Payload, Number)
+  local Previous = (LastIndex[SenderId] or 0)
+  if (Index ~= (Previous + 1)) or (Payload ~= "payload") or (Number ~= 1.5) then
+    OrderIsValid = false
+  end
+  LastIndex[SenderId] = Index
+  ReceivedCount       = (ReceivedCount + 1)
+end
+
+function SenderExitEvent (ThreadId)
+  Thread.join(ThreadId)
+  FinishedCount = (FinishedCount + 1)
+  if (FinishedCount == SENDER_COUNT) then
+    Event.stoploop()
+  end
+end
+
+--------------------------------------------------------------------------------
+-- CONTENTION                                                                 --
+--------------------------------------------------------------------------------
+
+Reporter:block("CONTENTION")
+
+local StartTime = uv.hrtime()
+
+for Index = 1, SENDER_COUNT do
+  Thread.create("contention-sender", "SenderExitEvent")
+end
+
+Event.runloop()
+
+local ElapsedSeconds = ((uv.hrtime() - StartTime) / 1e9)
+
+Reporter:printf("%d senders, %d events received in %.3f sec", SENDER_COUNT, ReceivedCount, ElapsedSeconds)
+Reporter:printf("%.0f events/sec", (ReceivedCount / ElapsedSeconds))
+
+-- The exit event of a sender is posted after its last event, so all the events
+-- have been received when the loop stops
+Reporter:expect("CONTENTION-001-received", (ReceivedCount == (SENDER_COUNT * MESSAGE_COUNT)))
+Reporter:expect("CONTENTION-002-order",    OrderIsValid)
+
+--------------------------------------------------------------------------------
+-- SUMMARY
+--------------------------------------------------------------------------------
+
+Reporter:printf("== SUMMARY ==")
+Reporter:summary("os.exit")
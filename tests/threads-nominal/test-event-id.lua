@@ -0,0 +1,120 @@
+--------------------------------------------------------------------------------
+-- TESTS BOILERPLATE FOR PACKAGE.PATH                                         --
+--------------------------------------------------------------------------------
+
+-- This kind of code should not appear in the real use of ComEXE
+--
+-- Initialize package.path to include ..\lib\xxx because test libraries are in
+-- this directory
+
+local function TEST_UpdatePackagePath (RelativeDirectory)
+  -- Retrieve package confiuration (file loadlib.c, function luaopen_package)
+  local Configuration = package.config
+  local LUA_DIRSEP    = Configuration:sub(1, 1)
+  local LUA_PATH_SEP  = Configuration:sub(3, 3)
+  local LUA_PATH_MARK = Configuration:sub(5, 5)
+  -- Load required modules
+  local Runtime   = require("com.runtime")
+  local Directory = Runtime.getrelativepath(RelativeDirectory) -- relative to arg[0] directory
+  -- Prepend path in a Linux/Windows compatible way
+  package.path = string.format("%s%s%s.lua%s%s", Directory, LUA_DIRSEP, LUA_PATH_MARK, LUA_PATH_SEP, package.path)
+end
+
+TEST_UpdatePackagePath("../lib")
+
+--------------------------------------------------------------------------------
+-- IMPORTS                                                                    --
+--------------------------------------------------------------------------------
+
+-- Events sent by ID are dispatched to the handlers registered with
+-- Event.register, the events without handler go to the fallback. Compare the
+-- dispatch of small events by name (global lookup) and by ID.
+
+local Thread   = require("com.thread")
+local Event    = require("com.event")
+local uv       = require("luv")
+local reporter = require("mini-reporter")
+
+local EVENT_COUNT = 100000
+
+local Reporter = reporter.new()
+local Reply
+
+Event.register("WorkerReply", function (...)
+  Reply = table.pack(...)
+  Event.stoploop()
+end)
+
+function WorkerExitEvent (ThreadId)
+  Thread.join(ThreadId)
+  Event.stoploop()
+end
+
+--------------------------------------------------------------------------------
+-- IDS                                                                        --
+--------------------------------------------------------------------------------
+
+Reporter:block("IDS")
+
+-- The IDs are the same in all the threads
+local PingId = Event.getid("Ping")
+Reporter:expect("ID-001-getid-stable",      (Event.getid("Ping") == PingId))
+Reporter:expect("ID-002-getname",           (Event.getname(PingId) == "Ping"))
+Reporter:expect("ID-003-getname-unknown",   (Event.getname(123456) == nil))
+Reporter:expect("ID-004-register-number",   (not pcall(Event.register, "Ping", 42)))
+
+local WorkerId = Thread.create("eventid-worker", "WorkerExitEvent")
+Event.runloop()
+Reporter:expect("ID-005-worker-ready", (Reply[1] == "ready"))
+
+--------------------------------------------------------------------------------
+-- DISPATCH                                                                   --
+--------------------------------------------------------------------------------
+
+Reporter:block("DISPATCH")
+
+local function RunBenchmark (Label, EventName)
+  local StartTime = uv.hrtime()
+  for Index = 1, EVENT_COUNT do
+    Event.send(WorkerId, EventName, Index)
+  end
+  Event.send(WorkerId, "Report", Label)
+  Event.runloop()
+  local ElapsedMs = ((uv.hrtime() - StartTime) / 1e6)
+  Reporter:printf("%-5s %d events in %.1f ms (%.0f events/s)",
+                  Label, EVENT_COUNT, ElapsedMs, (EVENT_COUNT / (ElapsedMs / 1000)))
+  -- Return value
+  return ((Reply[1] == Label) and (Reply[2] == EVENT_COUNT))
+end
+
+Reporter:expect("DISPATCH-001-by-name", RunBenchmark("NAME", "PingGlobal"))
+Reporter:expect("DISPATCH-002-by-id",   RunBenchmark("ID", PingId))
+
+--------------------------------------------------------------------------------
+-- FALLBACK                                                                   --
+--------------------------------------------------------------------------------
+
+Reporter:block("FALLBACK")
+
+-- No handler: the fallback receives the name and the arguments
+Event.send(WorkerId, "Nope", 1, 2)
+Event.runloop()
+Reporter:expect("FALLBACK-001-by-name", ((Reply[1] == "fallback") and (Reply[2] == "Nope") and (Reply[3] == 2)))
+
+Event.send(WorkerId, Event.getid("Nope"), 1)
+Event.runloop()
+Reporter:expect("FALLBACK-002-by-id", ((Reply[1] == "fallback") and (Reply[2] == "Nope") and (Reply[3] == 1)))
+
+Event.send(WorkerId, 123456)
+Event.runloop()
+Reporter:expect("FALLBACK-003-unknown-id", ((Reply[1] == "fallback") and (Reply[2] == 123456) and (Reply[3] == 0)))
+
+Event.send(WorkerId, Event.getid("Stop"))
+Event.runloop()
+
+--------------------------------------------------------------------------------
+-- SUMMARY
+--------------------------------------------------------------------------------
+
+Reporter:printf("== SUMMARY ==")
+Reporter:summary("os.exit")
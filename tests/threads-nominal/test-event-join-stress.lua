@@ -0,0 +1,120 @@
+--------------------------------------------------------------------------------
+-- TESTS BOILERPLATE FOR PACKAGE.PATH                                         --
+--------------------------------------------------------------------------------
+
+-- This kind of code should not appear in the real use of ComEXE
+--
+-- Initialize package.path to include ..\lib\xxx because test libraries are in
+-- this directory
+
+local function TEST_UpdatePackagePath (RelativeDirectory)
+  -- Retrieve package confiuration (file loadlib.c, function luaopen_package)
+  local Configuration = package.config
+  local LUA_DIRSEP    = Configuration:sub(1, 1)
+  local LUA_PATH_SEP  = Configuration:sub(3, 3)
+  local LUA_PATH_MARK = Configuration:sub(5, 5)
+  -- Load required modules
+  local Runtime   = require("com.runtime")
+  local Directory = Runtime.getrelativepath(RelativeDirectory) -- relative to arg[0] directory
+  -- Prepend path in a Linux/Windows compatible way
+  package.path = string.format("%s%s%s.lua%s%s", Directory, LUA_DIRSEP, LUA_PATH_MARK, LUA_PATH_SEP, package.path)
+end
+
+TEST_UpdatePackagePath("../lib")
+
+--------------------------------------------------------------------------------
+-- IMPORTS                                                                    --
+--------------------------------------------------------------------------------
+
+-- Broadcast, publish, send and call while the targets are joined: the senders
+-- deliver after releasing the lock on the instances, Event.sendtimeout and
+-- Thread.calltimeout wait without it, so Thread.join must not release or
+-- recycle a target still used by a sender. The workers finish as soon as they
+-- start, the pool recycles their instances.
+
+local Thread   = require("com.thread")
+local Event    = require("com.event")
+local reporter = require("mini-reporter")
+
+local POOL_SIZE    = 4
+local WORKER_COUNT = 8
+local SENDER_COUNT = 4
+
+local Reporter      = reporter.new()
+local LiveWorkers   = 0
+local JoinedWorkers = 0
+local JoinedSenders = 0
+local SentCount     = 0
+local Stopping      = false
+
+-- The main thread receives the broadcasts too
+function StressEvent (Payload)
+end
+
+local function StopIfDone ()
+  if Stopping and (LiveWorkers == 0) then
+    Event.stoploop()
+  end
+end
+
+function WorkerExitEvent (ThreadId)
+  Thread.join(ThreadId)
+  LiveWorkers   = (LiveWorkers - 1)
+  JoinedWorkers = (JoinedWorkers + 1)
+  if Stopping then
+    StopIfDone()
+  else
+    Thread.create("stress-worker", "WorkerExitEvent")
+    LiveWorkers = (LiveWorkers + 1)
+  end
+end
+
+function SenderDone (Count)
+  SentCount = (SentCount + Count)
+end
+
+function SenderExitEvent (ThreadId)
+  Thread.join(ThreadId)
+  JoinedSenders = (JoinedSenders + 1)
+  if (JoinedSenders == SENDER_COUNT) then
+    Stopping = true
+    StopIfDone()
+  end
+end
+
+--------------------------------------------------------------------------------
+-- JOIN WHILE SENDING                                                         --
+--------------------------------------------------------------------------------
+
+Reporter:block("JOIN WHILE SENDING")
+
+Thread.setpoolsize(POOL_SIZE)
+
+for Index = 1, WORKER_COUNT do
+  Thread.create("stress-worker", "WorkerExitEvent")
+  LiveWorkers = (LiveWorkers + 1)
+end
+
+for Index = 1, SENDER_COUNT do
+  Thread.create("stress-sender", "SenderExitEvent")
+end
+
+Event.runloop()
+
+local Stats = Thread.getpoolstats()
+
+Reporter:printf("%d workers joined, %d events sent, %d instances recycled",
+                JoinedWorkers,
+                SentCount,
+                Stats.recycled)
+
+Reporter:expect("STRESS-001-workers-joined", (JoinedWorkers > WORKER_COUNT))
+Reporter:expect("STRESS-002-events-sent",    (SentCount > 0))
+Reporter:expect("STRESS-003-recycled",       (Stats.recycled > 0))
+
+--------------------------------------------------------------------------------
+-- SUMMARY
+--------------------------------------------------------------------------------
+
+Reporter:printf("== SUMMARY ==")
+Reporter:summary("os.exit")
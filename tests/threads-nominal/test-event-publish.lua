@@ -0,0 +1,143 @@
+--------------------------------------------------------------------------------
+-- TESTS BOILERPLATE FOR PACKAGE.PATH                                         --
+--------------------------------------------------------------------------------
+
+-- This kind of code should not appear in the real use of ComEXE
+--
+-- Initialize package.path to include ..\lib\xxx because test libraries are in
+-- this directory
+
+local function TEST_UpdatePackagePath (RelativeDirectory)
+  -- Retrieve package confiuration (file loadlib.c, function luaopen_package)
+  local Configuration = package.config
+  local LUA_DIRSEP    = Configuration:sub(1, 1)
+  local LUA_PATH_SEP  = Configuration:sub(3, 3)
+  local LUA_PATH_MARK = Configuration:sub(5, 5)
+  -- Load required modules
+  local Runtime   = require("com.runtime")
+  local Directory = Runtime.getrelativepath(RelativeDirectory) -- relative to arg[0] directory
+  -- Prepend path in a Linux/Windows compatible way
+  package.path = string.format("%s%s%s.lua%s%s", Directory, LUA_DIRSEP, LUA_PATH_MARK, LUA_PATH_SEP, package.path)
+end
+
+TEST_UpdatePackagePath("../lib")
+
+--------------------------------------------------------------------------------
+-- IMPORTS                                                                    --
+--------------------------------------------------------------------------------
+
+-- Event.publish only reaches the subscribers of a topic, Event.broadcast
+-- reaches all the threads. In both cases, the arguments are encoded once and
+-- shared by all the targets.
+
+local Thread   = require("com.thread")
+local Event    = require("com.event")
+local uv       = require("luv")
+local reporter = require("mini-reporter")
+
+local WORKER_COUNT = 16
+local CONFIG_SIZE  = (1024 * 1024)
+
+local Config = string.rep("c", CONFIG_SIZE)
+
+local Reporter      = reporter.new()
+local ReadyCount    = 0
+local ReceivedCount = 0
+local ExpectedCount = 0
+local JoinedCount   = 0
+local SizeIsValid   = true
+
+function WorkerReady (ThreadId)
+  ReadyCount = (ReadyCount + 1)
+  if (ReadyCount == WORKER_COUNT) then
+    Event.stoploop()
+  end
+end
+
+function ConfigReceived (ThreadId, Size)
+  if (Size ~= CONFIG_SIZE) then
+    SizeIsValid = false
+  end
+  ReceivedCount = (ReceivedCount + 1)
+  if (ReceivedCount == ExpectedCount) then
+    Event.stoploop()
+  end
+end
+
+-- The main thread receives its own broadcast
+function ConfigEvent (Value)
+  ConfigReceived(1, #Value)
+end
+
+function WorkerExitEvent (ThreadId)
+  Thread.join(ThreadId)
+  JoinedCount = (JoinedCount + 1)
+  if (JoinedCount == WORKER_COUNT) then
+    Event.stoploop()
+  end
+end
+
+local Workers     = {}
+local Subscribers = 0
+for Index = 1, WORKER_COUNT do
+  Workers[Index] = Thread.create("publish-worker", "WorkerExitEvent")
+  if ((Workers[Index] % 2) == 0) then
+    Subscribers = (Subscribers + 1)
+  end
+end
+Event.runloop()
+
+--------------------------------------------------------------------------------
+-- PUBLISH                                                                    --
+--------------------------------------------------------------------------------
+
+Reporter:block("PUBLISH")
+
+-- Publish to the subscribers only
+ReceivedCount = 0
+ExpectedCount = Subscribers
+local StartTime = uv.hrtime()
+local Reached   = Event.publish("config", "ConfigEvent", Config)
+Event.runloop()
+local PublishMs = ((uv.hrtime() - StartTime) / 1e6)
+
+Reporter:printf("PUBLISH:   %d/%d threads in %.2f ms", ReceivedCount, WORKER_COUNT, PublishMs)
+Reporter:expect("PUBLISH-001-reached",  (Reached == Subscribers))
+Reporter:expect("PUBLISH-002-received", (ReceivedCount == Subscribers))
+
+-- Nobody subscribed to this topic
+Reporter:expect("PUBLISH-003-no-subscriber", (Event.publish("nobody", "ConfigEvent", Config) == 0))
+
+--------------------------------------------------------------------------------
+-- BROADCAST                                                                  --
+--------------------------------------------------------------------------------
+
+Reporter:block("BROADCAST")
+
+-- Broadcast to all, including the main thread
+ReceivedCount = 0
+ExpectedCount = (WORKER_COUNT + 1)
+StartTime     = uv.hrtime()
+local BroadcastReached = Event.broadcast("ConfigEvent", Config)
+Event.runloop()
+local BroadcastMs = ((uv.hrtime() - StartTime) / 1e6)
+
+Reporter:printf("BROADCAST: %d threads in %.2f ms", ReceivedCount, BroadcastMs)
+Reporter:expect("BROADCAST-001-received", (ReceivedCount == ExpectedCount))
+Reporter:expect("BROADCAST-002-size",     SizeIsValid)
+Reporter:expect("BROADCAST-003-reached",  (BroadcastReached == ExpectedCount))
+
+-- The joined threads are unsubscribed
+for Index, ThreadId in ipairs(Workers) do
+  Event.send(ThreadId, "StopWorker")
+end
+Event.runloop()
+
+Reporter:expect("BROADCAST-004-unsubscribed", (Event.publish("config", "ConfigEvent", Config) == 0))
+
+--------------------------------------------------------------------------------
+-- SUMMARY
+--------------------------------------------------------------------------------
+
+Reporter:printf("== SUMMARY ==")
+Reporter:summary("os.exit")
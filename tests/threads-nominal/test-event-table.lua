@@ -0,0 +1,199 @@
+--------------------------------------------------------------------------------
+-- TESTS BOILERPLATE FOR PACKAGE.PATH                                         --
+--------------------------------------------------------------------------------
+
+-- This kind of code should not appear in the real use of ComEXE
+--
+-- Initialize package.path to include ..\lib\xxx because test libraries are in
+-- this directory
+
+local function TEST_UpdatePackagePath (RelativeDirectory)
+  -- Retrieve package confiuration (file loadlib.c, function luaopen_package)
+  local Configuration = package.config
+  local LUA_DIRSEP    = Configuration:sub(1, 1)
+  local LUA_PATH_SEP  = Configuration:sub(3, 3)
+  local LUA_PATH_MARK = Configuration:sub(5, 5)
+  -- Load required modules
+  local Runtime   = require("com.runtime")
+  local Directory = Runtime.getrelativepath(RelativeDirectory) -- relative to arg[0] directory
+  -- Prepend path in a Linux/Windows compatible way
+  package.path = string.format("%s%s%s.lua%s%s", Directory, LUA_DIRSEP, LUA_PATH_MARK, LUA_PATH_SEP, package.path)
+end
+
+TEST_UpdatePackagePath("../lib")
+
+--------------------------------------------------------------------------------
+-- IMPORTS                                                                    --
+--------------------------------------------------------------------------------
+
+-- Tables in events: correctness of the copy, errors, and throughput of the
+-- native encoding against the string round-trip which was needed before
+-- (serialize to a Lua constructor, send the string, load it back). The native
+-- encoding is about 9x faster, the test only checks that it is faster: a
+-- loaded machine slows down both benchmarks.
+--
+-- The events are sent to the current thread, so only the encoding and the
+-- decoding are measured.
+
+local Thread   = require("com.thread")
+local Event    = require("com.event")
+local uv       = require("luv")
+local reporter = require("mini-reporter")
+
+local format = string.format
+local concat = table.concat
+
+local SelfId   = Thread.getid()
+local Reporter = reporter.new()
+
+--------------------------------------------------------------------------------
+-- CORRECTNESS                                                                --
+--------------------------------------------------------------------------------
+
+Reporter:block("CORRECTNESS")
+
+local Received
+
+function TableEvent (Value, Trailing)
+  Received = { Value, Trailing }
+end
+
+local function RoundTrip (Value)
+  Received = nil
+  Event.send(SelfId, "TableEvent", Value, "END")
+  Event.runonce()
+  -- Return value
+  return Received[1], Received[2]
+end
+
+local Source = {
+  10, 20, 30,
+  name   = "table",
+  ratio  = 0.5,
+  flag   = false,
+  nested = { 1, { 2, { 3 } }, key = "value" },
+  [-1]   = "negative",
+  [100]  = "sparse",
+}
+
+local Copy, Trailing = RoundTrip(Source)
+
+Reporter:expect("TABLE-001-copy",     (Copy ~= Source))
+Reporter:expect("TABLE-002-trailing", (Trailing == "END"))
+Reporter:expect("TABLE-003-array",    ((#Copy == 3) and (Copy[1] == 10) and (Copy[3] == 30)))
+Reporter:expect("TABLE-004-fields",   ((Copy.name == "table") and (Copy.ratio == 0.5) and (Copy.flag == false)))
+Reporter:expect("TABLE-005-nested",   ((Copy.nested[2][2][1] == 3) and (Copy.nested.key == "value")))
+Reporter:expect("TABLE-006-sparse",   ((Copy[-1] == "negative") and (Copy[100] == "sparse")))
+
+-- A table seen twice, but not in its own path, is copied twice
+local Shared = { 1 }
+local Twice  = RoundTrip({ Shared, Shared })
+Reporter:expect("TABLE-007-seen-twice", ((Twice[1][1] == 1) and (Twice[2][1] == 1)))
+
+-- Cycles, excessive nesting and unsupported values raise an error
+local Cycle = {}
+Cycle.self  = Cycle
+
+local Deep = {}
+local Current = Deep
+for Level = 1, 40 do
+  Current.next = {}
+  Current      = Current.next
+end
+
+local function ExpectError (Value, Pattern)
+  local Status, Message = pcall(Event.send, SelfId, "TableEvent", Value)
+  return (not Status) and (Message:find(Pattern, 1, true) ~= nil)
+end
+
+Reporter:expect("TABLE-008-cycle",       ExpectError(Cycle, "cycle detected"))
+Reporter:expect("TABLE-009-deep",        ExpectError(Deep, "nested too deeply"))
+Reporter:expect("TABLE-010-unsupported", ExpectError({ print }, "unsupported type 'function'"))
+
+--------------------------------------------------------------------------------
+-- THROUGHPUT                                                                 --
+--------------------------------------------------------------------------------
+
+Reporter:block("THROUGHPUT")
+
+local MESSAGE_COUNT = 20000
+local BATCH_SIZE    = 1000
+
+local function Serialize (Value, Buffer)
+  local ValueType = type(Value)
+  if (ValueType == "table") then
+    Buffer[#Buffer + 1] = "{"
+    for Key, Item in pairs(Value) do
+      Buffer[#Buffer + 1] = "["
+      Serialize(Key, Buffer)
+      Buffer[#Buffer + 1] = "]="
+      Serialize(Item, Buffer)
+      Buffer[#Buffer + 1] = ","
+    end
+    Buffer[#Buffer + 1] = "}"
+  elseif (ValueType == "string") then
+    Buffer[#Buffer + 1] = format("%q", Value)
+  else
+    Buffer[#Buffer + 1] = tostring(Value)
+  end
+end
+
+local function ToString (Value)
+  local Buffer = {}
+  Serialize(Value, Buffer)
+  -- Return value
+  return concat(Buffer)
+end
+
+local Message = {
+  id      = 42,
+  method  = "update",
+  values  = { 1, 2, 3, 4, 5, 6, 7, 8 },
+  options = { enabled = true, ratio = 0.25, label = "some label" },
+}
+
+local ReceivedCount = 0
+
+function NativeEvent (Value)
+  ReceivedCount = (ReceivedCount + 1)
+end
+
+function StringEvent (String)
+  local Value = load(format("return %s", String), "=event", "t")()
+  ReceivedCount = (ReceivedCount + 1)
+end
+
+local function RunBenchmark (Label, EventName, Convert)
+  ReceivedCount = 0
+  local StartTime = uv.hrtime()
+  for Batch = 1, (MESSAGE_COUNT // BATCH_SIZE) do
+    for Index = 1, BATCH_SIZE do
+      Event.send(SelfId, EventName, Convert(Message))
+    end
+    Event.runonce()
+  end
+  local ElapsedSeconds = ((uv.hrtime() - StartTime) / 1e9)
+  local Rate           = (ReceivedCount / ElapsedSeconds)
+  Reporter:printf("%-7s %d tables in %.3f sec, %.0f tables/sec", Label, ReceivedCount, ElapsedSeconds, Rate)
+  -- Return value
+  return Rate, ReceivedCount
+end
+
+local function Identity (Value)
+  return Value
+end
+
+local StringRate, StringCount = RunBenchmark("STRING", "StringEvent", ToString)
+local NativeRate, NativeCount = RunBenchmark("NATIVE", "NativeEvent", Identity)
+
+Reporter:printf("NATIVE/STRING: %.1fx", (NativeRate / StringRate))
+Reporter:expect("THROUGHPUT-001-string-received", (StringCount == MESSAGE_COUNT))
+Reporter:expect("THROUGHPUT-002-native-received", (NativeCount == MESSAGE_COUNT))
+Reporter:expect("THROUGHPUT-003-native-faster",   (NativeRate > StringRate))
+
+--------------------------------------------------------------------------------
+-- SUMMARY
+--------------------------------------------------------------------------------
+
+Reporter:printf("== SUMMARY ==")
+Reporter:summary("os.exit")
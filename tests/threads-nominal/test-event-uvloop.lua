@@ -0,0 +1,110 @@
+--------------------------------------------------------------------------------
+-- TESTS BOILERPLATE FOR PACKAGE.PATH                                         --
+--------------------------------------------------------------------------------
+
+-- This kind of code should not appear in the real use of ComEXE
+--
+-- Initialize package.path to include ..\lib\xxx because test libraries are in
+-- this directory
+
+local function TEST_UpdatePackagePath (RelativeDirectory)
+  -- Retrieve package confiuration (file loadlib.c, function luaopen_package)
+  local Configuration = package.config
+  local LUA_DIRSEP    = Configuration:sub(1, 1)
+  local LUA_PATH_SEP  = Configuration:sub(3, 3)
+  local LUA_PATH_MARK = Configuration:sub(5, 5)
+  -- Load required modules
+  local Runtime   = require("com.runtime")
+  local Directory = Runtime.getrelativepath(RelativeDirectory) -- relative to arg[0] directory
+  -- Prepend path in a Linux/Windows compatible way
+  package.path = string.format("%s%s%s.lua%s%s", Directory, LUA_DIRSEP, LUA_PATH_MARK, LUA_PATH_SEP, package.path)
+end
+
+TEST_UpdatePackagePath("../lib")
+
+--------------------------------------------------------------------------------
+-- IMPORTS                                                                    --
+--------------------------------------------------------------------------------
+
+-- Event.runloop("uv"): the events of the other threads and the luv handles are
+-- serviced by the same uv_run, without polling
+
+local Thread   = require("com.thread")
+local Event    = require("com.event")
+local uv       = require("luv")
+local reporter = require("mini-reporter")
+
+local Reporter      = reporter.new()
+local ReceivedCount = 0
+local TimerCount    = 0
+local SenderJoined  = false
+
+function UvLoopEvent (Index)
+  ReceivedCount = (ReceivedCount + 1)
+end
+
+function SenderExitEvent (ThreadId)
+  Thread.join(ThreadId)
+  SenderJoined = true
+end
+
+--------------------------------------------------------------------------------
+-- UV LOOP                                                                    --
+--------------------------------------------------------------------------------
+
+Reporter:block("UV LOOP")
+
+-- 1) Events and timer in the same loop
+local Timer = uv.new_timer()
+Timer:start(10, 10, function ()
+  TimerCount = (TimerCount + 1)
+  if SenderJoined and (TimerCount >= 10) then
+    Timer:stop()
+    Event.stoploop()
+  end
+end)
+
+Thread.create("uvloop-sender", "SenderExitEvent")
+Event.runloop("uv")
+
+Reporter:printf("events: %d, timer ticks: %d", ReceivedCount, TimerCount)
+Reporter:expect("UVLOOP-001-events", (ReceivedCount == 5))
+
+-- 2) The loop can be run again, and it does not burn CPU while idle
+local IdleTimer = uv.new_timer()
+IdleTimer:start(300, 0, function ()
+  Event.stoploop()
+end)
+
+local CpuStart  = os.clock()
+local WallStart = uv.hrtime()
+Event.runloop("uv")
+local CpuMs  = ((os.clock() - CpuStart) * 1000)
+local WallMs = ((uv.hrtime() - WallStart) / 1e6)
+
+Reporter:printf("idle loop: %.1f ms elapsed, %.1f ms CPU", WallMs, CpuMs)
+Reporter:expect("UVLOOP-002-idle-timer", (WallMs >= 250))
+Reporter:expect("UVLOOP-003-idle-cpu",   (CpuMs < 100))
+
+Timer:close()
+IdleTimer:close()
+
+-- 3) The default mode still works after the uv mode
+local SecondSender = false
+function SecondSenderExitEvent (ThreadId)
+  Thread.join(ThreadId)
+  SecondSender = true
+  Event.stoploop()
+end
+
+Thread.create("uvloop-sender", "SecondSenderExitEvent")
+Event.runloop()
+
+Reporter:expect("UVLOOP-004-default-mode", (SecondSender and (ReceivedCount == 10)))
+
+--------------------------------------------------------------------------------
+-- SUMMARY
+--------------------------------------------------------------------------------
+
+Reporter:printf("== SUMMARY ==")
+Reporter:summary("os.exit")
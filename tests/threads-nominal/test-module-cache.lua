@@ -0,0 +1,114 @@
+--------------------------------------------------------------------------------
+-- TESTS BOILERPLATE FOR PACKAGE.PATH                                         --
+--------------------------------------------------------------------------------
+
+-- This kind of code should not appear in the real use of ComEXE
+--
+-- Initialize package.path to include ..\lib\xxx because test libraries are in
+-- this directory
+
+local function TEST_UpdatePackagePath (RelativeDirectory)
+  -- Retrieve package confiuration (file loadlib.c, function luaopen_package)
+  local Configuration = package.config
+  local LUA_DIRSEP    = Configuration:sub(1, 1)
+  local LUA_PATH_SEP  = Configuration:sub(3, 3)
+  local LUA_PATH_MARK = Configuration:sub(5, 5)
+  -- Load required modules
+  local Runtime   = require("com.runtime")
+  local Directory = Runtime.getrelativepath(RelativeDirectory) -- relative to arg[0] directory
+  -- Prepend path in a Linux/Windows compatible way
+  package.path = string.format("%s%s%s.lua%s%s", Directory, LUA_DIRSEP, LUA_PATH_MARK, LUA_PATH_SEP, package.path)
+end
+
+TEST_UpdatePackagePath("../lib")
+
+--------------------------------------------------------------------------------
+-- IMPORTS                                                                    --
+--------------------------------------------------------------------------------
+
+-- The ZIP entries and the bytecode of the modules are cached process-wide: a
+-- module already loaded by one thread must be a cache hit for the next ones.
+
+local Runtime  = require("com.runtime")
+local Thread   = require("com.thread")
+local Event    = require("com.event")
+local reporter = require("mini-reporter")
+
+local MODULE_NAME = "com.chunk-buffer"
+
+local Reporter = reporter.new()
+
+local function PrintStats (Label, Stats)
+  Reporter:printf("%-8s hits=%d misses=%d entries=%d size=%d/%d evictions=%d",
+                  Label,
+                  Stats.hits,
+                  Stats.misses,
+                  Stats.entries,
+                  Stats.size,
+                  Stats.capacity,
+                  Stats.evictions)
+end
+
+--------------------------------------------------------------------------------
+-- FIRST LOAD                                                                 --
+--------------------------------------------------------------------------------
+
+Reporter:block("FIRST LOAD")
+
+local StatsInitial = Runtime.getmodulecachestats()
+PrintStats("INITIAL", StatsInitial)
+
+-- Make sure the module is in the cache, the first load counts a single miss
+-- even if several keys are probed
+require(MODULE_NAME)
+
+local StatsBefore = Runtime.getmodulecachestats()
+PrintStats("BEFORE", StatsBefore)
+
+Reporter:expect("CACHE-001-first-load-miss",   ((StatsBefore.misses - StatsInitial.misses) == 1))
+Reporter:expect("CACHE-002-first-load-no-hit", ((StatsBefore.hits - StatsInitial.hits) == 0))
+
+--------------------------------------------------------------------------------
+-- RELOAD                                                                     --
+--------------------------------------------------------------------------------
+
+Reporter:block("RELOAD")
+
+-- The chunk is served from its bytecode, the entry is not inflated again
+local MODULE_ENTRY = "comexe/usr/share/lua/5.5/com/chunk-buffer.lua"
+
+local Chunk       = Runtime.loadzipentry(MODULE_ENTRY, "@com.chunk-buffer")
+local StatsReload = Runtime.getmodulecachestats()
+PrintStats("RELOAD", StatsReload)
+
+Reporter:expect("RELOAD-001-chunk",    (type(Chunk) == "function"))
+Reporter:expect("RELOAD-002-hit",      ((StatsReload.hits - StatsBefore.hits) == 1))
+Reporter:expect("RELOAD-003-no-miss",  (StatsReload.misses == StatsBefore.misses))
+Reporter:expect("RELOAD-004-no-entry", (StatsReload.entries == StatsBefore.entries))
+
+--------------------------------------------------------------------------------
+-- OTHER THREAD                                                               --
+--------------------------------------------------------------------------------
+
+Reporter:block("OTHER THREAD")
+
+function WorkerExitEvent (ThreadId)
+  Thread.join(ThreadId)
+  Event.stoploop()
+end
+
+Thread.create("module-cache-worker", "WorkerExitEvent")
+Event.runloop()
+
+local StatsAfter = Runtime.getmodulecachestats()
+PrintStats("AFTER", StatsAfter)
+
+Reporter:expect("CACHE-003-worker-hit", (StatsAfter.hits > StatsBefore.hits))
+Reporter:expect("CACHE-004-capacity",   (StatsAfter.size <= StatsAfter.capacity))
+
+--------------------------------------------------------------------------------
+-- SUMMARY
+--------------------------------------------------------------------------------
+
+Reporter:printf("== SUMMARY ==")
+Reporter:summary("os.exit")
@@ -0,0 +1,208 @@
+--------------------------------------------------------------------------------
+-- TESTS BOILERPLATE FOR PACKAGE.PATH                                         --
+--------------------------------------------------------------------------------
+
+-- This kind of code should not appear in the real use of ComEXE
+--
+-- Initialize package.path to include ..\lib\xxx because test libraries are in
+-- this directory
+
+local function TEST_UpdatePackagePath (RelativeDirectory)
+  -- Retrieve package confiuration (file loadlib.c, function luaopen_package)
+  local Configuration = package.config
+  local LUA_DIRSEP    = Configuration:sub(1, 1)
+  local LUA_PATH_SEP  = Configuration:sub(3, 3)
+  local LUA_PATH_MARK = Configuration:sub(5, 5)
+  -- Load required modules
+  local Runtime   = require("com.runtime")
+  local Directory = Runtime.getrelativepath(RelativeDirectory) -- relative to arg[0] directory
+  -- Prepend path in a Linux/Windows compatible way
+  package.path = string.format("%s%s%s.lua%s%s", Directory, LUA_DIRSEP, LUA_PATH_MARK, LUA_PATH_SEP, package.path)
+end
+
+TEST_UpdatePackagePath("../lib")
+
+--------------------------------------------------------------------------------
+-- IMPORTS                                                                    --
+--------------------------------------------------------------------------------
+
+-- com.parallel: futures, map and foreach over a pool of workers, the workers
+-- which exit on an error, and the speedup of a CPU-bound map compared to a
+-- single thread. The speedup is only checked with a CPU per worker, against
+-- MIN_SPEEDUP far below the ideal.
+
+local Parallel = require("com.parallel")
+local Shared   = require("com.shared")
+local Thread   = require("com.thread")
+local uv       = require("luv")
+local reporter = require("mini-reporter")
+
+local JOB_COUNT     = 64
+local JOB_ITERATION = 200000 -- Loop of Burn
+local MIN_SPEEDUP   = 1.5
+
+local Reporter = reporter.new()
+
+-- No upvalue: the function is sent to the workers with string.dump
+local function Burn (Job)
+  local Value = Job.Seed
+  for Index = 1, Job.IterationCount do
+    Value = ((Value * 1103515245) + 12345) % 2147483648
+  end
+  return Value
+end
+
+--------------------------------------------------------------------------------
+-- FUTURES                                                                    --
+--------------------------------------------------------------------------------
+
+Reporter:block("FUTURES")
+
+local Pool = Parallel.new(4)
+Reporter:expect("FUTURE-001-workercount", (Pool:workercount() == 4))
+
+local Future = Pool:submit(function (A, B) return (A + B), (A * B) end, 6, 7)
+local Ok, Sum, Product = Future:get()
+Reporter:expect("FUTURE-002-submit",  (Ok and (Sum == 13) and (Product == 42)))
+Reporter:expect("FUTURE-003-isready", Future:isready())
+
+Ok, Sum = Pool:submit("parallel-task:Square", 9):get()
+Reporter:expect("FUTURE-004-module-task", (Ok and (Sum == 81)))
+
+local Message
+Ok, Message = Pool:submit(function () error("expected error", 0) end):get()
+Reporter:expect("FUTURE-005-error", ((not Ok) and (Message == "expected error")))
+
+Ok, Message = Pool:submit("parallel-task:Unknown"):get()
+Reporter:expect("FUTURE-006-unknown-function", ((not Ok) and (type(Message) == "string")))
+
+-- Futures collected without being read, the futures must not stay on the
+-- stack of the caller
+local function SubmitAndDrop (Count)
+  for Index = 1, Count do
+    Pool:submit(function (Value) return Value end, Index)
+  end
+end
+
+local function IsEmpty (Table)
+  return (next(Table) == nil)
+end
+
+-- Results received after the collection
+SubmitAndDrop(10)
+collectgarbage("collect")
+Reporter:expect("FUTURE-007-dropped-futures", Pool:submit(function () return true end):get())
+uv.sleep(100)
+Reporter:expect("FUTURE-008-dropped-futures", Pool:submit(function () return true end):get())
+Reporter:expect("FUTURE-009-dropped-received-later", (IsEmpty(Pool.Done) and IsEmpty(Pool.Abandoned)))
+
+-- Results received before the collection
+SubmitAndDrop(10)
+uv.sleep(100)
+Reporter:expect("FUTURE-010-dropped-futures", Pool:submit(function () return true end):get())
+collectgarbage("collect")
+Reporter:expect("FUTURE-011-dropped-received-before", (IsEmpty(Pool.Done) and IsEmpty(Pool.Abandoned)))
+
+local Slow = Pool:submit(function (DelayMs) require("luv").sleep(DelayMs) return true end, 100)
+Ok, Message = Slow:get(10)
+Reporter:expect("FUTURE-012-get-timeout",       ((not Ok) and (Message == "timeout")))
+Reporter:expect("FUTURE-013-get-after-timeout", Slow:get())
+
+--------------------------------------------------------------------------------
+-- MAP AND FOREACH                                                            --
+--------------------------------------------------------------------------------
+
+Reporter:block("MAP AND FOREACH")
+
+-- Map, results in order
+local Values = {}
+for Index = 1, 1000 do
+  Values[Index] = Index
+end
+local Squares = Pool:map("parallel-task:Square", Values)
+local Ordered = (#Squares == 1000)
+for Index = 1, 1000 do
+  Ordered = Ordered and (Squares[Index] == (Index * Index))
+end
+Reporter:expect("MAP-001-map",       Ordered)
+Reporter:expect("MAP-002-map-empty", (#Pool:map(Burn, {}) == 0))
+
+local Raised = not pcall(Pool.map, Pool, function (Value) assert(Value < 500) end, Values, 100)
+Reporter:expect("MAP-003-map-error", Raised)
+
+-- Foreach, the workers count in a shared store
+Pool:foreach(function (Value) require("com.shared").open("parallel"):incr("sum", Value) end, Values)
+Reporter:expect("MAP-004-foreach", (Shared.open("parallel"):get("sum") == 500500))
+
+--------------------------------------------------------------------------------
+-- WORKER EXIT                                                                --
+--------------------------------------------------------------------------------
+
+Reporter:block("WORKER EXIT")
+
+-- The argument doesn't fit in the memory of the worker: popping the job raises
+-- an error out of the job and the worker exits. The timeouts only keep the
+-- test from hanging, the futures must fail before.
+local SmallPool = Parallel.new(1, { maxmemory = (4 * 1024 * 1024) })
+local Lost      = SmallPool:submit(function (Value) return #Value end, string.rep("x", (16 * 1024 * 1024)))
+local Queued    = SmallPool:submit(function () return true end)
+
+local function IsWorkerExit (Ok, Message)
+  return (not Ok) and (type(Message) == "string") and (Message:find("worker exited", 1, true) ~= nil)
+end
+
+Reporter:expect("EXIT-001-lost-job",         IsWorkerExit(Lost:get(10000)))
+Reporter:expect("EXIT-002-queued-job",       IsWorkerExit(Queued:get(10000)))
+Reporter:expect("EXIT-003-submit-no-worker", IsWorkerExit(SmallPool:submit(Burn, {}):get(10000)))
+SmallPool:close()
+
+--------------------------------------------------------------------------------
+-- SPEEDUP                                                                    --
+--------------------------------------------------------------------------------
+
+Reporter:block("SPEEDUP")
+
+local Jobs = {}
+for Index = 1, JOB_COUNT do
+  Jobs[Index] = { Seed = Index, IterationCount = JOB_ITERATION }
+end
+
+local StartTime = uv.hrtime()
+local Expected  = {}
+for Index = 1, JOB_COUNT do
+  Expected[Index] = Burn(Jobs[Index])
+end
+local SerialMs = ((uv.hrtime() - StartTime) / 1e6)
+
+StartTime = uv.hrtime()
+local Results = Pool:map(Burn, Jobs, 1)
+local ParallelMs = ((uv.hrtime() - StartTime) / 1e6)
+
+local AllMatched = true
+for Index = 1, JOB_COUNT do
+  AllMatched = AllMatched and (Results[Index] == Expected[Index])
+end
+Reporter:expect("SPEEDUP-001-map-results", AllMatched)
+
+local CpuCount = Thread.getcpucount()
+local Speedup  = (SerialMs / ParallelMs)
+
+Reporter:printf("PARALLEL %d jobs of %d iterations: serial %.1f ms, %d workers %.1f ms, speedup %.2f, %d CPUs",
+                JOB_COUNT, JOB_ITERATION, SerialMs, Pool:workercount(), ParallelMs, Speedup, CpuCount)
+
+if (CpuCount >= Pool:workercount()) then
+  Reporter:expect("SPEEDUP-002-faster-than-serial", (Speedup > MIN_SPEEDUP))
+else
+  Reporter:printf("SPEEDUP not checked: %d CPUs for %d workers", CpuCount, Pool:workercount())
+end
+
+Pool:close()
+Ok = pcall(Pool.submit, Pool, Burn, 1)
+Reporter:expect("SPEEDUP-003-submit-after-close", (not Ok))
+
+--------------------------------------------------------------------------------
+-- SUMMARY
+--------------------------------------------------------------------------------
+
+Reporter:printf("== SUMMARY ==")
+Reporter:summary("os.exit")
@@ -0,0 +1,152 @@
+--------------------------------------------------------------------------------
+-- TESTS BOILERPLATE FOR PACKAGE.PATH                                         --
+--------------------------------------------------------------------------------
+
+-- This kind of code should not appear in the real use of ComEXE
+--
+-- Initialize package.path to include ..\lib\xxx because test libraries are in
+-- this directory
+
+local function TEST_UpdatePackagePath (RelativeDirectory)
+  -- Retrieve package confiuration (file loadlib.c, function luaopen_package)
+  local Configuration = package.config
+  local LUA_DIRSEP    = Configuration:sub(1, 1)
+  local LUA_PATH_SEP  = Configuration:sub(3, 3)
+  local LUA_PATH_MARK = Configuration:sub(5, 5)
+  -- Load required modules
+  local Runtime   = require("com.runtime")
+  local Directory = Runtime.getrelativepath(RelativeDirectory) -- relative to arg[0] directory
+  -- Prepend path in a Linux/Windows compatible way
+  package.path = string.format("%s%s%s.lua%s%s", Directory, LUA_DIRSEP, LUA_PATH_MARK, LUA_PATH_SEP, package.path)
+end
+
+TEST_UpdatePackagePath("../lib")
+
+--------------------------------------------------------------------------------
+-- IMPORTS                                                                    --
+--------------------------------------------------------------------------------
+
+-- Stores shared by all the threads: the API in a single thread, then the
+-- read/write throughput with several threads.
+
+local Thread   = require("com.thread")
+local Event    = require("com.event")
+local Shared   = require("com.shared")
+local uv       = require("luv")
+local reporter = require("mini-reporter")
+
+local WORKER_COUNT    = 4
+local OPERATION_COUNT = 200000
+local WRITE_RATIO     = 10 -- One write every 10 operations
+local KEY_COUNT       = 1000
+
+local Reporter = reporter.new()
+
+--------------------------------------------------------------------------------
+-- SINGLE THREAD                                                              --
+--------------------------------------------------------------------------------
+
+Reporter:block("VALUES")
+
+local Store = Shared.open("test")
+Reporter:expect("SHARED-001-set", Store:set("string", "value"))
+Store:set("integer", 42)
+Store:set("float", 1.5)
+Store:set("boolean", false)
+Store:set("table", { name = "comexe", list = { 1, 2, 3 } })
+Reporter:expect("SHARED-002-get-string", (Store:get("string") == "value"))
+Reporter:expect("SHARED-003-get-integer", (math.type(Store:get("integer")) == "integer"))
+Reporter:expect("SHARED-004-get-float", (Store:get("float") == 1.5))
+Reporter:expect("SHARED-005-get-boolean", (Store:get("boolean") == false))
+local Table = Store:get("table")
+Reporter:expect("SHARED-006-get-table", ((Table.name == "comexe") and (Table.list[3] == 3)))
+Reporter:expect("SHARED-007-get-unknown", (Store:get("unknown") == nil))
+Reporter:expect("SHARED-008-same-store", (Shared.open("test"):get("string") == "value"))
+Reporter:expect("SHARED-009-other-store", (Shared.open("other"):get("string") == nil))
+
+Store:set("string", nil)
+Reporter:expect("SHARED-010-set-nil", (Store:get("string") == nil))
+Store:delete("integer")
+Reporter:expect("SHARED-011-delete", (Store:get("integer") == nil))
+
+Reporter:block("ATOMIC OPERATIONS")
+
+-- Add
+Reporter:expect("SHARED-012-add", Store:add("added", 1))
+local Ok, Reason = Store:add("added", 2)
+Reporter:expect("SHARED-013-add-exists", ((not Ok) and (Reason == "exists") and (Store:get("added") == 1)))
+
+-- Increment
+Reporter:expect("SHARED-014-incr-new", (Store:incr("counter") == 1))
+Reporter:expect("SHARED-015-incr-delta", (Store:incr("counter", 10) == 11))
+Reporter:expect("SHARED-016-incr-float", (Store:incr("counter", 0.5) == 11.5))
+local Value, Message = Store:incr("table")
+Reporter:expect("SHARED-017-incr-table", ((Value == nil) and (Message == "not a number")))
+
+-- Compare and swap
+Reporter:expect("SHARED-018-cas-absent", Store:cas("cas", nil, "first"))
+Reporter:expect("SHARED-019-cas-present", (not Store:cas("cas", nil, "second")))
+Reporter:expect("SHARED-020-cas-mismatch", (not Store:cas("cas", "other", "second")))
+Reporter:expect("SHARED-021-cas-match", (Store:cas("cas", "first", "second") and (Store:get("cas") == "second")))
+Store:set("cas-number", 1)
+Reporter:expect("SHARED-022-cas-number", Store:cas("cas-number", 1.0, 2))
+
+Reporter:block("TTL AND ITERATION")
+
+-- TTL
+Store:set("ttl", "short", 20)
+Reporter:expect("SHARED-023-ttl", (Store:ttl("ttl") <= 20))
+Reporter:expect("SHARED-024-ttl-none", (Store:ttl("added") == -1))
+Reporter:expect("SHARED-025-ttl-unknown", (Store:ttl("unknown") == nil))
+Reporter:expect("SHARED-026-expire", Store:expire("added", 20))
+uv.sleep(40)
+Reporter:expect("SHARED-027-expired", ((Store:get("ttl") == nil) and (Store:get("added") == nil)))
+Reporter:expect("SHARED-028-add-expired", Store:add("ttl", "again"))
+Reporter:expect("SHARED-029-flushexpired", (Store:flushexpired() == 1))
+
+-- Iteration
+local Keys = Store:keys()
+table.sort(Keys)
+Reporter:expect("SHARED-030-keys-count", (#Keys == Store:count()))
+Reporter:expect("SHARED-031-keys", (table.concat(Keys, ",") == "boolean,cas,cas-number,counter,float,table,ttl"))
+Store:clear()
+Reporter:expect("SHARED-032-clear", (Store:count() == 0))
+
+--------------------------------------------------------------------------------
+-- THROUGHPUT                                                                 --
+--------------------------------------------------------------------------------
+
+Reporter:block("THROUGHPUT")
+
+local Counters = Shared.open("benchmark")
+local Exited   = 0
+
+function WorkerExitEvent (ThreadId)
+  Thread.join(ThreadId)
+  Exited = (Exited + 1)
+  if (Exited == WORKER_COUNT) then
+    Event.stoploop()
+  end
+end
+
+local StartTime = uv.hrtime()
+for Index = 1, WORKER_COUNT do
+  Thread.create("shared-worker", "WorkerExitEvent",
+                { arguments = { "benchmark", OPERATION_COUNT, WRITE_RATIO, KEY_COUNT } })
+end
+Event.runloop()
+local ElapsedMs = ((uv.hrtime() - StartTime) / 1e6)
+
+Reporter:expect("SHARED-033-workers-done", (Counters:get("done") == WORKER_COUNT))
+Reporter:expect("SHARED-034-atomic-incr", (Counters:get("writes") == ((WORKER_COUNT * OPERATION_COUNT) // WRITE_RATIO)))
+
+local OperationTotal = (WORKER_COUNT * OPERATION_COUNT)
+Reporter:printf("SHARED %d threads, %d operations (1 write every %d): %.1f ms, %.0f operations per second",
+                WORKER_COUNT, OperationTotal, WRITE_RATIO, ElapsedMs, ((OperationTotal * 1000) / ElapsedMs))
+
+--------------------------------------------------------------------------------
+-- SUMMARY
+--------------------------------------------------------------------------------
+
+Reporter:printf("== SUMMARY ==")
+Reporter:summary("os.exit")
@@ -0,0 +1,131 @@
+--------------------------------------------------------------------------------
+-- TESTS BOILERPLATE FOR PACKAGE.PATH                                         --
+--------------------------------------------------------------------------------
+
+-- This kind of code should not appear in the real use of ComEXE
+--
+-- Initialize package.path to include ..\lib\xxx because test libraries are in
+-- this directory
+
+local function TEST_UpdatePackagePath (RelativeDirectory)
+  -- Retrieve package confiuration (file loadlib.c, function luaopen_package)
+  local Configuration = package.config
+  local LUA_DIRSEP    = Configuration:sub(1, 1)
+  local LUA_PATH_SEP  = Configuration:sub(3, 3)
+  local LUA_PATH_MARK = Configuration:sub(5, 5)
+  -- Load required modules
+  local Runtime   = require("com.runtime")
+  local Directory = Runtime.getrelativepath(RelativeDirectory) -- relative to arg[0] directory
+  -- Prepend path in a Linux/Windows compatible way
+  package.path = string.format("%s%s%s.lua%s%s", Directory, LUA_DIRSEP, LUA_PATH_MARK, LUA_PATH_SEP, package.path)
+end
+
+TEST_UpdatePackagePath("../lib")
+
+--------------------------------------------------------------------------------
+-- IMPORTS                                                                    --
+--------------------------------------------------------------------------------
+
+-- Thread.call sends an event and waits for the values returned by its
+-- handler. Compare the round-trip latency with the two-event pattern.
+
+local Thread   = require("com.thread")
+local Event    = require("com.event")
+local uv       = require("luv")
+local reporter = require("mini-reporter")
+
+local ROUND_TRIP_COUNT = 10000
+
+local Reporter = reporter.new()
+
+function WorkerExitEvent (ThreadId)
+  Thread.join(ThreadId)
+  Event.stoploop()
+end
+
+function Pong (Value)
+  Event.stoploop()
+end
+
+local WorkerId = Thread.create("call-worker", "WorkerExitEvent")
+
+--------------------------------------------------------------------------------
+-- RESULTS AND ERRORS                                                         --
+--------------------------------------------------------------------------------
+
+Reporter:block("RESULTS AND ERRORS")
+
+local Ok, Value, Key = Thread.call(WorkerId, "Get", "answer")
+Reporter:expect("CALL-001-get",         (Ok and (Value == 42) and (Key == "answer")))
+
+Ok, Value = Thread.call(WorkerId, "Get", "unknown")
+Reporter:expect("CALL-002-get-unknown", (Ok and (Value == nil)))
+
+Ok, Value = Thread.call(WorkerId, "Fail", "expected error")
+Reporter:expect("CALL-003-fail",        ((not Ok) and (Value == "expected error")))
+
+Ok, Value = Thread.call(WorkerId, "NoSuchFunction")
+Reporter:expect("CALL-004-no-handler",  ((not Ok) and (type(Value) == "string")))
+
+Ok, Value = Thread.call(123456, "Get", "answer")
+Reporter:expect("CALL-005-invalid-thread", ((not Ok) and (Value == "invalid thread ID")))
+
+Ok, Value = Thread.call(Thread.getid(), "Get", "answer")
+Reporter:expect("CALL-006-itself", (not Ok))
+
+--------------------------------------------------------------------------------
+-- TIMEOUT AND POSTCALL                                                       --
+--------------------------------------------------------------------------------
+
+Reporter:block("TIMEOUT AND POSTCALL")
+
+-- Timeout, the late reply is dropped
+Ok, Value = Thread.calltimeout(WorkerId, 10, "Slow", 200)
+Reporter:expect("TIMEOUT-001-calltimeout",        ((not Ok) and (Value == "timeout")))
+
+Ok, Value = Thread.calltimeout(WorkerId, 1000, "Get", "name")
+Reporter:expect("TIMEOUT-002-call-after-timeout", (Ok and (Value == "comexe")))
+
+-- Non-blocking call, as used by a Copas coroutine
+Reporter:expect("TIMEOUT-003-postcall",        Thread.postcall(WorkerId, "Slow", 50))
+Reporter:expect("TIMEOUT-004-reply-too-early", (Thread.getreply() == nil))
+repeat
+  uv.sleep(1)
+  Ok, Value = Thread.getreply()
+until (Ok ~= nil)
+Reporter:expect("TIMEOUT-005-getreply", (Ok and (Value == "slow")))
+
+--------------------------------------------------------------------------------
+-- ROUND-TRIP LATENCY                                                         --
+--------------------------------------------------------------------------------
+
+Reporter:block("ROUND-TRIP LATENCY")
+
+local StartTime = uv.hrtime()
+for Index = 1, ROUND_TRIP_COUNT do
+  Event.send(WorkerId, "Ping", Index)
+  Event.runloop()
+end
+local EventsMs = ((uv.hrtime() - StartTime) / 1e6)
+
+StartTime = uv.hrtime()
+for Index = 1, ROUND_TRIP_COUNT do
+  Ok, Value = Thread.call(WorkerId, "Get", "answer")
+end
+local CallMs = ((uv.hrtime() - StartTime) / 1e6)
+Reporter:expect("LATENCY-001-last-call", (Ok and (Value == 42)))
+
+Reporter:printf("EVENTS %d round trips: %.1f ms, %.2f us per round trip",
+                ROUND_TRIP_COUNT, EventsMs, ((EventsMs * 1000) / ROUND_TRIP_COUNT))
+Reporter:printf("CALL   %d round trips: %.1f ms, %.2f us per round trip",
+                ROUND_TRIP_COUNT, CallMs, ((CallMs * 1000) / ROUND_TRIP_COUNT))
+
+Event.send(WorkerId, Event.getid("Stop"))
+Event.runloop()
+
+--------------------------------------------------------------------------------
+-- SUMMARY
+--------------------------------------------------------------------------------
+
+Reporter:printf("== SUMMARY ==")
+Reporter:summary("os.exit")
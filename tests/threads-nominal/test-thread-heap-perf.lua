@@ -0,0 +1,90 @@
+--------------------------------------------------------------------------------
+-- TESTS BOILERPLATE FOR PACKAGE.PATH                                         --
+--------------------------------------------------------------------------------
+
+-- This kind of code should not appear in the real use of ComEXE
+--
+-- Initialize package.path to include ..\lib\xxx because test libraries are in
+-- this directory
+
+local function TEST_UpdatePackagePath (RelativeDirectory)
+  -- Retrieve package confiuration (file loadlib.c, function luaopen_package)
+  local Configuration = package.config
+  local LUA_DIRSEP    = Configuration:sub(1, 1)
+  local LUA_PATH_SEP  = Configuration:sub(3, 3)
+  local LUA_PATH_MARK = Configuration:sub(5, 5)
+  -- Load required modules
+  local Runtime   = require("com.runtime")
+  local Directory = Runtime.getrelativepath(RelativeDirectory) -- relative to arg[0] directory
+  -- Prepend path in a Linux/Windows compatible way
+  package.path = string.format("%s%s%s.lua%s%s", Directory, LUA_DIRSEP, LUA_PATH_MARK, LUA_PATH_SEP, package.path)
+end
+
+TEST_UpdatePackagePath("../lib")
+
+--------------------------------------------------------------------------------
+-- IMPORTS                                                                    --
+--------------------------------------------------------------------------------
+
+-- Allocation-heavy threads: table churn in 16 threads, then the time to tear
+-- down threads holding a large lua_State. Each instance allocates from its own
+-- heap and closes its lua_State before the end of its thread, which is
+-- measured by Thread.join.
+
+local Thread   = require("com.thread")
+local Event    = require("com.event")
+local uv       = require("luv")
+local reporter = require("mini-reporter")
+
+local THREAD_COUNT = 16
+local CHURN_COUNT  = 500000
+local KEEP_COUNT   = 200000
+
+local Reporter = reporter.new()
+
+--------------------------------------------------------------------------------
+-- CHURN AND TEARDOWN                                                         --
+--------------------------------------------------------------------------------
+
+Reporter:block("CHURN AND TEARDOWN")
+
+local ExitedCount = 0
+local JoinedCount = 0
+local JoinNs      = 0
+local MaxJoinNs   = 0
+
+function WorkerExitEvent (ThreadId)
+  local StartTime = uv.hrtime()
+  if Thread.join(ThreadId) then
+    JoinedCount = (JoinedCount + 1)
+  end
+  local ElapsedNs = (uv.hrtime() - StartTime)
+  JoinNs      = (JoinNs + ElapsedNs)
+  MaxJoinNs   = math.max(MaxJoinNs, ElapsedNs)
+  ExitedCount = (ExitedCount + 1)
+  if (ExitedCount == THREAD_COUNT) then
+    Event.stoploop()
+  end
+end
+
+local StartTime = uv.hrtime()
+for Index = 1, THREAD_COUNT do
+  Thread.create("heap-worker", "WorkerExitEvent", { arguments = { CHURN_COUNT, KEEP_COUNT } })
+end
+Event.runloop()
+local TotalMs = ((uv.hrtime() - StartTime) / 1e6)
+
+Reporter:expect("HEAP-001-all-threads-exited", (ExitedCount == THREAD_COUNT))
+Reporter:expect("HEAP-002-all-threads-joined", (JoinedCount == THREAD_COUNT))
+
+Reporter:printf("HEAP %d threads, %d churned tables and %d kept objects each: %.1f ms",
+                THREAD_COUNT, CHURN_COUNT, KEEP_COUNT, TotalMs)
+Reporter:printf("HEAP teardown (Thread.join): %.2f ms average, %.2f ms max",
+                ((JoinNs / THREAD_COUNT) / 1e6), (MaxJoinNs / 1e6))
+
+--------------------------------------------------------------------------------
+-- SUMMARY
+--------------------------------------------------------------------------------
+
+Reporter:printf("== SUMMARY ==")
+Reporter:summary("os.exit")
@@ -0,0 +1,99 @@
+--------------------------------------------------------------------------------
+-- TESTS BOILERPLATE FOR PACKAGE.PATH                                         --
+--------------------------------------------------------------------------------
+
+-- This kind of code should not appear in the real use of ComEXE
+--
+-- Initialize package.path to include ..\lib\xxx because test libraries are in
+-- this directory
+
+local function TEST_UpdatePackagePath (RelativeDirectory)
+  -- Retrieve package confiuration (file loadlib.c, function luaopen_package)
+  local Configuration = package.config
+  local LUA_DIRSEP    = Configuration:sub(1, 1)
+  local LUA_PATH_SEP  = Configuration:sub(3, 3)
+  local LUA_PATH_MARK = Configuration:sub(5, 5)
+  -- Load required modules
+  local Runtime   = require("com.runtime")
+  local Directory = Runtime.getrelativepath(RelativeDirectory) -- relative to arg[0] directory
+  -- Prepend path in a Linux/Windows compatible way
+  package.path = string.format("%s%s%s.lua%s%s", Directory, LUA_DIRSEP, LUA_PATH_MARK, LUA_PATH_SEP, package.path)
+end
+
+TEST_UpdatePackagePath("../lib")
+
+--------------------------------------------------------------------------------
+-- IMPORTS                                                                    --
+--------------------------------------------------------------------------------
+
+-- Memory accounting and limits of the threads: a thread reaching its limit
+-- gets a memory error, and a thread which doesn't catch it finishes without
+-- stopping the application.
+
+local Thread   = require("com.thread")
+local Event    = require("com.event")
+local Runtime  = require("com.raw.runtime")
+local reporter = require("mini-reporter")
+
+local MAX_MEMORY = (8 * 1024 * 1024)
+
+local Reporter = reporter.new()
+
+--------------------------------------------------------------------------------
+-- ACCOUNTING                                                                 --
+--------------------------------------------------------------------------------
+
+Reporter:block("ACCOUNTING")
+
+local Stats = Runtime.getmemorystats()
+Reporter:expect("MEMORY-001-own-stats",      ((Stats.bytes > 0) and (Stats.peak >= Stats.bytes) and (Stats.allocations > 0)))
+Reporter:expect("MEMORY-002-no-limit",       (Stats.maxmemory == 0))
+Reporter:expect("MEMORY-003-invalid-thread", (Thread.getmemorystats(123456) == nil))
+
+local Before = Runtime.getmemorystats().bytes
+local Garbage = {}
+for Index = 1, 10000 do
+  Garbage[Index] = { Index }
+end
+Reporter:expect("MEMORY-004-bytes-grow", (Runtime.getmemorystats().bytes > Before))
+Garbage = nil
+
+--------------------------------------------------------------------------------
+-- LIMIT                                                                      --
+--------------------------------------------------------------------------------
+
+Reporter:block("LIMIT")
+
+-- The worker catches the memory error
+local Exited = false
+
+function WorkerResult (Ok, Message, Count, WorkerStats)
+  Reporter:expect("LIMIT-001-memory-error",          ((not Ok) and (Message == "not enough memory")))
+  Reporter:expect("LIMIT-002-allocations-before",    (Count > 0))
+  Reporter:expect("LIMIT-003-maxmemory",             (WorkerStats.maxmemory == MAX_MEMORY))
+  Reporter:expect("LIMIT-004-refused",               (WorkerStats.refused > 0))
+  Reporter:expect("LIMIT-005-peak-under-the-limit",  (WorkerStats.peak <= MAX_MEMORY))
+end
+
+function WorkerExitEvent (ThreadId)
+  Thread.join(ThreadId)
+  Exited = true
+  Event.stoploop()
+end
+
+Thread.create("memory-worker", "WorkerExitEvent", { maxmemory = MAX_MEMORY, arguments = { "catch" } })
+Event.runloop()
+Reporter:expect("LIMIT-006-catch-exit", Exited)
+
+-- The memory error is not caught, only the worker finishes
+Exited = false
+Thread.create("memory-worker", "WorkerExitEvent", { maxmemory = MAX_MEMORY, arguments = { "raise" } })
+Event.runloop()
+Reporter:expect("LIMIT-007-raise-exit", Exited)
+
+--------------------------------------------------------------------------------
+-- SUMMARY
+--------------------------------------------------------------------------------
+
+Reporter:printf("== SUMMARY ==")
+Reporter:summary("os.exit")
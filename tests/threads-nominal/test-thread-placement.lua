@@ -0,0 +1,145 @@
+--------------------------------------------------------------------------------
+-- TESTS BOILERPLATE FOR PACKAGE.PATH                                         --
+--------------------------------------------------------------------------------
+
+-- This kind of code should not appear in the real use of ComEXE
+--
+-- Initialize package.path to include ..\lib\xxx because test libraries are in
+-- this directory
+
+local function TEST_UpdatePackagePath (RelativeDirectory)
+  -- Retrieve package confiuration (file loadlib.c, function luaopen_package)
+  local Configuration = package.config
+  local LUA_DIRSEP    = Configuration:sub(1, 1)
+  local LUA_PATH_SEP  = Configuration:sub(3, 3)
+  local LUA_PATH_MARK = Configuration:sub(5, 5)
+  -- Load required modules
+  local Runtime   = require("com.runtime")
+  local Directory = Runtime.getrelativepath(RelativeDirectory) -- relative to arg[0] directory
+  -- Prepend path in a Linux/Windows compatible way
+  package.path = string.format("%s%s%s.lua%s%s", Directory, LUA_DIRSEP, LUA_PATH_MARK, LUA_PATH_SEP, package.path)
+end
+
+TEST_UpdatePackagePath("../lib")
+
+--------------------------------------------------------------------------------
+-- IMPORTS                                                                    --
+--------------------------------------------------------------------------------
+
+-- Thread placement: CPU affinity, priority, name and stack size given to
+-- Thread.create are applied by the new thread, and reverted when a pooled
+-- thread runs another module.
+
+local Thread   = require("com.thread")
+local Event    = require("com.event")
+local uv       = require("luv")
+local reporter = require("mini-reporter")
+
+local Reporter = reporter.new()
+
+--------------------------------------------------------------------------------
+-- OPTIONS                                                                    --
+--------------------------------------------------------------------------------
+
+Reporter:block("OPTIONS")
+
+local CpuCount = Thread.getcpucount()
+Reporter:expect("OPTIONS-001-getcpucount", ((math.type(CpuCount) == "integer") and (CpuCount >= 1)))
+
+-- Invalid options
+Reporter:expect("OPTIONS-002-empty-cpus",       (not pcall(Thread.create, "placement-worker", nil, { cpus = {} })))
+Reporter:expect("OPTIONS-003-negative-cpu",     (not pcall(Thread.create, "placement-worker", nil, { cpus = { -1 } })))
+Reporter:expect("OPTIONS-004-unknown-priority", (not pcall(Thread.create, "placement-worker", nil, { priority = "urgent" })))
+Reporter:expect("OPTIONS-005-name-type",        (not pcall(Thread.create, "placement-worker", nil, { name = 42 })))
+
+--------------------------------------------------------------------------------
+-- PLACEMENT                                                                  --
+--------------------------------------------------------------------------------
+
+Reporter:block("PLACEMENT")
+
+local Result
+
+function WorkerResult (...)
+  Result = table.pack(...)
+end
+
+function WorkerExit (ThreadId)
+  Thread.join(ThreadId)
+  Event.stoploop()
+end
+
+local function RunWorker (Options)
+  Result = nil
+  Thread.create("placement-worker", "WorkerExit", Options)
+  Event.runloop()
+  return table.unpack(Result, 1, Result.n)
+end
+
+local IsLinux = (uv.os_uname().sysname == "Linux")
+
+-- Explicit placement, lowering the priority needs no privilege
+local Name, FirstCpu, WorkerCpuCount, Priority, Depth = RunWorker({
+  cpus      = { 0 },
+  priority  = "belownormal",
+  name      = "placed-worker",
+  stacksize = (8 * 1024 * 1024),
+})
+Reporter:expect("PLACEMENT-001-stack", (Depth == 10000))
+if IsLinux then
+  Reporter:expect("PLACEMENT-002-name",     (Name == "placed-worker"))
+  Reporter:expect("PLACEMENT-003-affinity", (FirstCpu and (WorkerCpuCount == 1)))
+  Reporter:expect("PLACEMENT-004-priority", (Priority > 0))
+end
+
+--------------------------------------------------------------------------------
+-- POOLED THREADS                                                             --
+--------------------------------------------------------------------------------
+
+Reporter:block("POOLED THREADS")
+
+local function CountCpus (Affinity)
+  local Count = 0
+  for Cpu = 1, #Affinity do
+    if Affinity[Cpu] then
+      Count = (Count + 1)
+    end
+  end
+  return Count
+end
+
+local function WaitIdle ()
+  while (Thread.getpoolstats().idle < 1) do
+    uv.sleep(1)
+  end
+  return Thread.getpoolstats()
+end
+
+-- Defaults, the pooled threads restore the affinity at startup
+Thread.setpoolsize(1)
+RunWorker({ cpus = { 0 } })
+Name, FirstCpu, WorkerCpuCount = RunWorker()
+if IsLinux then
+  Reporter:expect("POOL-001-default-name",      (Name == "placement-worke"))
+  Reporter:expect("POOL-002-affinity-restored", (WorkerCpuCount == CountCpus(uv.thread_self():getaffinity())))
+end
+
+-- A priority can't be reverted: the thread is neither claimed from the pool
+-- nor recycled, the next pooled thread has the default priority
+local Before = WaitIdle()
+RunWorker({ priority = "lowest" })
+local After = WaitIdle()
+Reporter:expect("POOL-003-priority-not-claimed",  (After.hits == Before.hits))
+Reporter:expect("POOL-004-priority-not-recycled", (After.recycled == Before.recycled))
+Name, FirstCpu, WorkerCpuCount, Priority = RunWorker()
+if IsLinux then
+  Reporter:expect("POOL-005-default-priority", (Priority == 0))
+end
+Thread.setpoolsize(0)
+
+--------------------------------------------------------------------------------
+-- SUMMARY
+--------------------------------------------------------------------------------
+
+Reporter:printf("== SUMMARY ==")
+Reporter:summary("os.exit")
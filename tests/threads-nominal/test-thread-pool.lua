@@ -0,0 +1,117 @@
+--------------------------------------------------------------------------------
+-- TESTS BOILERPLATE FOR PACKAGE.PATH                                         --
+--------------------------------------------------------------------------------
+
+-- This kind of code should not appear in the real use of ComEXE
+--
+-- Initialize package.path to include ..\lib\xxx because test libraries are in
+-- this directory
+
+local function TEST_UpdatePackagePath (RelativeDirectory)
+  -- Retrieve package confiuration (file loadlib.c, function luaopen_package)
+  local Configuration = package.config
+  local LUA_DIRSEP    = Configuration:sub(1, 1)
+  local LUA_PATH_SEP  = Configuration:sub(3, 3)
+  local LUA_PATH_MARK = Configuration:sub(5, 5)
+  -- Load required modules
+  local Runtime   = require("com.runtime")
+  local Directory = Runtime.getrelativepath(RelativeDirectory) -- relative to arg[0] directory
+  -- Prepend path in a Linux/Windows compatible way
+  package.path = string.format("%s%s%s.lua%s%s", Directory, LUA_DIRSEP, LUA_PATH_MARK, LUA_PATH_SEP, package.path)
+end
+
+TEST_UpdatePackagePath("../lib")
+
+--------------------------------------------------------------------------------
+-- IMPORTS                                                                    --
+--------------------------------------------------------------------------------
+
+-- Thread.create claims the idle instances of the pool, Thread.join sends the
+-- finished instances back to the pool after a reset.
+
+local Thread   = require("com.thread")
+local Event    = require("com.event")
+local uv       = require("luv")
+local reporter = require("mini-reporter")
+
+local POOL_SIZE    = 4
+local THREAD_COUNT = 32
+
+local Reporter = reporter.new()
+
+local function PrintStats (Label, Stats)
+  Reporter:printf("%-8s size=%d idle=%d warming=%d hits=%d misses=%d recycled=%d",
+                  Label,
+                  Stats.size,
+                  Stats.idle,
+                  Stats.warming,
+                  Stats.hits,
+                  Stats.misses,
+                  Stats.recycled)
+end
+
+-- Wait until the pool is warm
+local function WaitIdleCount (Count)
+  local Stats = Thread.getpoolstats()
+  local Retry = 0
+  while (Stats.idle < Count) and (Retry < 500) do
+    uv.sleep(10)
+    Stats = Thread.getpoolstats()
+    Retry = (Retry + 1)
+  end
+  return Stats
+end
+
+--------------------------------------------------------------------------------
+-- RECYCLING                                                                  --
+--------------------------------------------------------------------------------
+
+Reporter:block("RECYCLING")
+
+Thread.setpoolsize(POOL_SIZE)
+local WarmStats = WaitIdleCount(POOL_SIZE)
+PrintStats("WARM", WarmStats)
+Reporter:expect("POOL-001-warm", (WarmStats.idle == POOL_SIZE))
+
+local JoinedCount = 0
+
+function WorkerExitEvent (ThreadId)
+  Thread.join(ThreadId)
+  JoinedCount = (JoinedCount + 1)
+  if (JoinedCount < THREAD_COUNT) then
+    Thread.create("pool-worker", "WorkerExitEvent")
+  else
+    Event.stoploop()
+  end
+end
+
+Thread.create("pool-worker", "WorkerExitEvent")
+Event.runloop()
+
+local Stats = WaitIdleCount(POOL_SIZE)
+PrintStats("AFTER", Stats)
+
+Reporter:expect("POOL-002-joined",   (JoinedCount == THREAD_COUNT))
+Reporter:expect("POOL-003-hits",     (Stats.hits > 0))
+Reporter:expect("POOL-004-recycled", (Stats.recycled > 0))
+Reporter:expect("POOL-005-idle",     (Stats.idle == POOL_SIZE))
+
+--------------------------------------------------------------------------------
+-- SHRINK                                                                     --
+--------------------------------------------------------------------------------
+
+Reporter:block("SHRINK")
+
+-- The idle instances are terminated
+Thread.setpoolsize(0)
+local EmptyStats = Thread.getpoolstats()
+PrintStats("EMPTY", EmptyStats)
+
+Reporter:expect("SHRINK-001-empty", (EmptyStats.idle == 0))
+
+--------------------------------------------------------------------------------
+-- SUMMARY
+--------------------------------------------------------------------------------
+
+Reporter:printf("== SUMMARY ==")
+Reporter:summary("os.exit")
@@ -0,0 +1,109 @@
+--------------------------------------------------------------------------------
+-- TESTS BOILERPLATE FOR PACKAGE.PATH                                         --
+--------------------------------------------------------------------------------
+
+-- This kind of code should not appear in the real use of ComEXE
+--
+-- Initialize package.path to include ..\lib\xxx because test libraries are in
+-- this directory
+
+local function TEST_UpdatePackagePath (RelativeDirectory)
+  -- Retrieve package confiuration (file loadlib.c, function luaopen_package)
+  local Configuration = package.config
+  local LUA_DIRSEP    = Configuration:sub(1, 1)
+  local LUA_PATH_SEP  = Configuration:sub(3, 3)
+  local LUA_PATH_MARK = Configuration:sub(5, 5)
+  -- Load required modules
+  local Runtime   = require("com.runtime")
+  local Directory = Runtime.getrelativepath(RelativeDirectory) -- relative to arg[0] directory
+  -- Prepend path in a Linux/Windows compatible way
+  package.path = string.format("%s%s%s.lua%s%s", Directory, LUA_DIRSEP, LUA_PATH_MARK, LUA_PATH_SEP, package.path)
+end
+
+TEST_UpdatePackagePath("../lib")
+
+--------------------------------------------------------------------------------
+-- IMPORTS                                                                    --
+--------------------------------------------------------------------------------
+
+-- Named threads: Thread.register, Thread.whereis, and the events and calls
+-- sent to a name instead of a thread ID
+
+local Thread   = require("com.thread")
+local Event    = require("com.event")
+local reporter = require("mini-reporter")
+
+local Reporter = reporter.new()
+
+local Registered
+
+function WorkerReady (Ok)
+  Registered = Ok
+  Event.stoploop()
+end
+
+function WorkerExitEvent (ThreadId)
+  Thread.join(ThreadId)
+  Event.stoploop()
+end
+
+--------------------------------------------------------------------------------
+-- REGISTER                                                                   --
+--------------------------------------------------------------------------------
+
+Reporter:block("REGISTER")
+
+Reporter:expect("REGISTER-001-unknown-name",         (Thread.whereis("cache") == nil))
+Reporter:expect("REGISTER-002-send-to-unknown-name", (Event.send("cache", "Set", "key", 1) == false))
+Reporter:expect("REGISTER-003-empty-name",           (not pcall(Thread.register, "")))
+
+-- Register the worker
+local WorkerId = Thread.create("registry-worker", "WorkerExitEvent", { arguments = { "cache" } })
+Event.runloop()
+Reporter:expect("REGISTER-004-worker-registered", Registered)
+Reporter:expect("REGISTER-005-whereis",           (Thread.whereis("cache") == WorkerId))
+
+-- The name belongs to the worker
+local Ok, Reason = Thread.register("cache")
+Reporter:expect("REGISTER-006-name-taken", ((not Ok) and (Reason == "exists")))
+
+--------------------------------------------------------------------------------
+-- EVENTS AND CALLS BY NAME                                                   --
+--------------------------------------------------------------------------------
+
+Reporter:block("EVENTS AND CALLS BY NAME")
+
+Reporter:expect("NAME-001-send",        Event.send("cache", "Set", "key", 42))
+Reporter:expect("NAME-002-sendtimeout", Event.sendtimeout("cache", -1, "Set", "other", 7))
+local Value
+Ok, Value = Thread.call("cache", "Get", "key")
+Reporter:expect("NAME-003-call",         (Ok and (Value == 42)))
+Ok, Value = Thread.calltimeout("cache", 1000, "Get", "other")
+Reporter:expect("NAME-004-calltimeout",  (Ok and (Value == 7)))
+Ok, Value = Thread.call("unknown", "Get", "key")
+Reporter:expect("NAME-005-call-unknown", (not Ok))
+
+--------------------------------------------------------------------------------
+-- OWN NAME                                                                   --
+--------------------------------------------------------------------------------
+
+Reporter:block("OWN NAME")
+
+-- Replaced by the second register
+Reporter:expect("OWN-001-register",          Thread.register("main-a"))
+Reporter:expect("OWN-002-register-again",    Thread.register("main-b"))
+Reporter:expect("OWN-003-name-replaced",     ((Thread.whereis("main-a") == nil) and (Thread.whereis("main-b") == Thread.getid())))
+Reporter:expect("OWN-004-unregister",        Thread.unregister())
+Reporter:expect("OWN-005-unregister-twice",  (not Thread.unregister()))
+
+-- The name is removed by Thread.join
+Event.send("cache", "Stop")
+Event.runloop()
+Reporter:expect("OWN-006-name-removed-by-join", (Thread.whereis("cache") == nil))
+
+--------------------------------------------------------------------------------
+-- SUMMARY
+--------------------------------------------------------------------------------
+
+Reporter:printf("== SUMMARY ==")
+Reporter:summary("os.exit")
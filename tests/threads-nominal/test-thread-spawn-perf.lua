@@ -0,0 +1,109 @@
+--------------------------------------------------------------------------------
+-- TESTS BOILERPLATE FOR PACKAGE.PATH                                         --
+--------------------------------------------------------------------------------
+
+-- This kind of code should not appear in the real use of ComEXE
+--
+-- Initialize package.path to include ..\lib\xxx because test libraries are in
+-- this directory
+
+local function TEST_UpdatePackagePath (RelativeDirectory)
+  -- Retrieve package confiuration (file loadlib.c, function luaopen_package)
+  local Configuration = package.config
+  local LUA_DIRSEP    = Configuration:sub(1, 1)
+  local LUA_PATH_SEP  = Configuration:sub(3, 3)
+  local LUA_PATH_MARK = Configuration:sub(5, 5)
+  -- Load required modules
+  local Runtime   = require("com.runtime")
+  local Directory = Runtime.getrelativepath(RelativeDirectory) -- relative to arg[0] directory
+  -- Prepend path in a Linux/Windows compatible way
+  package.path = string.format("%s%s%s.lua%s%s", Directory, LUA_DIRSEP, LUA_PATH_MARK, LUA_PATH_SEP, package.path)
+end
+
+TEST_UpdatePackagePath("../lib")
+
+--------------------------------------------------------------------------------
+-- IMPORTS                                                                    --
+--------------------------------------------------------------------------------
+
+-- Thread spawn latency: create and join N short-lived threads, one after the
+-- other. Without pool, the time is dominated by the creation of the lua_State
+-- and the loading of comexe/init.lua, which is compiled once per application.
+-- With the pool, Thread.create claims an instance which is already loaded.
+
+local Thread   = require("com.thread")
+local Event    = require("com.event")
+local uv       = require("luv")
+local reporter = require("mini-reporter")
+
+local THREAD_COUNT = 200
+
+local Reporter = reporter.new()
+
+local SpawnedCount
+local SpawnTime
+local MinLatency
+local MaxLatency
+
+local function SpawnWorker ()
+  SpawnTime = uv.hrtime()
+  Thread.create("spawn-perf-worker", "WorkerExitEvent")
+end
+
+function WorkerExitEvent (ThreadId)
+  local Latency = (uv.hrtime() - SpawnTime)
+  MinLatency    = math.min(MinLatency, Latency)
+  MaxLatency    = math.max(MaxLatency, Latency)
+  Thread.join(ThreadId)
+  SpawnedCount = (SpawnedCount + 1)
+  if (SpawnedCount < THREAD_COUNT) then
+    SpawnWorker()
+  else
+    Event.stoploop()
+  end
+end
+
+local function RunBenchmark (Label)
+  SpawnedCount = 0
+  MinLatency   = math.huge
+  MaxLatency   = 0
+  local StartTime = uv.hrtime()
+  SpawnWorker()
+  Event.runloop()
+  local ElapsedMs = ((uv.hrtime() - StartTime) / 1e6)
+  Reporter:printf("%-5s %d threads created and joined in %.1f ms", Label, SpawnedCount, ElapsedMs)
+  Reporter:printf("%-5s create+join: avg %.3f ms, min %.3f ms, max %.3f ms",
+                  Label,
+                  (ElapsedMs / SpawnedCount),
+                  (MinLatency / 1e6),
+                  (MaxLatency / 1e6))
+  return SpawnedCount
+end
+
+--------------------------------------------------------------------------------
+-- COLD AND WARM SPAWN                                                        --
+--------------------------------------------------------------------------------
+
+Reporter:block("COLD AND WARM SPAWN")
+
+local ColdCount = RunBenchmark("COLD")
+Reporter:expect("SPAWN-001-cold", (ColdCount == THREAD_COUNT))
+
+-- Warm the pool before measuring, 2 instances because the joined instance is
+-- still being reset when the next thread is created
+Thread.setpoolsize(2)
+while (Thread.getpoolstats().idle < 2) do
+  uv.sleep(1)
+end
+
+local WarmCount = RunBenchmark("WARM")
+Thread.setpoolsize(0)
+
+Reporter:expect("SPAWN-002-warm", (WarmCount == THREAD_COUNT))
+
+--------------------------------------------------------------------------------
+-- SUMMARY
+--------------------------------------------------------------------------------
+
+Reporter:printf("== SUMMARY ==")
+Reporter:summary("os.exit")
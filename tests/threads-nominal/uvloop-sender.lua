@@ -0,0 +1,8 @@
+-- Sender of test-event-uvloop.lua: send a few events, slowly
+local Runtime = require("com.runtime")
+local Event   = require("com.event")
+
+for Index = 1, 5 do
+  Runtime.sleepms(20)
+  Event.send(1, "UvLoopEvent", Index)
+end
@@ -79,12 +79,19 @@ local PROJECT_Flags = {
   header("../mbedtls/include"),
   header("../mbedtls/src/tf-psa-crypto/include"),
   header("../mbedtls/src/tf-psa-crypto/drivers/builtin/include"),
+  -- mbedtls/ssl_cache.h and mbedtls/ssl_ticket.h include threading_alt.h
+  header("../libuv/include"),
 }
 
 if (HOST == "windows") and (TARGET == "windows") then
   append(PROJECT_Flags, "-fdiagnostics-color=never")
 end
 
+-- pthread_rwlock_t is used by uv.h
+if (TARGET == "linux") then
+  append(PROJECT_Flags, "-D_GNU_SOURCE")
+end
+
 local LibSources = {
   "src/base64.c",
   "src/main.c",
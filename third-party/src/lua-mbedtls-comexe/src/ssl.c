@@ -31,14 +31,24 @@
 #include <mbedtls/x509.h>
 #include <mbedtls/ssl.h>
 #include <mbedtls/ssl_cookie.h>
+#include <mbedtls/ssl_cache.h>
+#include <mbedtls/ssl_ticket.h>
+#include <psa/crypto.h>
 #include <mbedtls/base64.h>
 #include <stdlib.h> /* malloc/free */
+#include <limits.h> /* INT_MAX */
 #include "common.h"
 #include "defcert.h"
 
 /* Forward declarations */
 static int m_handshake_step(lua_State *L);
 static int f_newconfig_mem(lua_State *L);
+static int f_newticketkey(lua_State *L);
+static int m_setsessioncache(lua_State *L);
+static int m_setsessiontickets(lua_State *L);
+static int m_rotateticketkey(lua_State *L);
+static int m_getsession(lua_State *L);
+static int m_setsession(lua_State *L);
 
 #if MBEDTLS_VERSION_MAJOR < 3
 #define MBEDTLS_PRIVATE(name) name
@@ -60,6 +70,8 @@ typedef struct {
 	mbedtls_x509_crt cacert, cert;
 	mbedtls_pk_context pkey;
 	int mode;
+	mbedtls_ssl_cache_context *cache; /* ComEXE: session cache (server) */
+	mbedtls_ssl_ticket_context *ticket; /* ComEXE: session tickets (server) */
 } Config;
 
 typedef struct {
@@ -113,6 +125,14 @@ static int freeconfig(lua_State *L) {
 	mbedtls_x509_crt_free(&cfg->cacert);
 	mbedtls_x509_crt_free(&cfg->cert);
 	mbedtls_pk_free(&cfg->pkey);
+	if (cfg->cache) {
+		mbedtls_ssl_cache_free(cfg->cache);
+		free(cfg->cache);
+	}
+	if (cfg->ticket) {
+		mbedtls_ssl_ticket_free(cfg->ticket);
+		free(cfg->ticket);
+	}
 	return 0;
 }
 
@@ -125,6 +145,8 @@ static int f_newconfig(lua_State *L) {
 	Base *base = getbase(L);
 	Config *cfg = lua_newuserdata(L, sizeof *cfg);
 	cfg->mode = mode;
+	cfg->cache = 0;
+	cfg->ticket = 0;
 	luaL_getmetatable(L, TYPE_SSL_CONFIG);
 	lua_setmetatable(L, -2);
 	mbedtls_ssl_config_init(&cfg->conf);
@@ -331,6 +353,8 @@ static const luaL_Reg t_context[] = {
 	{"write", m_write},
 	{"closenotify", m_closenotify},
 	{"reset", m_reset},
+	{"getsession", m_getsession},
+	{"setsession", m_setsession},
 	{"__gc", m__gc},
 	{0, 0}
 };
@@ -542,6 +566,14 @@ static const luaL_Reg l_ssl[] = {
 	{"newcontext", f_newcontext},
 	{"getcookie", f_getcookie},
 	{"checkcookie", f_checkcookie},
+	{"newticketkey", f_newticketkey},
+	{0, 0}
+};
+
+static const luaL_Reg t_config[] = {
+	{"setsessioncache", m_setsessioncache},
+	{"setsessiontickets", m_setsessiontickets},
+	{"rotateticketkey", m_rotateticketkey},
 	{0, 0}
 };
 
@@ -551,6 +583,13 @@ static void luacreate_metatables(lua_State *L) {
 	lua_setfield(L, -2, "__metatable");
 	lua_pushcfunction(L, freeconfig);
 	lua_setfield(L, -2, "__gc");
+#if LUA_VERSION_NUM < 502
+	lua_newtable(L);
+	luaL_register(L, 0, t_config);
+#else
+	luaL_newlib(L, t_config);
+#endif
+	lua_setfield(L, -2, "__index");
 	lua_pop(L, 1);
 }
 
@@ -626,6 +665,8 @@ static int f_newconfig_mem(lua_State *L) {
 	Base *base = getbase(L);
 	Config *cfg = lua_newuserdata(L, sizeof *cfg);
 	cfg->mode = mode;
+	cfg->cache = 0;
+	cfg->ticket = 0;
 	luaL_getmetatable(L, TYPE_SSL_CONFIG);
 	lua_setmetatable(L, -2);
 	mbedtls_ssl_config_init(&cfg->conf);
@@ -688,3 +729,156 @@ static int f_newconfig_mem(lua_State *L) {
 	}
 	return 1;
 }
+
+/*
+** Session resumption
+**
+** A server config keeps the sessions of its clients in a cache (TLS 1.2,
+** resumption by session ID) and/or issues session tickets (TLS 1.2 and 1.3):
+** the session is encrypted with a key of the server and kept by the client.
+** The cache and the ticket keys are shared by all the contexts of the config,
+** they must be set up before the first context is created.
+**
+** The tickets are protected with AES-256-GCM. The servers sharing the same
+** ticket key with rotateticketkey resume the sessions of each other. mbedtls
+** keeps the current and the previous key: the tickets of the previous key are
+** still accepted after a rotation. Without rotation, a new random key is
+** generated when the lifetime expires: the servers sharing a key must rotate
+** it before, com/ssl-server.lua derives the key of each period from a shared
+** secret.
+**
+** A client context exports its session with getsession once the handshake is
+** over, and a new context for the same server loads it with setsession before
+** the handshake. With TLS 1.3, the session is only available once the ticket
+** is received, after the handshake: getsession returns nil until then.
+*/
+
+#define TICKET_KEY_BITS 256
+#define TICKET_KEY_BYTES (TICKET_KEY_BITS / 8)
+#define TICKET_DEFAULT_LIFETIME 86400 /* 1 day */
+#define TICKET_MAX_LIFETIME 604800 /* 7 days, RFC 8446 */
+
+/* RES: name, key */
+static int f_newticketkey(lua_State *L) {
+	unsigned char name[MBEDTLS_SSL_TICKET_KEY_NAME_BYTES];
+	unsigned char key[TICKET_KEY_BYTES];
+	if (psa_generate_random(name, sizeof name) != PSA_SUCCESS) return luaL_error(L, "newticketkey: random failed");
+	if (psa_generate_random(key, sizeof key) != PSA_SUCCESS) return luaL_error(L, "newticketkey: random failed");
+	lua_pushlstring(L, (char *)name, sizeof name);
+	lua_pushlstring(L, (char *)key, sizeof key);
+	return 2;
+}
+
+/* ARG: [maxentries], [timeout] */
+static int m_setsessioncache(lua_State *L) {
+	Config *cfg = luaL_checkudata(L, 1, TYPE_SSL_CONFIG);
+	lua_Integer maxentries = luaL_optinteger(L, 2, MBEDTLS_SSL_CACHE_DEFAULT_MAX_ENTRIES);
+	lua_Integer timeout = luaL_optinteger(L, 3, MBEDTLS_SSL_CACHE_DEFAULT_TIMEOUT);
+	checkopsup(L, cfg->mode & 1, 1); /* Server only */
+	checkrange(L, maxentries > 0 && maxentries <= INT_MAX, 2);
+	checkrange(L, timeout >= 0 && timeout <= INT_MAX, 3);
+	if (!cfg->cache) {
+		cfg->cache = malloc(sizeof *cfg->cache);
+		if (!cfg->cache) return luaL_error(L, "setsessioncache: alloc failed");
+		mbedtls_ssl_cache_init(cfg->cache);
+		mbedtls_ssl_conf_session_cache(&cfg->conf, cfg->cache, mbedtls_ssl_cache_get, mbedtls_ssl_cache_set);
+	}
+	mbedtls_ssl_cache_set_max_entries(cfg->cache, (int)maxentries);
+	mbedtls_ssl_cache_set_timeout(cfg->cache, (int)timeout);
+	return 0;
+}
+
+/* ARG: [lifetime] */
+static int m_setsessiontickets(lua_State *L) {
+	Config *cfg = luaL_checkudata(L, 1, TYPE_SSL_CONFIG);
+	lua_Integer lifetime = luaL_optinteger(L, 2, TICKET_DEFAULT_LIFETIME);
+	mbedtls_ssl_ticket_context *ticket;
+	int err;
+	checkopsup(L, (cfg->mode & 1) && !cfg->ticket, 1); /* Server only, once */
+	checkrange(L, lifetime > 0 && lifetime <= TICKET_MAX_LIFETIME, 2);
+	ticket = malloc(sizeof *ticket);
+	if (!ticket) return luaL_error(L, "setsessiontickets: alloc failed");
+	mbedtls_ssl_ticket_init(ticket);
+	err = mbedtls_ssl_ticket_setup(ticket, PSA_ALG_GCM, PSA_KEY_TYPE_AES, TICKET_KEY_BITS, (uint32_t)lifetime);
+	if (err) { /* Not attached: rotateticketkey keeps failing */
+		mbedtls_ssl_ticket_free(ticket);
+		free(ticket);
+		checkresult(L, err);
+	}
+	cfg->ticket = ticket;
+	mbedtls_ssl_conf_session_tickets_cb(&cfg->conf, mbedtls_ssl_ticket_write, mbedtls_ssl_ticket_parse, cfg->ticket);
+	return 0;
+}
+
+/* ARG: name, key, [lifetime] */
+static int m_rotateticketkey(lua_State *L) {
+	Config *cfg = luaL_checkudata(L, 1, TYPE_SSL_CONFIG);
+	size_t nlen, klen;
+	const unsigned char *name = checkdata(L, 2, &nlen);
+	const unsigned char *key = checkdata(L, 3, &klen);
+	lua_Integer lifetime = luaL_optinteger(L, 4, TICKET_DEFAULT_LIFETIME);
+	checkopsup(L, cfg->ticket != 0, 1); /* After setsessiontickets */
+	checkvalue(L, nlen == MBEDTLS_SSL_TICKET_KEY_NAME_BYTES, 2);
+	checkvalue(L, klen == TICKET_KEY_BYTES, 3);
+	checkrange(L, lifetime > 0 && lifetime <= TICKET_MAX_LIFETIME, 4);
+	checkresult(L, mbedtls_ssl_ticket_rotate(cfg->ticket, name, nlen, key, klen, (uint32_t)lifetime));
+	return 0;
+}
+
+/* RES: session | nil */
+/* ComEXE: called by lua_pcall in m_getsession */
+static int pushsession(lua_State *L) {
+	const char *buf = lua_touserdata(L, 1);
+	size_t len = (size_t)lua_tointeger(L, 2);
+	lua_pushlstring(L, buf, len);
+	return 1;
+}
+
+static int m_getsession(lua_State *L) {
+	Context *ctx = checkcontext(L, 1);
+	mbedtls_ssl_session session;
+	unsigned char *buf = 0;
+	size_t len = 0;
+	int res, status;
+	checkopsup(L, !(ctx->cfg->mode & 1), 1); /* Client only */
+	mbedtls_ssl_session_init(&session);
+	/* Fails when the session was already exported or is not available yet */
+	res = mbedtls_ssl_get_session(&ctx->ssl, &session);
+	if (!res) {
+		res = mbedtls_ssl_session_save(&session, 0, 0, &len);
+		if (res == MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL) res = (buf = malloc(len)) ? mbedtls_ssl_session_save(&session, buf, len, &len) : -1;
+	}
+	mbedtls_ssl_session_free(&session);
+	if (res) {
+		free(buf);
+		lua_pushnil(L);
+		return 1;
+	}
+	/* A memory error raised by lua_pushlstring must not leak buf */
+	lua_pushcfunction(L, pushsession);
+	lua_pushlightuserdata(L, buf);
+	lua_pushinteger(L, (lua_Integer)len);
+	status = lua_pcall(L, 2, 1, 0);
+	free(buf);
+	if (status != LUA_OK) lua_error(L);
+	return 1;
+}
+
+/* ARG: session
+** RES: true | false */
+static int m_setsession(lua_State *L) {
+	Context *ctx = checkcontext(L, 1);
+	size_t len;
+	const unsigned char *buf = checkdata(L, 2, &len);
+	mbedtls_ssl_session session;
+	int res;
+	checkopsup(L, !(ctx->cfg->mode & 1), 1); /* Client only */
+	mbedtls_ssl_session_init(&session);
+	/* A session of another version of mbedtls or an expired ticket is not an
+	** error: the handshake is just a full handshake */
+	res = mbedtls_ssl_session_load(&session, buf, len);
+	if (!res) res = mbedtls_ssl_set_session(&ctx->ssl, &session);
+	mbedtls_ssl_session_free(&session);
+	lua_pushboolean(L, !res);
+	return 1;
+}
@@ -1,11 +1,16 @@
 #ifndef THREADING_ALT_H
 #define THREADING_ALT_H
 
+#include <stdint.h>
 #include <uv.h>
 
+/* The counters are written by the owner of Mutex and read without locking */
 typedef struct
 {
   uv_mutex_t Mutex;
+  uint64_t   LockCount;      /* Number of lock calls               */
+  uint64_t   ContendedCount; /* Lock calls which had to wait       */
+  uint64_t   WaitTimeNs;     /* Time spent waiting, in nanoseconds */
 
 } mbedtls_platform_mutex_t;
 
@@ -15,4 +20,4 @@ typedef struct
 
 } mbedtls_platform_condition_variable_t;
 
-#endif /* THREADING_ALT_H */
\ No newline at end of file
+#endif /* THREADING_ALT_H */